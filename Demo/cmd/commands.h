@@ -15,6 +15,7 @@
 //#include "cmd_mount.h"
 #include "cmd_testsuite.h"
 #include "fsinfo_cmd.h"
+#include "iostat_cmd.h"
 #include "hexview_cmd.h"
 #include "mkfile_cmd.h"
 
@@ -15,6 +15,7 @@ int hook_commands(FF_ENVIRONMENT *pEnv) {
 	FFTerm_AddExCmd(pConsole, "prompt",		(FFT_FN_COMMAND_EX) cmd_prompt,		cmdpromptInfo,	pEnv);
 	FFTerm_AddExCmd(pConsole, "pwd",		(FFT_FN_COMMAND_EX)	pwd_cmd,		pwdInfo,		pEnv);
 	FFTerm_AddExCmd(pConsole, "fsinfo",		(FFT_FN_COMMAND_EX) fsinfo_cmd,		fsinfoInfo,		pEnv);
+	FFTerm_AddExCmd(pConsole, "iostat",		(FFT_FN_COMMAND_EX) iostat_cmd,		iostatInfo,		pEnv);
 	FFTerm_AddExCmd(pConsole, "testsuite",	(FFT_FN_COMMAND_EX) cmd_testsuite,	NULL,			pEnv);
 	FFTerm_AddExCmd(pConsole, "more",		(FFT_FN_COMMAND_EX) more_cmd,		moreInfo,		pEnv);
 	FFTerm_AddExCmd(pConsole, "hex",		(FFT_FN_COMMAND_EX) hexview_cmd,	hexviewInfo,	pEnv);
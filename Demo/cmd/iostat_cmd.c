@@ -0,0 +1,58 @@
+/**
+ *	IOSTAT Command for FullFAT.
+ *
+ **/
+
+#include "iostat_cmd.h"
+
+static const char *szClasses[FF_CACHE_CLASSES] = {"FAT", "Directory", "Data", "Pinned FAT"};
+
+static unsigned int iostat_percent(FF_T_UINT32 Part, FF_T_UINT32 Rest) {
+	if(!(Part + Rest)) {
+		return 0;
+	}
+	return (unsigned int) (((float) Part * 100.0) / (float) (Part + Rest));
+}
+
+int iostat_cmd(int argc, char **argv, FF_ENVIRONMENT *pEnv) {
+	FF_IOMAN	*pIoman = pEnv->pIoman;
+	FF_IOSTATS	Stats;
+	FF_ERROR	Error;
+	int i;
+
+	Error = FF_GetStats(pIoman, &Stats);
+	if(FF_isERR(Error)) {
+		printf("%s\n", FF_GetErrMessage(Error));
+		return 0;
+	}
+
+	printf("Cache               Hits       Misses     Hit Rate\n");
+	for(i = 0; i < FF_CACHE_CLASSES; i++) {
+		printf("%-16s    %-10lu %-10lu %u%%\n", szClasses[i], (unsigned long) Stats.CacheHits[i], (unsigned long) Stats.CacheMisses[i],
+			iostat_percent(Stats.CacheHits[i], Stats.CacheMisses[i]));
+	}
+	printf("\n");
+	printf("Evictions               : %lu\n", (unsigned long) Stats.Evictions);
+	printf("Dirty Write-Backs       : %lu\n", (unsigned long) Stats.WriteBacks);
+	printf("Read-Aheads             : %lu (%lu lines used, %lu wasted)\n", (unsigned long) Stats.ReadAheads,
+		(unsigned long) Stats.ReadAheadHits, (unsigned long) Stats.ReadAheadWasted);
+	printf("Driver Reads            : %lu (%lu sectors)\n", (unsigned long) Stats.DriverReads, (unsigned long) Stats.DriverReadSectors);
+	printf("Driver Writes           : %lu (%lu sectors)\n", (unsigned long) Stats.DriverWrites, (unsigned long) Stats.DriverWriteSectors);
+	printf("FAT Buffer Reuse (Rd)   : %lu of %lu (%u%%)\n", (unsigned long) Stats.FatBufferReuses[0],
+		(unsigned long) (Stats.FatBufferGets[0] + Stats.FatBufferReuses[0] + Stats.FatBufferMisses[0]),
+		iostat_percent(Stats.FatBufferReuses[0], Stats.FatBufferGets[0] + Stats.FatBufferMisses[0]));
+	printf("FAT Buffer Reuse (Wr)   : %lu of %lu (%u%%)\n", (unsigned long) Stats.FatBufferReuses[1],
+		(unsigned long) (Stats.FatBufferGets[1] + Stats.FatBufferReuses[1] + Stats.FatBufferMisses[1]),
+		iostat_percent(Stats.FatBufferReuses[1], Stats.FatBufferGets[1] + Stats.FatBufferMisses[1]));
+	printf("Buffer Waits            : %lu (%lu us)\n", (unsigned long) Stats.BufferWaits, (unsigned long) Stats.BufferWaitTime);
+	printf("Cache Lock Wait         : %lu us\n", (unsigned long) Stats.LockWaitTime);
+
+	return 0;
+}
+
+const FFT_ERR_TABLE iostatInfo[] =
+{
+	{"Unknown or Generic Error",		-1},							// Generic Error (always the first entry).
+	{"Cache and driver statistics of the mounted file-system.",		FFT_COMMAND_DESCRIPTION},
+	{ NULL }
+};
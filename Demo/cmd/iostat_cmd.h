@@ -0,0 +1,11 @@
+#ifndef _IOSTAT_CMD_
+#define _IOSTAT_CMD_
+
+#include "cmd_helpers.h"
+#include "../../src/fullfat.h"
+#include "../../../ffterm/src/ffterm.h"
+
+int iostat_cmd(int argc, char **argv, FF_ENVIRONMENT *pEnv);
+extern const FFT_ERR_TABLE iostatInfo[];
+
+#endif
@@ -1,9 +1,12 @@
 #include "../../src/ff_safety.h"
 #include <unistd.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
 
 void *FF_CreateSemaphore(void) {
-	sem_t *pSem = (sem_t *) malloc(sizeof(pSem));
+	sem_t *pSem = (sem_t *) malloc(sizeof(sem_t));
 	
 	sem_init(pSem, 0, 1);
 
@@ -35,6 +38,114 @@ void FF_DestroySemaphore(void *pSemaphore) {
 	free(pSem);
 }
 
+typedef struct {
+	pthread_mutex_t	Mutex;
+	pthread_cond_t	Cond;
+	FF_T_UINT32		Generation;		// Incremented by each signal, so that waiters can ignore spurious wake-ups.
+} FF_LINUX_CONDITION;
+
+void *FF_CreateCondition(void) {
+	FF_LINUX_CONDITION *pCond = (FF_LINUX_CONDITION *) malloc(sizeof(FF_LINUX_CONDITION));
+	pthread_condattr_t Attr;
+
+	if(pCond) {
+		pthread_mutex_init(&pCond->Mutex, NULL);
+		pthread_condattr_init(&Attr);
+		pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);	// Timeouts are not affected by changes to the wall clock.
+		pthread_cond_init(&pCond->Cond, &Attr);
+		pthread_condattr_destroy(&Attr);
+		pCond->Generation = 0;
+	}
+
+	return (void *) pCond;
+}
+
+FF_T_BOOL FF_WaitCondition(void *pCondition, void *pSemaphore, FF_T_UINT32 TimeMs) {
+	FF_LINUX_CONDITION *pCond = (FF_LINUX_CONDITION *) pCondition;
+	struct timespec Deadline;
+	FF_T_UINT32 Generation;
+	FF_T_BOOL bSignalled;
+
+	clock_gettime(CLOCK_MONOTONIC, &Deadline);
+	Deadline.tv_sec += TimeMs / 1000;
+	Deadline.tv_nsec += (long) (TimeMs % 1000) * 1000000L;
+	if(Deadline.tv_nsec >= 1000000000L) {
+		Deadline.tv_sec += 1;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+
+	// The mutex is taken before the semaphore is released, so a signal sent
+	// between the two cannot be missed.
+	pthread_mutex_lock(&pCond->Mutex);
+	Generation = pCond->Generation;
+	FF_ReleaseSemaphore(pSemaphore);
+	while(pCond->Generation == Generation) {
+		if(pthread_cond_timedwait(&pCond->Cond, &pCond->Mutex, &Deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	bSignalled = (FF_T_BOOL) (pCond->Generation != Generation);
+	pthread_mutex_unlock(&pCond->Mutex);
+	FF_PendSemaphore(pSemaphore);
+
+	return bSignalled;
+}
+
+void FF_SignalCondition(void *pCondition) {
+	FF_LINUX_CONDITION *pCond = (FF_LINUX_CONDITION *) pCondition;
+
+	pthread_mutex_lock(&pCond->Mutex);
+	pCond->Generation++;
+	pthread_cond_broadcast(&pCond->Cond);
+	pthread_mutex_unlock(&pCond->Mutex);
+}
+
+void FF_DestroyCondition(void *pCondition) {
+	FF_LINUX_CONDITION *pCond = (FF_LINUX_CONDITION *) pCondition;
+
+	pthread_cond_destroy(&pCond->Cond);
+	pthread_mutex_destroy(&pCond->Mutex);
+	free(pCond);
+}
+
+void *FF_CreateRWLock(void) {
+	pthread_rwlock_t *pLock = (pthread_rwlock_t *) malloc(sizeof(pthread_rwlock_t));
+	pthread_rwlockattr_t Attr;
+
+	if(pLock) {
+		pthread_rwlockattr_init(&Attr);
+#ifdef __GLIBC__
+		// Waiting writers hold back new readers, otherwise a steady stream of readers could starve them.
+		pthread_rwlockattr_setkind_np(&Attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		pthread_rwlock_init(pLock, &Attr);
+		pthread_rwlockattr_destroy(&Attr);
+	}
+
+	return (void *) pLock;
+}
+
+void FF_PendRead(void *pRWLock) {
+	pthread_rwlock_rdlock((pthread_rwlock_t *) pRWLock);
+}
+
+void FF_ReleaseRead(void *pRWLock) {
+	pthread_rwlock_unlock((pthread_rwlock_t *) pRWLock);
+}
+
+void FF_PendWrite(void *pRWLock) {
+	pthread_rwlock_wrlock((pthread_rwlock_t *) pRWLock);
+}
+
+void FF_ReleaseWrite(void *pRWLock) {
+	pthread_rwlock_unlock((pthread_rwlock_t *) pRWLock);
+}
+
+void FF_DestroyRWLock(void *pRWLock) {
+	pthread_rwlock_destroy((pthread_rwlock_t *) pRWLock);
+	free(pRWLock);
+}
+
 void FF_Yield(void) {
 	// Call your OS's thread Yield function.
 	// If this doesn't work, then a deadlock will occur
@@ -45,4 +156,52 @@ void FF_Sleep(FF_T_UINT32 TimeMs) {
 	// Call your OS's thread sleep function,
 	// Sleep for TimeMs milliseconds
 	usleep(TimeMs);
-}
\ No newline at end of file
+}
+
+void FF_AtomicAdd(FF_T_UINT32 *pValue, FF_T_UINT32 Add) {
+	__sync_fetch_and_add(pValue, Add);
+}
+
+FF_T_UINT32 FF_GetMicroseconds(void) {
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (FF_T_UINT32) (((FF_T_UINT32) Now.tv_sec * 1000000UL + (FF_T_UINT32) (Now.tv_nsec / 1000)) & 0xFFFFFFFF);
+}
+
+typedef struct {
+	pthread_t			Thread;
+	FF_THREAD_FUNCTION	fnThread;
+	void				*pParam;
+} FF_LINUX_THREAD;
+
+static void *FF_ThreadEntry(void *pArg) {
+	FF_LINUX_THREAD *pThread = (FF_LINUX_THREAD *) pArg;
+
+	pThread->fnThread(pThread->pParam);
+
+	return NULL;
+}
+
+void *FF_CreateThread(FF_THREAD_FUNCTION fnThread, void *pParam) {
+	FF_LINUX_THREAD *pThread = (FF_LINUX_THREAD *) malloc(sizeof(FF_LINUX_THREAD));
+
+	if(pThread) {
+		pThread->fnThread	= fnThread;
+		pThread->pParam		= pParam;
+		if(pthread_create(&pThread->Thread, NULL, FF_ThreadEntry, pThread) != 0) {
+			free(pThread);
+			pThread = NULL;
+		}
+	}
+
+	return (void *) pThread;
+}
+
+void FF_JoinThread(void *pThread) {
+	FF_LINUX_THREAD *pLinuxThread = (FF_LINUX_THREAD *) pThread;
+
+	pthread_join(pLinuxThread->Thread, NULL);
+	free(pLinuxThread);
+}
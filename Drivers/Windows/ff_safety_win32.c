@@ -67,6 +67,147 @@ void FF_DestroySemaphore(void *pSemaphore) {
 	CloseHandle(hSem);
 }
 
+/*
+	Condition variables let a thread wait for a buffer to be released, instead of polling the cache.
+	This portable version only needs FF_Sleep(). It polls a generation counter, which
+	FF_SignalCondition() increments. Replace it with your OS's condition variables or events if you can.
+*/
+
+#define	FF_CONDITION_POLL_TIME	10		// Milliseconds between checks of the generation counter.
+
+void *FF_CreateCondition(void) {
+	// Call your OS's CreateCondition/CreateEvent function
+	//
+	FF_T_UINT32 *pGeneration = (FF_T_UINT32 *) malloc(sizeof(FF_T_UINT32));
+
+	if(pGeneration) {
+		*pGeneration = 0;
+	}
+
+	return (void *) pGeneration;
+}
+
+FF_T_BOOL FF_WaitCondition(void *pCondition, void *pSemaphore, FF_T_UINT32 TimeMs) {
+	// Called with pSemaphore claimed. Release it, wait until FF_SignalCondition() is called
+	// or TimeMs has elapsed, then claim pSemaphore again.
+	// Return FF_TRUE if the condition was signalled.
+	//
+	volatile FF_T_UINT32 *pGeneration = (volatile FF_T_UINT32 *) pCondition;
+	FF_T_UINT32 Generation = *pGeneration;
+	FF_T_UINT32 Waited;
+
+	FF_ReleaseSemaphore(pSemaphore);
+	for(Waited = 0; *pGeneration == Generation && Waited < TimeMs; Waited += FF_CONDITION_POLL_TIME) {
+		FF_Sleep(FF_CONDITION_POLL_TIME);
+	}
+	FF_PendSemaphore(pSemaphore);
+
+	return (FF_T_BOOL) (*pGeneration != Generation);
+}
+
+void FF_SignalCondition(void *pCondition) {
+	// Wake every thread waiting on pCondition. (Called with the associated semaphore claimed).
+	//
+	FF_T_UINT32 *pGeneration = (FF_T_UINT32 *) pCondition;
+	*pGeneration += 1;
+}
+
+void FF_DestroyCondition(void *pCondition) {
+	// Call your OS's DestroyCondition/DestroyEvent function
+	//
+	free(pCondition);
+}
+
+/*
+	Reader-writer locks let several threads read the FAT at once, while a thread that modifies it
+	has it to itself. This portable version is built from the semaphore and condition functions above.
+	Replace it with your OS's reader-writer locks if you can.
+*/
+
+#define	FF_RWLOCK_POLL_TIME		100		// Milliseconds between checks of the lock, in case a wake-up is missed.
+
+typedef struct {
+	void			*pSemaphore;		// Protects the fields below.
+	void			*pCondition;		// Signalled whenever the lock is released.
+	FF_T_UINT32		Readers;			// Threads holding the lock for reading.
+	FF_T_UINT32		WritersWaiting;		// Threads waiting to write. New readers wait behind them.
+	FF_T_BOOL		bWriter;			// FF_TRUE while a thread holds the lock for writing.
+} FF_RWLOCK;
+
+void *FF_CreateRWLock(void) {
+	// Call your OS's CreateRWLock function
+	//
+	FF_RWLOCK *pLock = (FF_RWLOCK *) malloc(sizeof(FF_RWLOCK));
+
+	if(pLock) {
+		pLock->pSemaphore		= FF_CreateSemaphore();
+		pLock->pCondition		= FF_CreateCondition();
+		pLock->Readers			= 0;
+		pLock->WritersWaiting	= 0;
+		pLock->bWriter			= FF_FALSE;
+	}
+
+	return (void *) pLock;
+}
+
+void FF_PendRead(void *pRWLock) {
+	// Block until no thread holds, or waits for, the lock for writing. (A thread never claims it twice).
+	//
+	FF_RWLOCK *pLock = (FF_RWLOCK *) pRWLock;
+
+	FF_PendSemaphore(pLock->pSemaphore);
+	while(pLock->bWriter || pLock->WritersWaiting) {
+		FF_WaitCondition(pLock->pCondition, pLock->pSemaphore, FF_RWLOCK_POLL_TIME);
+	}
+	pLock->Readers++;
+	FF_ReleaseSemaphore(pLock->pSemaphore);
+}
+
+void FF_ReleaseRead(void *pRWLock) {
+	FF_RWLOCK *pLock = (FF_RWLOCK *) pRWLock;
+
+	FF_PendSemaphore(pLock->pSemaphore);
+	pLock->Readers--;
+	if(!pLock->Readers) {
+		FF_SignalCondition(pLock->pCondition);
+	}
+	FF_ReleaseSemaphore(pLock->pSemaphore);
+}
+
+void FF_PendWrite(void *pRWLock) {
+	// Block until no other thread holds the lock at all.
+	//
+	FF_RWLOCK *pLock = (FF_RWLOCK *) pRWLock;
+
+	FF_PendSemaphore(pLock->pSemaphore);
+	pLock->WritersWaiting++;
+	while(pLock->bWriter || pLock->Readers) {
+		FF_WaitCondition(pLock->pCondition, pLock->pSemaphore, FF_RWLOCK_POLL_TIME);
+	}
+	pLock->WritersWaiting--;
+	pLock->bWriter = FF_TRUE;
+	FF_ReleaseSemaphore(pLock->pSemaphore);
+}
+
+void FF_ReleaseWrite(void *pRWLock) {
+	FF_RWLOCK *pLock = (FF_RWLOCK *) pRWLock;
+
+	FF_PendSemaphore(pLock->pSemaphore);
+	pLock->bWriter = FF_FALSE;
+	FF_SignalCondition(pLock->pCondition);
+	FF_ReleaseSemaphore(pLock->pSemaphore);
+}
+
+void FF_DestroyRWLock(void *pRWLock) {
+	// Call your OS's DestroyRWLock function
+	//
+	FF_RWLOCK *pLock = (FF_RWLOCK *) pRWLock;
+
+	FF_DestroyCondition(pLock->pCondition);
+	FF_DestroySemaphore(pLock->pSemaphore);
+	free(pLock);
+}
+
 void FF_Yield(void) {
 	// Call your OS's thread Yield function.
 	// If this doesn't work, then a deadlock will occur
@@ -77,4 +218,56 @@ void FF_Sleep(FF_T_UINT32 TimeMs) {
 	// Call your OS's thread sleep function,
 	// Sleep for TimeMs milliseconds
 	Sleep(TimeMs);
-}
\ No newline at end of file
+}
+
+void FF_AtomicAdd(FF_T_UINT32 *pValue, FF_T_UINT32 Add) {
+	InterlockedExchangeAdd((volatile LONG *) pValue, (LONG) Add);
+}
+
+FF_T_UINT32 FF_GetMicroseconds(void) {
+	LARGE_INTEGER Frequency, Now;
+
+	if(!QueryPerformanceFrequency(&Frequency) || !QueryPerformanceCounter(&Now) || Frequency.QuadPart < 1000000) {
+		return GetTickCount() * 1000;
+	}
+
+	return (FF_T_UINT32) (Now.QuadPart / (Frequency.QuadPart / 1000000));
+}
+
+typedef struct {
+	HANDLE				hThread;
+	FF_THREAD_FUNCTION	fnThread;
+	void				*pParam;
+} FF_WIN32_THREAD;
+
+static DWORD WINAPI FF_ThreadEntry(LPVOID pArg) {
+	FF_WIN32_THREAD *pThread = (FF_WIN32_THREAD *) pArg;
+
+	pThread->fnThread(pThread->pParam);
+
+	return 0;
+}
+
+void *FF_CreateThread(FF_THREAD_FUNCTION fnThread, void *pParam) {
+	FF_WIN32_THREAD *pThread = (FF_WIN32_THREAD *) malloc(sizeof(FF_WIN32_THREAD));
+
+	if(pThread) {
+		pThread->fnThread	= fnThread;
+		pThread->pParam		= pParam;
+		pThread->hThread	= CreateThread(NULL, 0, FF_ThreadEntry, pThread, 0, NULL);
+		if(!pThread->hThread) {
+			free(pThread);
+			pThread = NULL;
+		}
+	}
+
+	return (void *) pThread;
+}
+
+void FF_JoinThread(void *pThread) {
+	FF_WIN32_THREAD *pWin32Thread = (FF_WIN32_THREAD *) pThread;
+
+	WaitForSingleObject(pWin32Thread->hThread, INFINITE);
+	CloseHandle(pWin32Thread->hThread);
+	free(pWin32Thread);
+}
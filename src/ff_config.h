@@ -81,26 +81,88 @@
 										// If you don't need FAT12 support, why have it. FAT12 is more complex to process,
 										// therefore savings can be made by not having it.
 
+#define FF_FAT12_DECODE					// Decodes the FAT of a FAT12 volume into a table of 16-bit entries when it is mounted, (2 bytes per
+										// cluster, at most 8KB, as well as a copy of the FAT itself). Entries that span two sectors then need
+										// no special handling, and FAT12 is searched and counted like FAT16. Modified sectors are encoded and
+										// written back by FF_FlushCache(), (which FF_Close() and unmounting call). Needs FF_FAT12_SUPPORT.
+										// Without it, (or when there is no memory for the table), entries are read and written in the sectors.
+
 #define FF_OPTIMISE_UNALIGNED_ACCESS	// Optimise unaligned accesses. This requires that each FILE handle has an associated buffer
 										// of atleast BLOCKSIZE bytes.
 										// If your system is not memory constrained, you should enable this to reduce accesses
 										// to the underlying block device.
 
-#define FF_CACHE_WRITE_THROUGH
+#define FF_FILE_EXTENT_MAP				// Each FILE handle keeps a map of the runs of consecutive clusters in its chain, filled in as
+										// the chain is walked. Seeks then find their cluster with a binary search, rather than by
+										// following the chain from its start. (12 bytes per run, grown as needed).
+#define FF_FILE_EXTENT_MAP_RUNS	1024	// Most runs that a FILE handle maps. Past them, the chain is followed from the last mapped cluster.
+
+//---------- CACHE WRITE POLICY
+										// Uncomment the prefered method. (Can only choose a single method).
+#define FF_CACHE_WRITE_THROUGH			// A modified sector is written to the device as soon as its buffer is released.
+//#define FF_CACHE_WRITE_BACK			// Modified sectors stay in the cache until they are evicted, or FF_FlushCache() is called.
+										// Flushes sort the dirty sectors by LBA, and merge neighbours into multi-sector writes.
+										// This saves many driver calls, but changes are lost if the media is removed before
+										// the next flush. (FF_Close(), FF_Seek() and FF_UnmountPartition() all flush).
+
+#define FF_FLUSH_MAX_SECTORS	16		// Most sectors that FF_FlushCache() merges into a single write. With FF_CACHE_WRITE_BACK
+										// this needs a staging buffer of this many sectors. (1 disables merging).
+
+//#define FF_CACHE_FLUSHER				// With FF_CACHE_WRITE_BACK, a thread started at mount writes the dirty sectors back in the
+										// background, so that the write-backs aren't paid for by whichever call evicts them.
+										// The thread is created by FF_CreateThread() in ff_safety.c. Without threads, writers
+										// that reach FF_FLUSH_DIRTY_LIMIT flush the cache themselves.
+#define FF_FLUSH_INTERVAL		100		// Milliseconds between the flusher's passes, that write back the sectors dirty for too long.
+#define FF_FLUSH_DIRTY_AGE		2000	// Milliseconds that a sector may stay dirty. (Measured in FF_FLUSH_INTERVAL steps).
+#define FF_FLUSH_DIRTY_RATIO	25		// Percentage of a shard's buffers that may be dirty, before the flusher writes back all of them.
+#define FF_FLUSH_DIRTY_LIMIT	50		// Percentage of a shard's buffers that may be dirty. Writers past this are throttled,
+										// waiting for the flusher to catch up.
+
+//---------- CACHE REPLACEMENT POLICY
+										// Uncomment the prefered method. (Can only choose a single method).
+//#define FF_CACHE_REPLACE_LRU			// Unpinned buffers are kept on a Least Recently Used list. Finding a victim and
+										// touching a buffer are constant time operations.
+#define FF_CACHE_REPLACE_2Q				// Scan resistant 2Q policy. Sectors referenced once stay on a probationary FIFO,
+										// and only sectors referenced again after leaving it enter the main LRU list.
+										// Large scans (file data, FAT scans) cannot displace the FAT and directory sectors.
+										// Costs an extra sizeof(FF_BUFFER) + 4 bytes for every 2 sectors of cache.
+//#define FF_CACHE_REPLACE_SCAN			// The original policy, that ages every unpinned buffer on each cache miss.
+										// This is O(n) in the cache size, and is only kept for benchmarking.
+
+#define FF_CACHE_LINE_SECTORS	8		// Number of consecutive sectors in a cache line. (Must be a power of 2, upto 128).
+										// A miss fetches the whole aligned line with a single driver call, so directory
+										// scans and FAT walks make far fewer calls. 8 suits most SD cards and image files.
+										// Lines are never longer than a cluster of the mounted partition, and small
+										// caches use shorter lines, so that there are always at least 8 lines.
+
+#define FF_READAHEAD_SECTORS	32		// Most sectors read ahead, when cache misses follow on from each other. (0 disables).
+										// FAT scans and directory walks then take one driver call for many sectors.
+										// The read-ahead window adapts to how much of it is used, and is limited to
+										// a quarter of the cache. Costs a staging buffer of this many sectors.
+
+#define FF_CACHE_SHARDS			1		// Number of lock shards the buffer cache is split into. (Must be a power of 2, upto 64).
+										// Each shard has its own semaphore and replacement state, so threads working on
+										// different sectors don't serialise on a single lock. Use about 2x the number of cores.
+										// Small caches use fewer shards, so that every shard keeps at least 8 buffers.
 
 //---------- WRITE BOTH FATS
 #define FF_WRITE_BOTH_FATS				// Writes the 2nd FAT (backup) at runtime. Disabling this can improve performance.
 										// However, leaving it enabled guarantees that both FATs will match, and fs checkers
 										// will not complain. (More compliant).
 
-//#define FF_MIRROR_FATS_UMOUNT			// This will cause all FAT tables to be duplicated on unmount.
-										// This is usually expensive in terms of time but will ensure that all FAT copies
-										// are consistent. (If you can guarantee an unmount operation, use this while disabling FF_WRITE_BOTH_FATS).
+//#define FF_MIRROR_FATS_UMOUNT			// Only the first FAT is written at runtime. The sectors it has modified are copied to the other FATs
+										// in runs by FF_FlushCache(), (which FF_Close() and unmounting call), so all copies are consistent after
+										// each flush, but not in between. This takes precedence over FF_WRITE_BOTH_FATS while the copies are
+										// deferred, (the default once mounted). FF_DeferFatCopies(pIoman, FF_FALSE) brings the copies up to date,
+										// and FF_WRITE_BOTH_FATS then decides again. Off by default, as it changes what is on the disk between flushes.
 
 #define FF_WRITE_FREE_COUNT				// Enabling this option will modify the FreeCount on the disk at runtime.
 										// This incurs a small performance penalty, and is not required. (All filesystems should not
 										// trust the on-disk value anyway.
 
+#define FF_FSINFO_UPDATE_INTERVAL	0	// With FF_WRITE_FREE_COUNT, the FreeCount is kept in RAM, and written by FF_FlushCache(), (which
+										// FF_Close() and unmounting call), and after this many changes in between. (0 only when flushing).
+
 //#define FF_FSINFO_TRUSTED				// Trust the values in the FSINFO sector. Safe when media is not removable.
 
 //---------- TIME SUPPORT
@@ -124,6 +186,26 @@
 //#define FF_MOUNT_FIND_FREE				// Uncomment this option to check for Freespace on a volume mount. (Performance Penalty while mounting).
 										// If not done in the mount, it will be done on the first call to FF_GetFreeSize() function.
 
+#define FF_FREE_BITMAP					// Keeps a bitmap of the free clusters in RAM, (1 bit per cluster), built from the FAT on the
+										// first allocation. Free clusters are then found without reading the FAT. If there is not
+										// enough memory for the bitmap, the FAT is searched as before.
+
+//#define FF_FAT_MIRROR					// Loads the whole FAT into RAM when the partition is mounted, if it is no larger than FF_FAT_MIRROR_MAX_SIZE.
+										// FAT entries are then read and written in the RAM copy, without going through the cache. Modified
+										// sectors are written back in runs, by FF_FlushCache(), (which FF_Close() and unmounting call).
+#define FF_FAT_MIRROR_MAX_SIZE	262144	// Largest FAT, in bytes, that is mirrored. (256KB takes all of FAT16, or FAT32 up to 64K clusters).
+
+#define FF_ALLOC_GROUPS			1		// Splits the data region into this many allocation groups, each with its own free-cluster hint and lock.
+										// Files opened for writing are bound to the groups in turn, so streaming writers allocate at the
+										// same time, and each file stays contiguous. Needs FF_FREE_BITMAP. (1 to 32, 1 keeps one FAT lock).
+
+#define FF_FAT_SCAN_SECTORS		64		// Scans of the whole FAT, (building the free-cluster bitmap, counting the free clusters), read this
+										// many sectors at a time straight from the device, so they don't push everything else out of the
+										// cache. This needs a buffer of as many sectors during the scan. (0 reads through the cache).
+
+#define FF_FAT_SCAN_SIMD				// Tests FAT entries with SSE2 or AVX2 instructions, when the compiler targets them. Otherwise
+										// portable C is used.
+
 
 //---------- FIND API WILD-CARD SUPPORT
 #define FF_FINDAPI_ALLOW_WILDCARDS		// Defined to enable Wild-cards in the API. Disabling this, makes the API consistent with 1.0.x series.
@@ -179,6 +261,16 @@
 #define FF_DRIVER_BUSY_SLEEP	20		// How long FullFAT should sleep the thread for in ms, if FF_ERR_DRIVER_BUSY is recieved.
 
 
+//---------- Buffer Wait Time
+#define FF_GETBUFFER_TIMEOUT	20000	// How long in ms a thread waits for another thread to release a buffer, before FF_GetBuffer() gives up.
+										// Waiters are woken by FF_ReleaseBuffer(), so this only limits how long a stalled thread can block.
+
+
+//---------- I/O STATISTICS
+#define FF_STATS_TIMING					// FF_GetStats() also reports the time spent waiting for buffers and cache locks.
+										// Costs 2 calls to FF_GetMicroseconds() each time a cache shard is claimed.
+
+
 //---------- DEBUGGING FEATURES (HELPFUL ERROR MESSAGES)
 #define FF_DEBUG						// Enable the Error Code string functions. const FF_T_INT8 *FF_GetErrMessage( FF_T_SINT32 iErrorCode);
 										// Uncommenting this just stops FullFAT error strings being compiled.
@@ -186,6 +278,12 @@
 										// This should be disabled to reduce code-size dramatically.
 
 #endif
+
+#ifdef FF_CONFIG_OVERRIDE
+#include FF_CONFIG_OVERRIDE					// A header that may #undef or redefine any of the options above. (testsuite/regression builds
+										// the library once for each of its configurations this way).
+#endif
+
 //---------- AUTOMATIC SETTINGS DO NOT EDIT -- These configure your options from above, and check sanity!
 
 #ifdef FF_LFN_SUPPORT
@@ -218,6 +316,81 @@
 #endif
 #endif
 
+#ifndef FF_CACHE_WRITE_THROUGH
+#ifndef FF_CACHE_WRITE_BACK
+#error	FullFAT Invalid ff_config.h file: A cache write policy must be specified. See ff_config.h file.
+#endif
+#endif
+
+#ifdef FF_CACHE_WRITE_THROUGH
+#ifdef FF_CACHE_WRITE_BACK
+#error FullFAT Invalid ff_config.h file: Must choose a single cache write policy. THROUGH or BACK. See ff_config.h file.
+#endif
+#endif
+
+#if FF_FLUSH_MAX_SECTORS < 1
+#error FullFAT Invalid ff_config.h file: FF_FLUSH_MAX_SECTORS must be at least 1. See ff_config.h file.
+#endif
+
+#ifdef FF_CACHE_FLUSHER
+#ifndef FF_CACHE_WRITE_BACK
+#error FullFAT Invalid ff_config.h file: FF_CACHE_FLUSHER needs FF_CACHE_WRITE_BACK. See ff_config.h file.
+#endif
+#if FF_FLUSH_INTERVAL < 1 || FF_FLUSH_DIRTY_AGE < 0
+#error FullFAT Invalid ff_config.h file: FF_FLUSH_INTERVAL must be at least 1, and FF_FLUSH_DIRTY_AGE must not be negative. See ff_config.h file.
+#endif
+#if FF_FLUSH_DIRTY_RATIO < 1 || FF_FLUSH_DIRTY_RATIO > FF_FLUSH_DIRTY_LIMIT || FF_FLUSH_DIRTY_LIMIT > 100
+#error FullFAT Invalid ff_config.h file: Must have 1 <= FF_FLUSH_DIRTY_RATIO <= FF_FLUSH_DIRTY_LIMIT <= 100. See ff_config.h file.
+#endif
+#endif
+
+#if defined(FF_FAT_MIRROR) && FF_FAT_MIRROR_MAX_SIZE < 1
+#error FullFAT Invalid ff_config.h file: FF_FAT_MIRROR_MAX_SIZE must be at least 1. See ff_config.h file.
+#endif
+
+#if defined(FF_FAT12_DECODE) && !defined(FF_FAT12_SUPPORT)
+#error FullFAT Invalid ff_config.h file: FF_FAT12_DECODE needs FF_FAT12_SUPPORT. See ff_config.h file.
+#endif
+
+#if defined(FF_WRITE_FREE_COUNT) && FF_FSINFO_UPDATE_INTERVAL < 0
+#error FullFAT Invalid ff_config.h file: FF_FSINFO_UPDATE_INTERVAL must not be negative. See ff_config.h file.
+#endif
+
+#if FF_FAT_SCAN_SECTORS < 0
+#error FullFAT Invalid ff_config.h file: FF_FAT_SCAN_SECTORS must be 0 or more. See ff_config.h file.
+#endif
+
+#if defined(FF_FILE_EXTENT_MAP) && FF_FILE_EXTENT_MAP_RUNS < 1
+#error FullFAT Invalid ff_config.h file: FF_FILE_EXTENT_MAP_RUNS must be at least 1. See ff_config.h file.
+#endif
+
+#if FF_CACHE_LINE_SECTORS < 1 || FF_CACHE_LINE_SECTORS > 128 || (FF_CACHE_LINE_SECTORS & (FF_CACHE_LINE_SECTORS - 1))
+#error FullFAT Invalid ff_config.h file: FF_CACHE_LINE_SECTORS must be a power of 2, from 1 to 128. See ff_config.h file.
+#endif
+
+#if FF_READAHEAD_SECTORS < 0
+#error FullFAT Invalid ff_config.h file: FF_READAHEAD_SECTORS must be 0 or more. See ff_config.h file.
+#endif
+
+#if FF_CACHE_SHARDS < 1 || FF_CACHE_SHARDS > 64 || (FF_CACHE_SHARDS & (FF_CACHE_SHARDS - 1))
+#error FullFAT Invalid ff_config.h file: FF_CACHE_SHARDS must be a power of 2, from 1 to 64. See ff_config.h file.
+#endif
+
+#if FF_ALLOC_GROUPS < 1 || FF_ALLOC_GROUPS > 32
+#error FullFAT Invalid ff_config.h file: FF_ALLOC_GROUPS must be from 1 to 32. See ff_config.h file.
+#endif
+#if FF_ALLOC_GROUPS > 1 && !defined(FF_FREE_BITMAP)
+#error FullFAT Invalid ff_config.h file: FF_ALLOC_GROUPS needs FF_FREE_BITMAP. See ff_config.h file.
+#endif
+
+#if !defined(FF_CACHE_REPLACE_LRU) && !defined(FF_CACHE_REPLACE_2Q) && !defined(FF_CACHE_REPLACE_SCAN)
+#error	FullFAT Invalid ff_config.h file: A cache replacement policy must be specified. See ff_config.h file.
+#endif
+
+#if (defined(FF_CACHE_REPLACE_LRU) && (defined(FF_CACHE_REPLACE_2Q) || defined(FF_CACHE_REPLACE_SCAN))) || (defined(FF_CACHE_REPLACE_2Q) && defined(FF_CACHE_REPLACE_SCAN))
+#error FullFAT Invalid ff_config.h file: Must choose a single cache replacement policy. LRU, 2Q or SCAN. See ff_config.h file.
+#endif
+
 #ifdef FF_UNICODE_SUPPORT
 #ifdef FF_HASH_CACHE
 #error FullFAT Invalid ff_config.h file: HASH cache feature is not UNICODE compatible, please disable it.
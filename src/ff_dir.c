@@ -87,24 +87,11 @@ static void FF_ProcessShortName(FF_T_INT8 *name);
 #endif
 
 void FF_lockDIR(FF_IOMAN *pIoman) {
-	FF_PendSemaphore(pIoman->pSemaphore);	// Use Semaphore to protect DIR modifications.
-	{
-		while((pIoman->Locks & FF_DIR_LOCK)) {
-			FF_ReleaseSemaphore(pIoman->pSemaphore);
-			FF_Yield();						// Keep Releasing and Yielding until we have the DIR protector.
-			FF_PendSemaphore(pIoman->pSemaphore);
-		}
-		pIoman->Locks |= FF_DIR_LOCK;
-	}
-	FF_ReleaseSemaphore(pIoman->pSemaphore);
+	FF_PendWrite(pIoman->pDirLock);		// Blocks until no other thread is modifying a directory. (Lookups don't take the lock).
 }
 
 void FF_unlockDIR(FF_IOMAN *pIoman) {
-	FF_PendSemaphore(pIoman->pSemaphore);
-	{
-		pIoman->Locks &= ~FF_DIR_LOCK;
-	}
-	FF_ReleaseSemaphore(pIoman->pSemaphore);
+	FF_ReleaseWrite(pIoman->pDirLock);
 }
 
 static FF_T_UINT8 FF_CreateChkSum(const FF_T_UINT8 *pa_pShortName) {
@@ -894,7 +881,7 @@ FF_ERROR FF_FetchEntryWithContext(FF_IOMAN *pIoman, FF_T_UINT32 ulEntry, FF_FETC
 				return Error;
 			}
 		}
-		pContext->pBuffer = FF_GetBuffer(pIoman, ulItemLBA, FF_MODE_READ);
+		pContext->pBuffer = FF_GetBuffer(pIoman, ulItemLBA, FF_MODE_READ | FF_MODE_DIR);
 		if(!pContext->pBuffer) {
 			return FF_ERR_DEVICE_DRIVER_FAILED | FF_FETCHENTRYWITHCONTEXT;
 		}
@@ -939,7 +926,7 @@ FF_ERROR FF_PushEntryWithContext(FF_IOMAN *pIoman, FF_T_UINT32 ulEntry, FF_FETCH
 				return Error;
 			}
 		}
-		pContext->pBuffer = FF_GetBuffer(pIoman, ulItemLBA, FF_MODE_WRITE);
+		pContext->pBuffer = FF_GetBuffer(pIoman, ulItemLBA, FF_MODE_WRITE | FF_MODE_DIR);
 		if(!pContext->pBuffer) {
 			return FF_ERR_DEVICE_DRIVER_FAILED | FF_FETCHENTRYWITHCONTEXT;
 		}
@@ -2292,7 +2279,7 @@ FF_ERROR FF_ExtendDirectory(FF_IOMAN *pIoman, FF_T_UINT32 DirCluster) {
 	FF_T_UINT32 CurrentCluster;
 	FF_T_UINT32 NextCluster;
 	FF_ERROR Error;
-	FF_FatBuffers FatBuf;
+	FF_EXTENT Extent;
 
 	if(pIoman->pPartition->Type != FF_T_FAT32) {
 		if(DirCluster == pIoman->pPartition->RootDirCluster) {
@@ -2318,22 +2305,13 @@ FF_ERROR FF_ExtendDirectory(FF_IOMAN *pIoman, FF_T_UINT32 DirCluster) {
 			return Error;
 		}
 
-		NextCluster = FF_FindFreeCluster(pIoman, &Error);
-		if(FF_isERR(Error)) {
-			FF_unlockFAT(pIoman);
-			return Error;
-		}
-
-		FF_InitFatBuffer (&FatBuf, FF_MODE_WRITE);
-		Error = FF_putFatEntry(pIoman, CurrentCluster, NextCluster, &FatBuf);
-		if(!FF_isERR(Error)) {
-			Error = FF_putFatEntry(pIoman, NextCluster, 0xFFFFFFFF, &FatBuf);
-		}
-		Error = FF_ReleaseFatBuffer(pIoman, &FatBuf);
+		// The cluster following the directory is preferred, so that it stays contiguous.
+		Error = FF_AllocateExtent(pIoman, 1, CurrentCluster, &Extent);
 		if(FF_isERR(Error)) {
 			FF_unlockFAT(pIoman);
 			return Error;
 		}
+		NextCluster = Extent.Runs[0].Start;
 	}
 	FF_unlockFAT(pIoman);
 
@@ -2540,7 +2518,11 @@ FF_T_UINT32 FF_CreateFile(FF_IOMAN *pIoman, FF_T_UINT32 DirCluster, FF_T_INT8 *F
 	strncpy(MyFile.FileName, FileName, FF_MAX_FILENAME);
 #endif
 
+#if FF_ALLOC_GROUPS > 1
+	MyFile.ObjectCluster = FF_CreateGroupChain(pIoman, FF_BindAllocGroup(pIoman, 0), pError);	// FF_Open() binds the file to this group.
+#else
 	MyFile.ObjectCluster = FF_CreateClusterChain(pIoman, pError);
+#endif
 	if(FF_isERR(*pError)) {
 		// HT: TODO: can we unlink what we didn't create?
 		// JW: This is ok, because if the item item has a 0 in it, the no unlinking will occur.
@@ -98,6 +98,12 @@ const struct _FFFUNCTIONTAB
 	{"FF_DetermineFatType",      FF_GETMOD_FUNC(FF_DETERMINEFATTYPE) },
 	{"FF_GetEfiPartitionEntry",  FF_GETMOD_FUNC(FF_GETEFIPARTITIONENTRY) },
 	{"FF_UserDriver",            FF_GETMOD_FUNC(FF_USERDRIVER) },
+	{"FF_GetStats",              FF_GETMOD_FUNC(FF_GETSTATS) },
+	{"FF_ResizeCache",           FF_GETMOD_FUNC(FF_RESIZECACHE) },
+	{"FF_DestroyCachePool",      FF_GETMOD_FUNC(FF_DESTROYCACHEPOOL) },
+	{"FF_CreatePooledIOMAN",     FF_GETMOD_FUNC(FF_CREATEPOOLEDIOMAN) },
+	{"FF_SetCacheSnapshot",      FF_GETMOD_FUNC(FF_SETCACHESNAPSHOT) },
+	{"FF_DeferFatCopies",        FF_GETMOD_FUNC(FF_DEFERFATCOPIES) },
 
 //----- FF_DIR - The FullFAT directory handling routines
 	{"FF_FindNextInDir",         FF_GETMOD_FUNC(FF_FINDNEXTINDIR) },
@@ -146,6 +152,10 @@ const struct _FFFUNCTIONTAB
 	{"FF_putFatEntry",           FF_GETMOD_FUNC(FF_PUTFATENTRY) },
 	{"FF_FindFreeCluster",       FF_GETMOD_FUNC(FF_FINDFREECLUSTER) },
 	{"FF_CountFreeClusters",     FF_GETMOD_FUNC(FF_COUNTFREECLUSTERS) },
+	{"FF_AllocateExtent",        FF_GETMOD_FUNC(FF_ALLOCATEEXTENT) },
+	{"FF_ScanFAT",               FF_GETMOD_FUNC(FF_SCANFAT) },
+	{"FF_SyncFatCopies",         FF_GETMOD_FUNC(FF_SYNCFATCOPIES) },
+	{"FF_AllocateGroupExtent",   FF_GETMOD_FUNC(FF_ALLOCATEGROUPEXTENT) },
 
 //----- FF_HASH - The FullFAT hashing routines
 	{"FF_ClearHashTable",        FF_GETMOD_FUNC(FF_CLEARHASHTABLE) },
@@ -188,6 +198,9 @@ const struct _FFERRTAB
 	{"Disk full",                                                                   FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE},
 	{"Attempted to Read a sector out of bounds",									FF_ERR_IOMAN_OUT_OF_BOUNDS_READ},
 	{"Attempted to Write a sector out of bounds",									FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE},
+	{"The cache layout quotas add up to more than 100%",							FF_ERR_IOMAN_BAD_CACHE_LAYOUT},
+	{"The cache is shared through a pool, and can't be changed by one of its IOMANs",	FF_ERR_IOMAN_CACHE_POOLED},
+	{"The cache pool still has IOMANs attached",									FF_ERR_IOMAN_POOL_IN_USE},
 	{"I/O driver is busy",                                                          FF_ERR_IOMAN_DRIVER_BUSY},
 	{"I/O driver returned fatal error",                                             FF_ERR_IOMAN_DRIVER_FATAL_ERROR},
 
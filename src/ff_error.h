@@ -112,6 +112,12 @@
 #define FF_USERDRIVER				((13		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
 #define FF_DECREASEFREECLUSTERS	((14		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
 #define FF_INCREASEFREECLUSTERS	((15		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_GETSTATS					((16		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_RESIZECACHE				((17		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_DESTROYCACHEPOOL			((18		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_CREATEPOOLEDIOMAN		((19		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_SETCACHESNAPSHOT			((20		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
+#define FF_DEFERFATCOPIES			((21		<< FF_FUNCTION_SHIFT) | FF_MODULE_IOMAN)
 
 //----- FullFAT Return codes for user Rd/Wr routines
 #define FF_ERR_DRIVER_BUSY			(FF_ERR_IOMAN_DRIVER_BUSY 		  | FF_USERDRIVER | FF_MODULE_DRIVER)
@@ -166,6 +172,10 @@
 #define FF_PUTFATENTRY				((3			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
 #define FF_FINDFREECLUSTER			((4			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
 #define FF_COUNTFREECLUSTERS		((5			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
+#define FF_ALLOCATEEXTENT			((6			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
+#define FF_SCANFAT					((7			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
+#define FF_SYNCFATCOPIES			((8			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
+#define FF_ALLOCATEGROUPEXTENT		((9			<< FF_FUNCTION_SHIFT) | FF_MODULE_FAT)
 
 //----- FF_HASH - The FullFAT hashing routines.
 #define FF_CLEARHASHTABLE			((1			<< FF_FUNCTION_SHIFT) | FF_MODULE_HASH)
@@ -211,6 +221,9 @@
 #define FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE	22
 #define FF_ERR_IOMAN_OUT_OF_BOUNDS_READ		23
 #define FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE	24
+#define FF_ERR_IOMAN_BAD_CACHE_LAYOUT		25	///< The cache quotas add up to more than 100%.
+#define FF_ERR_IOMAN_CACHE_POOLED			26	///< The cache is shared through a pool, it can't be changed through one of its IOMANs.
+#define FF_ERR_IOMAN_POOL_IN_USE			27	///< The cache pool still has IOMANs attached to it.
 
 // File Error Codes                         30 +
 #define FF_ERR_FILE_ALREADY_OPEN			30	///< File is in use.
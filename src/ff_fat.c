@@ -52,28 +52,184 @@
 #include "ff_config.h"
 #include <string.h>
 
-struct SFatStat fatStat;
+#if defined(FF_FAT_SCAN_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(FF_FAT_SCAN_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+/**
+ *	@private
+ *	@brief	Locks the FAT for modification, blocking until no other thread holds it, (for reading or writing).
+ **/
 void FF_lockFAT(FF_IOMAN *pIoman) {
-	FF_PendSemaphore(pIoman->pSemaphore);	// Use Semaphore to protect FAT modifications.
+	FF_PendWrite(pIoman->pFatLock);
+}
+
+void FF_unlockFAT(FF_IOMAN *pIoman) {
+	FF_ReleaseWrite(pIoman->pFatLock);
+}
+
+/**
+ *	@private
+ *	@brief	Locks the FAT for reading, so chains can be walked by several threads at once.
+ *
+ *	No entry may be changed under this lock, (except by the owners of allocation groups), and a thread
+ *	must not claim it again while it holds it, a waiting writer would block the second claim.
+ **/
+void FF_lockFATRead(FF_IOMAN *pIoman) {
+	FF_PendRead(pIoman->pFatLock);
+}
+
+void FF_unlockFATRead(FF_IOMAN *pIoman) {
+	FF_ReleaseRead(pIoman->pFatLock);
+}
+
+#if FF_ALLOC_GROUPS > 1
+/**
+ *	@private
+ *	@brief	Splits the data region into allocation groups, when the partition is mounted.
+ *
+ *	Each group starts on a multiple of 32 FAT sectors, so no FAT sector, nor any word of the free-cluster
+ *	bitmap, (or of the FAT mirror and FAT copy sector maps), is shared by two groups.
+ *	FAT12 volumes, and volumes too small for 2 groups, have a single group.
+ **/
+void FF_InitAllocGroups(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Groups = 1;
+	FF_T_UINT16		i;
+#ifdef FF_FREE_BITMAP
+	FF_T_UINT32		Align = 32 * (pPart->BlkSize / ((pPart->Type == FF_T_FAT32) ? 4 : 2));
+
+	if(pPart->Type != FF_T_FAT12) {
+		Groups	= pPart->NumClusters / Align;
+		if(Groups > FF_ALLOC_GROUPS) {
+			Groups = FF_ALLOC_GROUPS;
+		}
+	}
+	if(Groups > 1) {
+		pPart->AllocGroupSize = ((pPart->NumClusters / Groups) / Align) * Align;
+	} else
+#endif
 	{
-		while((pIoman->Locks & FF_FAT_LOCK)) {
-			FF_ReleaseSemaphore(pIoman->pSemaphore);
-			FF_Yield();						// Keep Releasing and Yielding until we have the Fat protector.
-			FF_PendSemaphore(pIoman->pSemaphore);
+		Groups = 1;
+		pPart->AllocGroupSize = pPart->NumClusters;
+	}
+
+	pPart->nAllocGroups		= (FF_T_UINT16) Groups;
+	pPart->NextAllocGroup	= 0;
+	for(i = 0; i < Groups; i++) {
+		pPart->AllocGroupHint[i] = i * pPart->AllocGroupSize;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Returns the allocation group that nCluster belongs to.
+ **/
+FF_INLINE FF_T_UINT16 FF_AllocGroupOf(FF_PARTITION *pPart, FF_T_UINT32 nCluster) {
+	FF_T_UINT32 Group = nCluster / pPart->AllocGroupSize;
+
+	return (FF_T_UINT16) ((Group < pPart->nAllocGroups) ? Group : pPart->nAllocGroups - 1);
+}
+
+/**
+ *	@private
+ *	@brief	Chooses the allocation group for a file opened for writing.
+ *
+ *	A file that has clusters grows in the group where it starts, new files are given the groups in turn.
+ **/
+FF_T_UINT16 FF_BindAllocGroup(FF_IOMAN *pIoman, FF_T_UINT32 ObjectCluster) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT16		Group;
+
+	if(pPart->nAllocGroups < 2) {
+		return 0;
+	}
+	if(ObjectCluster >= 2 && ObjectCluster < pPart->NumClusters + 2) {
+		return FF_AllocGroupOf(pPart, ObjectCluster);
+	}
+
+	FF_PendSemaphore(pIoman->pSemaphore);
+	{
+		Group = pPart->NextAllocGroup;
+		pPart->NextAllocGroup = (FF_T_UINT16) ((Group + 1) % pPart->nAllocGroups);
+	}
+	FF_ReleaseSemaphore(pIoman->pSemaphore);
+
+	return Group;
+}
+
+/**
+ *	@private
+ *	@brief	FF_TRUE when clusters can be allocated within a group, (it needs the free-cluster bitmap).
+ **/
+static FF_T_BOOL FF_AllocGroupsUsable(FF_PARTITION *pPart) {
+#ifdef FF_FREE_BITMAP
+	return (pPart->nAllocGroups > 1 && pPart->pFreeBitmap) ? FF_TRUE : FF_FALSE;
+#else
+	return FF_FALSE;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Locks allocation group Group, and the group of Tail, for FF_AllocateGroupExtent().
+ *
+ *	The FAT is held for reading, so writers in different groups, and chain walks, go on at the same time,
+ *	while FF_lockFAT() waits for all of them. If groups can't be used, the whole FAT is locked with FF_lockFAT() instead.
+ *
+ *	@param	Tail	Last cluster of the chain that will be extended, 0 for a new chain.
+ *
+ *	@return	The lock bits to pass to FF_unlockAllocGroup(), 0 when the FAT was locked with FF_lockFAT().
+ **/
+FF_T_UINT32 FF_lockAllocGroup(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_T_UINT32 Tail) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Mask;
+
+	if(!FF_AllocGroupsUsable(pPart) || Group >= pPart->nAllocGroups) {
+		FF_lockFAT(pIoman);
+		return 0;
+	}
+
+	Mask = (FF_T_UINT32) 1 << Group;
+	if(Tail >= 2 && Tail < pPart->NumClusters + 2) {
+		Mask |= (FF_T_UINT32) 1 << FF_AllocGroupOf(pPart, Tail);	// The tail is linked to the new clusters.
+	}
+
+	FF_lockFATRead(pIoman);
+	FF_PendSemaphore(pIoman->pSemaphore);
+	{
+		// Both groups are taken at once, so two writers never each hold a group that the other waits for.
+		while((pIoman->GroupLocks & Mask)) {
+			FF_WaitCondition(pIoman->pGroupCondition, pIoman->pSemaphore, FF_GETBUFFER_TIMEOUT);
 		}
-		pIoman->Locks |= FF_FAT_LOCK;
+		pIoman->GroupLocks |= Mask;
 	}
 	FF_ReleaseSemaphore(pIoman->pSemaphore);
+
+	return Mask;
 }
 
-void FF_unlockFAT(FF_IOMAN *pIoman) {
+/**
+ *	@private
+ *	@brief	Releases the locks taken by FF_lockAllocGroup().
+ **/
+void FF_unlockAllocGroup(FF_IOMAN *pIoman, FF_T_UINT32 Locked) {
+	if(!Locked) {
+		FF_unlockFAT(pIoman);
+		return;
+	}
+
 	FF_PendSemaphore(pIoman->pSemaphore);
 	{
-		pIoman->Locks &= ~FF_FAT_LOCK;
+		pIoman->GroupLocks &= ~Locked;
+		FF_SignalCondition(pIoman->pGroupCondition);
 	}
 	FF_ReleaseSemaphore(pIoman->pSemaphore);
+	FF_unlockFATRead(pIoman);
 }
+#endif
 
 /**
  *	@private
@@ -131,11 +287,505 @@ FF_ERROR FF_ReleaseFatBuffer (FF_IOMAN *pIoman, FF_FatBuffers *pBuffer)
 			pBuffer->pBuffers[i] = NULL;
 		}
 	}
-	fatStat.clearCount++;
 
 	return Error;
 }
 
+#define FF_FAT_SECTORS(pIoman)	(((pIoman)->pPartition->SectorsPerFAT * (pIoman)->pPartition->BlkSize) / (pIoman)->BlkSize)	///< Device sectors in one FAT.
+
+#if defined(FF_FAT_MIRROR) || defined(FF_MIRROR_FATS_UMOUNT) || defined(FF_FAT12_DECODE)
+/**
+ *	@private
+ *	@brief	Sets the bit of a sector in a bitmap of FAT sectors.
+ **/
+FF_INLINE void FF_MarkSector(FF_T_UINT32 *pBits, FF_T_UINT32 Sector) {
+	pBits[Sector / 32] |= ((FF_T_UINT32) 1 << (Sector % 32));
+}
+
+/**
+ *	@private
+ *	@brief	Finds the next run of set bits in a bitmap of FAT sectors, from *pSector, and clears them.
+ *
+ *	@param	pSector		Sector to search from, receives the first sector of the run.
+ *	@param	MaxRun		Longest run to take, the rest is found by the next call.
+ *
+ *	@return	Length of the run, 0 when no bits are set from *pSector to Sectors.
+ **/
+static FF_T_UINT32 FF_TakeSectorRun(FF_T_UINT32 *pBits, FF_T_UINT32 Sectors, FF_T_UINT32 *pSector, FF_T_UINT32 MaxRun) {
+	FF_T_UINT32 Sector = *pSector, nRun = 0;
+
+	while(Sector < Sectors && !((pBits[Sector / 32] >> (Sector % 32)) & 1)) {
+		if(!(pBits[Sector / 32] >> (Sector % 32))) {
+			Sector = (Sector | 31) + 1;	// Nothing else set in this word.
+		} else {
+			Sector++;
+		}
+	}
+	while(Sector + nRun < Sectors && nRun < MaxRun && ((pBits[(Sector + nRun) / 32] >> ((Sector + nRun) % 32)) & 1)) {
+		pBits[(Sector + nRun) / 32] &= ~((FF_T_UINT32) 1 << ((Sector + nRun) % 32));
+		nRun++;
+	}
+	*pSector = Sector;
+
+	return nRun;
+}
+#endif
+
+#ifdef FF_FAT_MIRROR
+/**
+ *	@private
+ *	@brief	Marks the sector that holds byte Offset of the FAT mirror as modified.
+ **/
+FF_INLINE void FF_MarkMirrorDirty(FF_IOMAN *pIoman, FF_T_UINT32 Offset) {
+	FF_MarkSector(pIoman->pPartition->pFatMirrorDirty, Offset / pIoman->BlkSize);
+}
+
+/**
+ *	@private
+ *	@brief	Reads a FAT entry from the FAT mirror.
+ **/
+FF_INLINE FF_T_UINT32 FF_getMirrorEntry(FF_PARTITION *pPart, FF_T_UINT32 nCluster) {
+	FF_T_UINT32 FatEntry;
+
+	switch(pPart->Type) {
+		case FF_T_FAT32:
+			return FF_getLong(pPart->pFatMirror, nCluster * 4) & 0x0fffffff;	// Clear the top 4 bits.
+
+		case FF_T_FAT16:
+			return (FF_T_UINT32) FF_getShort(pPart->pFatMirror, nCluster * 2);
+
+		default:	// FAT12, entries that span a sector are no different here.
+			FatEntry = (FF_T_UINT32) FF_getShort(pPart->pFatMirror, nCluster + (nCluster / 2));
+			if(nCluster & 0x0001) {
+				FatEntry = FatEntry >> 4;
+			}
+			return FatEntry & 0x0FFF;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Writes a FAT entry into the FAT mirror, and marks its sector(s) to be written back.
+ **/
+static void FF_putMirrorEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Value) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		FatOffset, FatEntry;
+
+	switch(pPart->Type) {
+		case FF_T_FAT32:
+			FatOffset = nCluster * 4;
+			FF_putLong(pPart->pFatMirror, FatOffset, Value & 0x0fffffff);	// Clear the top 4 bits.
+			break;
+
+		case FF_T_FAT16:
+			FatOffset = nCluster * 2;
+			FF_putShort(pPart->pFatMirror, FatOffset, (FF_T_UINT16) Value);
+			break;
+
+		default:
+			FatOffset	= nCluster + (nCluster / 2);
+			FatEntry	= (FF_T_UINT32) FF_getShort(pPart->pFatMirror, FatOffset);
+			if(nCluster & 0x0001) {
+				FatEntry   &= 0x000F;
+				Value		= (Value << 4);
+				Value	   &= 0xFFF0;
+			} else {
+				FatEntry	&= 0xF000;
+				Value		&= 0x0FFF;
+			}
+			FF_putShort(pPart->pFatMirror, FatOffset, (FF_T_UINT16) (FatEntry | Value));
+			FF_MarkMirrorDirty(pIoman, FatOffset + 1);	// The entry may span two sectors.
+			break;
+	}
+	FF_MarkMirrorDirty(pIoman, FatOffset);
+}
+
+/**
+ *	@private
+ *	@brief	Frees the FAT mirror. Anything not written back by FF_FlushFatMirror() is lost.
+ **/
+void FF_DestroyFatMirror(FF_IOMAN *pIoman) {
+	if(pIoman->pPartition->pFatMirror) {
+		FF_FREE(pIoman->pPartition->pFatMirror);
+		pIoman->pPartition->pFatMirror = NULL;
+	}
+	if(pIoman->pPartition->pFatMirrorDirty) {
+		FF_FREE(pIoman->pPartition->pFatMirrorDirty);
+		pIoman->pPartition->pFatMirrorDirty = NULL;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Reads the whole (first) FAT into RAM, with one multi-sector read, if it is no larger than FF_FAT_MIRROR_MAX_SIZE.
+ *
+ *	@return	FF_ERR_NONE, also when the FAT is not mirrored because it is too large, or there is no memory.
+ *	@return	The FAT is then accessed through the cache, as usual.
+ **/
+FF_ERROR FF_LoadFatMirror(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Sectors = FF_FAT_SECTORS(pIoman);
+	FF_T_UINT32		Words = (Sectors + 31) / 32;
+	FF_T_SINT32		slRetVal;
+
+	FF_DestroyFatMirror(pIoman);
+
+#ifdef FF_FAT12_DECODE
+	if(pPart->pFat12Table) {
+		return FF_ERR_NONE;	// Already held in RAM, decoded.
+	}
+#endif
+	if(!Sectors || Sectors * pIoman->BlkSize > FF_FAT_MIRROR_MAX_SIZE) {
+		return FF_ERR_NONE;
+	}
+
+	pPart->pFatMirror		= (FF_T_UINT8 *) FF_MALLOC(Sectors * pIoman->BlkSize);
+	pPart->pFatMirrorDirty	= (FF_T_UINT32 *) FF_MALLOC(Words * sizeof(FF_T_UINT32));
+	if(!pPart->pFatMirror || !pPart->pFatMirrorDirty) {
+		FF_DestroyFatMirror(pIoman);
+		return FF_ERR_NONE;
+	}
+	memset(pPart->pFatMirrorDirty, '\0', Words * sizeof(FF_T_UINT32));
+
+	slRetVal = FF_BlockRead(pIoman, FF_getRealLBA(pIoman, pPart->FatBeginLBA), Sectors, pPart->pFatMirror, FF_FALSE);
+	if(FF_isERR(slRetVal)) {
+		FF_DestroyFatMirror(pIoman);
+		return slRetVal;
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Writes the modified sectors of the FAT mirror back to the device.
+ *
+ *	Each run of neighbouring modified sectors is written with a single driver call,
+ *	(to every FAT with FF_WRITE_BOTH_FATS or FF_MIRROR_FATS_UMOUNT).
+ *
+ *	@return	FF_ERR_NONE, or the first error from the driver. Sectors that failed stay modified, to be retried.
+ **/
+FF_ERROR FF_FlushFatMirror(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Sectors, Sector, i, nRun;
+	FF_T_UINT16		Fat, NumFATs = 1;
+	FF_T_SINT32		slRetVal;
+	FF_ERROR		Error = FF_ERR_NONE;
+
+#if defined(FF_WRITE_BOTH_FATS) || defined(FF_MIRROR_FATS_UMOUNT)
+	NumFATs = pPart->NumFATS;	// The copies are written from RAM as well, there is nothing to read.
+#endif
+
+	if(!pPart->pFatMirror) {
+		return FF_ERR_NONE;
+	}
+
+	FF_lockFAT(pIoman);	// Keeps the entries still while they are written.
+	if(pPart->pFatMirror) {
+		Sectors = FF_FAT_SECTORS(pIoman);
+		for(Sector = 0; (nRun = FF_TakeSectorRun(pPart->pFatMirrorDirty, Sectors, &Sector, Sectors)) != 0; Sector += nRun) {
+			for(Fat = 0; Fat < NumFATs; Fat++) {
+				slRetVal = FF_BlockWrite(pIoman, FF_getRealLBA(pIoman, pPart->FatBeginLBA + (Fat * pPart->SectorsPerFAT)) + Sector,
+										 nRun, pPart->pFatMirror + (Sector * pIoman->BlkSize), FF_FALSE);
+				if(FF_isERR(slRetVal)) {
+					if(!FF_isERR(Error)) {
+						Error = slRetVal;
+					}
+					for(i = Sector; i < Sector + nRun; i++) {
+						FF_MarkSector(pPart->pFatMirrorDirty, i);
+					}
+				}
+			}
+		}
+	}
+	FF_unlockFAT(pIoman);
+
+	return Error;
+}
+#endif
+
+#ifdef FF_FAT12_DECODE
+/**
+ *	@private
+ *	@brief	Frees the decoded FAT12 table. Anything not written back by FF_FlushFat12Table() is lost.
+ **/
+void FF_DestroyFat12Table(FF_IOMAN *pIoman) {
+	if(pIoman->pPartition->pFat12Table) {
+		FF_FREE(pIoman->pPartition->pFat12Table);
+		pIoman->pPartition->pFat12Table = NULL;
+	}
+	if(pIoman->pPartition->pFat12Raw) {
+		FF_FREE(pIoman->pPartition->pFat12Raw);
+		pIoman->pPartition->pFat12Raw = NULL;
+	}
+	if(pIoman->pPartition->pFat12Dirty) {
+		FF_FREE(pIoman->pPartition->pFat12Dirty);
+		pIoman->pPartition->pFat12Dirty = NULL;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Reads the whole (first) FAT of a FAT12 volume, with one multi-sector read, and decodes it into pFat12Table.
+ *
+ *	@return	FF_ERR_NONE, also when the volume is not FAT12, or there is no memory.
+ *	@return	The FAT is then accessed through the FAT mirror or the cache, as usual.
+ **/
+FF_ERROR FF_LoadFat12Table(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Sectors = FF_FAT_SECTORS(pIoman);
+	FF_T_UINT32		Words = (Sectors + 31) / 32;
+	FF_T_UINT32		nEntries = pPart->NumClusters + 2;
+	FF_T_UINT32		nEntry, FatEntry;
+	FF_T_SINT32		slRetVal;
+
+	FF_DestroyFat12Table(pIoman);
+
+	if(pPart->Type != FF_T_FAT12 || !Sectors || ((nEntries * 3) + 1) / 2 > Sectors * pIoman->BlkSize) {
+		return FF_ERR_NONE;
+	}
+
+	pPart->pFat12Raw	= (FF_T_UINT8 *) FF_MALLOC(Sectors * pIoman->BlkSize);
+	pPart->pFat12Table	= (FF_T_UINT16 *) FF_MALLOC(nEntries * sizeof(FF_T_UINT16));
+	pPart->pFat12Dirty	= (FF_T_UINT32 *) FF_MALLOC(Words * sizeof(FF_T_UINT32));
+	if(!pPart->pFat12Raw || !pPart->pFat12Table || !pPart->pFat12Dirty) {
+		FF_DestroyFat12Table(pIoman);
+		return FF_ERR_NONE;
+	}
+	memset(pPart->pFat12Dirty, '\0', Words * sizeof(FF_T_UINT32));
+
+	slRetVal = FF_BlockRead(pIoman, FF_getRealLBA(pIoman, pPart->FatBeginLBA), Sectors, pPart->pFat12Raw, FF_FALSE);
+	if(FF_isERR(slRetVal)) {
+		FF_DestroyFat12Table(pIoman);
+		return slRetVal;
+	}
+
+	for(nEntry = 0; nEntry < nEntries; nEntry++) {
+		FatEntry = (FF_T_UINT32) FF_getShort(pPart->pFat12Raw, nEntry + (nEntry / 2));
+		if(nEntry & 0x0001) {
+			FatEntry = FatEntry >> 4;
+		}
+		pPart->pFat12Table[nEntry] = (FF_T_UINT16) (FatEntry & 0x0FFF);
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Encodes the entries of pFat12Table that lie in bytes Begin to End of the FAT back into pFat12Raw.
+ **/
+static void FF_EncodeFat12Table(FF_PARTITION *pPart, FF_T_UINT32 Begin, FF_T_UINT32 End) {
+	FF_T_UINT32 nEntries = pPart->NumClusters + 2;
+	FF_T_UINT32 nEntry = (Begin * 2) / 3;
+	FF_T_UINT32 FatOffset, FatEntry;
+
+	if(nEntry) {
+		nEntry--;	// The entry that spans into Begin.
+	}
+	for(; nEntry < nEntries && (FatOffset = nEntry + (nEntry / 2)) < End; nEntry++) {
+		FatEntry = (FF_T_UINT32) FF_getShort(pPart->pFat12Raw, FatOffset);
+		if(nEntry & 0x0001) {
+			FatEntry = (FatEntry & 0x000F) | ((FF_T_UINT32) pPart->pFat12Table[nEntry] << 4);
+		} else {
+			FatEntry = (FatEntry & 0xF000) | pPart->pFat12Table[nEntry];
+		}
+		FF_putShort(pPart->pFat12Raw, FatOffset, (FF_T_UINT16) FatEntry);
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Encodes the modified sectors of the decoded FAT12 table, and writes them back to the device.
+ *
+ *	Like FF_FlushFatMirror(), each run of neighbouring modified sectors is written with a single driver call.
+ *
+ *	@return	FF_ERR_NONE, or the first error from the driver. Sectors that failed stay modified, to be retried.
+ **/
+FF_ERROR FF_FlushFat12Table(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Sectors, Sector, i, nRun;
+	FF_T_UINT16		Fat, NumFATs = 1;
+	FF_T_SINT32		slRetVal;
+	FF_ERROR		Error = FF_ERR_NONE;
+
+#if defined(FF_WRITE_BOTH_FATS) || defined(FF_MIRROR_FATS_UMOUNT)
+	NumFATs = pPart->NumFATS;
+#endif
+
+	if(!pPart->pFat12Table) {
+		return FF_ERR_NONE;
+	}
+
+	FF_lockFAT(pIoman);
+	if(pPart->pFat12Table) {
+		Sectors = FF_FAT_SECTORS(pIoman);
+		for(Sector = 0; (nRun = FF_TakeSectorRun(pPart->pFat12Dirty, Sectors, &Sector, Sectors)) != 0; Sector += nRun) {
+			FF_EncodeFat12Table(pPart, Sector * pIoman->BlkSize, (Sector + nRun) * pIoman->BlkSize);
+			for(Fat = 0; Fat < NumFATs; Fat++) {
+				slRetVal = FF_BlockWrite(pIoman, FF_getRealLBA(pIoman, pPart->FatBeginLBA + (Fat * pPart->SectorsPerFAT)) + Sector,
+										 nRun, pPart->pFat12Raw + (Sector * pIoman->BlkSize), FF_FALSE);
+				if(FF_isERR(slRetVal)) {
+					if(!FF_isERR(Error)) {
+						Error = slRetVal;
+					}
+					for(i = Sector; i < Sector + nRun; i++) {
+						FF_MarkSector(pPart->pFat12Dirty, i);
+					}
+				}
+			}
+		}
+	}
+	FF_unlockFAT(pIoman);
+
+	return Error;
+}
+
+#define FF_FAT12_DECODED(pPart)	((pPart)->pFat12Table != NULL)	///< FF_TRUE when the FAT12 entries are held in pFat12Table.
+#else
+#define FF_FAT12_DECODED(pPart)	FF_FALSE
+#endif
+
+#ifdef FF_MIRROR_FATS_UMOUNT
+/**
+ *	@private
+ *	@brief	Frees the map of first-FAT sectors that are not yet copied. Those copies are lost.
+ **/
+void FF_DestroyFatCopyMap(FF_IOMAN *pIoman) {
+	if(pIoman->pPartition->pFatCopyDirty) {
+		FF_FREE(pIoman->pPartition->pFatCopyDirty);
+		pIoman->pPartition->pFatCopyDirty = NULL;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Allocates the map of first-FAT sectors that the other FATs have to be updated from.
+ *
+ *	Without the memory, (or with a single FAT), there is no map, and FF_putFatEntry() writes
+ *	each entry in every FAT at once (with FF_WRITE_BOTH_FATS).
+ **/
+void FF_CreateFatCopyMap(FF_IOMAN *pIoman) {
+	FF_T_UINT32 Words = (FF_FAT_SECTORS(pIoman) + 31) / 32;
+
+	FF_DestroyFatCopyMap(pIoman);
+
+	if(pIoman->pPartition->NumFATS < 2 || !Words) {
+		return;
+	}
+	pIoman->pPartition->pFatCopyDirty = (FF_T_UINT32 *) FF_MALLOC(Words * sizeof(FF_T_UINT32));
+	if(pIoman->pPartition->pFatCopyDirty) {
+		memset(pIoman->pPartition->pFatCopyDirty, '\0', Words * sizeof(FF_T_UINT32));
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Copies the sectors of the first FAT that were modified since the last call to the other FATs.
+ *
+ *	Each run of modified sectors, (up to FF_FAT_SCAN_SECTORS at a time), is gathered from the cache and
+ *	written to each copy with a single driver call. Without the memory for that, the sectors are copied
+ *	one at a time.
+ *
+ *	@return	FF_ERR_NONE, or the first error. Sectors that were not copied stay marked, to be retried.
+ **/
+FF_ERROR FF_SyncFatCopies(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Sectors, Sector, FatLBA, i, nRun, MaxRun = 1;
+	FF_T_UINT8		*pStaging = NULL;
+	FF_BUFFER		*pBuffer;
+	FF_T_UINT16		Fat;
+	FF_T_SINT32		slRetVal;
+	FF_ERROR		Error = FF_ERR_NONE, RelError;
+
+	if(!pPart->pFatCopyDirty) {
+		return FF_ERR_NONE;
+	}
+
+	FF_lockFAT(pIoman);	// The first FAT can't change while it is copied.
+	if(pPart->pFatCopyDirty) {
+		Sectors	= FF_FAT_SECTORS(pIoman);
+		FatLBA	= FF_getRealLBA(pIoman, pPart->FatBeginLBA);
+#if FF_FAT_SCAN_SECTORS > 0
+		i = 0;
+		while(i < (Sectors + 31) / 32 && !pPart->pFatCopyDirty[i]) {
+			i++;
+		}
+		if(i < (Sectors + 31) / 32) {	// Only when there is something to copy.
+			pStaging = (FF_T_UINT8 *) FF_MALLOC(FF_FAT_SCAN_SECTORS * pIoman->BlkSize);
+			if(pStaging) {
+				MaxRun = FF_FAT_SCAN_SECTORS;
+			}
+		}
+#endif
+		for(Sector = 0; (nRun = FF_TakeSectorRun(pPart->pFatCopyDirty, Sectors, &Sector, MaxRun)) != 0; Sector += nRun) {
+			// The sectors were just modified, so they are read from the cache.
+			pBuffer = NULL;
+			slRetVal = FF_ERR_NONE;
+			for(i = 0; i < nRun && !FF_isERR(slRetVal); i++) {
+				pBuffer = FF_GetBuffer(pIoman, FatLBA + Sector + i, FF_MODE_READ);
+				if(!pBuffer) {
+					slRetVal = FF_ERR_DEVICE_DRIVER_FAILED | FF_SYNCFATCOPIES;
+				} else if(pStaging) {
+					memcpy(pStaging + (i * pIoman->BlkSize), pBuffer->pBuffer, pIoman->BlkSize);
+					slRetVal = FF_ReleaseBuffer(pIoman, pBuffer);
+					pBuffer = NULL;
+				}
+			}
+			for(Fat = 1; !FF_isERR(slRetVal) && Fat < pPart->NumFATS; Fat++) {
+				slRetVal = FF_BlockWrite(pIoman, FF_getRealLBA(pIoman, pPart->FatBeginLBA + (Fat * pPart->SectorsPerFAT)) + Sector,
+										 nRun, pStaging ? pStaging : pBuffer->pBuffer, FF_FALSE);
+			}
+			if(pBuffer) {
+				RelError = FF_ReleaseBuffer(pIoman, pBuffer);
+				if(!FF_isERR(slRetVal)) {
+					slRetVal = RelError;
+				}
+			}
+			if(FF_isERR(slRetVal)) {
+				if(!FF_isERR(Error)) {
+					Error = slRetVal;
+				}
+				for(i = Sector; i < Sector + nRun; i++) {
+					FF_MarkSector(pPart->pFatCopyDirty, i);
+				}
+			}
+		}
+	}
+	FF_unlockFAT(pIoman);
+
+	if(pStaging) {
+		FF_FREE(pStaging);
+	}
+
+	return Error;
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Number of FATs that FF_putFatEntry() writes an entry in, which is in device sector FatSector of the first FAT.
+ *
+ *	While the copies are deferred, the sector is marked for FF_SyncFatCopies() instead, and only the first FAT is written.
+ **/
+FF_INLINE FF_T_UINT16 FF_FatsToWrite(FF_IOMAN *pIoman, FF_T_UINT32 FatSector) {
+#ifdef FF_MIRROR_FATS_UMOUNT
+	FF_PARTITION *pPart = pIoman->pPartition;
+
+	if(pPart->pFatCopyDirty && pPart->bDeferFatCopies) {
+		FF_MarkSector(pPart->pFatCopyDirty, FatSector - FF_getRealLBA(pIoman, pPart->FatBeginLBA));
+		return 1;
+	}
+#else
+	(void) FatSector;	// Only marked while the copies are deferred.
+#endif
+#ifdef FF_WRITE_BOTH_FATS
+	return pIoman->pPartition->NumFATS;
+#else
+	return 1;
+#endif
+}
+
 /**
  *	@private
  **/
@@ -156,11 +806,21 @@ FF_T_UINT32 FF_getFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_ERROR *pEr
 #endif
 	*pError = FF_ERR_NONE;
 
-	if (nCluster >= pIoman->pPartition->NumClusters) {
+	if (nCluster >= pIoman->pPartition->NumClusters + 2) {	// Cluster numbers run from 2 to NumClusters + 1.
 		// HT: find a more specific error code
 		*pError = FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_GETFATENTRY;
 		return 0;
 	}
+#ifdef FF_FAT12_DECODE
+	if(pIoman->pPartition->pFat12Table) {
+		return pIoman->pPartition->pFat12Table[nCluster];
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	if(pIoman->pPartition->pFatMirror) {
+		return FF_getMirrorEntry(pIoman->pPartition, nCluster);
+	}
+#endif
 	if(pIoman->pPartition->Type == FF_T_FAT32) {
 		FatOffset = nCluster * 4;
 	} else if(pIoman->pPartition->Type == FF_T_FAT16) {
@@ -181,6 +841,12 @@ FF_T_UINT32 FF_getFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_ERROR *pEr
 	if(pIoman->pPartition->Type == FF_T_FAT12) {
 		if(relClusterEntry == (FF_T_UINT32)((pIoman->BlkSize - 1))) {
 			// Fat Entry SPANS a Sector!
+			if(pFatBuf) {	// It may hold one of the sectors, which FF_GetBuffer() would then wait for forever.
+				*pError = FF_ReleaseFatBuffer(pIoman, pFatBuf);
+				if(FF_isERR(*pError)) {
+					return 0;
+				}
+			}
 			// First Buffer get the last Byte in buffer (first byte of our address)!
 			pBuffer = FF_GetBuffer(pIoman, FatSector, Mode);
 			{
@@ -223,17 +889,17 @@ FF_T_UINT32 FF_getFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_ERROR *pEr
 		if (buf) {
 			if (buf->Sector == FatSector) {
 				pBuffer = buf;
-				fatStat.reuseCount[0]++;
+				FF_AtomicAdd(&pIoman->Stats.FatBufferReuses[0], 1);
 			} else {
 				*pError = FF_ReleaseBuffer(pIoman, buf);
 				if(FF_isERR(*pError)) {
 					return 0;
 				}
 				pFatBuf->pBuffers[0] = NULL;
-				fatStat.missCount[0]++;
+				FF_AtomicAdd(&pIoman->Stats.FatBufferMisses[0], 1);
 			}
 		} else {
-			fatStat.getCount[0]++;
+			FF_AtomicAdd(&pIoman->Stats.FatBufferGets[0], 1);
 		}
 	}
 	if (!pBuffer)
@@ -410,6 +1076,36 @@ FF_T_BOOL FF_isEndOfChain(FF_IOMAN *pIoman, FF_T_UINT32 fatEntry) {
 }
 
 
+#ifdef FF_FREE_BITMAP
+#define FF_BITMAP_CLUSTERS(pPart)	((pPart)->NumClusters + 2)						///< Cluster numbers run up to NumClusters + 1.
+#define FF_BITMAP_WORDS(pPart)		((FF_BITMAP_CLUSTERS(pPart) + 31) / 32)		///< 32 clusters are kept in each word, even where FF_T_UINT32 is wider.
+
+/**
+ *	@private
+ *	@brief	Records a change of a FAT entry in the free-cluster bitmap, if it has been built.
+ **/
+FF_INLINE void FF_MarkFreeBitmap(FF_PARTITION *pPart, FF_T_UINT32 nCluster, FF_T_BOOL bFree) {
+	if(pPart->pFreeBitmap) {
+		if(bFree) {
+			pPart->pFreeBitmap[nCluster / 32] |= ((FF_T_UINT32) 1 << (nCluster % 32));
+		} else {
+			pPart->pFreeBitmap[nCluster / 32] &= ~((FF_T_UINT32) 1 << (nCluster % 32));
+		}
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Frees the free-cluster bitmap, when the partition is unmounted.
+ **/
+void FF_DestroyFreeBitmap(FF_IOMAN *pIoman) {
+	if(pIoman->pPartition->pFreeBitmap) {
+		FF_FREE(pIoman->pPartition->pFreeBitmap);
+		pIoman->pPartition->pFreeBitmap = NULL;
+	}
+}
+#endif
+
 /**
  *	@private
  *	@brief	Writes a new Entry to the FAT Tables.
@@ -431,11 +1127,14 @@ FF_ERROR FF_putFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Valu
 #ifdef FF_FAT12_SUPPORT
 	FF_T_UINT8	F12short[2];		// For FAT12 FAT Table Across sector boundary traversal.
 #endif
+#ifdef FF_FREE_BITMAP
+	FF_T_BOOL	bFree;
+#endif
 
-	FF_T_INT i;
+	FF_T_INT i, NumFATs;
 
 	// HT: avoid corrupting the disk
-	if (!nCluster || nCluster >= pIoman->pPartition->NumClusters) {
+	if (!nCluster || nCluster >= pIoman->pPartition->NumClusters + 2) {
 		// find a more specific error code
 		return FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_PUTFATENTRY;
 	}
@@ -446,6 +1145,36 @@ FF_ERROR FF_putFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Valu
 	}else {
 		FatOffset = nCluster + (nCluster / 2);
 	}
+#ifdef FF_FREE_BITMAP
+	if(pIoman->pPartition->Type == FF_T_FAT32) {
+		bFree = (Value & 0x0fffffff) == 0;
+	} else if(pIoman->pPartition->Type == FF_T_FAT16) {
+		bFree = (Value & 0xffff) == 0;
+	} else {
+		bFree = (Value & 0x0fff) == 0;
+	}
+#endif
+
+#ifdef FF_FAT12_DECODE
+	if(pIoman->pPartition->pFat12Table) {
+		pIoman->pPartition->pFat12Table[nCluster] = (FF_T_UINT16) (Value & 0x0FFF);
+		FF_MarkSector(pIoman->pPartition->pFat12Dirty, FatOffset / pIoman->BlkSize);
+		FF_MarkSector(pIoman->pPartition->pFat12Dirty, (FatOffset + 1) / pIoman->BlkSize);	// The entry may span two sectors.
+#ifdef FF_FREE_BITMAP
+		FF_MarkFreeBitmap(pIoman->pPartition, nCluster, bFree);
+#endif
+		return FF_ERR_NONE;
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	if(pIoman->pPartition->pFatMirror) {
+		FF_putMirrorEntry(pIoman, nCluster, Value);
+#ifdef FF_FREE_BITMAP
+		FF_MarkFreeBitmap(pIoman->pPartition, nCluster, bFree);
+#endif
+		return FF_ERR_NONE;
+	}
+#endif
 
 	FatSector = pIoman->pPartition->FatBeginLBA + (FatOffset / pIoman->pPartition->BlkSize);
 	FatSectorEntry = FatOffset % pIoman->pPartition->BlkSize;
@@ -461,6 +1190,12 @@ FF_ERROR FF_putFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Valu
 		  if(relClusterEntry == (FF_T_UINT32) (pIoman->BlkSize - 1)) {
 
 				// Fat Entry SPANS a Sector!
+				if(pFatBuf) {	// It may hold one of the sectors, which FF_GetBuffer() would then wait for forever.
+					Error = FF_ReleaseFatBuffer(pIoman, pFatBuf);
+					if(FF_isERR(Error)) {
+						return Error;
+					}
+				}
 				// First Buffer get the last Byte in buffer (first byte of our address)!
 				pBuffer = FF_GetBuffer(pIoman, FatSector, FF_MODE_READ);
 				{
@@ -498,10 +1233,9 @@ FF_ERROR FF_putFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Valu
 
 				FF_putShort((FF_T_UINT8 *)F12short, 0x0000, (FF_T_UINT16) (FatEntry | Value));
 
-#ifdef FF_WRITE_BOTH_FATS
-				for (i = 0; i < pIoman->pPartition->NumFATS; i++) {
-					FatSector += (i * pIoman->pPartition->SectorsPerFAT);
-#endif
+				FF_FatsToWrite(pIoman, FatSector + 1);	// Marks the second sector, when the copies are deferred.
+				NumFATs = FF_FatsToWrite(pIoman, FatSector);
+				for (i = 0; i < NumFATs; i++, FatSector += pIoman->pPartition->SectorsPerFAT) {
 
 					pBuffer = FF_GetBuffer(pIoman, FatSector, FF_MODE_WRITE);
 					{
@@ -527,87 +1261,499 @@ FF_ERROR FF_putFatEntry(FF_IOMAN *pIoman, FF_T_UINT32 nCluster, FF_T_UINT32 Valu
 					if(FF_isERR(Error)) {
 						return Error;
 					}
+				}
+
+#ifdef FF_FREE_BITMAP
+				FF_MarkFreeBitmap(pIoman->pPartition, nCluster, bFree);
+#endif
+				return FF_ERR_NONE;
+		  }
+	 }
+#endif
+
+	NumFATs = FF_FatsToWrite(pIoman, FatSector);
+	for (i = 0; i < NumFATs; i++, FatSector += pIoman->pPartition->SectorsPerFAT) {
+
+		if (i < BUF_STORE_COUNT && pFatBuf) {
+			FF_BUFFER *buf = pFatBuf->pBuffers[i];
+			if (buf) {
+				if (buf->Sector == FatSector && (buf->Mode & FF_MODE_WRITE)) {
+					// Same sector, correct mode: we can reuse it
+					pBuffer = buf;
+					FF_AtomicAdd(&pIoman->Stats.FatBufferReuses[1], 1);
+				} else {
+					Error = FF_ReleaseBuffer(pIoman, buf);
+					if(FF_isERR(Error)) {
+						return Error;
+					}
+					pFatBuf->pBuffers[i] = NULL;
+					FF_AtomicAdd(&pIoman->Stats.FatBufferMisses[1], 1);
+					pBuffer = NULL;
+				}
+			} else {
+				FF_AtomicAdd(&pIoman->Stats.FatBufferGets[1], 1);
+			}
+		}
+		if (!pBuffer)
+			pBuffer = FF_GetBuffer(pIoman, FatSector, FF_MODE_WRITE);
+		{
+			if(!pBuffer) {
+				return FF_ERR_DEVICE_DRIVER_FAILED | FF_PUTFATENTRY;
+			}
+			if(pIoman->pPartition->Type == FF_T_FAT32) {
+				Value &= 0x0fffffff;	// Clear the top 4 bits.
+				FF_putLong(pBuffer->pBuffer, relClusterEntry, Value);
+			} else if(pIoman->pPartition->Type == FF_T_FAT16) {
+				FF_putShort(pBuffer->pBuffer, relClusterEntry, (FF_T_UINT16) Value);
+			} else {
+				FatEntry	= (FF_T_UINT32) FF_getShort(pBuffer->pBuffer, relClusterEntry);
+				if(nCluster & 0x0001) {	// Value is left as it is, for the next FAT.
+					FatEntry   &= 0x000F;
+					FatEntry   |= (Value << 4) & 0xFFF0;
+				}  else {
+					FatEntry	&= 0xF000;
+					FatEntry   |= Value & 0x0FFF;
+				}
+
+				FF_putShort(pBuffer->pBuffer, relClusterEntry, (FF_T_UINT16) FatEntry);
+			}
+		}
+		if (i < BUF_STORE_COUNT && pFatBuf) {
+			// Store it for later use
+			pFatBuf->pBuffers[i] = pBuffer;
+			pFatBuf->Mode = FF_MODE_WRITE;
+		} else {
+			Error = FF_ReleaseBuffer(pIoman, pBuffer);
+			if(FF_isERR(Error)) {
+				return Error;
+			}
+		}
+		pBuffer = NULL;
+	}
+
+#ifdef FF_FREE_BITMAP
+	FF_MarkFreeBitmap(pIoman->pPartition, nCluster, bFree);
+#endif
+	return FF_ERR_NONE;
+}
+
+
+
+/**
+ *	@private
+ *	@brief	Counts the bits set in the low 32 bits of a word.
+ **/
+FF_INLINE FF_T_UINT32 FF_CountBits(FF_T_UINT32 Bits) {
+	Bits = Bits & 0xFFFFFFFF;
+	Bits = Bits - ((Bits >> 1) & 0x55555555);
+	Bits = (Bits & 0x33333333) + ((Bits >> 2) & 0x33333333);
+	Bits = (Bits + (Bits >> 4)) & 0x0F0F0F0F;
+	return ((Bits * 0x01010101) & 0xFFFFFFFF) >> 24;
+}
+
+/**
+ *	@private
+ *	@brief	Tests one FAT16 or FAT32 entry in a block of FAT sectors.
+ **/
+FF_INLINE FF_T_BOOL FF_isFreeEntry(FF_T_UINT8 *pData, FF_T_UINT8 Type, FF_T_UINT32 nEntry) {
+	if(Type == FF_T_FAT32) {
+		return !(FF_getLong(pData, nEntry * 4) & 0x0fffffff);	// The top 4 bits are reserved.
+	}
+	return !FF_getShort(pData, nEntry * 2);
+}
+
+/**
+ *	@private
+ *	@brief	Tests 32 FAT16 or FAT32 entries, from nEntry in a block of FAT sectors.
+ *
+ *	@return	A mask with bit i set when entry nEntry + i is free.
+ **/
+static FF_T_UINT32 FF_FreeEntryMask(FF_T_UINT8 *pData, FF_T_UINT8 Type, FF_T_UINT32 nEntry) {
+	FF_T_UINT32	Mask = 0;
+	FF_T_UINT32	i;
+#if defined(FF_FAT_SCAN_SIMD) && defined(__AVX2__)
+	const __m256i	Zero = _mm256_setzero_si256();
+	__m256i			Entries;
+
+	if(Type == FF_T_FAT32) {
+		for(i = 0; i < 4; i++) {	// 8 entries at a time.
+			Entries = _mm256_loadu_si256((const __m256i *) (pData + (nEntry + i * 8) * 4));
+			Entries = _mm256_cmpeq_epi32(_mm256_and_si256(Entries, _mm256_set1_epi32(0x0fffffff)), Zero);
+			Mask |= (FF_T_UINT32) _mm256_movemask_ps(_mm256_castsi256_ps(Entries)) << (i * 8);
+		}
+	} else {
+		for(i = 0; i < 2; i++) {	// 16 entries at a time, packed to a byte each, (packing works within each half).
+			Entries = _mm256_loadu_si256((const __m256i *) (pData + (nEntry + i * 16) * 2));
+			Entries = _mm256_cmpeq_epi16(Entries, Zero);
+			Entries = _mm256_permute4x64_epi64(_mm256_packs_epi16(Entries, Entries), 0xD8);
+			Mask |= ((FF_T_UINT32) _mm256_movemask_epi8(Entries) & 0xFFFF) << (i * 16);
+		}
+	}
+#elif defined(FF_FAT_SCAN_SIMD) && defined(__SSE2__)
+	const __m128i	Zero = _mm_setzero_si128();
+	__m128i			Entries;
+
+	if(Type == FF_T_FAT32) {
+		for(i = 0; i < 8; i++) {	// 4 entries at a time.
+			Entries = _mm_loadu_si128((const __m128i *) (pData + (nEntry + i * 4) * 4));
+			Entries = _mm_cmpeq_epi32(_mm_and_si128(Entries, _mm_set1_epi32(0x0fffffff)), Zero);
+			Mask |= (FF_T_UINT32) _mm_movemask_ps(_mm_castsi128_ps(Entries)) << (i * 4);
+		}
+	} else {
+		for(i = 0; i < 4; i++) {	// 8 entries at a time, packed to a byte each.
+			Entries = _mm_loadu_si128((const __m128i *) (pData + (nEntry + i * 8) * 2));
+			Entries = _mm_cmpeq_epi16(Entries, Zero);
+			Mask |= ((FF_T_UINT32) _mm_movemask_epi8(_mm_packs_epi16(Entries, Entries)) & 0xFF) << (i * 8);
+		}
+	}
+#else
+	for(i = 0; i < 32; i++) {
+		if(FF_isFreeEntry(pData, Type, nEntry + i)) {
+			Mask |= (FF_T_UINT32) 1 << i;
+		}
+	}
+#endif
+	return Mask;
+}
+
+/**
+ *	@private
+ *	@brief	Finds the first free entry from From up to End, in a block of FAT16 or FAT32 sectors.
+ *
+ *	@return	The free entry, or End when there is none.
+ **/
+static FF_T_UINT32 FF_FindFreeEntry(FF_T_UINT8 *pData, FF_T_UINT8 Type, FF_T_UINT32 From, FF_T_UINT32 End) {
+	FF_T_UINT32 nEntry, Mask;
+
+	for(nEntry = From - (From % 32); nEntry + 32 <= End; nEntry += 32) {
+		Mask = FF_FreeEntryMask(pData, Type, nEntry);
+		if(nEntry < From) {
+			Mask &= (FF_T_UINT32) 0xFFFFFFFF << (From - nEntry);
+		}
+		if(Mask) {
+			while(!(Mask & 1)) {
+				Mask >>= 1;
+				nEntry++;
+			}
+			return nEntry;
+		}
+	}
+
+	for(nEntry = (nEntry > From) ? nEntry : From; nEntry < End; nEntry++) {
+		if(FF_isFreeEntry(pData, Type, nEntry)) {
+			return nEntry;
+		}
+	}
+
+	return End;
+}
+
+/**
+ *	@private
+ *	@brief	Counts the free entries in a block of FAT16 or FAT32 sectors, 32 at a time.
+ *
+ *	@param	pBitmap		If not NULL, receives a bit for each free entry, starting with the first word.
+ **/
+static FF_T_UINT32 FF_CountFreeEntries(FF_T_UINT8 *pData, FF_T_UINT8 Type, FF_T_UINT32 nEntries, FF_T_UINT32 *pBitmap) {
+	FF_T_UINT32 nEntry, i, Mask, FreeEntries = 0;
+
+	for(nEntry = 0; nEntry < nEntries; nEntry += 32) {
+		if(nEntry + 32 <= nEntries) {
+			Mask = FF_FreeEntryMask(pData, Type, nEntry);
+		} else {
+			for(Mask = 0, i = 0; nEntry + i < nEntries; i++) {	// The last few entries of the FAT.
+				if(FF_isFreeEntry(pData, Type, nEntry + i)) {
+					Mask |= (FF_T_UINT32) 1 << i;
+				}
+			}
+		}
+		if(pBitmap) {
+			pBitmap[nEntry / 32] = Mask;
+		}
+		FreeEntries += FF_CountBits(Mask);
+	}
+
+	return FreeEntries;
+}
+
+/**
+ *	@private
+ *	@brief	Returns the FAT when it is held in RAM in a form the scan kernels above can read, or NULL.
+ *
+ *	@param	pType	Receives the type of entry to pass to the kernels, (a decoded FAT12 table is read as FAT16).
+ **/
+FF_INLINE FF_T_UINT8 *FF_FatInRAM(FF_PARTITION *pPart, FF_T_UINT8 *pType) {
+#ifdef FF_FAT12_DECODE
+	if(pPart->pFat12Table) {
+		*pType = FF_T_FAT16;
+		return (FF_T_UINT8 *) pPart->pFat12Table;
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	if(pPart->pFatMirror && pPart->Type != FF_T_FAT12) {
+		*pType = pPart->Type;
+		return pPart->pFatMirror;
+	}
+#endif
+	*pType = pPart->Type;
+	return NULL;
+}
+
+/**
+ *	@private
+ *	@brief	Reads the whole of a FAT16 or FAT32 table, (or a decoded FAT12 table), and counts its free entries.
+ *
+ *	The FAT is read FF_FAT_SCAN_SECTORS at a time, straight from the device, (FF_BlockRead() still
+ *	picks up the sectors that are dirty in the cache). Without the memory for that it is read through
+ *	the cache, a sector at a time.
+ *
+ *	@param	pBitmap		If not NULL, receives a bit for each free cluster.
+ *
+ *	@return	The number of free entries, (of the NumClusters + 2 in the FAT), 0 on an error.
+ **/
+static FF_T_UINT32 FF_ScanFAT(FF_IOMAN *pIoman, FF_T_UINT32 *pBitmap, FF_ERROR *pError) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		EntriesPerSector = pIoman->BlkSize / ((pPart->Type == FF_T_FAT32) ? 4 : 2);
+	FF_T_UINT32		nEntries = pPart->NumClusters + 2;
+	FF_T_UINT32		Sector, Sectors, Count, nEntry = 0, n, FreeEntries = 0;
+	FF_T_UINT8		*pStaging = NULL;
+	FF_T_UINT8		*pFat, Type;
+	FF_BUFFER		*pBuffer;
+	FF_T_SINT32		slRetVal;
+
+	*pError = FF_ERR_NONE;
+
+	pFat = FF_FatInRAM(pPart, &Type);
+	if(pFat) {
+		return FF_CountFreeEntries(pFat, Type, nEntries, pBitmap);
+	}
+
+	Sectors = (nEntries + EntriesPerSector - 1) / EntriesPerSector;
+	if(Sectors > pPart->SectorsPerFAT) {
+		Sectors = pPart->SectorsPerFAT;
+	}
+
+#if FF_FAT_SCAN_SECTORS > 0
+	pStaging = (FF_T_UINT8 *) FF_MALLOC(FF_FAT_SCAN_SECTORS * pIoman->BlkSize);
+#endif
+
+	// Every sector holds a multiple of 32 entries, so each block starts on a word of the bitmap.
+	for(Sector = 0; Sector < Sectors && nEntry < nEntries; Sector += Count) {
+		if(pStaging) {
+			Count = (Sectors - Sector < FF_FAT_SCAN_SECTORS) ? Sectors - Sector : FF_FAT_SCAN_SECTORS;
+			slRetVal = FF_BlockRead(pIoman, pPart->FatBeginLBA + Sector, Count, pStaging, FF_FALSE);
+			if(FF_isERR(slRetVal)) {
+				*pError = slRetVal;
+				break;
+			}
+			n = (nEntries - nEntry < Count * EntriesPerSector) ? nEntries - nEntry : Count * EntriesPerSector;
+			FreeEntries += FF_CountFreeEntries(pStaging, pPart->Type, n, pBitmap ? pBitmap + nEntry / 32 : NULL);
+		} else {
+			Count = 1;
+			pBuffer = FF_GetBuffer(pIoman, pPart->FatBeginLBA + Sector, FF_MODE_READ);
+			if(!pBuffer) {
+				*pError = FF_ERR_DEVICE_DRIVER_FAILED | FF_SCANFAT;
+				break;
+			}
+			n = (nEntries - nEntry < EntriesPerSector) ? nEntries - nEntry : EntriesPerSector;
+			FreeEntries += FF_CountFreeEntries(pBuffer->pBuffer, pPart->Type, n, pBitmap ? pBitmap + nEntry / 32 : NULL);
+			*pError = FF_ReleaseBuffer(pIoman, pBuffer);
+			if(FF_isERR(*pError)) {
+				break;
+			}
+		}
+		nEntry += n;
+	}
+
+	if(pStaging) {
+		FF_FREE(pStaging);
+	}
+
+	return FF_isERR(*pError) ? 0 : FreeEntries;
+}
+
+#ifdef FF_FREE_BITMAP
+/**
+ *	@private
+ *	@brief	Builds the free-cluster bitmap, by reading the whole FAT once.
+ *
+ *	The free clusters are counted on the way, if the count isn't known yet.
+ *
+ *	@return	FF_ERR_NONE, also when there was no memory for the bitmap. Then pFreeBitmap stays NULL,
+ *	@return	and free clusters are found by searching the FAT.
+ **/
+static FF_ERROR FF_BuildFreeBitmap(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		*pBitmap;
+	FF_T_UINT32		FreeClusters = 0;
+	FF_ERROR		Error = FF_ERR_NONE;
+#ifdef FF_FAT12_SUPPORT
+	FF_FatBuffers	FatBuf;
+	FF_T_UINT32		nCluster, FatEntry;
+#endif
+
+	pBitmap = (FF_T_UINT32 *) FF_MALLOC(FF_BITMAP_WORDS(pPart) * sizeof(FF_T_UINT32));
+	if(!pBitmap) {
+		return FF_ERR_NONE;
+	}
+	memset(pBitmap, '\0', FF_BITMAP_WORDS(pPart) * sizeof(FF_T_UINT32));
+
+#ifdef FF_FAT12_SUPPORT
+	if(pPart->Type == FF_T_FAT12 && !FF_FAT12_DECODED(pPart)) {	// Entries straddle the sectors, so they are read one by one. (Like FF_CountFreeClustersOLD()).
+		FF_InitFatBuffer(&FatBuf, FF_MODE_READ);
+		for(nCluster = 2; nCluster < FF_BITMAP_CLUSTERS(pPart); nCluster++) {
+			FatEntry = FF_getFatEntry(pIoman, nCluster, &Error, &FatBuf);
+			if(FF_isERR(Error)) {
+				break;
+			}
+			if(!FatEntry) {
+				pBitmap[nCluster / 32] |= ((FF_T_UINT32) 1 << (nCluster % 32));
+				FreeClusters++;
+			}
+		}
+		if(!FF_isERR(Error)) {
+			Error = FF_ReleaseFatBuffer(pIoman, &FatBuf);
+		} else {
+			FF_ReleaseFatBuffer(pIoman, &FatBuf);	// Returning an error already.
+		}
+	} else
+#endif
+	{
+		FreeClusters = FF_ScanFAT(pIoman, pBitmap, &Error);
+	}
+
+	if(FF_isERR(Error)) {
+		FF_FREE(pBitmap);
+		return Error;
+	}
+
+	pPart->pFreeBitmap = pBitmap;
+	if(!pPart->FreeClusterCount) {
+		pPart->FreeClusterCount = FreeClusters;
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Finds the first free cluster from From up to End in the bitmap, a word at a time.
+ *
+ *	@return	The number of the free cluster, or End when there is none.
+ **/
+static FF_T_UINT32 FF_NextFreeBitmap(FF_PARTITION *pPart, FF_T_UINT32 From, FF_T_UINT32 End) {
+	FF_T_UINT32 b, Bits;
+
+	while(From < End) {
+		Bits = (pPart->pFreeBitmap[From / 32] & 0xFFFFFFFF) >> (From % 32);
+		if(Bits) {
+			for(b = 0; !(Bits & 1); b++) {
+				Bits >>= 1;
+			}
+			return (From + b < End) ? From + b : End;
+		}
+		From = ((From / 32) + 1) * 32;
+	}
+
+	return End;
+}
+
+/**
+ *	@private
+ *	@brief	Finds a free cluster in the bitmap.
+ *
+ *	The search starts at LastFreeCluster, and wraps around to the start of the FAT, so the
+ *	clusters freed behind the hint are found once the end is reached.
+ *
+ *	@return	The number of a free cluster, or 0 when there is none.
+ **/
+static FF_T_UINT32 FF_SearchFreeBitmap(FF_PARTITION *pPart) {
+	FF_T_UINT32 Start = (pPart->LastFreeCluster < FF_BITMAP_CLUSTERS(pPart)) ? pPart->LastFreeCluster : 0;
+	FF_T_UINT32 nCluster;
+
+	nCluster = FF_NextFreeBitmap(pPart, Start, FF_BITMAP_CLUSTERS(pPart));
+	if(nCluster == FF_BITMAP_CLUSTERS(pPart)) {
+		nCluster = FF_NextFreeBitmap(pPart, 0, Start);
+		if(nCluster == Start) {
+			return 0;
+		}
+	}
+
+	return nCluster;
+}
+
+/**
+ *	@private
+ *	@brief	Measures the run of free clusters starting at nCluster, up to Max clusters, (and stopping at End).
+ **/
+static FF_T_UINT32 FF_FreeRunLength(FF_PARTITION *pPart, FF_T_UINT32 nCluster, FF_T_UINT32 End, FF_T_UINT32 Max) {
+	FF_T_UINT32 Length = 0;
+
+	while(Length < Max && nCluster < End) {
+		if(!(nCluster % 32) && Max - Length >= 32 && nCluster + 32 <= End
+		&& (pPart->pFreeBitmap[nCluster / 32] & 0xFFFFFFFF) == 0xFFFFFFFF) {
+			Length		+= 32;	// A whole word of free clusters.
+			nCluster	+= 32;
+			continue;
+		}
+		if(!((pPart->pFreeBitmap[nCluster / 32] >> (nCluster % 32)) & 1)) {
+			break;
+		}
+		Length++;
+		nCluster++;
+	}
 
-#ifdef FF_WRITE_BOTH_FATS
-				}
-#endif
+	return Length;
+}
 
-				return FF_ERR_NONE;
-		  }
-	 }
-#endif
+/**
+ *	@private
+ *	@brief	Finds the first run of Want free clusters between Begin and End, searching from From, (wrapping around
+ *			to Begin), or else the longest run.
+ *
+ *	@return	Length of the run found, (at most Want), 0 when no cluster is free.
+ **/
+static FF_T_UINT32 FF_FindFreeRun(FF_PARTITION *pPart, FF_T_UINT32 Begin, FF_T_UINT32 End, FF_T_UINT32 From, FF_T_UINT32 Want, FF_T_UINT32 *pStart) {
+	FF_T_UINT32	nCluster, PassEnd, Length, Best = 0;
+	FF_T_UINT16	Pass;
 
-#ifdef FF_WRITE_BOTH_FATS
-	for (i = 0; i < pIoman->pPartition->NumFATS;
-		i++, FatSector += pIoman->pPartition->SectorsPerFAT)
-#else
-	// Will be optimized away by compiler
-	for (i = 0; i < 1; i++)
-#endif
-	{
+	if(From < Begin || From >= End) {
+		From = Begin;
+	}
 
-		if (i < BUF_STORE_COUNT && pFatBuf) {
-			FF_BUFFER *buf = pFatBuf->pBuffers[i];
-			if (buf) {
-				if (buf->Sector == FatSector && (buf->Mode & FF_MODE_WRITE)) {
-					// Same sector, correct mode: we can reuse it
-					pBuffer = buf;
-					fatStat.reuseCount[1]++;
-				} else {
-					Error = FF_ReleaseBuffer(pIoman, buf);
-					if(FF_isERR(Error)) {
-						return Error;
-					}
-					pFatBuf->pBuffers[i] = NULL;
-					fatStat.missCount[1]++;
-					pBuffer = NULL;
-				}
-			} else {
-				fatStat.getCount[1]++;
-			}
-		}
-		if (!pBuffer)
-			pBuffer = FF_GetBuffer(pIoman, FatSector, FF_MODE_WRITE);
-		{
-			if(!pBuffer) {
-				return FF_ERR_DEVICE_DRIVER_FAILED | FF_PUTFATENTRY;
-			}
-			if(pIoman->pPartition->Type == FF_T_FAT32) {
-				Value &= 0x0fffffff;	// Clear the top 4 bits.
-				FF_putLong(pBuffer->pBuffer, relClusterEntry, Value);
-			} else if(pIoman->pPartition->Type == FF_T_FAT16) {
-				FF_putShort(pBuffer->pBuffer, relClusterEntry, (FF_T_UINT16) Value);
-			} else {
-				FatEntry	= (FF_T_UINT32) FF_getShort(pBuffer->pBuffer, relClusterEntry);
-				if(nCluster & 0x0001) {
-					FatEntry   &= 0x000F;
-					Value		= (Value << 4);
-					Value	   &= 0xFFF0;
-				}  else {
-					FatEntry	&= 0xF000;
-					Value		&= 0x0FFF;
+	for(Pass = 0; Pass < 2; Pass++) {
+		nCluster	= Pass ? Begin : From;
+		PassEnd		= Pass ? From : End;
+		while((nCluster = FF_NextFreeBitmap(pPart, nCluster, PassEnd)) < PassEnd) {
+			Length = FF_FreeRunLength(pPart, nCluster, End, Want);
+			if(Length > Best) {
+				Best	= Length;
+				*pStart	= nCluster;
+				if(Best == Want) {
+					return Best;
 				}
-
-				FF_putShort(pBuffer->pBuffer, relClusterEntry, (FF_T_UINT16) (FatEntry | Value));
-			}
-		}
-		if (i < BUF_STORE_COUNT && pFatBuf) {
-			// Store it for later use
-			pFatBuf->pBuffers[i] = pBuffer;
-			pFatBuf->Mode = FF_MODE_WRITE;
-		} else {
-			Error = FF_ReleaseBuffer(pIoman, pBuffer);
-			if(FF_isERR(Error)) {
-				return Error;
 			}
+			nCluster += Length;	// Shorter than Want, so the run ends there.
 		}
-		pBuffer = NULL;
 	}
 
-	return FF_ERR_NONE;
+	return Best;
 }
 
+/**
+ *	@private
+ *	@brief	Counts the free clusters in the bitmap.
+ **/
+static FF_T_UINT32 FF_CountFreeBitmap(FF_PARTITION *pPart) {
+	FF_T_UINT32 w, FreeClusters = 0;
+
+	for(w = 0; w < FF_BITMAP_WORDS(pPart); w++) {
+		FreeClusters += FF_CountBits(pPart->pFreeBitmap[w]);
+	}
 
+	return FreeClusters;
+}
+#endif
 
 /**
  *	@private
@@ -627,7 +1773,7 @@ FF_T_UINT32 FF_FindFreeClusterOLD(FF_IOMAN *pIoman, FF_ERROR *pError) {
 
 	*pError = FF_ERR_NONE;
 
-	for(nCluster = pIoman->pPartition->LastFreeCluster; nCluster < pIoman->pPartition->NumClusters; nCluster++) {
+	for(nCluster = pIoman->pPartition->LastFreeCluster; nCluster < pIoman->pPartition->NumClusters + 2; nCluster++) {
 		fatEntry = FF_getFatEntry(pIoman, nCluster, pError, &FatBuf);
 		if(FF_isERR(*pError)) {
 			nCluster = 0;
@@ -646,20 +1792,45 @@ FF_T_UINT32 FF_FindFreeClusterOLD(FF_IOMAN *pIoman, FF_ERROR *pError) {
 
 FF_T_UINT32 FF_FindFreeCluster(FF_IOMAN *pIoman, FF_ERROR *pError) {
 	FF_BUFFER	*pBuffer;
+	FF_T_UINT8	*pFat, Type;
 	FF_T_UINT32	x, nCluster = pIoman->pPartition->LastFreeCluster;
 	FF_T_UINT32	FatOffset;
 	FF_T_UINT32	FatSector;
-	FF_T_UINT32	FatSectorEntry;
 	FF_T_UINT32	EntriesPerSector;
-	FF_T_UINT32 FatEntry = 1;
 	FF_ERROR Error;
 	const FF_T_INT EntrySize = (pIoman->pPartition->Type == FF_T_FAT32) ? 4 : 2;
-	const FF_T_UINT32 uNumClusters = pIoman->pPartition->NumClusters;
+	const FF_T_UINT32 uEndCluster = pIoman->pPartition->NumClusters + 2;	// Cluster numbers run from 2 to NumClusters + 1.
 
 	Error = FF_ERR_NONE;
 
+#ifdef FF_FREE_BITMAP
+	if(!pIoman->pPartition->pFreeBitmap) {
+		Error = FF_BuildFreeBitmap(pIoman);
+		if(FF_isERR(Error)) {
+			if(pError) {
+				*pError = Error;
+			}
+			return 0;
+		}
+	}
+	if(pIoman->pPartition->pFreeBitmap) {
+		nCluster = FF_SearchFreeBitmap(pIoman->pPartition);
+		if(!nCluster) {
+			if(pError) {
+				*pError = FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_FINDFREECLUSTER;
+			}
+			return 0;
+		}
+		if(pError) {
+			*pError = FF_ERR_NONE;
+		}
+		pIoman->pPartition->LastFreeCluster = nCluster;
+		return nCluster;
+	}
+#endif
+
 #ifdef FF_FAT12_SUPPORT
-	if(pIoman->pPartition->Type == FF_T_FAT12) {	// FAT12 tables are too small to optimise, and would make it very complicated!
+	if(pIoman->pPartition->Type == FF_T_FAT12 && !FF_FAT12_DECODED(pIoman->pPartition)) {	// Entries straddle the sectors, the decoded table is searched below.
 		return FF_FindFreeClusterOLD(pIoman, pError);
 	}
 #endif
@@ -684,6 +1855,22 @@ FF_T_UINT32 FF_FindFreeCluster(FF_IOMAN *pIoman, FF_ERROR *pError) {
 	}
 #endif
 
+	pFat = FF_FatInRAM(pIoman->pPartition, &Type);
+	if(pFat) {
+		nCluster = FF_FindFreeEntry(pFat, Type, nCluster, uEndCluster);
+		if(nCluster >= uEndCluster) {
+			if(pError) {
+				*pError = FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_FINDFREECLUSTER;
+			}
+			return 0;
+		}
+		if(pError) {
+			*pError = Error;
+		}
+		pIoman->pPartition->LastFreeCluster = nCluster;
+		return nCluster;
+	}
+
 	EntriesPerSector = pIoman->BlkSize / EntrySize;
 	FatOffset = nCluster * EntrySize;
 
@@ -696,30 +1883,21 @@ FF_T_UINT32 FF_FindFreeCluster(FF_IOMAN *pIoman, FF_ERROR *pError) {
 				*pError = FF_ERR_DEVICE_DRIVER_FAILED | FF_FINDFREECLUSTER;
 				return 0;
 			}
-			for(x = nCluster % EntriesPerSector; x < EntriesPerSector; x++) {
-				// HT double-check: don't use non-existing clusters
-				if (nCluster >= uNumClusters) {
-					FF_ReleaseBuffer(pIoman, pBuffer);	// Returning an error already, so don't check error here.
-					*pError = FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_FINDFREECLUSTER;
+			x = FF_FindFreeEntry(pBuffer->pBuffer, pIoman->pPartition->Type, nCluster % EntriesPerSector, EntriesPerSector);
+			nCluster += x - (nCluster % EntriesPerSector);
+			// HT double-check: don't use non-existing clusters
+			if (nCluster >= uEndCluster) {
+				FF_ReleaseBuffer(pIoman, pBuffer);	// Returning an error already, so don't check error here.
+				*pError = FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE | FF_FINDFREECLUSTER;
+				return 0;
+			}
+			if(x < EntriesPerSector) {
+				*pError = FF_ReleaseBuffer(pIoman, pBuffer);
+				if(FF_isERR(*pError)) {
 					return 0;
 				}
-				FatSectorEntry	= FatOffset % pIoman->pPartition->BlkSize;
-				if(pIoman->pPartition->Type == FF_T_FAT32) {
-					FatEntry = FF_getLong(pBuffer->pBuffer, FatSectorEntry);
-					FatEntry &= 0x0fffffff;	// Clear the top 4 bits.
-				} else {
-					FatEntry = (FF_T_UINT32) FF_getShort(pBuffer->pBuffer, FatSectorEntry);
-				}
-				if(FatEntry == 0x00000000) {
-					*pError = FF_ReleaseBuffer(pIoman, pBuffer);
-					if(FF_isERR(*pError)) {
-						return 0;
-					}
-					pIoman->pPartition->LastFreeCluster = nCluster;
-					return nCluster;
-				}
-				FatOffset += EntrySize;
-				nCluster++;
+				pIoman->pPartition->LastFreeCluster = nCluster;
+				return nCluster;
 			}
 		}
 		Error = FF_ReleaseBuffer(pIoman, pBuffer);
@@ -736,6 +1914,178 @@ FF_T_UINT32 FF_FindFreeCluster(FF_IOMAN *pIoman, FF_ERROR *pError) {
 	return 0;
 }
 
+/**
+ *	@private
+ *	@brief	Marks a run of free clusters as allocated, and appends it to the chain of an extent.
+ *
+ *	The entries are written in ascending order, so a run following its Tail is a single pass over the FAT.
+ **/
+static FF_ERROR FF_ClaimRun(FF_IOMAN *pIoman, FF_EXTENT *pExtent, FF_T_UINT32 Tail, FF_T_UINT32 Start, FF_T_UINT32 Length, FF_FatBuffers *pFatBuf) {
+	FF_T_UINT32	i;
+	FF_ERROR	Error;
+
+	if(pExtent->Count) {
+		Tail = pExtent->Runs[pExtent->Count - 1].Start + pExtent->Runs[pExtent->Count - 1].Length - 1;
+	}
+
+	if(Tail && Tail < Start) {
+		Error = FF_putFatEntry(pIoman, Tail, Start, pFatBuf);
+		if(FF_isERR(Error)) {
+			return Error;
+		}
+	}
+
+	for(i = 0; i < Length; i++) {
+		Error = FF_putFatEntry(pIoman, Start + i, (i + 1 < Length) ? Start + i + 1 : 0xFFFFFFFF, pFatBuf);
+		if(FF_isERR(Error)) {
+			return Error;
+		}
+	}
+
+	if(Tail > Start) {
+		// The run is complete, only now is it linked to the chain.
+		Error = FF_putFatEntry(pIoman, Tail, Start, pFatBuf);
+		if(FF_isERR(Error)) {
+			return Error;
+		}
+	}
+
+	if(pExtent->Count && Tail + 1 == Start) {
+		pExtent->Runs[pExtent->Count - 1].Length += Length;
+		pExtent->Clusters += Length;
+		return FF_ERR_NONE;
+	}
+
+	pExtent->Runs[pExtent->Count].Start		= Start;
+	pExtent->Runs[pExtent->Count].Length	= Length;
+	pExtent->Count++;
+	pExtent->Clusters += Length;
+
+	return FF_ERR_NONE;
+}
+
+#ifdef FF_FREE_BITMAP
+/**
+ *	@private
+ *	@brief	Allocates up to nClusters clusters from Begin up to End, with the free-cluster bitmap, (see FF_AllocateExtent()).
+ *
+ *	@param	pHint	Where the search for a run starts, moved past each run allocated.
+ **/
+static FF_ERROR FF_AllocateRuns(FF_IOMAN *pIoman, FF_T_UINT32 Begin, FF_T_UINT32 End, FF_T_UINT32 *pHint, FF_T_UINT32 nClusters, FF_T_UINT32 Tail, FF_EXTENT *pExtent) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_FatBuffers	FatBuf;
+	FF_T_UINT32		nCluster, Length, Hint = Tail + 1;
+	FF_ERROR		Error = FF_ERR_NONE, RelError;
+
+	// Nothing is read from the FAT, so its sectors can stay claimed from one run to the next.
+	// (FF_putFatEntry() lets them go itself for a FAT12 entry that spans two sectors).
+	FF_InitFatBuffer(&FatBuf, FF_MODE_WRITE);
+	while(pExtent->Clusters < nClusters && pExtent->Count < FF_EXTENT_MAX_RUNS) {
+		Length = 0;
+		if(Hint >= Begin && Hint < End) {
+			nCluster	= Hint;
+			Length		= FF_FreeRunLength(pPart, Hint, End, nClusters - pExtent->Clusters);
+		}
+		if(!Length) {
+			Length = FF_FindFreeRun(pPart, Begin, End, *pHint, nClusters - pExtent->Clusters, &nCluster);
+			if(!Length) {
+				break;	// No cluster is free.
+			}
+		}
+		Error = FF_ClaimRun(pIoman, pExtent, Tail, nCluster, Length, &FatBuf);
+		if(FF_isERR(Error)) {
+			break;
+		}
+		Hint = nCluster + Length;
+		*pHint = Hint;
+	}
+	RelError = FF_ReleaseFatBuffer(pIoman, &FatBuf);
+	if(!FF_isERR(Error)) {
+		Error = RelError;
+	}
+
+	return Error;
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Allocates up to nClusters clusters, in as few runs of consecutive clusters as possible.
+ *
+ *	The allocation continues just after Tail if that cluster is free, which keeps a file
+ *	contiguous, and Tail is linked to the first run. Otherwise the first run long enough for the rest of the
+ *	request is taken, searching on from LastFreeCluster, or the longest run if there is none.
+ *	LastFreeCluster then moves past the allocation, so concurrent writers don't interleave.
+ *
+ *	Without FF_FREE_BITMAP the clusters are found one by one, and only linked to Tail.
+ *
+ *	@param	pIoman		IOMAN object.
+ *	@param	nClusters	Number of clusters wanted.
+ *	@param	Tail		Last cluster of the chain to extend, 0 to start a new chain.
+ *	@param	pExtent		Receives the runs, linked into a chain. Fewer clusters than asked for are returned
+ *						when the runs run out (FF_EXTENT_MAX_RUNS), or the disk fills up.
+ *						On an error it still holds the runs that were linked before it.
+ *
+ *	@return	FF_ERR_NONE if any clusters were allocated, or FF_ERR_FAT_NO_FREE_CLUSTERS.
+ *
+ *	@pre	The FAT must be locked with FF_lockFAT(). Allocated clusters are not taken off the
+ *	@pre	FreeClusterCount, the caller does that with FF_DecreaseFreeClusters().
+ **/
+FF_ERROR FF_AllocateExtent(FF_IOMAN *pIoman, FF_T_UINT32 nClusters, FF_T_UINT32 Tail, FF_EXTENT *pExtent) {
+#ifdef FF_FREE_BITMAP
+	FF_PARTITION	*pPart = pIoman->pPartition;
+#endif
+	FF_FatBuffers	FatBuf;
+	FF_T_UINT32		nCluster;
+	FF_ERROR		Error = FF_ERR_NONE, RelError;
+
+	pExtent->Count		= 0;
+	pExtent->Clusters	= 0;
+
+#ifdef FF_FREE_BITMAP
+	if(!pPart->pFreeBitmap) {
+		Error = FF_BuildFreeBitmap(pIoman);
+		if(FF_isERR(Error)) {
+			return Error;
+		}
+	}
+	if(pPart->pFreeBitmap) {
+		Error = FF_AllocateRuns(pIoman, 2, FF_BITMAP_CLUSTERS(pPart), &pPart->LastFreeCluster, nClusters, Tail, pExtent);
+	} else
+#endif
+	{
+		while(pExtent->Clusters < nClusters) {
+			nCluster = FF_FindFreeCluster(pIoman, &Error);
+			if(FF_isERR(Error) || !nCluster) {
+				if(FF_GETERROR(Error) == FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE) {
+					Error = FF_ERR_NONE;	// The disk is full.
+				}
+				break;
+			}
+			if(pExtent->Count == FF_EXTENT_MAX_RUNS
+			&& nCluster != pExtent->Runs[pExtent->Count - 1].Start + pExtent->Runs[pExtent->Count - 1].Length) {
+				break;
+			}
+			// FF_FindFreeCluster() reads the FAT, so the buffers can't be kept between clusters.
+			FF_InitFatBuffer(&FatBuf, FF_MODE_WRITE);
+			Error = FF_ClaimRun(pIoman, pExtent, Tail, nCluster, 1, &FatBuf);
+			RelError = FF_ReleaseFatBuffer(pIoman, &FatBuf);
+			if(!FF_isERR(Error)) {
+				Error = RelError;
+			}
+			if(FF_isERR(Error)) {
+				break;
+			}
+		}
+	}
+
+	if(!FF_isERR(Error) && !pExtent->Clusters && nClusters) {
+		Error = FF_ERR_FAT_NO_FREE_CLUSTERS | FF_ALLOCATEEXTENT;
+	}
+
+	return Error;
+}
+
 /**
  * @private
  * @brief	Create's a Cluster Chain
@@ -778,16 +2128,88 @@ FF_T_UINT32 FF_CreateClusterChain(FF_IOMAN *pIoman, FF_ERROR *pError) {
 	return iStartCluster;
 }
 
+#if FF_ALLOC_GROUPS > 1
+/**
+ *	@private
+ *	@brief	Allocates like FF_AllocateExtent(), but only from the clusters of allocation group Group.
+ *
+ *	The search starts at the group's own hint, so writers bound to different groups each stay contiguous.
+ *
+ *	@return	FF_ERR_FAT_NO_FREE_CLUSTERS when the group is full, the caller then allocates from the whole
+ *			volume with FF_AllocateExtent().
+ *
+ *	@pre	The group, and the group of Tail, must be locked with FF_lockAllocGroup().
+ **/
+FF_ERROR FF_AllocateGroupExtent(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_T_UINT32 nClusters, FF_T_UINT32 Tail, FF_EXTENT *pExtent) {
+	FF_ERROR		Error = FF_ERR_NONE;
+#ifdef FF_FREE_BITMAP
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_T_UINT32		Begin = Group * pPart->AllocGroupSize;
+	FF_T_UINT32		End = (Group + 1 < pPart->nAllocGroups) ? Begin + pPart->AllocGroupSize : FF_BITMAP_CLUSTERS(pPart);
+#endif
+
+	pExtent->Count		= 0;
+	pExtent->Clusters	= 0;
+
+#ifdef FF_FREE_BITMAP
+	Error = FF_AllocateRuns(pIoman, (Begin < 2) ? 2 : Begin, End, &pPart->AllocGroupHint[Group], nClusters, Tail, pExtent);
+#endif
+
+	if(!FF_isERR(Error) && !pExtent->Clusters && nClusters) {
+		Error = FF_ERR_FAT_NO_FREE_CLUSTERS | FF_ALLOCATEGROUPEXTENT;
+	}
+
+	return Error;
+}
+
+/**
+ *	@private
+ *	@brief	Creates a cluster chain in allocation group Group, or anywhere if the group is full.
+ *	@return > 0 New created cluster
+ *	@return = 0 See pError
+ **/
+FF_T_UINT32 FF_CreateGroupChain(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_ERROR *pError) {
+	FF_EXTENT	Extent;
+	FF_T_UINT32	Locked;
+
+	if(!FF_AllocGroupsUsable(pIoman->pPartition)) {
+		return FF_CreateClusterChain(pIoman, pError);
+	}
+
+	Locked = FF_lockAllocGroup(pIoman, Group, 0);
+	{
+		*pError = FF_AllocateGroupExtent(pIoman, Group, 1, 0, &Extent);
+	}
+	FF_unlockAllocGroup(pIoman, Locked);
+
+	if(FF_GETERROR(*pError) == FF_ERR_FAT_NO_FREE_CLUSTERS) {
+		return FF_CreateClusterChain(pIoman, pError);
+	}
+	if(FF_isERR(*pError)) {
+		return 0;
+	}
+
+	*pError = FF_DecreaseFreeClusters(pIoman, 1);
+	if(FF_isERR(*pError)) {
+		return 0;
+	}
+
+	return Extent.Runs[0].Start;
+}
+#endif
+
 FF_T_UINT32 FF_GetChainLength(FF_IOMAN *pIoman, FF_T_UINT32 pa_nStartCluster, FF_T_UINT32 *piEndOfChain, FF_ERROR *pError) {
 	FF_T_UINT32 iLength = 0;
+	FF_T_UINT32 iLastCluster = pa_nStartCluster;
 	FF_FatBuffers FatBuf;
 	FF_InitFatBuffer (&FatBuf, FF_MODE_READ);
 
 	*pError = FF_ERR_NONE;
 
-	FF_lockFAT(pIoman);
+	FF_lockFATRead(pIoman);
 	{
 		while(!FF_isEndOfChain(pIoman, pa_nStartCluster)) {
+			iLastCluster = pa_nStartCluster;
 			pa_nStartCluster = FF_getFatEntry(pIoman, pa_nStartCluster, pError, &FatBuf);
 			if(FF_isERR(*pError)) {
 				iLength = 0;
@@ -796,11 +2218,11 @@ FF_T_UINT32 FF_GetChainLength(FF_IOMAN *pIoman, FF_T_UINT32 pa_nStartCluster, FF
 			iLength++;
 		}
 		if(piEndOfChain) {
-			*piEndOfChain = pa_nStartCluster;
+			*piEndOfChain = iLastCluster;	// The last cluster, not the End-of-Chain mark it holds.
 		}
 	}
 	*pError = FF_ReleaseFatBuffer(pIoman, &FatBuf);
-	FF_unlockFAT(pIoman);
+	FF_unlockFATRead(pIoman);
 	return iLength;
 }
 
@@ -880,7 +2302,7 @@ FF_T_UINT32 FF_CountFreeClustersOLD(FF_IOMAN *pIoman, FF_ERROR *pError) {
 
 	*pError = FF_ERR_NONE;
 
-	for(i = 0; i < TotalClusters; i++) {
+	for(i = 2; i < TotalClusters + 2; i++) {	// Cluster numbers start at 2.
 		FatEntry = FF_getFatEntry(pIoman, i, pError, NULL);
 		if(FF_isERR(*pError)) {
 			return 0;
@@ -896,26 +2318,29 @@ FF_T_UINT32 FF_CountFreeClustersOLD(FF_IOMAN *pIoman, FF_ERROR *pError) {
 
 
 FF_T_UINT32 FF_CountFreeClusters(FF_IOMAN *pIoman, FF_ERROR *pError) {
-	FF_BUFFER	*pBuffer;
-	FF_T_UINT32	i, x;
-	FF_T_UINT32	FatEntry;
-	FF_T_UINT32	EntriesPerSector;
 	FF_T_UINT32	FreeClusters = 0;
-	FF_T_UINT32	ClusterNum = 0;
-	FF_ERROR Error;
 
 #ifdef FF_FSINFO_TRUSTED
+	FF_BUFFER	*pBuffer;
+	FF_ERROR	Error;
 	FF_T_BOOL bInfoCounted = FF_FALSE;
 #endif
 
 	*pError = FF_ERR_NONE;
 
+#ifdef FF_FREE_BITMAP
+	if(pIoman->pPartition->pFreeBitmap) {
+		return FF_CountFreeBitmap(pIoman->pPartition);
+	}
+#endif
+
 #ifdef FF_FAT12_SUPPORT
-	if(pIoman->pPartition->Type == FF_T_FAT12) {	// FAT12 tables are too small to optimise, and would make it very complicated!
+	if(pIoman->pPartition->Type == FF_T_FAT12 && !FF_FAT12_DECODED(pIoman->pPartition)) {
 		FreeClusters = FF_CountFreeClustersOLD(pIoman, pError);
 		if(FF_isERR(*pError)) {
 			return 0;
 		}
+		return FreeClusters;	// FF_ScanFAT() only reads 16 and 32-bit entries, (or the decoded FAT12 table).
 	}
 #endif
 
@@ -944,47 +2369,12 @@ FF_T_UINT32 FF_CountFreeClusters(FF_IOMAN *pIoman, FF_ERROR *pError) {
 	}
 #endif
 
-	if(pIoman->pPartition->Type == FF_T_FAT32) {
-		EntriesPerSector = pIoman->BlkSize / 4;
-	} else {
-		EntriesPerSector = pIoman->BlkSize / 2;
-	}
-
 	if (!pIoman->pPartition->BlkSize)
 		return 0;  // better double-check than...
 
-	for(i = 0; i < pIoman->pPartition->SectorsPerFAT; i++) {
-		pBuffer = FF_GetBuffer(pIoman, pIoman->pPartition->FatBeginLBA + i, FF_MODE_READ);
-		{
-			if(!pBuffer) {
-				*pError = FF_ERR_DEVICE_DRIVER_FAILED | FF_COUNTFREECLUSTERS;
-				return 0;
-			}
-			for(x = 0; x < EntriesPerSector; x++) {
-				if(pIoman->pPartition->Type == FF_T_FAT32) {
-					FatEntry = FF_getLong(pBuffer->pBuffer, x * 4) & 0x0fffffff; // Clearing the top 4 bits.
-				} else {
-					FatEntry = (FF_T_UINT32) FF_getShort(pBuffer->pBuffer, x * 2);
-				}
-				if (!FatEntry) {
-					FreeClusters++;
-				}
-				if(ClusterNum > pIoman->pPartition->NumClusters) {	// FAT table might not be cluster aligned
-					break;											// Stop counting if thats the case.
-				}
-				ClusterNum++;
-			}
-		}
-		Error = FF_ReleaseBuffer(pIoman, pBuffer);
-		if(FF_isERR(Error)) {
-			if(pError) {
-				*pError = Error;
-			}
-			return 0;
-		}
-		if(ClusterNum > pIoman->pPartition->NumClusters) {
-			break;													// Break out of 2nd loop too ^^
-		}
+	FreeClusters = FF_ScanFAT(pIoman, NULL, pError);
+	if(FF_isERR(*pError)) {
+		return 0;
 	}
 	// FreeClusters is -2 because the first 2 fat entries in the table are reserved.
 	return FreeClusters <= pIoman->pPartition->NumClusters ? FreeClusters : pIoman->pPartition->NumClusters;
@@ -56,18 +56,6 @@
 
 //---------- PROTOTYPES
 
-// HT statistics Will be taken away after testing:
-
-struct SFatStat {
-	unsigned initCount;
-	unsigned clearCount;
-	unsigned getCount[2];  // 0 = read, 1 = write
-	unsigned reuseCount[2];  // 0 = read, 1 = write
-	unsigned missCount[2];  // 0 = read, 1 = write
-};
-
-extern struct SFatStat fatStat;
-
 #if defined(FF_WRITE_BOTH_FATS) //  || defined(FF_FAT12_SUPPORT)
 #define BUF_STORE_COUNT 2
 #else
@@ -79,6 +67,24 @@ typedef struct _FatBuffers {
 	FF_T_UINT8 Mode; // FF_MODE_READ or WRITE
 } FF_FatBuffers;
 
+#define FF_EXTENT_MAX_RUNS	8	///< Most runs that FF_AllocateExtent() returns at once.
+
+/**
+ *	@private
+ *	@brief	Clusters allocated by FF_AllocateExtent(), as runs of consecutive clusters.
+ *
+ *	The runs are already linked into a single chain, in order, ending with an End-of-Chain mark,
+ *	and linked to the Tail they were allocated for.
+ **/
+typedef struct {
+	struct {
+		FF_T_UINT32	Start;		///< First cluster of the run.
+		FF_T_UINT32	Length;		///< Number of consecutive clusters in the run.
+	} Runs[FF_EXTENT_MAX_RUNS];
+	FF_T_UINT16	Count;			///< Number of runs.
+	FF_T_UINT32	Clusters;		///< Clusters in all the runs.
+} FF_EXTENT;
+
 		FF_T_UINT32 FF_getRealLBA			(FF_IOMAN *pIoman, FF_T_UINT32 LBA);
 		FF_T_UINT32 FF_Cluster2LBA			(FF_IOMAN *pIoman, FF_T_UINT32 Cluster);
 		FF_T_UINT32 FF_LBA2Cluster			(FF_IOMAN *pIoman, FF_T_UINT32 Address);
@@ -90,6 +96,7 @@ typedef struct _FatBuffers {
 		FF_ERROR	FF_UnlinkClusterChain	(FF_IOMAN *pIoman, FF_T_UINT32 StartCluster, FF_T_BOOL bTruncate);
 		FF_T_UINT32	FF_TraverseFAT			(FF_IOMAN *pIoman, FF_T_UINT32 Start, FF_T_UINT32 Count, FF_ERROR *pError);
 		FF_T_UINT32 FF_CreateClusterChain	(FF_IOMAN *pIoman, FF_ERROR *pError);
+		FF_ERROR	FF_AllocateExtent		(FF_IOMAN *pIoman, FF_T_UINT32 nClusters, FF_T_UINT32 Tail, FF_EXTENT *pExtent);
 		FF_T_UINT32 FF_GetChainLength		(FF_IOMAN *pIoman, FF_T_UINT32 pa_nStartCluster, FF_T_UINT32 *piEndOfChain, FF_ERROR *pError);
 		FF_T_UINT32 FF_FindEndOfChain		(FF_IOMAN *pIoman, FF_T_UINT32 Start, FF_ERROR *pError);
 		FF_ERROR	FF_ClearCluster			(FF_IOMAN *pIoman, FF_T_UINT32 nCluster);
@@ -100,6 +107,34 @@ typedef struct _FatBuffers {
 #endif
 		FF_T_UINT32 FF_CountFreeClusters	(FF_IOMAN *pIoman, FF_ERROR *pError);	// WARNING: If this protoype changes, it must be updated in ff_ioman.c also!
 		void		FF_lockFAT				(FF_IOMAN *pIoman);
+		void		FF_lockFATRead			(FF_IOMAN *pIoman);
+		void		FF_unlockFATRead		(FF_IOMAN *pIoman);
+#ifdef FF_FREE_BITMAP
+		void		FF_DestroyFreeBitmap	(FF_IOMAN *pIoman);
+#endif
+#ifdef FF_FAT12_DECODE
+		FF_ERROR	FF_LoadFat12Table		(FF_IOMAN *pIoman);
+		FF_ERROR	FF_FlushFat12Table		(FF_IOMAN *pIoman);
+		void		FF_DestroyFat12Table	(FF_IOMAN *pIoman);
+#endif
+#ifdef FF_FAT_MIRROR
+		FF_ERROR	FF_LoadFatMirror		(FF_IOMAN *pIoman);
+		FF_ERROR	FF_FlushFatMirror		(FF_IOMAN *pIoman);
+		void		FF_DestroyFatMirror		(FF_IOMAN *pIoman);
+#endif
+#ifdef FF_MIRROR_FATS_UMOUNT
+		void		FF_CreateFatCopyMap		(FF_IOMAN *pIoman);
+		FF_ERROR	FF_SyncFatCopies		(FF_IOMAN *pIoman);
+		void		FF_DestroyFatCopyMap	(FF_IOMAN *pIoman);
+#endif
+#if FF_ALLOC_GROUPS > 1
+		void		FF_InitAllocGroups		(FF_IOMAN *pIoman);
+		FF_T_UINT16	FF_BindAllocGroup		(FF_IOMAN *pIoman, FF_T_UINT32 ObjectCluster);
+		FF_T_UINT32	FF_lockAllocGroup		(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_T_UINT32 Tail);
+		void		FF_unlockAllocGroup		(FF_IOMAN *pIoman, FF_T_UINT32 Locked);
+		FF_ERROR	FF_AllocateGroupExtent	(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_T_UINT32 nClusters, FF_T_UINT32 Tail, FF_EXTENT *pExtent);
+		FF_T_UINT32 FF_CreateGroupChain		(FF_IOMAN *pIoman, FF_T_UINT16 Group, FF_ERROR *pError);
+#endif
 		void		FF_unlockFAT			(FF_IOMAN *pIoman);
 
 FF_T_UINT32 FF_FindFreeCluster(FF_IOMAN *pIoman, FF_ERROR *pError);
@@ -116,7 +151,6 @@ FF_INLINE void FF_InitFatBuffer (FF_FatBuffers *pBuffer, unsigned aMode)
 #error Please check this code, maybe it is time to use memset
 #endif
 	pBuffer->Mode = aMode; // FF_MODE_READ/WRITE
-	fatStat.initCount++;
 }
 
 #endif
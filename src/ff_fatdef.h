@@ -59,6 +59,8 @@
 
 #define FF_FAT_16_VOL_LABEL			0x02B
 #define FF_FAT_32_VOL_LABEL			0x047
+#define FF_FAT_16_VOL_SERIAL		0x027
+#define FF_FAT_32_VOL_SERIAL		0x043
 
 #define FF_FAT_PTBL					0x1BE
 #define FF_FAT_PTBL_LBA				0x008
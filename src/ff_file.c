@@ -332,6 +332,12 @@ FF_FILE *FF_Open(FF_IOMAN *pIoman, const FF_T_INT8 *path, FF_T_UINT8 Mode, FF_ER
 		pFile->FilePointer = 0;
 	}
 
+#if FF_ALLOC_GROUPS > 1
+	if((pFile->Mode & FF_MODE_WRITE)) {
+		pFile->AllocGroup = FF_BindAllocGroup(pIoman, pFile->ObjectCluster);
+	}
+#endif
+
 	/*
 		Add pFile onto the end of our linked list of FF_FILE objects.
 	*/
@@ -864,6 +870,188 @@ static FF_T_UINT32 FF_GetSequentialClusters(FF_IOMAN *pIoman, FF_T_UINT32 StartC
 	return i;
 }
 
+#ifdef FF_FILE_EXTENT_MAP
+/**
+ *	@private
+ *	@brief	Appends Length clusters from Cluster to the extent map of a file.
+ *
+ *	@return	FF_FALSE if the map is full, or there is no memory to grow it.
+ **/
+static FF_T_BOOL FF_MapAppend(FF_FILE *pFile, FF_T_UINT32 Cluster, FF_T_UINT32 Length) {
+	FF_FILE_RUN	*pRuns;
+	FF_T_UINT32	nRunsMax;
+
+	if(pFile->nRuns) {
+		pRuns = &pFile->pRuns[pFile->nRuns - 1];
+		if(pRuns->Cluster + pRuns->Length == Cluster) {
+			pRuns->Length += Length;
+			pFile->nMappedClusters += Length;
+			return FF_TRUE;
+		}
+	}
+
+	if(pFile->nRuns == pFile->nRunsMax) {
+		if(pFile->nRunsMax == FF_FILE_EXTENT_MAP_RUNS) {
+			return FF_FALSE;
+		}
+		nRunsMax = pFile->nRunsMax ? pFile->nRunsMax * 2 : 8;
+		if(nRunsMax > FF_FILE_EXTENT_MAP_RUNS) {
+			nRunsMax = FF_FILE_EXTENT_MAP_RUNS;
+		}
+		pRuns = (FF_FILE_RUN *) FF_MALLOC(nRunsMax * sizeof(FF_FILE_RUN));
+		if(!pRuns) {
+			return FF_FALSE;
+		}
+		if(pFile->pRuns) {
+			memcpy(pRuns, pFile->pRuns, pFile->nRuns * sizeof(FF_FILE_RUN));
+			FF_FREE(pFile->pRuns);
+		}
+		pFile->pRuns	= pRuns;
+		pFile->nRunsMax	= nRunsMax;
+	}
+
+	pRuns = &pFile->pRuns[pFile->nRuns++];
+	pRuns->FileCluster	= pFile->nMappedClusters;
+	pRuns->Cluster		= Cluster;
+	pRuns->Length		= Length;
+	pFile->nMappedClusters += Length;
+
+	return FF_TRUE;
+}
+
+/**
+ *	@private
+ *	@brief	Follows the chain on from the end of the extent map, until the map covers cluster nCluster of the file.
+ *
+ *	Stops early at the end of the chain, or when the map can't grow.
+ **/
+static FF_ERROR FF_MapChain(FF_FILE *pFile, FF_T_UINT32 nCluster) {
+	FF_IOMAN		*pIoman = pFile->pIoman;
+	FF_FILE_RUN		*pLast;
+	FF_T_UINT32		Cluster;
+	FF_ERROR		Error = FF_ERR_NONE, RelError;
+	FF_FatBuffers	FatBuf;
+
+	if(!pFile->nMappedClusters) {
+		if(!pFile->ObjectCluster || !FF_MapAppend(pFile, pFile->ObjectCluster, 1)) {
+			return FF_ERR_NONE;
+		}
+	}
+
+	FF_InitFatBuffer(&FatBuf, FF_MODE_READ);
+	while(!pFile->bMapComplete && pFile->nMappedClusters <= nCluster) {
+		pLast = &pFile->pRuns[pFile->nRuns - 1];
+		Cluster = FF_getFatEntry(pIoman, pLast->Cluster + pLast->Length - 1, &Error, &FatBuf);
+		if(FF_isERR(Error)) {
+			break;
+		}
+		if(FF_isEndOfChain(pIoman, Cluster) || Cluster < 2) {
+			pFile->bMapComplete = FF_TRUE;
+			break;
+		}
+		if(!FF_MapAppend(pFile, Cluster, 1)) {
+			break;
+		}
+	}
+	RelError = FF_ReleaseFatBuffer(pIoman, &FatBuf);
+	if(!FF_isERR(Error)) {
+		Error = RelError;
+	}
+
+	return Error;
+}
+
+/**
+ *	@private
+ *	@brief	Finds the address of cluster nCluster of a file, with a binary search of its extent map.
+ *
+ *	@param	Limit		Most clusters to count in *pLength, at least 1.
+ *	@param	pLength		Receives the number of consecutive clusters from nCluster on, (NULL if not needed).
+ *
+ *	@return	The address. Past the end of the chain this is its last cluster, as with FF_TraverseFAT().
+ **/
+static FF_T_UINT32 FF_MapCluster(FF_FILE *pFile, FF_T_UINT32 nCluster, FF_T_UINT32 Limit, FF_T_UINT32 *pLength, FF_ERROR *pError) {
+	FF_FILE_RUN	*pRun;
+	FF_T_UINT32	Low, High, Mid, Cluster;
+
+	*pError = FF_MapChain(pFile, pLength ? nCluster + Limit - 1 : nCluster);
+	if(FF_isERR(*pError)) {
+		return 0;
+	}
+
+	if(nCluster < pFile->nMappedClusters) {
+		Low		= 0;
+		High	= pFile->nRuns - 1;
+		while(Low < High) {
+			Mid = (Low + High + 1) / 2;
+			if(pFile->pRuns[Mid].FileCluster <= nCluster) {
+				Low = Mid;
+			} else {
+				High = Mid - 1;
+			}
+		}
+		pRun = &pFile->pRuns[Low];
+		if(pLength) {
+			*pLength = pRun->FileCluster + pRun->Length - nCluster;
+			if(*pLength > Limit) {
+				*pLength = Limit;
+			}
+		}
+		return pRun->Cluster + (nCluster - pRun->FileCluster);
+	}
+
+	if(pFile->bMapComplete) {
+		pRun = &pFile->pRuns[pFile->nRuns - 1];
+		if(pLength) {
+			*pLength = 1;
+		}
+		return pRun->Cluster + pRun->Length - 1;
+	}
+
+	// The map could not grow this far, the rest of the chain is followed from its last cluster.
+	if(pFile->nMappedClusters) {
+		pRun = &pFile->pRuns[pFile->nRuns - 1];
+		Cluster = FF_TraverseFAT(pFile->pIoman, pRun->Cluster + pRun->Length - 1, nCluster - (pFile->nMappedClusters - 1), pError);
+	} else {
+		Cluster = FF_TraverseFAT(pFile->pIoman, pFile->ObjectCluster, nCluster, pError);
+	}
+	if(pLength && !FF_isERR(*pError)) {
+		*pLength = 1;
+		if(Limit > 1) {
+			*pLength += FF_GetSequentialClusters(pFile->pIoman, Cluster, Limit - 1, pError);
+		}
+	}
+
+	return Cluster;
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Counts the clusters after the current cluster of a file that follow on from it, up to Limit.
+ **/
+static FF_T_UINT32 FF_FileSequentialClusters(FF_FILE *pFile, FF_T_UINT32 Limit, FF_ERROR *pError) {
+#ifdef FF_FILE_EXTENT_MAP
+	FF_T_UINT32 Length = 1;
+	FF_MapCluster(pFile, pFile->CurrentCluster, Limit + 1, &Length, pError);
+	return Length - 1;
+#else
+	return FF_GetSequentialClusters(pFile->pIoman, pFile->AddrCurrentCluster, Limit, pError);
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Finds the address of the cluster Count clusters after the current cluster of a file.
+ **/
+static FF_T_UINT32 FF_FileTraverse(FF_FILE *pFile, FF_T_UINT32 Count, FF_ERROR *pError) {
+#ifdef FF_FILE_EXTENT_MAP
+	return FF_MapCluster(pFile, pFile->CurrentCluster + Count, 1, NULL, pError);
+#else
+	return FF_TraverseFAT(pFile->pIoman, pFile->AddrCurrentCluster, Count, pError);
+#endif
+}
+
 static FF_ERROR FF_ReadClusters(FF_FILE *pFile, FF_T_UINT32 Count, FF_T_UINT8 *buffer) {
 	FF_T_UINT32 ulSectors;
 	FF_T_UINT32 SequentialClusters = 0;
@@ -873,7 +1061,7 @@ static FF_ERROR FF_ReadClusters(FF_FILE *pFile, FF_T_UINT32 Count, FF_T_UINT8 *b
 
 	while(Count != 0) {
 		if((Count - 1) > 0) {
-			SequentialClusters = FF_GetSequentialClusters(pFile->pIoman, pFile->AddrCurrentCluster, (Count - 1), &Error);
+			SequentialClusters = FF_FileSequentialClusters(pFile, (Count - 1), &Error);
 			if(FF_isERR(Error)) {
 				return Error;
 			}
@@ -888,7 +1076,7 @@ static FF_ERROR FF_ReadClusters(FF_FILE *pFile, FF_T_UINT32 Count, FF_T_UINT8 *b
 		}
 
 		Count -= (SequentialClusters + 1);
-		pFile->AddrCurrentCluster = FF_TraverseFAT(pFile->pIoman, pFile->AddrCurrentCluster, (SequentialClusters + 1), &Error);
+		pFile->AddrCurrentCluster = FF_FileTraverse(pFile, (SequentialClusters + 1), &Error);
 		if(FF_isERR(Error)) {
 			return Error;
 		}
@@ -906,11 +1094,15 @@ static FF_ERROR FF_ExtendFile(FF_FILE *pFile, FF_T_UINT32 Size) {
 	FF_T_UINT32 nBytesPerCluster = pIoman->pPartition->BlkSize * pIoman->pPartition->SectorsPerCluster;
 	FF_T_UINT32 nTotalClustersNeeded = (Size + nBytesPerCluster-1) / nBytesPerCluster;
 	FF_T_UINT32 nClusterToExtend; 
-	FF_T_UINT32 CurrentCluster, NextCluster;
-	FF_T_UINT32	i;
+	FF_T_UINT32 CurrentCluster;
+	FF_T_UINT32	FirstCluster = 0;
+	FF_T_UINT32	i, j;
 	FF_DIRENT	OriginalEntry;
 	FF_ERROR	Error = FF_ERR_NONE;
-	FF_FatBuffers FatBuf;
+	FF_EXTENT	Extent;
+#if FF_ALLOC_GROUPS > 1
+	FF_T_UINT32	Locked;
+#endif
 
 	if((pFile->Mode & FF_MODE_WRITE) != FF_MODE_WRITE) {
 		return (FF_ERR_FILE_NOT_OPENED_IN_WRITE_MODE | FF_EXTENDFILE);
@@ -918,7 +1110,11 @@ static FF_ERROR FF_ExtendFile(FF_FILE *pFile, FF_T_UINT32 Size) {
 
 	if(pFile->Filesize == 0 && pFile->ObjectCluster == 0) {	// No Allocated clusters.
 		// Create a Cluster chain!
+#if FF_ALLOC_GROUPS > 1
+		pFile->AddrCurrentCluster = FF_CreateGroupChain(pFile->pIoman, pFile->AllocGroup, &Error);
+#else
 		pFile->AddrCurrentCluster = FF_CreateClusterChain(pFile->pIoman, &Error);
+#endif
 
 		if(FF_isERR(Error)) {
 			return Error;
@@ -939,6 +1135,9 @@ static FF_ERROR FF_ExtendFile(FF_FILE *pFile, FF_T_UINT32 Size) {
 		pFile->iChainLength = 1;
 		pFile->CurrentCluster = 0;
 		pFile->iEndOfChain = pFile->AddrCurrentCluster;
+#ifdef FF_FILE_EXTENT_MAP
+		pFile->bMapComplete = FF_MapAppend(pFile, pFile->ObjectCluster, 1);
+#endif
 	}
 
 	if(pFile->iChainLength == 0) {	// First extension requiring the chain length, 
@@ -952,61 +1151,82 @@ static FF_ERROR FF_ExtendFile(FF_FILE *pFile, FF_T_UINT32 Size) {
 
 	if(nTotalClustersNeeded > pFile->iChainLength) {
 
-		NextCluster = pFile->AddrCurrentCluster;
+#if FF_ALLOC_GROUPS > 1
+		Locked = FF_lockAllocGroup(pIoman, pFile->AllocGroup, pFile->iEndOfChain);	// (Or the whole FAT, when Locked is 0).
+#else
 		FF_lockFAT(pIoman);
+#endif
 		{
 			// HT This "<=" issue is now solved by asing for 1 extra byte
 			// Thus not always asking for 1 extra cluster
-			for(i = 0; i < nClusterToExtend; i++) {
-				CurrentCluster = FF_FindEndOfChain(pIoman, NextCluster, &Error);
-				if(FF_isERR(Error)) {
-					break;
+			// The chain is extended from its cached end, each extent linking on to the previous one,
+			// so a large write passes over the FAT only once.
+			i = 0;
+			CurrentCluster = pFile->iEndOfChain;
+			while(i < nClusterToExtend) {
+#if FF_ALLOC_GROUPS > 1
+				if(Locked) {
+					Error = FF_AllocateGroupExtent(pIoman, pFile->AllocGroup, nClusterToExtend - i, CurrentCluster, &Extent);
+					if(FF_GETERROR(Error) == FF_ERR_FAT_NO_FREE_CLUSTERS) {
+						// The group is full, the rest comes from anywhere, and the file moves to the group it ends up in.
+						FF_unlockAllocGroup(pIoman, Locked);
+						FF_lockFAT(pIoman);
+						Locked = 0;
+						continue;
+					}
+				} else {
+					Error = FF_AllocateExtent(pIoman, nClusterToExtend - i, CurrentCluster, &Extent);
 				}
-				NextCluster = FF_FindFreeCluster(pIoman, &Error);
-				if(!FF_isERR(Error) && !NextCluster) {
-					Error = FF_ERR_FAT_NO_FREE_CLUSTERS | FF_EXTENDFILE;
+#else
+				Error = FF_AllocateExtent(pIoman, nClusterToExtend - i, CurrentCluster, &Extent);
+#endif
+				for(j = 0; j < Extent.Count; j++) {
+#ifdef FF_FILE_EXTENT_MAP
+					if(pFile->bMapComplete) {
+						pFile->bMapComplete = FF_MapAppend(pFile, Extent.Runs[j].Start, Extent.Runs[j].Length);
+					}
+#endif
+					if(!i) {
+						FirstCluster = Extent.Runs[j].Start;
+					}
+					i += Extent.Runs[j].Length;
+					CurrentCluster = Extent.Runs[j].Start + Extent.Runs[j].Length - 1;
 				}
 				if(FF_isERR(Error)) {
 					break;
 				}
-				// Can not use this buffer earlier because of FF_FindEndOfChain/FF_FindFreeCluster
-				FF_InitFatBuffer (&FatBuf, FF_MODE_WRITE);
-				Error = FF_putFatEntry(pIoman, CurrentCluster, NextCluster, &FatBuf);
-				if(!FF_isERR(Error)) {
-					Error = FF_putFatEntry(pIoman, NextCluster, 0xFFFFFFFF, &FatBuf);
-				}
-				Error = FF_ReleaseFatBuffer(pIoman, &FatBuf);
-				if(FF_isERR(Error))
-					break;
-			}
-			if(FF_isERR(Error)) {
-				FF_unlockFAT(pIoman);
-				FF_DecreaseFreeClusters(pIoman, i);
-				return Error;
-			}
-
-			pFile->iEndOfChain = FF_FindEndOfChain(pIoman, NextCluster, &Error);
-			if(FF_isERR(Error)) {
-				FF_unlockFAT(pIoman);
-				FF_DecreaseFreeClusters(pIoman, i);
-				return Error;
 			}
+			// Whatever was linked stays part of the file, even on an error.
+			pFile->iEndOfChain = CurrentCluster;
 		}
-		FF_unlockFAT(pIoman);
-		pFile->iChainLength += i;
-		Error = FF_DecreaseFreeClusters(pIoman, i);	// Keep Tab of Numbers for fast FreeSize()
-		if(FF_isERR(Error)) {
-			return Error;
+#if FF_ALLOC_GROUPS > 1
+		if(!Locked && CurrentCluster) {
+			pFile->AllocGroup = FF_BindAllocGroup(pIoman, CurrentCluster);
 		}
+		FF_unlockAllocGroup(pIoman, Locked);
+#else
+		FF_unlockFAT(pIoman);
+#endif
 
 		/**
 		 *	We must ensure that the AddrCurrentCluster is not out-of-sync with the CurrentCluster number.
 		 *	This could have occured in append mode, where the file was opened with a filesize % clustersize == 0
 		 *	because of a seek, where the AddrCurrentCluster was not updated after extending. This caused the data to
 		 *	be written to the previous cluster(s).
+		 *	The CurrentCluster is then the first one added, however many clusters were added.
 		 **/
-		if(pFile->CurrentCluster == pFile->iChainLength-1 && pFile->AddrCurrentCluster != pFile->iEndOfChain) {
-			pFile->AddrCurrentCluster = pFile->iEndOfChain;
+		if(i && pFile->CurrentCluster == pFile->iChainLength) {
+			pFile->AddrCurrentCluster = FirstCluster;
+		}
+
+		pFile->iChainLength += i;
+		if(FF_isERR(Error)) {
+			FF_DecreaseFreeClusters(pIoman, i);
+			return Error;
+		}
+		Error = FF_DecreaseFreeClusters(pIoman, i);	// Keep Tab of Numbers for fast FreeSize()
+		if(FF_isERR(Error)) {
+			return Error;
 		}
 
 		Error = FF_FlushCache(pIoman);
@@ -1027,7 +1247,7 @@ static FF_ERROR FF_WriteClusters(FF_FILE *pFile, FF_T_UINT32 Count, FF_T_UINT8 *
 
 	while(Count != 0) {
 		if((Count - 1) > 0) {
-			SequentialClusters = FF_GetSequentialClusters(pFile->pIoman, pFile->AddrCurrentCluster, (Count - 1), &Error);
+			SequentialClusters = FF_FileSequentialClusters(pFile, (Count - 1), &Error);
 			if(FF_isERR(Error)) {
 				return Error;
 			}
@@ -1043,7 +1263,7 @@ static FF_ERROR FF_WriteClusters(FF_FILE *pFile, FF_T_UINT32 Count, FF_T_UINT8 *
 		}
 
 		Count -= (SequentialClusters + 1);
-		pFile->AddrCurrentCluster = FF_TraverseFAT(pFile->pIoman, pFile->AddrCurrentCluster, (SequentialClusters + 1), &Error);
+		pFile->AddrCurrentCluster = FF_FileTraverse(pFile, (SequentialClusters + 1), &Error);
 		if(FF_isERR(Error)) {
 			return Error;
 		}
@@ -1099,9 +1319,13 @@ static FF_T_UINT32 FF_SetCluster (FF_FILE *pFile, FF_ERROR  *pError) {
 	*pError = FF_ERR_NONE;
 
 	if(nNewCluster > pFile->CurrentCluster || bTraverse) {
-		pFile->AddrCurrentCluster = FF_TraverseFAT(pIoman, pFile->AddrCurrentCluster, nNewCluster - pFile->CurrentCluster, pError);
+		pFile->AddrCurrentCluster = FF_FileTraverse(pFile, nNewCluster - pFile->CurrentCluster, pError);
 	} else if(nNewCluster < pFile->CurrentCluster) {
+#ifdef FF_FILE_EXTENT_MAP
+		pFile->AddrCurrentCluster = FF_MapCluster(pFile, nNewCluster, 1, NULL, pError);
+#else
 		pFile->AddrCurrentCluster = FF_TraverseFAT(pIoman, pFile->ObjectCluster, nNewCluster, pError);
+#endif
 	} else {
 		// Well positioned
 	}
@@ -2187,6 +2411,11 @@ FF_ERROR FF_Close(FF_FILE *pFile) {
 		FF_ReleaseSemaphore(pFile->pIoman->pSemaphore);
 #ifdef FF_OPTIMISE_UNALIGNED_ACCESS
 		FF_FREE(pFile->pBuf);
+#endif
+#ifdef FF_FILE_EXTENT_MAP
+		if(pFile->pRuns) {
+			FF_FREE(pFile->pRuns);
+		}
 #endif
 		FF_FREE(pFile);  // So at least we have freed the pointer.
 		return FF_ERR_NONE;
@@ -2294,6 +2523,11 @@ skip_truncate:
 	}
 
 	FF_FREE(pFile->pBuf);
+#endif
+#ifdef FF_FILE_EXTENT_MAP
+	if(pFile->pRuns) {
+		FF_FREE(pFile->pRuns);
+	}
 #endif
 	FF_FREE(pFile);
 
@@ -67,6 +67,18 @@
 #define FF_BUFSTATE_WRITTEN				0x02	///< Data was written into pBuf, this must be saved when leaving sector.
 #endif
 
+#ifdef FF_FILE_EXTENT_MAP
+/**
+ *	@private
+ *	@brief	A run of consecutive clusters in a file's cluster chain.
+ **/
+typedef struct {
+	FF_T_UINT32		 FileCluster;		///< Position of the run's first cluster in the chain.
+	FF_T_UINT32		 Cluster;			///< Address of the run's first cluster.
+	FF_T_UINT32		 Length;			///< Number of clusters in the run.
+} FF_FILE_RUN;
+#endif
+
 typedef struct _FF_FILE {
 	FF_IOMAN		*pIoman;			///< Ioman Pointer!
 	FF_T_UINT32		 Filesize;			///< File's Size.
@@ -82,12 +94,23 @@ typedef struct _FF_FILE {
 
 	FF_T_UINT16		 DirEntry;			///< Dirent Entry Number describing this file.
 	FF_T_UINT8		 Mode;				///< Mode that File Was opened in.
+#if FF_ALLOC_GROUPS > 1
+	FF_T_UINT16		 AllocGroup;		///< Allocation group that the file's clusters are taken from.
+#endif
 
 #ifdef FF_OPTIMISE_UNALIGNED_ACCESS
 	FF_T_UINT8		*pBuf;				///< A buffer for providing fast unaligned access.
 	FF_T_UINT8		 ucState;			///< State information about the buffer.
 #endif
 
+#ifdef FF_FILE_EXTENT_MAP
+	FF_FILE_RUN		*pRuns;				///< Runs of the chain walked so far, in chain order.
+	FF_T_UINT32		 nRuns;				///< Number of runs in pRuns.
+	FF_T_UINT32		 nRunsMax;			///< Number of runs pRuns has room for.
+	FF_T_UINT32		 nMappedClusters;	///< Clusters covered by pRuns, from the start of the chain.
+	FF_T_BOOL		 bMapComplete;		///< pRuns covers the whole chain.
+#endif
+
 	struct _FF_FILE *Next;				///< Pointer to the next file object in the linked list.
 } FF_FILE,
 *PFF_FILE;
@@ -59,24 +59,191 @@
 #include "ff_fat.h"
 
 static void FF_IOMAN_InitBufferDescriptors(FF_IOMAN *pIoman);
+static void FF_IOMAN_SetLineSectors(FF_IOMAN *pIoman, FF_T_UINT32 MaxSectors);
+static void FF_IOMAN_PurgeLines(FF_IOMAN *pIoman);
+#ifdef FF_CACHE_FLUSHER
+static void FF_IOMAN_StopFlusher(FF_IOMAN *pIoman);
+#endif
+#ifndef FF_CACHE_REPLACE_SCAN
+static void FF_IOMAN_ListAppend(FF_BUFFER_LIST *pList, FF_BUFFER *pBuffer);
+#endif
+
+#ifdef FF_CACHE_REPLACE_2Q
+#define FF_QUEUE_FREE	0	///< Buffer holds no valid sector.
+#define FF_QUEUE_A1IN	1	///< Buffer is on probation.
+#define FF_QUEUE_AM		2	///< Buffer was re-referenced, it is on the main LRU list.
+#define FF_QUEUE_GHOST	3	///< Descriptor is a ghost, it has no sector memory.
+
+#define FF_IOMAN_DESCRIPTORS(pIoman)	((pIoman)->CacheSize + (pIoman)->GhostCount)	///< Number of buffer descriptors, including ghosts.
+#else
+#define FF_IOMAN_DESCRIPTORS(pIoman)	((pIoman)->CacheSize)							///< Number of buffer descriptors.
+#endif
+
+#define FF_CACHE_MIN_LINES	8	///< Small caches get shorter lines, then fewer shards, until every shard has at least this many lines.
+#define FF_RESIZE_ATTEMPTS	100	///< Times FF_ResizeCache() looks for the cache without held buffers, before giving up.
+
+#define FF_IOMAN_LINES(pIoman)	((pIoman)->CacheSize / (pIoman)->LineSectors)	///< Number of cache lines.
+#define FF_IOMAN_LINE_HEAD(pIoman, pBuffer)	((pIoman)->pBuffers + (((pBuffer) - (pIoman)->pBuffers) & ~((pIoman)->LineSectors - 1)))	///< First buffer of the line holding pBuffer.
+#define FF_IOMAN_KEY(pIoman, Sector)	((Sector) ^ (pIoman)->PoolTag)	///< What a sector of pIoman is hashed by. (Just the sector, unless the cache is pooled).
 
 /**
- *	@public
- *	@brief	Creates an FF_IOMAN object, to initialise FullFAT
+ *	@private
+ *	@brief	The share of Total given to shard s. Earlier shards take the remainder.
+ **/
+#define FF_IOMAN_SHARE(Total, pIoman, s)	(((Total) / (pIoman)->ShardCount) + ((s) < ((Total) % (pIoman)->ShardCount)))
+
+/**
+ *	@private
+ *	@brief	Size of the sector index of shard s. It is kept at most half full, so that probe sequences stay short.
+ **/
+static FF_T_UINT32 FF_IOMAN_ShardIndexSize(FF_IOMAN *pIoman, FF_T_UINT16 s) {
+	FF_T_UINT32 Descriptors = FF_IOMAN_SHARE(pIoman->CacheSize / pIoman->MaxLineSectors, pIoman, s) * pIoman->MaxLineSectors;	// Room for single sector lines.
+	FF_T_UINT32 IndexSize;
+#ifdef FF_CACHE_REPLACE_2Q
+	Descriptors += FF_IOMAN_SHARE(pIoman->GhostCount, pIoman, s);
+#endif
+	for(IndexSize = 4; IndexSize < Descriptors * 2; IndexSize <<= 1);
+	return IndexSize;
+}
+
+/**
+ *	@private
+ *	@brief	Allocates the buffer descriptors for CacheSize sectors, with the ghosts, shard indexes and flush list.
  *
- *	@param	pCacheMem		Pointer to a buffer for the cache. (NULL if ok to Malloc).
- *	@param	Size			The size of the provided buffer, or size of the cache to be created. (Must be atleast 2 * BlkSize). Always a multiple of BlkSize.
- *	@param	BlkSize			The block size of devices to be attached. If in doubt use 512.
- *	@param	pError			Pointer to a signed byte for error checking. Can be NULL if not required.
- *	@param	pError			To be checked when a NULL pointer is returned.
+ *	Sets pIoman->GhostCount, from the size of the cache. The descriptors are cleared,
+ *	FF_IOMAN_LayoutShards() then divides the block between the shards.
  *
- *	@return	Returns a pointer to an FF_IOMAN type object. NULL on Error, check the contents of
- *	@return pError
+ *	@return	The block, or NULL if there is not enough memory.
  **/
-FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, FF_ERROR *pError) {
+static FF_BUFFER *FF_IOMAN_AllocDescriptors(FF_IOMAN *pIoman) {
+	FF_BUFFER	*pBuffers;
+	FF_T_UINT32	IndexSize = 0;
+	FF_T_UINT16	s;
+
+#ifdef FF_CACHE_REPLACE_2Q
+	// 2Q remembers up to half the cache size of evicted lines. (Limited by the 16-bit index entries).
+	// There are enough ghosts for single sector lines, InitBufferDescriptors() only uses what the line size needs.
+	pIoman->GhostCount = (FF_T_UINT16) (pIoman->CacheSize / 2);
+	if(pIoman->GhostCount > 0xFFFF - pIoman->CacheSize) {
+		pIoman->GhostCount = (FF_T_UINT16) (0xFFFF - pIoman->CacheSize);
+	}
+#endif
+
+	// The sector indexes are allocated in the same block, directly after the descriptors.
+	for(s = 0; s < pIoman->ShardCount; s++) {
+		IndexSize += FF_IOMAN_ShardIndexSize(pIoman, s);
+	}
+
+	// The flush list follows the indexes. (Each index size is a multiple of 4 entries, keeping the list aligned).
+	pBuffers = (FF_BUFFER *) FF_MALLOC((sizeof(FF_BUFFER) * FF_IOMAN_DESCRIPTORS(pIoman)) + (sizeof(FF_T_UINT16) * IndexSize)
+									   + (sizeof(FF_BUFFER *) * pIoman->CacheSize));
+	if(pBuffers) {
+		memset (pBuffers, '\0', sizeof(FF_BUFFER) * FF_IOMAN_DESCRIPTORS(pIoman));
+	}
+
+	return pBuffers;
+}
+
+/**
+ *	@private
+ *	@brief	Gives each shard its range of pIoman->pBuffers, of the ghosts, and its index.
+ **/
+static void FF_IOMAN_LayoutShards(FF_IOMAN *pIoman) {
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pBuffer = pIoman->pBuffers;
+#ifdef FF_CACHE_REPLACE_2Q
+	FF_BUFFER		*pGhost = pIoman->pBuffers + pIoman->CacheSize;
+#endif
+	FF_T_UINT16		*pIndex = (FF_T_UINT16 *) (pIoman->pBuffers + FF_IOMAN_DESCRIPTORS(pIoman));
+	FF_T_UINT16		s;
+
+	// Each shard owns a contiguous range of the buffers, and of the ghosts.
+	for(s = 0; s < pIoman->ShardCount; s++) {
+		pShard = pIoman->pShards + s;
+		pShard->pBuffers	= pBuffer;
+		pShard->BufferCount	= (FF_T_UINT16) (FF_IOMAN_SHARE(pIoman->CacheSize / pIoman->MaxLineSectors, pIoman, s) * pIoman->MaxLineSectors);
+		pBuffer += pShard->BufferCount;
+#ifdef FF_CACHE_REPLACE_2Q
+		pShard->pGhosts		= pGhost;
+		pShard->GhostCount	= (FF_T_UINT16) FF_IOMAN_SHARE(pIoman->GhostCount, pIoman, s);
+		pGhost += pShard->GhostCount;
+#endif
+		pShard->pIndex		= pIndex;
+		pShard->IndexMask	= FF_IOMAN_ShardIndexSize(pIoman, s) - 1;
+		pIndex += pShard->IndexMask + 1;
+	}
+	pIoman->pFlushList = (FF_BUFFER **) pIndex;
+}
+
+/**
+ *	@private
+ *	@brief	Read-ahead is limited to a quarter of the cache, so that it can't replace the lines it has just read.
+ **/
+static FF_T_UINT32 FF_IOMAN_ReadAheadSectors(FF_IOMAN *pIoman) {
+	if(FF_READAHEAD_SECTORS > pIoman->CacheSize / 4) {
+		return pIoman->CacheSize / 4;
+	}
+	return FF_READAHEAD_SECTORS;
+}
+
+/**
+ *	@private
+ *	@brief	Shares the cache of a pool with an IOMAN that is being created, instead of giving it a cache of its own.
+ **/
+static void FF_IOMAN_JoinPool(FF_IOMAN *pIoman, FF_CACHE_POOL *pPool) {
+	FF_IOMAN *pCache = pPool->pCache;
+
+	pIoman->pPool			= pPool;
+	pIoman->pCacheMem		= pCache->pCacheMem;
+	pIoman->pBuffers		= pCache->pBuffers;
+	pIoman->CacheSize		= pCache->CacheSize;
+	pIoman->LineSectors		= pCache->LineSectors;	// Sectors of every device must belong to the same shard, so mounting doesn't change the line size.
+	pIoman->MaxLineSectors	= pCache->MaxLineSectors;
+	pIoman->pShards			= pCache->pShards;
+	pIoman->ShardCount		= pCache->ShardCount;
+#ifdef FF_CACHE_REPLACE_2Q
+	pIoman->GhostCount		= pCache->GhostCount;
+#endif
+	pIoman->pFlushList		= pCache->pFlushList;	// Only used while every shard is claimed.
+	pIoman->pFlushStaging	= pCache->pFlushStaging;
+	pIoman->Layout			= pCache->Layout;
+
+	FF_PendSemaphore(pPool->pSemaphore);
+	{
+		pPool->Members++;
+		pIoman->PoolTag = (++pPool->NextTag * 0x9E3779B9) & 0xFFFFFFFF;
+	}
+	FF_ReleaseSemaphore(pPool->pSemaphore);
+}
+
+/**
+ *	@private
+ *	@brief	Takes the sectors of an IOMAN that is being destroyed out of its pool's cache.
+ **/
+static void FF_IOMAN_LeavePool(FF_IOMAN *pIoman) {
+	FF_CACHE_POOL *pPool = pIoman->pPool;
+
+	FF_IOMAN_PurgeLines(pIoman);	// Lines mustn't be left tagged with an IOMAN that no longer exists.
+
+	FF_PendSemaphore(pPool->pSemaphore);
+	{
+		pPool->Members--;
+	}
+	FF_ReleaseSemaphore(pPool->pSemaphore);
+	pIoman->pPool = NULL;
+}
+
+/**
+ *	@private
+ *	@brief	Creates an FF_IOMAN object, with a cache of its own, or sharing the cache of pPool.
+ *
+ *	See FF_CreateIOMAN() for the parameters. With a pool, they must describe the pool's cache.
+ **/
+static FF_IOMAN *FF_IOMAN_Create(FF_CACHE_POOL *pPool, FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, const FF_CACHE_LAYOUT *pLayout, FF_ERROR *pError) {
 
 	FF_IOMAN	*pIoman = NULL;
 	FF_T_UINT32 *pLong	= NULL;
+	FF_T_UINT16	s;
 #ifdef FF_HASH_CACHE
 	FF_T_UINT i;
 #endif
@@ -99,6 +266,13 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
 		return NULL;	// Memory Size not a multiple of BlkSize > 0
 	}
 
+	if(pLayout && (pLayout->FatQuota + pLayout->DirQuota + pLayout->DataQuota) > 100) {
+		if(pError) {
+			*pError = FF_ERR_IOMAN_BAD_CACHE_LAYOUT | FF_CREATEIOMAN;
+		}
+		return NULL;
+	}
+
 	pIoman = (FF_IOMAN *) FF_MALLOC(sizeof(FF_IOMAN));
 
 	if(!pIoman) {		// Ensure malloc() succeeded.
@@ -109,6 +283,9 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
 	}
 
 	memset (pIoman, '\0', sizeof(FF_IOMAN));
+	if(pLayout) {
+		pIoman->Layout = *pLayout;
+	}
 
 	// This is just a bit-mask, to use a byte to keep track of memory.
 	// pIoman->MemAllocation = 0x00;	// Unset all allocation identifiers.
@@ -121,6 +298,9 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
 		return NULL;
 	}
 	memset (pIoman->pPartition, '\0', sizeof(FF_PARTITION));
+#ifdef FF_MIRROR_FATS_UMOUNT
+	pIoman->pPartition->bDeferFatCopies = FF_TRUE;
+#endif
 
 	pIoman->MemAllocation |= FF_IOMAN_ALLOC_PART;	// If succeeded, flag that allocation.
 
@@ -149,48 +329,119 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
 //	pIoman->pBlkDevice->fnWriteBlocks = NULL;
 //	pIoman->pBlkDevice->pParam = NULL;
 
-	// Organise the memory provided, or create our own!
-	if(pCacheMem) {
-		pIoman->pCacheMem = pCacheMem;
-	}else {	// No-Cache buffer provided (malloc)
-		pLong = (FF_T_UINT32 *) FF_MALLOC(Size);
-		pIoman->pCacheMem = (FF_T_UINT8 *) pLong;
-		if(!pIoman->pCacheMem) {
+	pIoman->BlkSize		 = BlkSize;
+
+	if(pPool) {
+		FF_IOMAN_JoinPool(pIoman, pPool);
+	} else {
+		// Organise the memory provided, or create our own!
+		if(pCacheMem) {
+			pIoman->pCacheMem = pCacheMem;
+		}else {	// No-Cache buffer provided (malloc)
+			pLong = (FF_T_UINT32 *) FF_MALLOC(Size);
+			pIoman->pCacheMem = (FF_T_UINT8 *) pLong;
+			if(!pIoman->pCacheMem) {
+				if(pError) {
+					*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+				}
+				FF_DestroyIOMAN(pIoman);
+				return NULL;
+			}
+			pIoman->MemAllocation |= FF_IOMAN_ALLOC_BUFFERS;
+
+		}
+		memset (pIoman->pCacheMem, '\0', Size);
+
+		pIoman->CacheSize	 = (FF_T_UINT16) (Size / BlkSize);
+//		pIoman->FirstFile	 = NULL;
+//		pIoman->Locks		 = 0;
+
+		/*	Malloc() memory for buffer objects. (FullFAT never refers to a buffer directly
+			but uses buffer objects instead. Allows us to provide thread safety.
+		*/
+		// Shorten the cache lines, then split the cache into lock shards, keeping enough lines in each
+		// shard for a thread that holds several sectors at once.
+		// The shards are laid out for the longest line, mounting a partition may shorten it.
+		for(pIoman->LineSectors = FF_CACHE_LINE_SECTORS; pIoman->LineSectors > 1 && FF_IOMAN_LINES(pIoman) < FF_CACHE_MIN_LINES; pIoman->LineSectors >>= 1);
+		pIoman->CacheSize -= (FF_T_UINT16) (pIoman->CacheSize % pIoman->LineSectors);	// Sectors that don't make up a whole line are not used.
+		pIoman->MaxLineSectors = pIoman->LineSectors;
+		for(pIoman->ShardCount = FF_CACHE_SHARDS; pIoman->ShardCount > 1 && (FF_IOMAN_LINES(pIoman) / pIoman->ShardCount) < FF_CACHE_MIN_LINES; pIoman->ShardCount >>= 1);
+
+		// The shards are allocated apart from the buffer descriptors, so that FF_ResizeCache() can replace the descriptors.
+		pIoman->pShards = (FF_CACHE_SHARD *) FF_MALLOC(sizeof(FF_CACHE_SHARD) * pIoman->ShardCount);
+		if(!pIoman->pShards) {
 			if(pError) {
 				*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
 			}
 			FF_DestroyIOMAN(pIoman);
 			return NULL;
 		}
-		pIoman->MemAllocation |= FF_IOMAN_ALLOC_BUFFERS;
+		memset (pIoman->pShards, '\0', sizeof(FF_CACHE_SHARD) * pIoman->ShardCount);
+		pIoman->MemAllocation |= FF_IOMAN_ALLOC_SHARDS;
+		for(s = 0; s < pIoman->ShardCount; s++) {
+			pIoman->pShards[s].pSemaphore	= FF_CreateSemaphore();
+			pIoman->pShards[s].pCondition	= FF_CreateCondition();
+		}
 
+		pIoman->pBuffers = FF_IOMAN_AllocDescriptors(pIoman);
+		if(!pIoman->pBuffers) {
+			if(pError) {
+				*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+			}
+			FF_DestroyIOMAN(pIoman);
+			return NULL;	// HT added
+		}
+		pIoman->MemAllocation |= FF_IOMAN_ALLOC_BUFDESCR;
+		FF_IOMAN_LayoutShards(pIoman);
 	}
-	memset (pIoman->pCacheMem, '\0', Size);
 
-	pIoman->BlkSize		 = BlkSize;
-	pIoman->CacheSize	 = (FF_T_UINT16) (Size / BlkSize);
-//	pIoman->FirstFile	 = NULL;
-//	pIoman->Locks		 = 0;
+	pIoman->ReadAhead.pSemaphore = FF_CreateSemaphore();
+#ifdef FF_CACHE_FLUSHER
+	pIoman->Flusher.pSemaphore	= FF_CreateSemaphore();
+	pIoman->Flusher.pCondition	= FF_CreateCondition();
+	pIoman->Flusher.pFlushed	= FF_CreateCondition();
+#endif
+	pIoman->ReadAhead.MaxSectors = FF_IOMAN_ReadAheadSectors(pIoman);
+	if(pIoman->ReadAhead.MaxSectors) {
+		pIoman->ReadAhead.pStaging = (FF_T_UINT8 *) FF_MALLOC(pIoman->BlkSize * pIoman->ReadAhead.MaxSectors);
+		if(!pIoman->ReadAhead.pStaging) {
+			if(pError) {
+				*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+			}
+			FF_DestroyIOMAN(pIoman);
+			return NULL;
+		}
+		pIoman->MemAllocation |= FF_IOMAN_ALLOC_READAHEAD;
+	}
 
-	/*	Malloc() memory for buffer objects. (FullFAT never refers to a buffer directly
-		but uses buffer objects instead. Allows us to provide thread safety.
-	*/
-	pIoman->pBuffers = (FF_BUFFER *) FF_MALLOC(sizeof(FF_BUFFER) * pIoman->CacheSize);
+	if(pPool) {
+		pIoman->ReadAhead.Window = pIoman->LineSectors;	// The pool's descriptors are in use, only the streams start out empty.
+	} else {
+		FF_IOMAN_InitBufferDescriptors(pIoman);
+	}
 
-	if(!pIoman->pBuffers) {
-		if(pError) {
-			*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+#ifdef FF_CACHE_WRITE_BACK
+	// Dirty sectors that are not neighbours in memory are gathered here before being written together.
+	if(FF_FLUSH_MAX_SECTORS > 1 && !pPool) {
+		pIoman->pFlushStaging = (FF_T_UINT8 *) FF_MALLOC(pIoman->BlkSize * FF_FLUSH_MAX_SECTORS);
+		if(!pIoman->pFlushStaging) {
+			if(pError) {
+				*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+			}
+			FF_DestroyIOMAN(pIoman);
+			return NULL;
 		}
-		FF_DestroyIOMAN(pIoman);
-		return NULL;	// HT added
+		pIoman->MemAllocation |= FF_IOMAN_ALLOC_STAGING;
 	}
-	memset (pIoman->pBuffers, '\0', sizeof(FF_BUFFER) * pIoman->CacheSize);
-
-	pIoman->MemAllocation |= FF_IOMAN_ALLOC_BUFDESCR;
-	FF_IOMAN_InitBufferDescriptors(pIoman);
+#endif
 
-	// Finally create a Semaphore for Buffer Description modifications.
-	pIoman->pSemaphore = FF_CreateSemaphore();
+	// Finally create a Semaphore for the file list, and the FAT and directory locks.
+	pIoman->pSemaphore	= FF_CreateSemaphore();
+	pIoman->pFatLock	= FF_CreateRWLock();
+	pIoman->pDirLock	= FF_CreateRWLock();
+#if FF_ALLOC_GROUPS > 1
+	pIoman->pGroupCondition = FF_CreateCondition();
+#endif
 
 #ifdef FF_BLKDEV_USES_SEM
 	pIoman->pBlkDevSemaphore = FF_CreateSemaphore();
@@ -199,6 +450,36 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
 	return pIoman;	// Sucess, return the created object.
 }
 
+/**
+ *	@public
+ *	@brief	Creates an FF_IOMAN object, to initialise FullFAT
+ *
+ *	@param	pCacheMem		Pointer to a buffer for the cache. (NULL if ok to Malloc).
+ *	@param	Size			The size of the provided buffer, or size of the cache to be created. (Must be atleast 2 * BlkSize). Always a multiple of BlkSize.
+ *	@param	BlkSize			The block size of devices to be attached. If in doubt use 512.
+ *	@param	pError			Pointer to a signed byte for error checking. Can be NULL if not required.
+ *	@param	pError			To be checked when a NULL pointer is returned.
+ *
+ *	@return	Returns a pointer to an FF_IOMAN type object. NULL on Error, check the contents of
+ *	@return pError
+ **/
+FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, FF_ERROR *pError) {
+	return FF_IOMAN_Create(NULL, pCacheMem, Size, BlkSize, NULL, pError);
+}
+
+/**
+ *	@public
+ *	@brief	Creates an FF_IOMAN object, like FF_CreateIOMAN(), with a layout for its cache.
+ *
+ *	@param	pLayout			Quotas reserving parts of the cache for FAT, directory and data sectors. (NULL shares the whole cache).
+ *
+ *	@return	Returns a pointer to an FF_IOMAN type object. NULL on Error, check the contents of
+ *	@return pError
+ **/
+FF_IOMAN *FF_CreateIOMANEx(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, const FF_CACHE_LAYOUT *pLayout, FF_ERROR *pError) {
+	return FF_IOMAN_Create(NULL, pCacheMem, Size, BlkSize, pLayout, pError);
+}
+
 /**
  *	@public
  *	@brief	Destroys an FF_IOMAN object, and frees all assigned memory.
@@ -210,6 +491,7 @@ FF_IOMAN *FF_CreateIOMAN(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 Bl
  **/
 FF_ERROR FF_DestroyIOMAN(FF_IOMAN *pIoman) {
 
+	FF_T_UINT16 s;
 #ifdef FF_HASH_CACHE
 	FF_T_UINT32 i;
 #endif
@@ -219,8 +501,29 @@ FF_ERROR FF_DestroyIOMAN(FF_IOMAN *pIoman) {
 		return FF_ERR_NULL_POINTER | FF_DESTROYIOMAN;
 	}
 
+#ifdef FF_CACHE_FLUSHER
+	FF_IOMAN_StopFlusher(pIoman);
+#endif
+
+	// The cache of a pool is not freed, only this IOMAN's sectors are removed from it.
+	if(pIoman->pPool) {
+		FF_IOMAN_LeavePool(pIoman);
+	}
+
 	// Ensure pPartition pointer was allocated.
 	if((pIoman->MemAllocation & FF_IOMAN_ALLOC_PART)) {
+#ifdef FF_FREE_BITMAP
+		FF_DestroyFreeBitmap(pIoman);
+#endif
+#ifdef FF_FAT12_DECODE
+		FF_DestroyFat12Table(pIoman);
+#endif
+#ifdef FF_FAT_MIRROR
+		FF_DestroyFatMirror(pIoman);
+#endif
+#ifdef FF_MIRROR_FATS_UMOUNT
+		FF_DestroyFatCopyMap(pIoman);
+#endif
 		FF_FREE(pIoman->pPartition);
 	}
 
@@ -229,6 +532,19 @@ FF_ERROR FF_DestroyIOMAN(FF_IOMAN *pIoman) {
 		FF_FREE(pIoman->pBlkDevice);
 	}
 
+	// Ensure pShards pointer was allocated.
+	if((pIoman->MemAllocation & FF_IOMAN_ALLOC_SHARDS)) {
+		for(s = 0; s < pIoman->ShardCount; s++) {
+			if(pIoman->pShards[s].pSemaphore) {
+				FF_DestroySemaphore(pIoman->pShards[s].pSemaphore);
+			}
+			if(pIoman->pShards[s].pCondition) {
+				FF_DestroyCondition(pIoman->pShards[s].pCondition);
+			}
+		}
+		FF_FREE(pIoman->pShards);
+	}
+
 	// Ensure pBuffers pointer was allocated.
 	if((pIoman->MemAllocation & FF_IOMAN_ALLOC_BUFDESCR)) {
 		FF_FREE(pIoman->pBuffers);
@@ -239,10 +555,45 @@ FF_ERROR FF_DestroyIOMAN(FF_IOMAN *pIoman) {
 		FF_FREE(pIoman->pCacheMem);
 	}
 
+	// Ensure pFlushStaging pointer was allocated.
+	if((pIoman->MemAllocation & FF_IOMAN_ALLOC_STAGING)) {
+		FF_FREE(pIoman->pFlushStaging);
+	}
+
+	// Ensure ReadAhead.pStaging pointer was allocated.
+	if((pIoman->MemAllocation & FF_IOMAN_ALLOC_READAHEAD)) {
+		FF_FREE(pIoman->ReadAhead.pStaging);
+	}
+
 	// Destroy any Semaphore that was created.
 	if(pIoman->pSemaphore) {
 		FF_DestroySemaphore(pIoman->pSemaphore);
 	}
+	if(pIoman->pFatLock) {
+		FF_DestroyRWLock(pIoman->pFatLock);
+	}
+	if(pIoman->pDirLock) {
+		FF_DestroyRWLock(pIoman->pDirLock);
+	}
+#if FF_ALLOC_GROUPS > 1
+	if(pIoman->pGroupCondition) {
+		FF_DestroyCondition(pIoman->pGroupCondition);
+	}
+#endif
+	if(pIoman->ReadAhead.pSemaphore) {
+		FF_DestroySemaphore(pIoman->ReadAhead.pSemaphore);
+	}
+#ifdef FF_CACHE_FLUSHER
+	if(pIoman->Flusher.pSemaphore) {
+		FF_DestroySemaphore(pIoman->Flusher.pSemaphore);
+	}
+	if(pIoman->Flusher.pCondition) {
+		FF_DestroyCondition(pIoman->Flusher.pCondition);
+	}
+	if(pIoman->Flusher.pFlushed) {
+		FF_DestroyCondition(pIoman->Flusher.pFlushed);
+	}
+#endif
 #ifdef FF_BLKDEV_USES_SEM
 	if(pIoman->pBlkDevSemaphore) {
 		FF_DestroySemaphore(pIoman->pBlkDevSemaphore);
@@ -270,177 +621,1541 @@ FF_ERROR FF_DestroyIOMAN(FF_IOMAN *pIoman) {
  *
  **/
 static void FF_IOMAN_InitBufferDescriptors(FF_IOMAN *pIoman) {
-	FF_T_UINT16 i;
-	FF_BUFFER *pBuffer = pIoman->pBuffers;
+	FF_T_UINT16 i, s, Lines;
+	FF_CACHE_SHARD *pShard;
+#ifndef FF_CACHE_REPLACE_SCAN
+	FF_BUFFER *pBuffer;
+#endif
 	pIoman->LastReplaced = 0;
+	// Streams don't survive the cache being emptied.
+	memset (pIoman->ReadAhead.NextLBA, '\0', sizeof(pIoman->ReadAhead.NextLBA));
+	pIoman->ReadAhead.NextStream	= 0;
+	pIoman->ReadAhead.Window		= pIoman->LineSectors;
 	// HT : it is assmued that pBuffer was cleared by memset ()
 	for(i = 0; i < pIoman->CacheSize; i++) {
-		pBuffer->pBuffer = (FF_T_UINT8 *)((pIoman->pCacheMem) + (pIoman->BlkSize * i));
-		pBuffer++;
+		(pIoman->pBuffers + i)->pBuffer = (FF_T_UINT8 *)((pIoman->pCacheMem) + (pIoman->BlkSize * i));
+	}
+	for(s = 0; s < pIoman->ShardCount; s++) {
+		pShard = pIoman->pShards + s;
+		pShard->LineSectors = pIoman->LineSectors;
+		memset (pShard->ClassLines, '\0', sizeof(pShard->ClassLines));
+#ifdef FF_CACHE_FLUSHER
+		pShard->DirtyCount = 0;
+#endif
+		Lines = pShard->BufferCount / pShard->LineSectors;
+		pShard->ClassQuota[FF_CACHE_CLASS_FAT]		= (FF_T_UINT16) ((Lines * pIoman->Layout.FatQuota) / 100);
+		pShard->ClassQuota[FF_CACHE_CLASS_DIR]		= (FF_T_UINT16) ((Lines * pIoman->Layout.DirQuota) / 100);
+		pShard->ClassQuota[FF_CACHE_CLASS_DATA]		= (FF_T_UINT16) ((Lines * pIoman->Layout.DataQuota) / 100);
+		pShard->ClassQuota[FF_CACHE_CLASS_PINNED]	= (FF_T_UINT16) (pIoman->Layout.PinnedFatSectors ? (Lines / 2) : 0);	// Most lines that may be pinned.
+#ifdef FF_CACHE_REPLACE_LRU
+		memset (&pShard->LRU, '\0', sizeof(FF_BUFFER_LIST));
+		for(pBuffer = pShard->pBuffers; pBuffer < pShard->pBuffers + pShard->BufferCount; pBuffer += pShard->LineSectors) {
+			FF_IOMAN_ListAppend(&pShard->LRU, pBuffer);
+		}
+#endif
+#ifdef FF_CACHE_REPLACE_2Q
+		memset (&pShard->FreeBuffers, '\0', sizeof(FF_BUFFER_LIST));
+		memset (&pShard->A1in, '\0', sizeof(FF_BUFFER_LIST));
+		memset (&pShard->Am, '\0', sizeof(FF_BUFFER_LIST));
+		memset (&pShard->A1out, '\0', sizeof(FF_BUFFER_LIST));
+		memset (&pShard->FreeGhosts, '\0', sizeof(FF_BUFFER_LIST));
+		pShard->A1inCount	= 0;
+		pShard->A1inTarget	= (FF_T_UINT16) ((pShard->BufferCount / pShard->LineSectors + 3) / 4);	// 25% of the cache, as recommended for 2Q.
+		for(pBuffer = pShard->pBuffers; pBuffer < pShard->pBuffers + pShard->BufferCount; pBuffer += pShard->LineSectors) {
+			pBuffer->Queue = FF_QUEUE_FREE;
+			FF_IOMAN_ListAppend(&pShard->FreeBuffers, pBuffer);
+		}
+		for(pBuffer = pShard->pGhosts; pBuffer < pShard->pGhosts + pShard->GhostCount / pShard->LineSectors; pBuffer++) {
+			pBuffer->pBuffer = NULL;
+			pBuffer->Queue = FF_QUEUE_GHOST;
+			FF_IOMAN_ListAppend(&pShard->FreeGhosts, pBuffer);
+		}
+#endif
+		// No line is allocated yet, so the index starts out empty.
+		memset (pShard->pIndex, '\0', sizeof(FF_T_UINT16) * (pShard->IndexMask + 1));
 	}
 }
 
-
 /**
  *	@private
- *	@brief		Flushes all Write cache buffers with no active Handles.
+ *	@brief	Empties the cache, and divides it into lines of upto MaxSectors sectors.
  *
- *	@param		pIoman	IOMAN Object.
+ *	@param	pIoman		IOMAN Object.
+ *	@param	MaxSectors	Longest line wanted, the line is never longer than the cache was laid out for.
  *
- *	@return		FF_ERR_NONE on Success.
+ *	@pre	No buffer may be in use, or modified.
  **/
-FF_ERROR FF_FlushCache(FF_IOMAN *pIoman) {
+static void FF_IOMAN_SetLineSectors(FF_IOMAN *pIoman, FF_T_UINT32 MaxSectors) {
+	for(pIoman->LineSectors = pIoman->MaxLineSectors; pIoman->LineSectors > MaxSectors && pIoman->LineSectors > 1; pIoman->LineSectors >>= 1);
 
-	FF_T_UINT16 i,x;
+	memset (pIoman->pBuffers, '\0', sizeof(FF_BUFFER) * FF_IOMAN_DESCRIPTORS(pIoman));
+	memset (pIoman->pCacheMem, '\0', pIoman->BlkSize * pIoman->CacheSize);
+	FF_IOMAN_InitBufferDescriptors(pIoman);
+}
 
-	if(!pIoman) {
-		return FF_ERR_NULL_POINTER | FF_FLUSHCACHE;
-	}
+/**
+ *	@private
+ *	@brief	Mixes the bits of a sector number.
+ *
+ *	The low bits give the home slot of the sector in its shard's index, and the top
+ *	bits choose the shard. Mixing spreads runs of consecutive sectors (FAT tables,
+ *	directory clusters) evenly across both.
+ **/
+FF_INLINE FF_T_UINT32 FF_IOMAN_HashSector(FF_T_UINT32 Sector) {
+	Sector = (Sector ^ (Sector >> 16)) & 0xFFFFFFFF;
+	Sector = (Sector * 0x9E3779B1) & 0xFFFFFFFF;
+	return (Sector ^ (Sector >> 15));
+}
 
-	FF_PendSemaphore(pIoman->pSemaphore);
-	{
-		for(i = 0; i < pIoman->CacheSize; i++) {
-			if((pIoman->pBuffers + i)->NumHandles == 0 && (pIoman->pBuffers + i)->Modified == FF_TRUE) {
+/**
+ *	@private
+ *	@brief	Finds the shard that a sector belongs to.
+ **/
+FF_INLINE FF_CACHE_SHARD *FF_IOMAN_GetShard(FF_IOMAN *pIoman, FF_T_UINT32 Sector) {
+	Sector -= (Sector & (pIoman->LineSectors - 1));	// All sectors of a line belong to the same shard.
+	return pIoman->pShards + ((FF_IOMAN_HashSector(FF_IOMAN_KEY(pIoman, Sector)) >> 24) & (pIoman->ShardCount - 1));
+}
 
-				FF_BlockWrite(pIoman, (pIoman->pBuffers + i)->Sector, 1, (pIoman->pBuffers + i)->pBuffer, FF_TRUE);
+/**
+ *	@private
+ *	@brief	Claims a shard's semaphore, adding the time spent waiting for it to the shard's statistics.
+ **/
+static void FF_IOMAN_PendShard(FF_CACHE_SHARD *pShard) {
+#ifdef FF_STATS_TIMING
+	FF_T_UINT32 Start = FF_GetMicroseconds();
 
-				// Buffer has now been flushed, mark it as a read buffer and unmodified.
-				(pIoman->pBuffers + i)->Mode = FF_MODE_READ;
-				(pIoman->pBuffers + i)->Modified = FF_FALSE;
-
-				// Search for other buffers that used this sector, and mark them as modified
-				// So that further requests will result in the new sector being fetched.
-				for(x = 0; x < pIoman->CacheSize; x++) {
-					if(x != i) {
-						if((pIoman->pBuffers + x)->Sector == (pIoman->pBuffers + i)->Sector && (pIoman->pBuffers + x)->Mode == FF_MODE_READ) {
-							(pIoman->pBuffers + x)->Modified = FF_TRUE;
-						}
-					}
-				}
-			}
+	FF_PendSemaphore(pShard->pSemaphore);
+	pShard->Stats.LockWaitTime += (FF_GetMicroseconds() - Start) & 0xFFFFFFFF;
+#else
+	FF_PendSemaphore(pShard->pSemaphore);
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Finds the head of the cache line starting at a sector, using the buffer index.
+ *
+ *	@param	pShard		The shard that Sector belongs to.
+ *	@param	pIoman		The IOMAN whose device Sector is on.
+ *	@param	Sector		LBA of the first sector of the line. (Aligned to the line size).
+ *
+ *	@return	The line head, (or a 2Q ghost) for Sector, or NULL if the line is not cached.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static FF_BUFFER *FF_IOMAN_FindBuffer(FF_CACHE_SHARD *pShard, FF_IOMAN *pIoman, FF_T_UINT32 Sector) {
+	FF_T_UINT32	i = FF_IOMAN_HashSector(FF_IOMAN_KEY(pIoman, Sector)) & pShard->IndexMask;
+	FF_BUFFER	*pBuffer;
+
+	while(pShard->pIndex[i]) {
+		pBuffer = pShard->pBuffers + (pShard->pIndex[i] - 1);
+		if(pBuffer->Sector == Sector && pBuffer->pOwner == pIoman) {
+			return pBuffer;
 		}
+		i = (i + 1) & pShard->IndexMask;
 	}
-	FF_ReleaseSemaphore(pIoman->pSemaphore);
 
-	return FF_ERR_NONE;
+	return NULL;
 }
 
-/*
-	A new version of FF_GetBuffer() with a simple mechanism for timeout
-*/
+/**
+ *	@private
+ *	@brief	Adds a line head, that has just been allocated, to the buffer index.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static void FF_IOMAN_IndexBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+	FF_T_UINT32	i = FF_IOMAN_HashSector(FF_IOMAN_KEY(pBuffer->pOwner, pBuffer->Sector)) & pShard->IndexMask;
 
-#define	FF_GETBUFFER_SLEEP_TIME	10
-#define	FF_GETBUFFER_WAIT_TIME	(20000 / FF_GETBUFFER_SLEEP_TIME)
+	while(pShard->pIndex[i]) {
+		i = (i + 1) & pShard->IndexMask;
+	}
 
-FF_BUFFER *FF_GetBuffer(FF_IOMAN *pIoman, FF_T_UINT32 Sector, FF_T_UINT8 Mode) {
-	FF_BUFFER	*pBuffer;
-	FF_BUFFER	*pBufLRU;
-//	FF_BUFFER	*pBufLHITS = NULL;  // Wasn't use anymore?
-	FF_BUFFER	*pBufMatch = NULL;
-	FF_T_SINT32	RetVal;
-	FF_T_INT    LoopCount = FF_GETBUFFER_WAIT_TIME;
+	pShard->pIndex[i] = (FF_T_UINT16) ((pBuffer - pShard->pBuffers) + 1);
+}
 
-	FF_T_INT cacheSize = pIoman->CacheSize;
-	if (cacheSize <= 0) {
-		return NULL;
+/**
+ *	@private
+ *	@brief	Removes a line head from the buffer index, before it is re-used or invalidated.
+ *
+ *	Entries following the removed one in the same probe sequence are shifted back
+ *	into the hole, so no tombstones are needed and lookups don't degrade over time.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static void FF_IOMAN_UnindexBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+	FF_T_UINT16	usEntry	= (FF_T_UINT16) ((pBuffer - pShard->pBuffers) + 1);
+	FF_T_UINT32	i		= FF_IOMAN_HashSector(FF_IOMAN_KEY(pBuffer->pOwner, pBuffer->Sector)) & pShard->IndexMask;
+	FF_T_UINT32	j, Home;
+	FF_BUFFER	*pEntry;
+
+	while(pShard->pIndex[i] != usEntry) {
+		if(!pShard->pIndex[i]) {
+			return;	// Not indexed.
+		}
+		i = (i + 1) & pShard->IndexMask;
 	}
 
-	while(!pBufMatch) {
-		if (!--LoopCount) {
-			//
-			// *pError = FF_ERR_IOMAN_GETBUFFER_TIMEOUT;
-			//
-			return NULL;
+	j = i;
+	for(;;) {
+		j = (j + 1) & pShard->IndexMask;
+		if(!pShard->pIndex[j]) {
+			break;
 		}
-		FF_PendSemaphore(pIoman->pSemaphore);
-		{
+		pEntry = pShard->pBuffers + (pShard->pIndex[j] - 1);
+		Home = FF_IOMAN_HashSector(FF_IOMAN_KEY(pEntry->pOwner, pEntry->Sector)) & pShard->IndexMask;
+		// Move the entry back, unless its home slot lies cyclically within (i, j].
+		if((i <= j) ? (Home <= i || Home > j) : (Home <= i && Home > j)) {
+			pShard->pIndex[i] = pShard->pIndex[j];
+			i = j;
+		}
+	}
 
-			for(pBuffer = pIoman->pBuffers; pBuffer < pIoman->pBuffers + cacheSize; pBuffer++) {
-				if(pBuffer->Sector == Sector && pBuffer->Valid) {
-					pBufMatch = pBuffer;
-					break;	// Don't look further if you found a perfect match
-				}
+	pShard->pIndex[i] = 0;
+}
+
+#ifndef FF_CACHE_REPLACE_SCAN
+/**
+ *	@private
+ *	@brief	Removes a buffer from a replacement list.
+ **/
+static void FF_IOMAN_ListUnlink(FF_BUFFER_LIST *pList, FF_BUFFER *pBuffer) {
+	if(pBuffer->pPrev) {
+		pBuffer->pPrev->pNext = pBuffer->pNext;
+	} else {
+		pList->pHead = pBuffer->pNext;
+	}
+	if(pBuffer->pNext) {
+		pBuffer->pNext->pPrev = pBuffer->pPrev;
+	} else {
+		pList->pTail = pBuffer->pPrev;
+	}
+	pBuffer->pPrev = NULL;
+	pBuffer->pNext = NULL;
+}
+
+/**
+ *	@private
+ *	@brief	Adds a buffer to the newest end of a replacement list.
+ **/
+static void FF_IOMAN_ListAppend(FF_BUFFER_LIST *pList, FF_BUFFER *pBuffer) {
+	pBuffer->pNext = NULL;
+	pBuffer->pPrev = pList->pTail;
+	if(pList->pTail) {
+		pList->pTail->pNext = pBuffer;
+	} else {
+		pList->pHead = pBuffer;
+	}
+	pList->pTail = pBuffer;
+}
+
+/**
+ *	@private
+ *	@brief	Adds a buffer to the oldest end of a replacement list, so it is re-used first.
+ **/
+static void FF_IOMAN_ListPrepend(FF_BUFFER_LIST *pList, FF_BUFFER *pBuffer) {
+	pBuffer->pPrev = NULL;
+	pBuffer->pNext = pList->pHead;
+	if(pList->pHead) {
+		pList->pHead->pPrev = pBuffer;
+	} else {
+		pList->pTail = pBuffer;
+	}
+	pList->pHead = pBuffer;
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Finds the class of a sector, for the cache quotas.
+ *
+ *	FAT and root directory sectors are known by their address. Directory clusters can
+ *	only be told apart from file data by the caller, which passes FF_MODE_DIR.
+ **/
+static FF_T_UINT8 FF_IOMAN_ClassifySector(FF_IOMAN *pIoman, FF_T_UINT32 Sector, FF_T_UINT8 Mode) {
+	FF_PARTITION *pPart = pIoman->pPartition;
+
+	if(!pPart->SectorsPerFAT || Sector < pPart->BeginLBA) {
+		return FF_CACHE_CLASS_DATA;	// The boot sector hasn't been read, or the sector is outside the partition.
+	}
+	if(Sector >= pPart->FatBeginLBA && Sector < pPart->FatBeginLBA + pIoman->Layout.PinnedFatSectors) {
+		return FF_CACHE_CLASS_PINNED;
+	}
+	if(Sector < pPart->ClusterBeginLBA) {
+		return FF_CACHE_CLASS_FAT;
+	}
+	if(Sector < pPart->FirstDataSector || (Mode & FF_MODE_DIR)) {
+		return FF_CACHE_CLASS_DIR;
+	}
+	return FF_CACHE_CLASS_DATA;
+}
+
+/**
+ *	@private
+ *	@brief	Assigns a class to a line that is being allocated, and counts it.
+ *
+ *	Pinned lines are limited to half of the shard, further pinned sectors are cached as FAT sectors.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static void FF_IOMAN_SetLineClass(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine, FF_T_UINT8 Class) {
+	if(Class == FF_CACHE_CLASS_PINNED && pShard->ClassLines[Class] >= pShard->ClassQuota[Class]) {
+		Class = FF_CACHE_CLASS_FAT;
+	}
+	pLine->Class = Class;
+	pShard->ClassLines[Class]++;
+}
+
+/**
+ *	@private
+ *	@brief	A cached line was requested as another class. (A line can't become pinned, or stop being pinned).
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+FF_INLINE void FF_IOMAN_ChangeLineClass(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine, FF_T_UINT8 Class) {
+	if(Class != pLine->Class && Class != FF_CACHE_CLASS_PINNED && pLine->Class != FF_CACHE_CLASS_PINNED) {
+		pShard->ClassLines[pLine->Class]--;
+		pShard->ClassLines[Class]++;
+		pLine->Class = Class;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Tells if a line can't be replaced by a line of Class, because of the quotas.
+ *
+ *	Without a layout every quota is 0, so only pinned lines are ever reserved.
+ **/
+FF_INLINE FF_T_BOOL FF_IOMAN_Reserved(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine, FF_T_UINT8 Class) {
+	if(!pLine->LineValid) {
+		return FF_FALSE;
+	}
+	if(pLine->Class == FF_CACHE_CLASS_PINNED) {
+		return FF_TRUE;
+	}
+	return (Class != FF_CACHE_CLASS_ANY && pLine->Class != Class && pShard->ClassLines[pLine->Class] <= pShard->ClassQuota[pLine->Class]);
+}
+
+#ifdef FF_CACHE_REPLACE_2Q
+/*
+	2Q keeps sectors that were referenced only once on a probationary FIFO (A1in).
+	When a sector falls out of probation, only its number is remembered, as a ghost
+	on the A1out FIFO. Sectors that miss while they have a ghost were clearly
+	re-referenced, and are admitted to the main LRU list (Am). Scans of file data or
+	of the whole FAT therefore only ever cycle through probation.
+
+	Ghosts are descriptors without sector memory, stored after the real buffers.
+	They are kept in the buffer index, so they are found by the same lookup.
+*/
+
+/**
+ *	@private
+ *	@brief	Remembers a sector that was evicted from probation.
+ *
+ *	The oldest ghost is recycled, once all ghost descriptors are in use.
+ **/
+static void FF_IOMAN_AddGhost(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine) {
+	FF_BUFFER *pGhost = pShard->FreeGhosts.pHead;
+
+	if(pGhost) {
+		FF_IOMAN_ListUnlink(&pShard->FreeGhosts, pGhost);
+	} else {
+		pGhost = pShard->A1out.pHead;
+		if(!pGhost) {
+			return;	// No ghosts for a cache this small.
+		}
+		FF_IOMAN_ListUnlink(&pShard->A1out, pGhost);
+		FF_IOMAN_UnindexBuffer(pShard, pGhost);
+	}
+
+	pGhost->Sector = pLine->Sector;
+	pGhost->pOwner = pLine->pOwner;
+	FF_IOMAN_IndexBuffer(pShard, pGhost);
+	FF_IOMAN_ListAppend(&pShard->A1out, pGhost);
+}
+
+/**
+ *	@private
+ *	@brief	Forgets a ghost, because its sector is being fetched again.
+ **/
+static void FF_IOMAN_RemoveGhost(FF_CACHE_SHARD *pShard, FF_BUFFER *pGhost) {
+	FF_IOMAN_ListUnlink(&pShard->A1out, pGhost);
+	FF_IOMAN_UnindexBuffer(pShard, pGhost);
+	FF_IOMAN_ListAppend(&pShard->FreeGhosts, pGhost);
+}
+
+/**
+ *	@private
+ *	@brief	Takes the oldest buffer without handles from probation.
+ *
+ *	Buffers on probation stay on the FIFO while they have handles, so that
+ *	re-references don't change their order. Only a few buffers are ever held
+ *	at once, so skipping them is cheap. Lines reserved by the quotas are also skipped.
+ **/
+static FF_BUFFER *FF_IOMAN_TakeProbation(FF_CACHE_SHARD *pShard, FF_T_UINT8 Class) {
+	FF_BUFFER *pBuffer;
+
+	for(pBuffer = pShard->A1in.pHead; pBuffer; pBuffer = pBuffer->pNext) {
+		if(!pBuffer->LineHandles && !FF_IOMAN_Reserved(pShard, pBuffer, Class)) {
+			FF_IOMAN_ListUnlink(&pShard->A1in, pBuffer);
+			pShard->A1inCount--;
+			return pBuffer;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+/*
+	Replacement policy hooks. The policies work on whole cache lines, passed by their head.
+	Only lines without handles can be replaced, so the policy is told when a line gains
+	its first handle, and when it loses its last.
+	All of these must be wrapped with the shard's semaphore.
+*/
+
+/**
+ *	@private
+ *	@brief	A buffer without handles is being claimed, it can no longer be replaced.
+ **/
+static void FF_IOMAN_PinBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+	if(pBuffer->Class == FF_CACHE_CLASS_PINNED) {
+		return;	// Never on the replacement lists.
+	}
+#ifdef FF_CACHE_REPLACE_LRU
+	FF_IOMAN_ListUnlink(&pShard->LRU, pBuffer);
+#elif defined(FF_CACHE_REPLACE_2Q)
+	if(pBuffer->Queue == FF_QUEUE_AM) {
+		FF_IOMAN_ListUnlink(&pShard->Am, pBuffer);
+	}
+#else
+	(void) pShard;
+	(void) pBuffer;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	The last handle of a buffer was released, it may now be replaced.
+ **/
+static void FF_IOMAN_UnpinBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+	if(pBuffer->Class == FF_CACHE_CLASS_PINNED) {
+		return;	// Never on the replacement lists.
+	}
+#ifdef FF_CACHE_REPLACE_LRU
+	FF_IOMAN_ListAppend(&pShard->LRU, pBuffer);
+#elif defined(FF_CACHE_REPLACE_2Q)
+	if(pBuffer->Queue == FF_QUEUE_AM) {
+		FF_IOMAN_ListAppend(&pShard->Am, pBuffer);
+	}
+#else
+	(void) pShard;
+	(void) pBuffer;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Chooses a buffer without handles, that a line of Class may replace.
+ *
+ *	Lines reserved by the quotas are passed over, in the policy's order. They are few when
+ *	a layout is used, and there are none without one.
+ *
+ *	@return	The buffer to be replaced, removed from the replacement policy, or NULL if there is none.
+ **/
+static FF_BUFFER *FF_IOMAN_FindVictim(FF_CACHE_SHARD *pShard, FF_T_UINT8 Class) {
+#ifdef FF_CACHE_REPLACE_LRU
+	FF_BUFFER	*pBufLRU = pShard->LRU.pHead;
+
+	while(pBufLRU && FF_IOMAN_Reserved(pShard, pBufLRU, Class)) {
+		pBufLRU = pBufLRU->pNext;
+	}
+	if(pBufLRU) {
+		FF_IOMAN_ListUnlink(&pShard->LRU, pBufLRU);
+	}
+	return pBufLRU;
+#elif defined(FF_CACHE_REPLACE_2Q)
+	FF_BUFFER	*pBufLRU = pShard->FreeBuffers.pHead;
+
+	if(pBufLRU) {
+		FF_IOMAN_ListUnlink(&pShard->FreeBuffers, pBufLRU);
+		return pBufLRU;
+	}
+
+	if(pShard->A1inCount > pShard->A1inTarget || !pShard->Am.pHead) {
+		pBufLRU = FF_IOMAN_TakeProbation(pShard, Class);
+		if(pBufLRU) {
+			return pBufLRU;
+		}
+	}
+
+	pBufLRU = pShard->Am.pHead;
+	while(pBufLRU && FF_IOMAN_Reserved(pShard, pBufLRU, Class)) {
+		pBufLRU = pBufLRU->pNext;
+	}
+	if(pBufLRU) {
+		FF_IOMAN_ListUnlink(&pShard->Am, pBufLRU);
+		return pBufLRU;
+	}
+
+	return FF_IOMAN_TakeProbation(pShard, Class);
+#else
+	FF_BUFFER	*pBuffer;
+	FF_BUFFER	*pBufLRU = NULL;
+
+	for(pBuffer = pShard->pBuffers; pBuffer < pShard->pBuffers + pShard->BufferCount; pBuffer += pShard->LineSectors) {
+		if(pBuffer->LineHandles)
+			continue;  // Occupied
+		pBuffer->LRU += 1;
+		if(FF_IOMAN_Reserved(pShard, pBuffer, Class))
+			continue;  // Kept for its class
+
+		if(!pBufLRU) {
+			pBufLRU = pBuffer;
+		}
+
+		if(pBuffer->LRU > pBufLRU->LRU ||
+		   (pBuffer->LRU == pBufLRU->LRU && pBuffer->Persistance > pBufLRU->Persistance)) {
+			pBufLRU = pBuffer;
+		}
+	}
+	return pBufLRU;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Chooses a buffer without handles to be replaced by a line of Class.
+ *
+ *	The chosen buffer is removed from the replacement policy. The caller must either
+ *	fill it and hand it out, or give it back with FF_IOMAN_ReturnVictim().
+ *	The quotas are ignored when they leave nothing to replace, pinned lines never are.
+ *
+ *	@return	The buffer to be replaced, or NULL if every buffer has handles.
+ **/
+static FF_BUFFER *FF_IOMAN_SelectVictim(FF_CACHE_SHARD *pShard, FF_T_UINT8 Class) {
+	FF_BUFFER *pBufLRU = FF_IOMAN_FindVictim(pShard, Class);
+
+	if(!pBufLRU && Class != FF_CACHE_CLASS_ANY) {
+		pBufLRU = FF_IOMAN_FindVictim(pShard, FF_CACHE_CLASS_ANY);
+	}
+	return pBufLRU;
+}
+
+/**
+ *	@private
+ *	@brief	A victim's sector is being dropped from the cache.
+ *
+ *	Called once the victim has been written back and removed from the buffer index.
+ **/
+static void FF_IOMAN_EvictBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+#ifdef FF_CACHE_REPLACE_2Q
+	if(pBuffer->Queue == FF_QUEUE_A1IN && !pBuffer->ReadAhead) {	// A line that was only read ahead was never referenced.
+		FF_IOMAN_AddGhost(pShard, pBuffer);
+	}
+	pBuffer->Queue = FF_QUEUE_FREE;
+#else
+	(void) pShard;
+	(void) pBuffer;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	Gives back a victim that could not be re-used, so that it is chosen again first.
+ **/
+static void FF_IOMAN_ReturnVictim(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+#ifdef FF_CACHE_REPLACE_LRU
+	FF_IOMAN_ListPrepend(&pShard->LRU, pBuffer);
+#elif defined(FF_CACHE_REPLACE_2Q)
+	if(!pBuffer->LineValid) {
+		pBuffer->Queue = FF_QUEUE_FREE;
+		FF_IOMAN_ListPrepend(&pShard->FreeBuffers, pBuffer);
+	} else if(pBuffer->Queue == FF_QUEUE_A1IN) {
+		FF_IOMAN_ListPrepend(&pShard->A1in, pBuffer);
+		pShard->A1inCount++;
+	} else {
+		FF_IOMAN_ListPrepend(&pShard->Am, pBuffer);
+	}
+#else
+	(void) pShard;
+	(void) pBuffer;
+#endif
+}
+
+/**
+ *	@private
+ *	@brief	A victim was filled with a new sector, and handed out with a single handle.
+ *
+ *	@param	bReferenced	FF_TRUE if the sector was recently in the cache. (A 2Q ghost was found).
+ **/
+static void FF_IOMAN_AdmitBuffer(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer, FF_T_BOOL bReferenced) {
+#ifdef FF_CACHE_REPLACE_2Q
+	if(bReferenced || pBuffer->Class == FF_CACHE_CLASS_PINNED) {
+		pBuffer->Queue = FF_QUEUE_AM;	// Joins the LRU list when released.
+	} else {
+		pBuffer->Queue = FF_QUEUE_A1IN;
+		FF_IOMAN_ListAppend(&pShard->A1in, pBuffer);
+		pShard->A1inCount++;
+	}
+#else
+	(void) pShard;
+	(void) pBuffer;
+	(void) bReferenced;
+#endif
+}
+
+#ifdef FF_CACHE_FLUSHER
+#define FF_FLUSH_AGE_TICKS	((FF_FLUSH_DIRTY_AGE + FF_FLUSH_INTERVAL - 1) / FF_FLUSH_INTERVAL)	///< Flusher ticks that a sector may stay dirty.
+#define FF_IOMAN_DIRTY_SHARE(pShard, Percent)	(((FF_T_UINT32) (pShard)->BufferCount * (Percent)) / 100)	///< Dirty buffers allowed in a shard.
+
+/**
+ *	@private
+ *	@brief	Asks the flusher to write back every dirty sector, without waiting for its interval.
+ **/
+static void FF_IOMAN_KickFlusher(FF_IOMAN *pIoman) {
+	FF_PendSemaphore(pIoman->Flusher.pSemaphore);
+	{
+		pIoman->Flusher.bKicked = FF_TRUE;
+		FF_SignalCondition(pIoman->Flusher.pCondition);
+	}
+	FF_ReleaseSemaphore(pIoman->Flusher.pSemaphore);
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Marks a buffer as modified, for a writer.
+ *
+ *	With FF_CACHE_FLUSHER the buffer's age is recorded, and the flusher is woken when the
+ *	shard passes FF_FLUSH_DIRTY_RATIO.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+FF_INLINE void FF_IOMAN_SetModified(FF_IOMAN *pIoman, FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+#ifdef FF_CACHE_FLUSHER
+	if(!pBuffer->Modified) {
+		pBuffer->DirtyTick = pIoman->Flusher.Tick;
+		if(++pShard->DirtyCount == FF_IOMAN_DIRTY_SHARE(pShard, FF_FLUSH_DIRTY_RATIO) + 1 && pIoman->Flusher.pThread) {
+			FF_IOMAN_KickFlusher(pIoman);
+		}
+	}
+#else
+	(void) pIoman;
+	(void) pShard;
+#endif
+	pBuffer->Modified = FF_TRUE;
+}
+
+/**
+ *	@private
+ *	@brief	A modified buffer was written back, or its contents were dropped.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+FF_INLINE void FF_IOMAN_ClearModified(FF_CACHE_SHARD *pShard, FF_BUFFER *pBuffer) {
+#ifdef FF_CACHE_FLUSHER
+	if(pBuffer->Modified) {
+		pShard->DirtyCount--;
+	}
+#else
+	(void) pShard;
+#endif
+	pBuffer->Modified = FF_FALSE;
+}
+
+/**
+ *	@private
+ *	@brief	Drops a line without handles from the cache, without writing it back.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static void FF_IOMAN_ForgetLine(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine) {
+	FF_T_UINT16 i;
+
+	FF_IOMAN_PinBuffer(pShard, pLine);	// Takes it off the replacement lists, like a victim.
+#ifdef FF_CACHE_REPLACE_2Q
+	if(pLine->Queue == FF_QUEUE_A1IN) {
+		FF_IOMAN_ListUnlink(&pShard->A1in, pLine);
+		pShard->A1inCount--;
+	}
+#endif
+	FF_IOMAN_UnindexBuffer(pShard, pLine);
+	pShard->ClassLines[pLine->Class]--;
+	pLine->LineValid = FF_FALSE;
+	pLine->ReadAhead = FF_FALSE;
+	for(i = 0; i < pShard->LineSectors; i++) {
+		pLine[i].Valid		= FF_FALSE;
+		FF_IOMAN_ClearModified(pShard, pLine + i);
+	}
+	FF_IOMAN_ReturnVictim(pShard, pLine);	// An invalid line is re-used first.
+}
+
+/**
+ *	@private
+ *	@brief	Removes every line, and 2Q ghost, of an IOMAN from a pooled cache.
+ *
+ *	Modified sectors are lost, as when the cache is laid out again for a mount.
+ *
+ *	@pre	The IOMAN must not hold any buffers.
+ **/
+static void FF_IOMAN_PurgeLines(FF_IOMAN *pIoman) {
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pLine;
+#ifdef FF_CACHE_REPLACE_2Q
+	FF_BUFFER		*pNext;
+#endif
+
+	for(pShard = pIoman->pShards; pShard < pIoman->pShards + pIoman->ShardCount; pShard++) {
+		FF_IOMAN_PendShard(pShard);
+		{
+			for(pLine = pShard->pBuffers; pLine < pShard->pBuffers + pShard->BufferCount; pLine += pShard->LineSectors) {
+				if(pLine->LineValid && pLine->pOwner == pIoman) {
+					FF_IOMAN_ForgetLine(pShard, pLine);
+				}
+			}
+#ifdef FF_CACHE_REPLACE_2Q
+			for(pLine = pShard->A1out.pHead; pLine; pLine = pNext) {
+				pNext = pLine->pNext;
+				if(pLine->pOwner == pIoman) {
+					FF_IOMAN_RemoveGhost(pShard, pLine);
+				}
+			}
+#endif
+		}
+		FF_ReleaseSemaphore(pShard->pSemaphore);
+	}
+}
+
+/**
+ *	@private
+ *	@brief	qsort() comparison, orders buffer pointers by their sector address.
+ **/
+static int FF_IOMAN_CompareSectors(const void *pA, const void *pB) {
+	FF_T_UINT32 SectorA = (*(FF_BUFFER * const *) pA)->Sector;
+	FF_T_UINT32 SectorB = (*(FF_BUFFER * const *) pB)->Sector;
+
+	if(SectorA < SectorB) {
+		return -1;
+	}
+	return (SectorA > SectorB);
+}
+
+/**
+ *	@private
+ *	@brief		Writes back the modified buffers with no active Handles, that have been dirty for long enough.
+ *
+ *	Modified buffers are written in ascending sector order. Runs of consecutive sectors
+ *	are merged into a single driver write of up to FF_FLUSH_MAX_SECTORS sectors.
+ *	When the cache is pooled, only the sectors of pIoman's device are written.
+ *
+ *	@param		pIoman	IOMAN Object.
+ *	@param		MinAge	Flusher ticks that a buffer must have been dirty for. (0 writes them all).
+ *
+ *	@return		FF_ERR_NONE on Success, or the first error returned by the device driver.
+ *	@return		Buffers that failed to be written stay modified, so a later flush can retry them.
+ **/
+static FF_ERROR FF_IOMAN_FlushDirty(FF_IOMAN *pIoman, FF_T_UINT32 MinAge) {
+
+	FF_BUFFER	*pLine;
+	FF_BUFFER	*pBuffer;
+	FF_BUFFER	*pFirst;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	i, x, nDirty, nRun;
+	FF_T_BOOL	bContiguous;
+	FF_T_SINT32	slRetVal;
+	FF_T_UINT16	s;
+	FF_ERROR	Error = FF_ERR_NONE;
+#ifdef FF_CACHE_FLUSHER
+	FF_T_UINT32	Tick = pIoman->Flusher.Tick;
+#else
+	(void) MinAge;
+#endif
+
+	// Every shard is claimed, in order, so that runs can be merged across shards.
+	for(s = 0; s < pIoman->ShardCount; s++) {
+		FF_IOMAN_PendShard(pIoman->pShards + s);
+	}
+	{
+		nDirty = 0;
+		for(pLine = pIoman->pBuffers; pLine < pIoman->pBuffers + pIoman->CacheSize; pLine += pIoman->LineSectors) {
+			if(!pLine->LineValid || pLine->pOwner != pIoman) {
+				continue;	// Only allocated lines can be modified.
+			}
+			for(pBuffer = pLine; pBuffer < pLine + pIoman->LineSectors; pBuffer++) {
+				if(pBuffer->NumHandles == 0 && pBuffer->Valid && pBuffer->Modified == FF_TRUE) {
+#ifdef FF_CACHE_FLUSHER
+					if(((Tick - pBuffer->DirtyTick) & 0xFFFFFFFF) < MinAge) {
+						continue;	// Recently modified, it may well be modified again.
+					}
+#endif
+					pIoman->pFlushList[nDirty++] = pBuffer;
+				}
+			}
+		}
+
+		if(nDirty > 1) {
+			qsort(pIoman->pFlushList, nDirty, sizeof(FF_BUFFER *), FF_IOMAN_CompareSectors);
+		}
+
+		for(i = 0; i < nDirty; i += nRun) {
+			pFirst		= pIoman->pFlushList[i];
+			bContiguous	= FF_TRUE;
+
+			// Extend the run while the sectors follow on. Buffers that are not neighbours in
+			// memory can only be merged through the staging buffer.
+			for(nRun = 1; (i + nRun) < nDirty && nRun < FF_FLUSH_MAX_SECTORS; nRun++) {
+				pBuffer = pIoman->pFlushList[i + nRun];
+				if(pBuffer->Sector != pFirst->Sector + nRun) {
+					break;
+				}
+				if(pBuffer->pBuffer != pFirst->pBuffer + (nRun * pIoman->BlkSize)) {
+					if(!pIoman->pFlushStaging) {
+						break;
+					}
+					bContiguous = FF_FALSE;
+				}
+			}
+
+			pData = pFirst->pBuffer;
+			if(!bContiguous) {
+				pData = pIoman->pFlushStaging;
+				for(x = 0; x < nRun; x++) {
+					memcpy(pData + (x * pIoman->BlkSize), pIoman->pFlushList[i + x]->pBuffer, pIoman->BlkSize);
+				}
+			}
+
+			slRetVal = FF_BlockWrite(pIoman, pFirst->Sector, nRun, pData, FF_TRUE);
+			FF_AtomicAdd(&pIoman->Stats.WriteBacks, 1);
+			if(FF_isERR(slRetVal)) {
+				if(!FF_isERR(Error)) {
+					Error = slRetVal;
+				}
+				continue;
+			}
+
+			for(x = 0; x < nRun; x++) {
+				// Buffer has now been flushed, mark it as a read buffer and unmodified.
+				pBuffer = pIoman->pFlushList[i + x];
+				pBuffer->Mode = FF_MODE_READ;
+				FF_IOMAN_ClearModified(FF_IOMAN_GetShard(pIoman, pBuffer->Sector), pBuffer);
+			}
+		}
+	}
+	for(s = pIoman->ShardCount; s > 0; s--) {
+		FF_ReleaseSemaphore(pIoman->pShards[s - 1].pSemaphore);
+	}
+
+	return Error;
+}
+
+#ifdef FF_WRITE_FREE_COUNT
+/**
+ *	@private
+ *	@brief	Writes the free cluster count, and the last allocated cluster, to the FSINFO sector if they changed.
+ *
+ *	@return	FF_ERR_NONE on success. On an error the sector stays out of date, for the next flush to retry.
+ **/
+static FF_ERROR FF_IOMAN_FlushFSInfo(FF_IOMAN *pIoman) {
+	FF_PARTITION	*pPart = pIoman->pPartition;
+	FF_BUFFER		*pBuffer;
+
+	if(!pPart->bFSInfoDirty) {
+		return FF_ERR_NONE;
+	}
+	pPart->bFSInfoDirty		= FF_FALSE;	// Cleared first, so a change made while it is written marks it again.
+	pPart->FSInfoUpdates	= 0;
+
+	pBuffer = FF_GetBuffer(pIoman, pPart->FSInfoLBA, FF_MODE_WRITE);
+	if(!pBuffer) {
+		pPart->bFSInfoDirty = FF_TRUE;
+		return FF_ERR_DEVICE_DRIVER_FAILED | FF_FLUSHCACHE;
+	}
+	if(FF_getLong(pBuffer->pBuffer, 0) == 0x41615252 && FF_getLong(pBuffer->pBuffer, 484) == 0x61417272) {
+		// FSINFO sector magic nums we're verified. Safe to write.
+		FF_putLong(pBuffer->pBuffer, 488, pPart->FreeClusterCount);
+		FF_putLong(pBuffer->pBuffer, 492, pPart->LastFreeCluster);
+	}
+
+	return FF_ReleaseBuffer(pIoman, pBuffer);
+}
+
+/**
+ *	@private
+ *	@brief	Notes a change of the free cluster count. The FSINFO sector, (only FAT32 has one), is written
+ *			by the next flush, or once FF_FSINFO_UPDATE_INTERVAL changes have been made.
+ **/
+static FF_ERROR FF_IOMAN_FSInfoChanged(FF_IOMAN *pIoman) {
+	if(pIoman->pPartition->Type != FF_T_FAT32) {
+		return FF_ERR_NONE;
+	}
+	pIoman->pPartition->bFSInfoDirty = FF_TRUE;
+#if FF_FSINFO_UPDATE_INTERVAL > 0
+	if(++pIoman->pPartition->FSInfoUpdates >= FF_FSINFO_UPDATE_INTERVAL) {
+		return FF_IOMAN_FlushFSInfo(pIoman);
+	}
+#endif
+
+	return FF_ERR_NONE;
+}
+#endif
+
+/**
+ *	@private
+ *	@brief		Flushes all Write cache buffers with no active Handles.
+ *
+ *	A changed free cluster count is written to the FSINFO sector first, (with FF_WRITE_FREE_COUNT).
+ *	With FF_FAT_MIRROR, the modified sectors of the FAT mirror are written next. With
+ *	FF_MIRROR_FATS_UMOUNT, the other FATs are brought up to date with the first one last.
+ *
+ *	@param		pIoman	IOMAN Object.
+ *
+ *	@return		FF_ERR_NONE on Success, or the first error returned by the device driver.
+ *	@return		Buffers that failed to be written stay modified, so a later flush can retry them.
+ **/
+FF_ERROR FF_FlushCache(FF_IOMAN *pIoman) {
+	FF_ERROR Error = FF_ERR_NONE, FlushError;
+
+	if(!pIoman) {
+		return FF_ERR_NULL_POINTER | FF_FLUSHCACHE;
+	}
+
+#ifdef FF_WRITE_FREE_COUNT
+	Error = FF_IOMAN_FlushFSInfo(pIoman);	// Into the cache, to be written with the rest.
+#endif
+
+#ifdef FF_FAT12_DECODE
+	FlushError = FF_FlushFat12Table(pIoman);
+	if(!FF_isERR(Error)) {
+		Error = FlushError;
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	FlushError = FF_FlushFatMirror(pIoman);
+	if(!FF_isERR(Error)) {
+		Error = FlushError;
+	}
+#endif
+
+	FlushError = FF_IOMAN_FlushDirty(pIoman, 0);
+	if(!FF_isERR(Error)) {
+		Error = FlushError;
+	}
+
+#ifdef FF_MIRROR_FATS_UMOUNT
+	FlushError = FF_SyncFatCopies(pIoman);
+	if(!FF_isERR(Error)) {
+		Error = FlushError;
+	}
+#endif
+
+	return Error;
+}
+
+#ifdef FF_CACHE_FLUSHER
+/**
+ *	@private
+ *	@brief	The flusher thread, writes back old dirty sectors once every FF_FLUSH_INTERVAL.
+ *
+ *	A kick from a writer flushes every dirty sector at once. Sectors are aged in flusher
+ *	ticks, so the clock only advances when an interval passes without a kick.
+ **/
+static void FF_IOMAN_Flusher(void *pParam) {
+	FF_IOMAN	*pIoman = (FF_IOMAN *) pParam;
+	FF_FLUSHER	*pFlusher = &pIoman->Flusher;
+	FF_T_BOOL	bKicked;
+
+	FF_PendSemaphore(pFlusher->pSemaphore);
+	while(!pFlusher->bStop) {
+		if(!pFlusher->bKicked) {
+			if(!FF_WaitCondition(pFlusher->pCondition, pFlusher->pSemaphore, FF_FLUSH_INTERVAL)) {
+				pFlusher->Tick++;
+			}
+			if(pFlusher->bStop) {
+				break;
+			}
+		}
+		bKicked = pFlusher->bKicked;
+		pFlusher->bKicked = FF_FALSE;
+		FF_ReleaseSemaphore(pFlusher->pSemaphore);
+
+		// Errors are left to the next pass, or to FF_FlushCache(), as the sectors stay modified.
+		FF_IOMAN_FlushDirty(pIoman, bKicked ? 0 : FF_FLUSH_AGE_TICKS);
+		FF_AtomicAdd(&pIoman->Stats.FlusherPasses, 1);
+
+		FF_PendSemaphore(pFlusher->pSemaphore);
+		FF_SignalCondition(pFlusher->pFlushed);
+	}
+	FF_ReleaseSemaphore(pFlusher->pSemaphore);
+}
+
+/**
+ *	@private
+ *	@brief	Starts the flusher thread for a mounted partition.
+ *
+ *	Without thread support in ff_safety.c dirty sectors are only written by FF_FlushCache(),
+ *	and by writers at FF_FLUSH_DIRTY_LIMIT.
+ **/
+static void FF_IOMAN_StartFlusher(FF_IOMAN *pIoman) {
+	if(pIoman->Flusher.pThread || !pIoman->Flusher.pSemaphore) {
+		return;
+	}
+	pIoman->Flusher.Tick	= 0;
+	pIoman->Flusher.bKicked	= FF_FALSE;
+	pIoman->Flusher.bStop	= FF_FALSE;
+	pIoman->Flusher.pThread	= FF_CreateThread(FF_IOMAN_Flusher, pIoman);
+}
+
+/**
+ *	@private
+ *	@brief	Stops the flusher thread, and waits for its last pass to finish.
+ **/
+static void FF_IOMAN_StopFlusher(FF_IOMAN *pIoman) {
+	if(!pIoman->Flusher.pThread) {
+		return;
+	}
+	FF_PendSemaphore(pIoman->Flusher.pSemaphore);
+	{
+		pIoman->Flusher.bStop = FF_TRUE;
+		FF_SignalCondition(pIoman->Flusher.pCondition);
+	}
+	FF_ReleaseSemaphore(pIoman->Flusher.pSemaphore);
+
+	FF_JoinThread(pIoman->Flusher.pThread);
+	pIoman->Flusher.pThread = NULL;
+}
+
+/**
+ *	@private
+ *	@brief	Holds back a writer while its shard has more than FF_FLUSH_DIRTY_LIMIT dirty buffers.
+ *
+ *	The writer waits for one pass of the flusher, and writes back the cache itself if that
+ *	was not enough (or there is no flusher thread).
+ *
+ *	@pre	No cache semaphore may be held by the caller.
+ **/
+static void FF_IOMAN_ThrottleWriter(FF_IOMAN *pIoman, FF_CACHE_SHARD *pShard) {
+	FF_T_UINT32 Limit = FF_IOMAN_DIRTY_SHARE(pShard, FF_FLUSH_DIRTY_LIMIT);
+
+	if(pShard->DirtyCount <= Limit) {	// Read without the semaphore, it is only a hint.
+		return;
+	}
+	FF_AtomicAdd(&pIoman->Stats.WriterThrottles, 1);
+
+	if(pIoman->Flusher.pThread) {
+		FF_PendSemaphore(pIoman->Flusher.pSemaphore);
+		{
+			pIoman->Flusher.bKicked = FF_TRUE;
+			FF_SignalCondition(pIoman->Flusher.pCondition);
+			FF_WaitCondition(pIoman->Flusher.pFlushed, pIoman->Flusher.pSemaphore, FF_FLUSH_INTERVAL);
+		}
+		FF_ReleaseSemaphore(pIoman->Flusher.pSemaphore);
+	}
+
+	if(pShard->DirtyCount > Limit) {
+		FF_IOMAN_FlushDirty(pIoman, 0);	// Not FF_FlushCache(), the writer may hold the FAT lock.
+	}
+}
+#endif
+
+/**
+ *	@private
+ *	@brief	Writes back the modified sectors of a cache line that is about to be replaced.
+ *
+ *	Modified sectors that are neighbours are also neighbours in memory, so each run
+ *	of them takes a single driver write.
+ *
+ *	@return	The error from the device driver, or FF_ERR_NONE. Sectors that were not written stay modified.
+ **/
+static FF_T_SINT32 FF_IOMAN_WriteLine(FF_IOMAN *pIoman, FF_CACHE_SHARD *pShard, FF_BUFFER *pLine) {
+	FF_T_UINT16	i, x, nRun;
+	FF_T_SINT32	slRetVal;
+
+	for(i = 0; i < pIoman->LineSectors; i += nRun) {
+		for(nRun = 0; (i + nRun) < pIoman->LineSectors && pLine[i + nRun].Modified == FF_TRUE; nRun++);
+		if(!nRun) {
+			nRun = 1;
+			continue;
+		}
+		// Along with the FF_TRUE parameter to indicate semapahore has been claimed
+		slRetVal = FF_BlockWrite(pIoman, pLine[i].Sector, nRun, pLine[i].pBuffer, FF_TRUE);
+		FF_AtomicAdd(&pIoman->Stats.WriteBacks, 1);
+		if(slRetVal < 0) {
+			return slRetVal;
+		}
+		for(x = 0; x < nRun; x++) {
+			FF_IOMAN_ClearModified(pShard, pLine + i + x);
+		}
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Loads a newly allocated cache line, with a single driver read.
+ *
+ *	The read stops at the end of the partition. If the device can't read the whole line,
+ *	only the requested sector is read, and the rest of the line is left invalid. Sectors
+ *	that are still invalid are read on their own, the first time they are requested.
+ *
+ *	@param	Sector	The sector that was requested, it is always made valid.
+ *	@param	Mode	FF_MODE_WR_ONLY sectors are cleared instead of read, along with the rest of the line.
+ *
+ *	@return	The error from the device driver, or FF_ERR_NONE.
+ **/
+static FF_T_SINT32 FF_IOMAN_FillLine(FF_IOMAN *pIoman, FF_BUFFER *pLine, FF_T_UINT32 Sector, FF_T_UINT8 Mode) {
+	FF_BUFFER	*pBuffer	= pLine + (Sector - pLine->Sector);
+	FF_T_UINT32	nSectors	= pIoman->LineSectors;
+	FF_T_UINT32	EndLBA;
+	FF_T_UINT32	i;
+	FF_T_SINT32	slRetVal;
+
+	if(Mode == FF_MODE_WR_ONLY) {
+		// The sector is about to be overwritten, so neither it nor its neighbours are read.
+		memset (pBuffer->pBuffer, '\0', pIoman->BlkSize);
+		pBuffer->Valid = FF_TRUE;
+		return FF_ERR_NONE;
+	}
+
+	if(pIoman->pPartition->TotalSectors) {
+		EndLBA = pIoman->pPartition->TotalSectors + pIoman->pPartition->BeginLBA;
+		if(Sector < EndLBA && (pLine->Sector + nSectors) > EndLBA) {
+			nSectors = EndLBA - pLine->Sector;
+		}
+	}
+
+	if(nSectors > 1) {
+		slRetVal = FF_BlockRead(pIoman, pLine->Sector, nSectors, pLine->pBuffer, FF_TRUE);
+		if(slRetVal >= 0) {
+			for(i = 0; i < nSectors; i++) {
+				pLine[i].Valid = FF_TRUE;
+			}
+			return FF_ERR_NONE;
+		}
+	}
+
+	slRetVal = FF_BlockRead(pIoman, Sector, 1, pBuffer->pBuffer, FF_TRUE);
+	if(slRetVal < 0) {
+		return slRetVal;
+	}
+	pBuffer->Valid = FF_TRUE;
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Read less ahead, because a line that was read ahead was never requested.
+ **/
+static void FF_IOMAN_ShrinkWindow(FF_IOMAN *pIoman) {
+	FF_READAHEAD *pReadAhead = &pIoman->ReadAhead;
+
+	FF_PendSemaphore(pReadAhead->pSemaphore);
+	{
+		pReadAhead->Window = (pReadAhead->Window / 2) & ~((FF_T_UINT32) pIoman->LineSectors - 1);
+		if(pReadAhead->Window < pIoman->LineSectors) {
+			pReadAhead->Window = pIoman->LineSectors;
+		}
+	}
+	FF_ReleaseSemaphore(pReadAhead->pSemaphore);
+}
+
+/**
+ *	@private
+ *	@brief	Frees a victim line, writing back its modified sectors first.
+ *
+ *	In a pooled cache the line may belong to another IOMAN, so it is written through its owner's device.
+ *
+ *	@return	The error from the device driver, or FF_ERR_NONE. The line is left allocated on error.
+ *
+ *	@pre	This function must be wrapped with the shard's semaphore.
+ **/
+static FF_T_SINT32 FF_IOMAN_DropLine(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine) {
+	FF_T_SINT32 slRetVal;
+
+	if(!pLine->LineValid) {
+		return FF_ERR_NONE;
+	}
+
+	slRetVal = FF_IOMAN_WriteLine(pLine->pOwner, pShard, pLine);
+	if(slRetVal < 0) {
+		return slRetVal;
+	}
+	FF_IOMAN_UnindexBuffer(pShard, pLine);
+	pLine->LineValid = FF_FALSE;
+	pShard->ClassLines[pLine->Class]--;
+	pShard->Stats.Evictions++;
+	FF_IOMAN_EvictBuffer(pShard, pLine);
+
+	if(pLine->ReadAhead) {
+		pLine->ReadAhead = FF_FALSE;
+		pShard->Stats.ReadAheadWasted++;
+		FF_IOMAN_ShrinkWindow(pLine->pOwner);
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Counts a request for a line that was found in the cache.
+ **/
+FF_INLINE void FF_IOMAN_CountHit(FF_CACHE_SHARD *pShard, FF_BUFFER *pLine) {
+	pShard->Stats.CacheHits[pLine->Class]++;
+	if(pLine->ReadAhead) {
+		pLine->ReadAhead = FF_FALSE;
+		pShard->Stats.ReadAheadHits++;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Records a cache miss, and decides whether to read ahead of it.
+ *
+ *	A miss on the line that follows a recent miss continues that stream, and the window
+ *	grows, as the whole of the last one was used. Other misses start a new stream, in place
+ *	of the oldest one.
+ *
+ *	@param	LineLBA		First sector of the line that missed.
+ *	@param	pStartLBA	Receives the first sector to read ahead.
+ *
+ *	@return	Number of sectors to read ahead, 0 for none. Otherwise the caller owns the staging
+ *	@return	buffer, and must pass it on to FF_IOMAN_ReadAhead().
+ *
+ *	@pre	This function must be wrapped with the semaphore of LineLBA's shard.
+ **/
+static FF_T_UINT32 FF_IOMAN_DetectStream(FF_IOMAN *pIoman, FF_T_UINT32 LineLBA, FF_T_UINT32 *pStartLBA) {
+	FF_READAHEAD	*pReadAhead	= &pIoman->ReadAhead;
+	FF_T_UINT32		MaxWindow	= pReadAhead->MaxSectors & ~((FF_T_UINT32) pIoman->LineSectors - 1);
+	FF_T_UINT32		EndLBA		= pIoman->pPartition->TotalSectors + pIoman->pPartition->BeginLBA;
+	FF_T_UINT32		nSectors	= 0;
+	FF_T_UINT16		i;
+
+	if(!MaxWindow || !pIoman->pPartition->PartitionMounted) {
+		return 0;	// Disabled, or the partition's bounds are not known yet.
+	}
+
+	FF_PendSemaphore(pReadAhead->pSemaphore);
+	{
+		for(i = 0; i < FF_READAHEAD_STREAMS && pReadAhead->NextLBA[i] != LineLBA; i++);
+		if(i == FF_READAHEAD_STREAMS) {
+			i = pReadAhead->NextStream;
+			pReadAhead->NextStream = (FF_T_UINT16) ((i + 1) % FF_READAHEAD_STREAMS);
+		} else if(!pReadAhead->Busy) {
+			*pStartLBA = LineLBA + pIoman->LineSectors;
+			if(*pStartLBA < EndLBA) {
+				nSectors = pReadAhead->Window;
+				if(nSectors > EndLBA - *pStartLBA) {
+					nSectors = EndLBA - *pStartLBA;
+				}
+				pReadAhead->Busy = FF_TRUE;
+				// The stream is next expected to miss just after the lines read ahead.
+				pReadAhead->NextLBA[i] = *pStartLBA + pReadAhead->Window;
+				if(pReadAhead->Window < MaxWindow) {
+					pReadAhead->Window *= 2;
+					if(pReadAhead->Window > MaxWindow) {
+						pReadAhead->Window = MaxWindow;
+					}
+				}
+			}
+		}
+		if(!nSectors) {
+			pReadAhead->NextLBA[i] = LineLBA + pIoman->LineSectors;
+		}
+	}
+	FF_ReleaseSemaphore(pReadAhead->pSemaphore);
+
+	return nSectors;
+}
+
+/**
+ *	@private
+ *	@brief	Claims, or releases, the semaphore of every shard holding a line of a sector range.
+ *
+ *	Shards are claimed in ascending order, like FF_FlushCache() does.
+ **/
+static void FF_IOMAN_ClaimShards(FF_IOMAN *pIoman, FF_T_UINT32 StartLBA, FF_T_UINT32 nSectors, FF_T_BOOL bClaim) {
+	FF_CACHE_SHARD	*pShard;
+	FF_T_UINT32		LineLBA;
+
+	for(pShard = pIoman->pShards; pShard < pIoman->pShards + pIoman->ShardCount; pShard++) {
+		for(LineLBA = StartLBA; LineLBA < StartLBA + nSectors; LineLBA += pIoman->LineSectors) {
+			if(FF_IOMAN_GetShard(pIoman, LineLBA) == pShard) {
+				if(bClaim) {
+					FF_IOMAN_PendShard(pShard);
+				} else {
+					FF_ReleaseSemaphore(pShard->pSemaphore);
+				}
+				break;
+			}
+		}
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Reads the lines following a stream of misses, with a single driver call.
+ *
+ *	Only the span of lines that are not cached is read. Lines that were read ahead go
+ *	on probation like any new line, but without a handle. Read-ahead is only a hint,
+ *	so lines that can't be replaced are skipped, and errors are ignored.
+ *
+ *	The shards stay claimed from the read until the lines are filled, so direct transfers
+ *	(FF_IOMAN_SyncDirect()) can't slip in between, and leave stale lines behind.
+ *
+ *	@param	StartLBA	First sector to read ahead, as given by FF_IOMAN_DetectStream(). (Aligned to the line size).
+ *	@param	nSectors	Number of sectors to read ahead.
+ *	@param	Mode		Mode of the request that continued the stream, it tells directory sectors apart.
+ *
+ *	@pre	The caller must not hold any shard's semaphore.
+ **/
+static void FF_IOMAN_ReadAhead(FF_IOMAN *pIoman, FF_T_UINT32 StartLBA, FF_T_UINT32 nSectors, FF_T_UINT8 Mode) {
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pLine;
+	FF_T_UINT8		*pData;
+	FF_T_UINT32		LineLBA, FirstLBA = 0, EndLBA = 0;
+	FF_T_UINT16		i;
+	FF_T_UINT8		Class;
+
+	FF_IOMAN_ClaimShards(pIoman, StartLBA, nSectors, FF_TRUE);
+	{
+		for(LineLBA = StartLBA; LineLBA < StartLBA + nSectors; LineLBA += pIoman->LineSectors) {
+			if(!FF_IOMAN_FindBuffer(FF_IOMAN_GetShard(pIoman, LineLBA), pIoman, LineLBA)) {
+				if(!EndLBA) {
+					FirstLBA = LineLBA;
+				}
+				EndLBA = LineLBA + pIoman->LineSectors;
+			}
+		}
+		if(EndLBA > StartLBA + nSectors) {
+			EndLBA = StartLBA + nSectors;	// The partition ends inside the last line.
+		}
+
+		if(EndLBA) {
+			FF_AtomicAdd(&pIoman->Stats.ReadAheads, 1);
+		}
+		if(EndLBA && FF_BlockRead(pIoman, FirstLBA, EndLBA - FirstLBA, pIoman->ReadAhead.pStaging, FF_TRUE) >= 0) {
+			for(LineLBA = FirstLBA; LineLBA < EndLBA; LineLBA += pIoman->LineSectors) {
+				pShard = FF_IOMAN_GetShard(pIoman, LineLBA);
+				if(FF_IOMAN_FindBuffer(pShard, pIoman, LineLBA)) {
+					continue;
+				}
+				Class = FF_IOMAN_ClassifySector(pIoman, LineLBA, Mode);
+				pLine = FF_IOMAN_SelectVictim(pShard, Class);
+				if(!pLine) {
+					continue;
+				}
+				if(FF_IOMAN_DropLine(pShard, pLine) < 0) {
+					FF_IOMAN_ReturnVictim(pShard, pLine);
+					continue;
+				}
+				pData = pIoman->ReadAhead.pStaging + ((LineLBA - FirstLBA) * pIoman->BlkSize);
+				for(i = 0; i < pIoman->LineSectors; i++) {
+					pLine[i].Sector		= LineLBA + i;
+					pLine[i].Mode		= FF_MODE_READ;
+					pLine[i].Modified	= FF_FALSE;
+					pLine[i].Valid		= (LineLBA + i) < EndLBA;
+					if(pLine[i].Valid) {
+						memcpy(pLine[i].pBuffer, pData + (i * pIoman->BlkSize), pIoman->BlkSize);
+					}
+				}
+				pLine->Persistance	= 0;
+				pLine->LRU			= 0;
+				pLine->LineValid	= FF_TRUE;
+				pLine->ReadAhead	= FF_TRUE;
+				pLine->pOwner		= pIoman;
+				FF_IOMAN_SetLineClass(pShard, pLine, Class);
+
+				FF_IOMAN_IndexBuffer(pShard, pLine);
+				FF_IOMAN_AdmitBuffer(pShard, pLine, FF_FALSE);
+				FF_IOMAN_UnpinBuffer(pShard, pLine);	// It has no handles, so it can be replaced straight away.
+			}
+		}
+	}
+	FF_IOMAN_ClaimShards(pIoman, StartLBA, nSectors, FF_FALSE);
+
+	FF_PendSemaphore(pIoman->ReadAhead.pSemaphore);
+	pIoman->ReadAhead.Busy = FF_FALSE;
+	FF_ReleaseSemaphore(pIoman->ReadAhead.pSemaphore);
+}
+
+/*
+	A new version of FF_GetBuffer() with a simple mechanism for timeout.
+	A thread that finds the sector in use, or every buffer of its shard in use, sleeps on the shard's condition
+	until FF_ReleaseBuffer() frees a buffer. It gives up if nothing is released for FF_GETBUFFER_TIMEOUT ms.
+
+	The returned buffer describes the requested sector, inside a cache line of LineSectors sectors.
+	Directory sectors are requested with FF_MODE_DIR added to the Mode, so that they count against the directory quota.
+*/
+
+FF_BUFFER *FF_GetBuffer(FF_IOMAN *pIoman, FF_T_UINT32 Sector, FF_T_UINT8 Mode) {
+	FF_BUFFER	*pBufLRU;
+	FF_BUFFER	*pBufLine;
+//	FF_BUFFER	*pBufLHITS = NULL;  // Wasn't use anymore?
+	FF_BUFFER	*pBufMatch = NULL;
+	FF_T_SINT32	RetVal;
+	FF_T_UINT32	LineLBA;
+	FF_T_UINT32	ReadAheadLBA = 0;
+	FF_T_UINT32	nReadAhead = 0;
+	FF_T_UINT16	i;
+	FF_T_BOOL	bReferenced = FF_FALSE;
+	FF_T_BOOL	bSignalled;
+	FF_T_UINT8	Class;
+	FF_T_UINT8	DirHint;
+#ifdef FF_STATS_TIMING
+	FF_T_UINT32	WaitStart;
+#endif
+	FF_CACHE_SHARD	*pShard;
+
+	FF_T_INT cacheSize = pIoman->CacheSize;
+	if (cacheSize <= 0) {
+		return NULL;
+	}
+
+	Class	= FF_IOMAN_ClassifySector(pIoman, Sector, Mode);
+	DirHint	= (FF_T_UINT8) (Mode & FF_MODE_DIR);
+	Mode	&= ~FF_MODE_DIR;
+
+	LineLBA	= Sector - (Sector & (pIoman->LineSectors - 1));
+	pShard	= FF_IOMAN_GetShard(pIoman, Sector);
+
+#ifdef FF_CACHE_FLUSHER
+	if((Mode & FF_MODE_WRITE) != 0) {
+		FF_IOMAN_ThrottleWriter(pIoman, pShard);
+	}
+#endif
+
+	FF_IOMAN_PendShard(pShard);
+	while(!pBufMatch) {
+		{
+
+			pBufLine = FF_IOMAN_FindBuffer(pShard, pIoman, LineLBA);
+#ifdef FF_CACHE_REPLACE_2Q
+			if(pBufLine && pBufLine->Queue == FF_QUEUE_GHOST) {
+				// The line was on probation not long ago, so this is a re-reference.
+				FF_IOMAN_RemoveGhost(pShard, pBufLine);
+				pBufLine	= NULL;
+				bReferenced	= FF_TRUE;
 			}
+#endif
 
-			if(pBufMatch) {
+			if(pBufLine) {
 				// A Match was found process!
+				FF_IOMAN_ChangeLineClass(pShard, pBufLine, Class);
+				pBufMatch = pBufLine + (Sector - LineLBA);
+				if(!pBufMatch->Valid) {
+					// The line was loaded without this sector, it can't have any handles.
+					if (Mode == FF_MODE_WR_ONLY) {
+						memset (pBufMatch->pBuffer, '\0', pIoman->BlkSize);
+					} else {
+						RetVal = FF_BlockRead(pIoman, Sector, 1, pBufMatch->pBuffer, FF_TRUE);
+						if (RetVal < 0) {
+							pBufMatch = NULL;
+							break;
+						}
+					}
+					pBufMatch->Valid = FF_TRUE;
+				}
+
 				if(Mode == FF_MODE_READ && pBufMatch->Mode == FF_MODE_READ) {
+					if(pBufLine->LineHandles++ == 0) {
+						FF_IOMAN_PinBuffer(pShard, pBufLine);
+					}
 					pBufMatch->NumHandles += 1;
-					pBufMatch->Persistance += 1;
+					pBufLine->Persistance += 1;
+					FF_IOMAN_CountHit(pShard, pBufLine);
 					break;
 				}
 
 				if(pBufMatch->NumHandles == 0) {
 					pBufMatch->Mode = (Mode & FF_MODE_RD_WR);
 					if((Mode & FF_MODE_WRITE) != 0) {	// This buffer has no attached handles.
-						pBufMatch->Modified = FF_TRUE;
+						FF_IOMAN_SetModified(pIoman, pShard, pBufMatch);
+					}
+					if(pBufLine->LineHandles++ == 0) {
+						FF_IOMAN_PinBuffer(pShard, pBufLine);
 					}
 					pBufMatch->NumHandles = 1;
-					pBufMatch->Persistance += 1;
+					pBufLine->Persistance += 1;
+					FF_IOMAN_CountHit(pShard, pBufLine);
 					break;
 				}
 
 				pBufMatch = NULL;	// Sector is already in use, keep yielding until its available!
 
 			} else {
-				pBufLRU   = NULL;	// So put them to NULL here
-
-				for(pBuffer = pIoman->pBuffers; pBuffer < pIoman->pBuffers + cacheSize; pBuffer++) {
-					if(pBuffer->NumHandles)
-						continue;  // Occupied
-					pBuffer->LRU += 1;
-
-					if(!pBufLRU) {
-						pBufLRU = pBuffer;
-					}
-
-					if(pBuffer->LRU > pBufLRU->LRU ||
-					   (pBuffer->LRU == pBufLRU->LRU && pBuffer->Persistance > pBufLRU->Persistance)) {
-						pBufLRU = pBuffer;
-					}
-
-				}
-				// Choose a suitable buffer!
+				// Choose a suitable line!
+				pBufLRU = FF_IOMAN_SelectVictim(pShard, Class);
 				if(pBufLRU) {
 					// Process the suitable candidate.
-					if(pBufLRU->Modified == FF_TRUE) {
-						// Along with the FF_TRUE parameter to indicate semapahore has been claimed
-
-						RetVal = FF_BlockWrite(pIoman, pBufLRU->Sector, 1, pBufLRU->pBuffer, FF_TRUE);
-						if (RetVal < 0) {
-							pBufMatch = NULL;
-							break;
-						}
+					RetVal = FF_IOMAN_DropLine(pShard, pBufLRU);
+					if (RetVal < 0) {
+						FF_IOMAN_ReturnVictim(pShard, pBufLRU);
+						pBufMatch = NULL;
+						break;
 					}
-					if (Mode == FF_MODE_WR_ONLY) {
-						memset (pBufLRU->pBuffer, '\0', pIoman->BlkSize);
-					} else {
-						RetVal = FF_BlockRead(pIoman, Sector, 1, pBufLRU->pBuffer, FF_TRUE);
-						if (RetVal < 0) {
-							pBufMatch = NULL;
-							break;
-						}
+					for(i = 0; i < pIoman->LineSectors; i++) {
+						pBufLRU[i].Sector	= LineLBA + i;
+						pBufLRU[i].Mode		= FF_MODE_READ;
+						pBufLRU[i].Modified	= FF_FALSE;
+						pBufLRU[i].Valid	= FF_FALSE;
+					}
+					RetVal = FF_IOMAN_FillLine(pIoman, pBufLRU, Sector, Mode);
+					if (RetVal < 0) {
+						FF_IOMAN_ReturnVictim(pShard, pBufLRU);	// Contents were lost, the line stays invalid.
+						pBufMatch = NULL;
+						break;
 					}
-					pBufLRU->Mode = (Mode & FF_MODE_RD_WR);
 					pBufLRU->Persistance = 1;
 					pBufLRU->LRU = 0;
-					pBufLRU->NumHandles = 1;
-					pBufLRU->Sector = Sector;
+					pBufLRU->LineHandles = 1;
+					pBufLRU->LineValid = FF_TRUE;
+					pBufLRU->pOwner = pIoman;
+					FF_IOMAN_SetLineClass(pShard, pBufLRU, Class);
+
+					pBufMatch = pBufLRU + (Sector - LineLBA);
+					pBufMatch->Mode = (Mode & FF_MODE_RD_WR);
+					pBufMatch->NumHandles = 1;
+					if((Mode & FF_MODE_WRITE) != 0) {
+						FF_IOMAN_SetModified(pIoman, pShard, pBufMatch);
+					}
 
-					pBufLRU->Modified = (Mode & FF_MODE_WRITE) != 0;
+					FF_IOMAN_IndexBuffer(pShard, pBufLRU);
+					FF_IOMAN_AdmitBuffer(pShard, pBufLRU, bReferenced);
 
-					pBufLRU->Valid = FF_TRUE;
-					pBufMatch = pBufLRU;
+					pShard->Stats.CacheMisses[Class]++;
+					if(Mode != FF_MODE_WR_ONLY) {
+						nReadAhead = FF_IOMAN_DetectStream(pIoman, LineLBA, &ReadAheadLBA);
+					}
 					break;
 				}
 
 			}
 		}
-		FF_ReleaseSemaphore(pIoman->pSemaphore);
-		// Better to go asleep to give low-priority task a chance to release buffer(s)
-		FF_Sleep (FF_GETBUFFER_SLEEP_TIME);
+		// Sleep until another task releases a buffer.
+		pShard->Waiters++;
+		pShard->Stats.BufferWaits++;
+#ifdef FF_STATS_TIMING
+		WaitStart = FF_GetMicroseconds();
+#endif
+		bSignalled = FF_WaitCondition(pShard->pCondition, pShard->pSemaphore, FF_GETBUFFER_TIMEOUT);
+#ifdef FF_STATS_TIMING
+		pShard->Stats.BufferWaitTime += (FF_GetMicroseconds() - WaitStart) & 0xFFFFFFFF;
+#endif
+		pShard->Waiters--;
+		if(!bSignalled) {
+			//
+			// *pError = FF_ERR_IOMAN_GETBUFFER_TIMEOUT;
+			//
+			break;
+		}
 	}	// while(!pBufMatch)
-	FF_ReleaseSemaphore(pIoman->pSemaphore);
+	FF_ReleaseSemaphore(pShard->pSemaphore);
+
+	if(nReadAhead) {
+		FF_IOMAN_ReadAhead(pIoman, ReadAheadLBA, nReadAhead, DirHint);
+	}
 
 	return pBufMatch;	// Return the Matched Buffer!
 }
@@ -456,25 +2171,34 @@ FF_BUFFER *FF_GetBuffer(FF_IOMAN *pIoman, FF_T_UINT32 Sector, FF_T_UINT8 Mode) {
  **/
 FF_ERROR FF_ReleaseBuffer(FF_IOMAN *pIoman, FF_BUFFER *pBuffer) {
 	FF_ERROR Error = FF_ERR_NONE;
+	FF_CACHE_SHARD *pShard = FF_IOMAN_GetShard(pIoman, pBuffer->Sector);	// The sector can't change while a handle is held.
+	FF_BUFFER *pLine = FF_IOMAN_LINE_HEAD(pIoman, pBuffer);
 
 	// Protect description changes with a semaphore.
-	FF_PendSemaphore(pIoman->pSemaphore);
+	FF_IOMAN_PendShard(pShard);
 	{
 		if (pBuffer->NumHandles) {
 			pBuffer->NumHandles--;
+			if(!--pLine->LineHandles) {
+				FF_IOMAN_UnpinBuffer(pShard, pLine);
+			}
+			if(!pBuffer->NumHandles && pShard->Waiters) {
+				FF_SignalCondition(pShard->pCondition);
+			}
 		} else {
 			//printf ("FF_ReleaseBuffer: buffer not claimed\n");
 		}
 #ifdef FF_CACHE_WRITE_THROUGH
 		if(pBuffer->Modified == FF_TRUE) {
 			Error = FF_BlockWrite(pIoman, pBuffer->Sector, 1, pBuffer->pBuffer, FF_TRUE);
+			pShard->Stats.WriteBacks++;
 			if(!FF_isERR(Error)) {				// Ensure if an error occurs its still possible to write the block again.
 				pBuffer->Modified = FF_FALSE;
 			}
 		}
 #endif
 	}
-	FF_ReleaseSemaphore(pIoman->pSemaphore);
+	FF_ReleaseSemaphore(pShard->pSemaphore);
 
 	return Error;
 }
@@ -529,6 +2253,53 @@ FF_ERROR FF_RegisterBlkDevice(FF_IOMAN *pIoman, FF_T_UINT16 BlkSize, FF_WRITE_BL
 	return FF_ERR_NONE;	// Success
 }
 
+/**
+ *	@private
+ *	@brief	Keeps the cache coherent with a transfer that bypassed it.
+ *
+ *	After a direct write, cached copies of the sectors take on the new contents.
+ *	After a direct read, sectors that are still dirty in the cache replace the stale data read from the device.
+ *
+ *	@param	bWritten	FF_TRUE if pData was written to the device, FF_FALSE if it was read.
+ **/
+static void FF_IOMAN_SyncDirect(FF_IOMAN *pIoman, FF_T_UINT32 ulSectorLBA, FF_T_UINT32 ulNumSectors, FF_T_UINT8 *pData, FF_T_BOOL bWritten) {
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pBuffer;
+	FF_T_UINT8		*pSector;
+	FF_T_UINT32		i, LineLBA;
+
+	// Each shard is claimed once, and checked for the sectors that belong to it.
+	for(pShard = pIoman->pShards; pShard < pIoman->pShards + pIoman->ShardCount; pShard++) {
+		FF_IOMAN_PendShard(pShard);
+		{
+			for(i = 0, pSector = pData; i < ulNumSectors; i++, pSector += pIoman->BlkSize) {
+				if(pIoman->ShardCount > 1 && FF_IOMAN_GetShard(pIoman, ulSectorLBA + i) != pShard) {
+					continue;
+				}
+				LineLBA = (ulSectorLBA + i) - ((ulSectorLBA + i) & (pIoman->LineSectors - 1));
+				pBuffer = FF_IOMAN_FindBuffer(pShard, pIoman, LineLBA);
+				if(!pBuffer || !pBuffer->LineValid) {
+					continue;
+				}
+				pBuffer += (ulSectorLBA + i) - LineLBA;
+				if(pBuffer->pBuffer == pSector) {
+					continue;
+				}
+				if(bWritten) {
+					memcpy(pBuffer->pBuffer, pSector, pIoman->BlkSize);
+					pBuffer->Valid = FF_TRUE;
+					if(!pBuffer->NumHandles) {
+						FF_IOMAN_ClearModified(pShard, pBuffer);	// The device now holds these contents.
+					}
+				} else if(pBuffer->Valid && pBuffer->Modified) {
+					memcpy(pSector, pBuffer->pBuffer, pIoman->BlkSize);
+				}
+			}
+		}
+		FF_ReleaseSemaphore(pShard->pSemaphore);
+	}
+}
+
 /*
 	New Interface for FullFAT to read blocks.
 */
@@ -548,6 +2319,42 @@ FF_T_SINT32 FF_BlockRead(FF_IOMAN *pIoman, FF_T_UINT32 ulSectorLBA, FF_T_UINT32
 			FF_PendSemaphore(pIoman->pBlkDevSemaphore);
 #endif
 		slRetVal = pIoman->pBlkDevice->fnpReadBlocks(pBuffer, ulSectorLBA, ulNumSectors, pIoman->pBlkDevice->pParam);
+		FF_AtomicAdd(&pIoman->Stats.DriverReads, 1);
+		FF_AtomicAdd(&pIoman->Stats.DriverReadSectors, ulNumSectors);
+#ifdef	FF_BLKDEV_USES_SEM
+		if (!aSemLocked || pIoman->pSemaphore != pIoman->pBlkDevSemaphore)
+			FF_ReleaseSemaphore(pIoman->pBlkDevSemaphore);
+#endif
+		if(!FF_isERR(slRetVal) && FF_GETERROR(slRetVal) != FF_ERR_DRIVER_BUSY) {
+			break;
+		}
+		FF_Sleep(FF_DRIVER_BUSY_SLEEP);
+	} while (FF_TRUE);
+
+	if(!aSemLocked && !FF_isERR(slRetVal)) {
+		FF_IOMAN_SyncDirect(pIoman, ulSectorLBA, ulNumSectors, (FF_T_UINT8 *) pBuffer, FF_FALSE);
+	}
+
+	return slRetVal;
+}
+
+FF_T_SINT32 FF_BlockWrite(FF_IOMAN *pIoman, FF_T_UINT32 ulSectorLBA, FF_T_UINT32 ulNumSectors, void *pBuffer, FF_T_BOOL aSemLocked) {
+	FF_T_SINT32 slRetVal = 0;
+
+	if(pIoman->pPartition->TotalSectors) {
+		if((ulSectorLBA + ulNumSectors) > (pIoman->pPartition->TotalSectors + pIoman->pPartition->BeginLBA)) {
+			return (FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE | FF_BLOCKWRITE);
+		}
+	}
+
+	if(pIoman->pBlkDevice->fnpWriteBlocks) do {	// Make sure we don't execute a NULL.
+#ifdef	FF_BLKDEV_USES_SEM
+		if (!aSemLocked || pIoman->pSemaphore != pIoman->pBlkDevSemaphore)
+			FF_PendSemaphore(pIoman->pBlkDevSemaphore);
+#endif
+		slRetVal = pIoman->pBlkDevice->fnpWriteBlocks(pBuffer, ulSectorLBA, ulNumSectors, pIoman->pBlkDevice->pParam);
+		FF_AtomicAdd(&pIoman->Stats.DriverWrites, 1);
+		FF_AtomicAdd(&pIoman->Stats.DriverWriteSectors, ulNumSectors);
 #ifdef	FF_BLKDEV_USES_SEM
 		if (!aSemLocked || pIoman->pSemaphore != pIoman->pBlkDevSemaphore)
 			FF_ReleaseSemaphore(pIoman->pBlkDevSemaphore);
@@ -558,36 +2365,253 @@ FF_T_SINT32 FF_BlockRead(FF_IOMAN *pIoman, FF_T_UINT32 ulSectorLBA, FF_T_UINT32
 		FF_Sleep(FF_DRIVER_BUSY_SLEEP);
 	} while (FF_TRUE);
 
+	if(!aSemLocked && !FF_isERR(slRetVal)) {
+		FF_IOMAN_SyncDirect(pIoman, ulSectorLBA, ulNumSectors, (FF_T_UINT8 *) pBuffer, FF_TRUE);
+	}
+
 	return slRetVal;
 }
 
-FF_T_SINT32 FF_BlockWrite(FF_IOMAN *pIoman, FF_T_UINT32 ulSectorLBA, FF_T_UINT32 ulNumSectors, void *pBuffer, FF_T_BOOL aSemLocked) {
-	FF_T_SINT32 slRetVal = 0;
+#define FF_SNAPSHOT_SIGNATURE		0x53484646	///< "FFHS" in the first 4 bytes marks a hot-sector snapshot.
+#define FF_SNAPSHOT_FINGERPRINT		4			///< Offset of the volume fingerprint.
+#define FF_SNAPSHOT_COUNT			8			///< Offset of the number of lines in the snapshot.
+#define FF_SNAPSHOT_DIRCOUNT		12			///< Offset of the number of directory lines, listed before the others.
+#define FF_SNAPSHOT_LBAS			16			///< Offset of the first line LBA. (4 bytes each, sorted in ascending order).
+
+/**
+ *	@private
+ *	@brief	Identifies a volume, so that a snapshot isn't applied to a different one.
+ **/
+static FF_T_UINT32 FF_IOMAN_Fingerprint(FF_PARTITION *pPart) {
+	FF_T_UINT32	Values[6];
+	FF_T_UINT32	Hash = 0;
+	FF_T_UINT16	i;
+
+	Values[0] = pPart->VolSerial;
+	Values[1] = pPart->BeginLBA;
+	Values[2] = pPart->TotalSectors;
+	Values[3] = pPart->SectorsPerFAT;
+	Values[4] = pPart->RootDirCluster;
+	Values[5] = ((FF_T_UINT32) pPart->BlkSize << 8) | pPart->SectorsPerCluster;
+
+	for(i = 0; i < 6; i++) {
+		Hash = ((Hash ^ Values[i]) * 0x9E3779B9) & 0xFFFFFFFF;
+	}
+
+	return Hash;
+}
+
+/**
+ *	@private
+ *	@brief	qsort() comparison of two little-endian LBAs in a snapshot.
+ **/
+static int FF_IOMAN_CompareLBAs(const void *pA, const void *pB) {
+	FF_T_UINT32 a = FF_getLong((FF_T_UINT8 *) pA, 0);
+	FF_T_UINT32 b = FF_getLong((FF_T_UINT8 *) pB, 0);
+
+	return (a > b) - (a < b);
+}
+
+/**
+ *	@private
+ *	@brief	Saves the lines of the mounted partition that are in the cache, to the caller's snapshot storage.
+ *
+ *	FAT lines are saved first, then directory lines, and then file data, until the storage
+ *	is full. Lines that were read ahead and never requested are left out.
+ *
+ *	@pre	The caller must not hold any shard's semaphore.
+ **/
+static void FF_IOMAN_SaveSnapshot(FF_IOMAN *pIoman) {
+	static const FF_T_UINT8 Order[] = { FF_CACHE_CLASS_PINNED, FF_CACHE_CLASS_FAT, FF_CACHE_CLASS_DIR, FF_CACHE_CLASS_DATA };
+	FF_T_UINT8		*pLBAs = pIoman->pSnapshot + FF_SNAPSHOT_LBAS;
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pLine;
+	FF_T_UINT32		Capacity, nDir = 0, nOther = 0;
+	FF_T_UINT16		o;
+
+	if(!pIoman->pSnapshot) {
+		return;
+	}
+	Capacity = (pIoman->SnapshotSize - FF_SNAPSHOT_LBAS) / 4;
+
+	// Directory lines are listed from the front, the others from the back, until they meet.
+	for(o = 0; o < sizeof(Order) && nDir + nOther < Capacity; o++) {
+		for(pShard = pIoman->pShards; pShard < pIoman->pShards + pIoman->ShardCount; pShard++) {
+			FF_IOMAN_PendShard(pShard);
+			for(pLine = pShard->pBuffers; pLine < pShard->pBuffers + pShard->BufferCount && nDir + nOther < Capacity; pLine += pShard->LineSectors) {
+				if(!pLine->LineValid || pLine->pOwner != pIoman || pLine->ReadAhead || pLine->Class != Order[o]) {
+					continue;
+				}
+				if(pLine->Class == FF_CACHE_CLASS_DIR) {
+					FF_putLong(pLBAs, nDir++ * 4, pLine->Sector);
+				} else {
+					FF_putLong(pLBAs, (Capacity - ++nOther) * 4, pLine->Sector);
+				}
+			}
+			FF_ReleaseSemaphore(pShard->pSemaphore);
+		}
+	}
+
+	memmove(pLBAs + (nDir * 4), pLBAs + ((Capacity - nOther) * 4), nOther * 4);
+	qsort(pLBAs, nDir, 4, FF_IOMAN_CompareLBAs);
+	qsort(pLBAs + (nDir * 4), nOther, 4, FF_IOMAN_CompareLBAs);
+
+	FF_putLong(pIoman->pSnapshot, 0, FF_SNAPSHOT_SIGNATURE);
+	FF_putLong(pIoman->pSnapshot, FF_SNAPSHOT_FINGERPRINT, FF_IOMAN_Fingerprint(pIoman->pPartition));
+	FF_putLong(pIoman->pSnapshot, FF_SNAPSHOT_COUNT, nDir + nOther);
+	FF_putLong(pIoman->pSnapshot, FF_SNAPSHOT_DIRCOUNT, nDir);
+}
+
+/**
+ *	@private
+ *	@brief	Loads a batch of lines from a snapshot into the cache.
+ *
+ *	The batch is read with a single driver call through the read-ahead staging buffer,
+ *	when it is free. Otherwise each line is requested on its own.
+ **/
+static void FF_IOMAN_PrefetchBatch(FF_IOMAN *pIoman, FF_T_UINT32 StartLBA, FF_T_UINT32 nSectors, FF_T_UINT8 Mode) {
+	FF_BUFFER	*pBuffer;
+	FF_T_UINT32	LineLBA;
+	FF_T_BOOL	bBusy = FF_TRUE;
+
+	if(pIoman->ReadAhead.MaxSectors) {
+		FF_PendSemaphore(pIoman->ReadAhead.pSemaphore);
+		{
+			bBusy = pIoman->ReadAhead.Busy;
+			pIoman->ReadAhead.Busy = FF_TRUE;
+		}
+		FF_ReleaseSemaphore(pIoman->ReadAhead.pSemaphore);
+	}
+
+	if(!bBusy) {
+		FF_IOMAN_ReadAhead(pIoman, StartLBA, nSectors, Mode);	// Also clears the Busy flag.
+		return;
+	}
+
+	for(LineLBA = StartLBA; LineLBA < StartLBA + nSectors; LineLBA += pIoman->LineSectors) {
+		pBuffer = FF_GetBuffer(pIoman, LineLBA, Mode);
+		if(!pBuffer) {
+			break;
+		}
+		FF_ReleaseBuffer(pIoman, pBuffer);
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Prefetches a sorted list of lines from a snapshot, merging neighbouring lines into batches.
+ *
+ *	A batch grows up to the read-ahead size, and may bridge a hole of a single line, as
+ *	reading it costs less than another driver call.
+ **/
+static void FF_IOMAN_PrefetchLines(FF_IOMAN *pIoman, FF_T_UINT8 *pLBAs, FF_T_UINT32 nLBAs, FF_T_UINT8 Mode) {
+	FF_T_UINT32	EndLBA		= pIoman->pPartition->BeginLBA + pIoman->pPartition->TotalSectors;
+	FF_T_UINT32	Mask		= ~((FF_T_UINT32) pIoman->LineSectors - 1);
+	FF_T_UINT32	MaxBatch	= pIoman->ReadAhead.MaxSectors & Mask;
+	FF_T_UINT32	i, LineLBA = 0, StartLBA = 0, NextLBA = 0;
+
+	for(i = 0; i <= nLBAs; i++) {
+		if(i < nLBAs) {
+			LineLBA = FF_getLong(pLBAs, i * 4) & Mask;
+			if(LineLBA >= EndLBA || (NextLBA && LineLBA >= StartLBA && LineLBA < NextLBA)) {
+				continue;	// Outside of the partition, or already in the batch. (Lines may be longer than when it was saved).
+			}
+			if(NextLBA && LineLBA >= NextLBA && LineLBA <= NextLBA + pIoman->LineSectors
+			&& LineLBA + pIoman->LineSectors - StartLBA <= MaxBatch) {
+				NextLBA = LineLBA + pIoman->LineSectors;
+				continue;
+			}
+		}
+		if(NextLBA) {
+			FF_IOMAN_PrefetchBatch(pIoman, StartLBA, (NextLBA < EndLBA ? NextLBA : EndLBA) - StartLBA, Mode);
+		}
+		StartLBA	= LineLBA;
+		NextLBA		= LineLBA + pIoman->LineSectors;
+	}
+}
+
+/**
+ *	@private
+ *	@brief	Warms up the cache of a newly mounted partition, with the lines saved at its last unmount.
+ *
+ *	Nothing is loaded unless the snapshot was taken of the same volume. The sectors are read
+ *	from the device, so a snapshot that is out of date only costs some wasted reads.
+ **/
+static void FF_IOMAN_LoadSnapshot(FF_IOMAN *pIoman) {
+	FF_T_UINT32 Count, nDir;
+
+	if(!pIoman->pSnapshot
+	|| FF_getLong(pIoman->pSnapshot, 0) != FF_SNAPSHOT_SIGNATURE
+	|| FF_getLong(pIoman->pSnapshot, FF_SNAPSHOT_FINGERPRINT) != FF_IOMAN_Fingerprint(pIoman->pPartition)) {
+		return;
+	}
+
+	Count	= FF_getLong(pIoman->pSnapshot, FF_SNAPSHOT_COUNT);
+	nDir	= FF_getLong(pIoman->pSnapshot, FF_SNAPSHOT_DIRCOUNT);
+	if(Count > (pIoman->SnapshotSize - FF_SNAPSHOT_LBAS) / 4 || nDir > Count) {
+		return;	// Damaged.
+	}
+
+	FF_IOMAN_PrefetchLines(pIoman, pIoman->pSnapshot + FF_SNAPSHOT_LBAS, nDir, FF_MODE_READ | FF_MODE_DIR);
+	FF_IOMAN_PrefetchLines(pIoman, pIoman->pSnapshot + FF_SNAPSHOT_LBAS + (nDir * 4), Count - nDir, FF_MODE_READ);
+}
+
+/**
+ *	@public
+ *	@brief	Gives FullFAT storage for a snapshot of the hot sectors, to warm up the cache after a remount.
+ *
+ *	FF_UnmountPartition() saves the LBAs of the sectors held in the cache into the storage,
+ *	with a fingerprint of the volume. FF_MountPartition() then reads those sectors back in
+ *	large sorted batches, if the volume has the same fingerprint. The caller may keep the
+ *	storage over a reboot, (all Size bytes of it), and give it back before mounting.
+ *
+ *	@param	pIoman		FF_IOMAN Object.
+ *	@param	pSnapshot	Storage for the snapshot, 16 bytes plus 4 bytes for each cache line. (NULL stops taking snapshots).
+ *	@param	Size		Size of the storage in bytes.
+ *
+ *	@return	FF_ERR_NONE on success, or FF_ERR_IOMAN_BAD_MEMSIZE when the storage can't hold a single line.
+ **/
+FF_ERROR FF_SetCacheSnapshot(FF_IOMAN *pIoman, FF_T_UINT8 *pSnapshot, FF_T_UINT32 Size) {
+	if(!pIoman) {
+		return FF_ERR_NULL_POINTER | FF_SETCACHESNAPSHOT;
+	}
+	if(pSnapshot && Size < FF_SNAPSHOT_LBAS + 4) {
+		return FF_ERR_IOMAN_BAD_MEMSIZE | FF_SETCACHESNAPSHOT;
+	}
+
+	pIoman->pSnapshot		= pSnapshot;
+	pIoman->SnapshotSize	= pSnapshot ? Size : 0;
+
+	return FF_ERR_NONE;
+}
 
-	if(pIoman->pPartition->TotalSectors) {
-		if((ulSectorLBA + ulNumSectors) > (pIoman->pPartition->TotalSectors + pIoman->pPartition->BeginLBA)) {
-			return (FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE | FF_BLOCKWRITE);
-		}
+#ifdef FF_MIRROR_FATS_UMOUNT
+/**
+ *	@public
+ *	@brief	Chooses when the FAT copies, (every FAT but the first), are written.
+ *
+ *	Deferred, FAT entries are only written in the first FAT, and FF_FlushCache() copies the
+ *	sectors that changed to the other FATs, a run of sectors at a time. Otherwise each entry
+ *	is written in every FAT at once, (with FF_WRITE_BOTH_FATS). Deferring is the default.
+ *
+ *	@param	pIoman	FF_IOMAN Object.
+ *	@param	bDefer	FF_TRUE to defer the copies, FF_FALSE to bring them up to date and write them at once.
+ *
+ *	@return	FF_ERR_NONE on success, or the error from copying the outstanding sectors.
+ **/
+FF_ERROR FF_DeferFatCopies(FF_IOMAN *pIoman, FF_T_BOOL bDefer) {
+	if(!pIoman) {
+		return FF_ERR_NULL_POINTER | FF_DEFERFATCOPIES;
 	}
 
-	if(pIoman->pBlkDevice->fnpWriteBlocks) do {	// Make sure we don't execute a NULL.
-#ifdef	FF_BLKDEV_USES_SEM
-		if (!aSemLocked || pIoman->pSemaphore != pIoman->pBlkDevSemaphore)
-			FF_PendSemaphore(pIoman->pBlkDevSemaphore);
-#endif
-		slRetVal = pIoman->pBlkDevice->fnpWriteBlocks(pBuffer, ulSectorLBA, ulNumSectors, pIoman->pBlkDevice->pParam);
-#ifdef	FF_BLKDEV_USES_SEM
-		if (!aSemLocked || pIoman->pSemaphore != pIoman->pBlkDevSemaphore)
-			FF_ReleaseSemaphore(pIoman->pBlkDevSemaphore);
-#endif
-		if(!FF_isERR(slRetVal) && FF_GETERROR(slRetVal) != FF_ERR_DRIVER_BUSY) {
-			break;
-		}
-		FF_Sleep(FF_DRIVER_BUSY_SLEEP);
-	} while (FF_TRUE);
+	pIoman->pPartition->bDeferFatCopies = bDefer;
+	if(!bDefer && pIoman->pPartition->PartitionMounted) {
+		return FF_SyncFatCopies(pIoman);	// Entries written from now on go to every FAT.
+	}
 
-	return slRetVal;
+	return FF_ERR_NONE;
 }
+#endif
 
 
 /**
@@ -839,9 +2863,18 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 	}*/
 
 	pPart = pIoman->pPartition;
-
-	memset (pIoman->pBuffers, '\0', sizeof(FF_BUFFER) * pIoman->CacheSize);
-	memset (pIoman->pCacheMem, '\0', pIoman->BlkSize * pIoman->CacheSize);
+#ifdef FF_FREE_BITMAP
+	FF_DestroyFreeBitmap(pIoman);	// Sized for the partition that was mounted before.
+#endif
+#ifdef FF_FAT12_DECODE
+	FF_DestroyFat12Table(pIoman);
+#endif
+#ifdef FF_FAT_MIRROR
+	FF_DestroyFatMirror(pIoman);
+#endif
+#ifdef FF_MIRROR_FATS_UMOUNT
+	FF_DestroyFatCopyMap(pIoman);
+#endif
 
 #ifdef FF_HASH_CACHE
 	for(i = 0; i < FF_HASH_CACHE_DEPTH; i++) {
@@ -849,7 +2882,11 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 	}
 #endif
 
-	FF_IOMAN_InitBufferDescriptors(pIoman);
+	if(pIoman->pPool) {
+		FF_IOMAN_PurgeLines(pIoman);	// Other IOMANs are using the pool, only this device's sectors are dropped.
+	} else {
+		FF_IOMAN_SetLineSectors(pIoman, pIoman->MaxLineSectors);
+	}
 	pIoman->FirstFile = 0;
 
 	pBuffer = FF_GetBuffer(pIoman, 0, FF_MODE_READ);
@@ -933,6 +2970,7 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 			pPart->TotalSectors = FF_getLong(pBuffer->pBuffer, FF_FAT_32_TOTAL_SECTORS);
 		}
 		memcpy (pPart->VolLabel, pBuffer->pBuffer + FF_FAT_32_VOL_LABEL, sizeof pPart->VolLabel);
+		pPart->VolSerial		= FF_getLong(pBuffer->pBuffer, FF_FAT_32_VOL_SERIAL);
 	} else {	// FAT16
 		pPart->ClusterBeginLBA	= pPart->BeginLBA + pPart->ReservedSectors + (pPart->NumFATS * pPart->SectorsPerFAT);
 		pPart->TotalSectors		= (FF_T_UINT32) FF_getShort(pBuffer->pBuffer, FF_FAT_16_TOTAL_SECTORS);
@@ -941,6 +2979,7 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 			pPart->TotalSectors = FF_getLong(pBuffer->pBuffer, FF_FAT_32_TOTAL_SECTORS);
 		}
 		memcpy (pPart->VolLabel, pBuffer->pBuffer + FF_FAT_16_VOL_LABEL, sizeof pPart->VolLabel);
+		pPart->VolSerial		= FF_getLong(pBuffer->pBuffer, FF_FAT_16_VOL_SERIAL);
 	}
 #ifdef FF_WRITE_FREE_COUNT
 	pPart->FSInfoLBA = pPart->BeginLBA + FF_getShort(pBuffer->pBuffer, 48);
@@ -965,13 +3004,42 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 
 	pPart->NumClusters = pPart->DataSectors / pPart->SectorsPerCluster;
 
+	// A line that spans several clusters mostly fetches sectors of unrelated files and directories,
+	// and wastes the cache on them. (Nothing is held in the cache yet, so it can be laid out again).
+	// A pooled cache keeps the line size it was created with.
+	if(!pIoman->pPool) {
+		FF_IOMAN_SetLineSectors(pIoman, pPart->SectorsPerCluster);
+	}
+
 	Error = FF_DetermineFatType(pIoman);
 
 	if(FF_isERR(Error)) {
 		return Error;
 	}
+#ifdef FF_FAT12_DECODE
+	Error = FF_LoadFat12Table(pIoman);
+	if(FF_isERR(Error)) {
+		return Error;
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	Error = FF_LoadFatMirror(pIoman);
+	if(FF_isERR(Error)) {
+		return Error;
+	}
+#endif
+#ifdef FF_MIRROR_FATS_UMOUNT
+	FF_CreateFatCopyMap(pIoman);
+#endif
+#if FF_ALLOC_GROUPS > 1
+	FF_InitAllocGroups(pIoman);
+#endif
 	pPart->PartitionMounted = FF_TRUE;
 	pPart->LastFreeCluster	= 0;
+#ifdef FF_WRITE_FREE_COUNT
+	pPart->bFSInfoDirty		= FF_FALSE;
+	pPart->FSInfoUpdates	= 0;
+#endif
 #ifdef FF_MOUNT_FIND_FREE
 	pPart->LastFreeCluster	= FF_FindFreeCluster(pIoman, &Error);
 	if(FF_isERR(Error)) {
@@ -985,6 +3053,12 @@ FF_ERROR FF_MountPartition(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber) {
 	pPart->FreeClusterCount = 0;
 #endif
 
+	FF_IOMAN_LoadSnapshot(pIoman);
+
+#ifdef FF_CACHE_FLUSHER
+	FF_IOMAN_StartFlusher(pIoman);
+#endif
+
 	return FF_ERR_NONE;
 }
 
@@ -1030,20 +3104,25 @@ FF_ERROR FF_UnregisterBlkDevice(FF_IOMAN *pIoman) {
  *
  *	@return		FF_TRUE if an active handle is found, else FF_FALSE.
  *
- *	@pre		This function must be wrapped with the cache handling semaphore.
+ *	@pre		This function must be wrapped with the cache handling semaphore. (Each shard is claimed in turn).
  **/
 static FF_T_BOOL FF_ActiveHandles(FF_IOMAN *pIoman) {
-	FF_T_UINT32	i;
-	FF_BUFFER	*pBuffer;
-
-	for(i = 0; i < pIoman->CacheSize; i++) {
-		pBuffer = (pIoman->pBuffers + i);
-		if(pBuffer->NumHandles) {
-			return FF_TRUE;
+	FF_CACHE_SHARD	*pShard;
+	FF_BUFFER		*pLine;
+	FF_T_BOOL		bActive = FF_FALSE;
+
+	for(pShard = pIoman->pShards; pShard < pIoman->pShards + pIoman->ShardCount && !bActive; pShard++) {
+		FF_IOMAN_PendShard(pShard);
+		for(pLine = pShard->pBuffers; pLine < pShard->pBuffers + pShard->BufferCount; pLine += pShard->LineSectors) {
+			if(pLine->LineHandles && pLine->pOwner == pIoman) {	// Handles on other IOMANs of a pool don't count.
+				bActive = FF_TRUE;
+				break;
+			}
 		}
+		FF_ReleaseSemaphore(pShard->pSemaphore);
 	}
 
-	return FF_FALSE;
+	return bActive;
 }
 
 
@@ -1057,10 +3136,6 @@ static FF_T_BOOL FF_ActiveHandles(FF_IOMAN *pIoman) {
  **/
 FF_ERROR FF_UnmountPartition(FF_IOMAN *pIoman) {
 	FF_ERROR RetVal = FF_ERR_NONE;
-#ifdef FF_MIRROR_FATS_UMOUNT
-	FF_T_UINT i, y;
-	FF_BUFFER *pBuffer;
-#endif 
 
 	if(!pIoman || !pIoman->pPartition) {
 		return FF_ERR_NULL_POINTER | FF_UNMOUNTPARTITION;
@@ -1074,27 +3149,31 @@ FF_ERROR FF_UnmountPartition(FF_IOMAN *pIoman) {
 			if(pIoman->FirstFile == NULL) {
 				// Release Semaphore to call this function!
 				FF_ReleaseSemaphore(pIoman->pSemaphore);
+#ifdef FF_CACHE_FLUSHER
+				FF_IOMAN_StopFlusher(pIoman);			// The last write-back is done here.
+#endif
 				RetVal = FF_FlushCache(pIoman);			// Flush any unwritten sectors to disk.
 				if(FF_isERR(RetVal)) {
+#ifdef FF_CACHE_FLUSHER
+					FF_IOMAN_StartFlusher(pIoman);		// Still mounted, keep retrying in the background.
+#endif
 					return RetVal;
 				}
+				FF_IOMAN_SaveSnapshot(pIoman);
 				// Reclaim Semaphore
 				FF_PendSemaphore(pIoman->pSemaphore);
 				pIoman->pPartition->PartitionMounted = FF_FALSE;
-
+#ifdef FF_FREE_BITMAP
+				FF_DestroyFreeBitmap(pIoman);
+#endif
+#ifdef FF_FAT12_DECODE
+				FF_DestroyFat12Table(pIoman);
+#endif
+#ifdef FF_FAT_MIRROR
+				FF_DestroyFatMirror(pIoman);
+#endif
 #ifdef FF_MIRROR_FATS_UMOUNT
-				FF_ReleaseSemaphore(pIoman->pSemaphore);
-				for(i = 0; i < pIoman->pPartition->SectorsPerFAT; i++) {
-					 pBuffer = FF_GetBuffer(pIoman, pIoman->pPartition->FatBeginLBA + i, FF_MODE_READ);
-					 if(!pBuffer) {
-						  RetVal = FF_ERR_DEVICE_DRIVER_FAILED | FF_UNMOUNTPARTITION;
-						  break;
-					 }
-					 for(y = 0; y < pIoman->pPartition->NumFATS; y++) {
-						  FF_BlockWrite(pIoman, pIoman->pPartition->FatBeginLBA + (y*pIoman->pPartition->SectorsPerFAT) + i, 1, pBuffer->pBuffer, FF_FALSE);
-					 }					 
-				}
-				FF_PendSemaphore(pIoman->pSemaphore);
+				FF_DestroyFatCopyMap(pIoman);			// The copies were brought up to date by FF_FlushCache().
 #endif
 			} else {
 				RetVal = FF_ERR_IOMAN_ACTIVE_HANDLES | FF_UNMOUNTPARTITION;
@@ -1113,17 +3192,13 @@ FF_ERROR FF_IncreaseFreeClusters(FF_IOMAN *pIoman, FF_T_UINT32 Count) {
 
 	FF_ERROR Error;
 
-#ifdef FF_WRITE_FREE_COUNT
-	FF_BUFFER *pBuffer;
-#endif
-
 	if(!pIoman->pPartition->FreeClusterCount) {
 		 pIoman->pPartition->FreeClusterCount = FF_CountFreeClusters(pIoman, &Error);
 		 if(FF_isERR(Error)) {
 			  return Error;
 		 }
 	} else {
-		 pIoman->pPartition->FreeClusterCount += Count;
+		 FF_AtomicAdd(&pIoman->pPartition->FreeClusterCount, Count);	// Writers in allocation groups update it at the same time.
 	}
 
 	if(!pIoman->pPartition->LastFreeCluster) {
@@ -1134,37 +3209,15 @@ FF_ERROR FF_IncreaseFreeClusters(FF_IOMAN *pIoman, FF_T_UINT32 Count) {
 	}
 
 #ifdef FF_WRITE_FREE_COUNT
-	// FAT32 update the FSINFO sector.
-	if(pIoman->pPartition->Type == FF_T_FAT32) {
-		 // Find the FSINFO sector.
-		 pBuffer = FF_GetBuffer(pIoman, pIoman->pPartition->FSInfoLBA, FF_MODE_WRITE);
-		 {
-			  if(!pBuffer) {
-					return FF_ERR_DEVICE_DRIVER_FAILED | FF_INCREASEFREECLUSTERS;
-			  }
-
-			  if(FF_getLong(pBuffer->pBuffer, 0) == 0x41615252 && FF_getLong(pBuffer->pBuffer, 484) == 0x61417272) {
-					// FSINFO sector magic nums we're verified. Safe to write.
-					FF_putLong(pBuffer->pBuffer, 488, pIoman->pPartition->FreeClusterCount);
-					FF_putLong(pBuffer->pBuffer, 492, pIoman->pPartition->LastFreeCluster);
-			  }
-		 }
-		 Error = FF_ReleaseBuffer(pIoman, pBuffer);
-		 if(FF_isERR(Error)) {
-			 return Error;
-		 }
-	}
-#endif
-
+	return FF_IOMAN_FSInfoChanged(pIoman);	// The FSINFO sector is written by FF_FlushCache().
+#else
 	return FF_ERR_NONE;
+#endif
 }
 
 FF_ERROR FF_DecreaseFreeClusters(FF_IOMAN *pIoman, FF_T_UINT32 Count) {
 
 	FF_ERROR Error;
-#ifdef FF_WRITE_FREE_COUNT
-	FF_BUFFER *pBuffer;
-#endif
 
 	if(!pIoman->pPartition->FreeClusterCount) {
 		 pIoman->pPartition->FreeClusterCount = FF_CountFreeClusters(pIoman, &Error);
@@ -1172,7 +3225,7 @@ FF_ERROR FF_DecreaseFreeClusters(FF_IOMAN *pIoman, FF_T_UINT32 Count) {
 			  return Error;
 		 }
 	} else {
-		 pIoman->pPartition->FreeClusterCount -= Count;
+		 FF_AtomicAdd(&pIoman->pPartition->FreeClusterCount, 0 - Count);
 	}
 
 	if(!pIoman->pPartition->LastFreeCluster) {
@@ -1183,28 +3236,10 @@ FF_ERROR FF_DecreaseFreeClusters(FF_IOMAN *pIoman, FF_T_UINT32 Count) {
 	}
 
 #ifdef FF_WRITE_FREE_COUNT
-	// FAT32 update the FSINFO sector.
-	if(pIoman->pPartition->Type == FF_T_FAT32) {
-		 // Find the FSINFO sector.
-		 pBuffer = FF_GetBuffer(pIoman, pIoman->pPartition->FSInfoLBA, FF_MODE_WRITE);
-		 {
-			  if(!pBuffer) {
-					return FF_ERR_DEVICE_DRIVER_FAILED | FF_DECREASEFREECLUSTERS;
-			  }
-
-			  if(FF_getLong(pBuffer->pBuffer, 0) == 0x41615252 && FF_getLong(pBuffer->pBuffer, 484) == 0x61417272) {
-					// FSINFO sector magic nums we're verified. Safe to write.
-					FF_putLong(pBuffer->pBuffer, 488, pIoman->pPartition->FreeClusterCount);
-					FF_putLong(pBuffer->pBuffer, 492, pIoman->pPartition->LastFreeCluster);
-			  }
-		 }
-		 Error = FF_ReleaseBuffer(pIoman, pBuffer);
-		 if(FF_isERR(Error)) {
-			 return Error;
-		 }
-	}
-#endif
+	return FF_IOMAN_FSInfoChanged(pIoman);	// The FSINFO sector is written by FF_FlushCache().
+#else
 	return FF_ERR_NONE;
+#endif
 }
 
 
@@ -1256,3 +3291,376 @@ FF_T_UINT32 FF_GetVolumeSize(FF_IOMAN *pIoman) {
 }
 #endif
 
+/**
+ *	@public
+ *	@brief	Gets the I/O statistics of an IOMAN.
+ *
+ *	The cache statistics are kept by each shard, and are summed with those of the IOMAN.
+ *	Counters are never reset, so take the difference of two calls to measure an interval.
+ *	The cache counters of an IOMAN created by FF_CreatePooledIOMAN() are those of the whole pool.
+ *
+ *	@param	pIoman		FF_IOMAN Object returned from FF_CreateIOMAN()
+ *	@param	pStats		Receives the statistics.
+ *
+ *	@return	FF_ERR_NONE on success.
+ **/
+FF_ERROR FF_GetStats(FF_IOMAN *pIoman, FF_IOSTATS *pStats) {
+	FF_T_UINT32		*pSum, *pCount;
+	FF_T_UINT16		s, i;
+
+	if(!pIoman || !pStats) {
+		return FF_ERR_NULL_POINTER | FF_GETSTATS;
+	}
+
+	*pStats	= pIoman->Stats;
+	pSum	= (FF_T_UINT32 *) pStats;	// Every member is an FF_T_UINT32 counter.
+
+	for(s = 0; s < pIoman->ShardCount; s++) {
+		FF_PendSemaphore(pIoman->pShards[s].pSemaphore);
+		{
+			pCount = (FF_T_UINT32 *) &pIoman->pShards[s].Stats;
+			for(i = 0; i < sizeof(FF_IOSTATS) / sizeof(FF_T_UINT32); i++) {
+				pSum[i] = (pSum[i] + pCount[i]) & 0xFFFFFFFF;
+			}
+		}
+		FF_ReleaseSemaphore(pIoman->pShards[s].pSemaphore);
+	}
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@private
+ *	@brief	Moves the lines held by a shard's old buffers into its new buffers, for FF_ResizeCache().
+ *
+ *	Lines are moved while the shard has unallocated lines left, so that a smaller cache keeps
+ *	what fits. With 2Q, lines that were re-referenced are moved before those on probation.
+ *
+ *	@param	pOld		The shard's first buffer, in the old descriptors.
+ *	@param	OldCount	Number of buffers the shard had.
+ *
+ *	@pre	The shard's semaphore must be claimed, and the old lines must be clean, without handles.
+ **/
+static void FF_IOMAN_MoveLines(FF_IOMAN *pIoman, FF_CACHE_SHARD *pShard, FF_BUFFER *pOld, FF_T_UINT16 OldCount) {
+	FF_BUFFER	*pLine, *pNew;
+	FF_T_BOOL	bReferenced = FF_FALSE;
+	FF_T_UINT16	i, Pass;
+
+	for(Pass = 0; Pass < 2; Pass++) {
+		for(pLine = pOld; pLine < pOld + OldCount; pLine += pIoman->LineSectors) {
+			if(!pLine->LineValid) {
+				continue;
+			}
+#ifdef FF_CACHE_REPLACE_2Q
+			bReferenced = (FF_T_BOOL) (pLine->Queue == FF_QUEUE_AM);
+			if(bReferenced != (Pass == 0)) {
+				continue;
+			}
+#else
+			if(Pass) {
+				return;
+			}
+#endif
+			pNew = FF_IOMAN_SelectVictim(pShard, FF_CACHE_CLASS_ANY);
+			if(!pNew) {
+				return;
+			}
+			if(pNew->LineValid) {
+				FF_IOMAN_ReturnVictim(pShard, pNew);	// The shard is full.
+				return;
+			}
+			for(i = 0; i < pIoman->LineSectors; i++) {
+				pNew[i].Sector		= pLine[i].Sector;
+				pNew[i].Mode		= FF_MODE_READ;
+				pNew[i].Modified	= FF_FALSE;
+				pNew[i].Valid		= pLine[i].Valid;
+				if(pNew[i].Valid) {
+					memcpy(pNew[i].pBuffer, pLine[i].pBuffer, pIoman->BlkSize);
+				}
+			}
+			pNew->Persistance	= pLine->Persistance;
+			pNew->LRU			= 0;
+			pNew->LineValid		= FF_TRUE;
+			pNew->ReadAhead		= pLine->ReadAhead;
+			pNew->pOwner		= pLine->pOwner;
+			FF_IOMAN_SetLineClass(pShard, pNew, pLine->Class);
+
+			FF_IOMAN_IndexBuffer(pShard, pNew);
+			FF_IOMAN_AdmitBuffer(pShard, pNew, bReferenced);
+			FF_IOMAN_UnpinBuffer(pShard, pNew);
+		}
+	}
+}
+
+/**
+ *	@public
+ *	@brief	Changes the size of the cache, while partitions stay mounted and files stay open.
+ *
+ *	The cache is flushed, and the cached sectors that fit are moved to the new cache.
+ *	Cache memory that was given to FF_CreateIOMAN() is kept when the cache shrinks, (its
+ *	cached sectors are then dropped). Otherwise new memory is allocated, and the caller may
+ *	free the memory it gave, once this succeeds.
+ *
+ *	The number of lock shards is fixed by FF_CreateIOMAN(), every shard must still get at
+ *	least 8 cache lines, of the line size in use. A cache shared through a pool can't be resized.
+ *
+ *	@param	pIoman		FF_IOMAN Object returned from FF_CreateIOMAN()
+ *	@param	Size		The new size of the cache in bytes, a multiple of the IOMAN's BlkSize. (Atleast 2 * BlkSize).
+ *
+ *	@return	FF_ERR_NONE on success. The cache is left as it was on error.
+ *	@return	FF_ERR_IOMAN_ACTIVE_HANDLES if buffers stay held, for example by an unfinished FF_FindFirst()/FF_FindNext().
+ *	@return	FF_ERR_IOMAN_CACHE_POOLED if pIoman was created by FF_CreatePooledIOMAN().
+ **/
+FF_ERROR FF_ResizeCache(FF_IOMAN *pIoman, FF_T_UINT32 Size) {
+	FF_BUFFER		*pOldLines[FF_CACHE_SHARDS] = { NULL };
+	FF_T_UINT16		OldCounts[FF_CACHE_SHARDS] = { 0 };
+	FF_BUFFER		*pOldBuffers = NULL, *pBuffer;
+	FF_T_UINT8		*pOldCacheMem = NULL, *pOldStaging = NULL;
+	FF_T_UINT8		*pCacheMem = NULL, *pStaging = NULL;
+	FF_T_UINT32		CacheSize, MaxLineSectors, ReadAheadSectors = 0;
+	FF_T_UINT16		OldCacheSize, OldMaxLineSectors, s, Attempt;
+	FF_T_BOOL		bReserved;
+	FF_ERROR		Error = FF_ERR_NONE;
+
+	if(!pIoman) {
+		return FF_ERR_NULL_POINTER | FF_RESIZECACHE;
+	}
+
+	if(pIoman->pPool) {
+		return FF_ERR_IOMAN_CACHE_POOLED | FF_RESIZECACHE;	// Every IOMAN of the pool holds its own copy of the cache's layout.
+	}
+
+	CacheSize = Size / pIoman->BlkSize;
+	if((Size % pIoman->BlkSize) != 0 || CacheSize < 2 || CacheSize > 0xFFFF) {
+		return FF_ERR_IOMAN_BAD_MEMSIZE | FF_RESIZECACHE;
+	}
+
+	// Sectors keep their shard, so the line size in use can't change.
+	for(MaxLineSectors = FF_CACHE_LINE_SECTORS; MaxLineSectors > pIoman->LineSectors && (CacheSize / MaxLineSectors) / pIoman->ShardCount < FF_CACHE_MIN_LINES; MaxLineSectors >>= 1);
+	if(pIoman->ShardCount > 1 && (CacheSize / MaxLineSectors) / pIoman->ShardCount < FF_CACHE_MIN_LINES) {
+		return FF_ERR_IOMAN_BAD_MEMSIZE | FF_RESIZECACHE;
+	}
+	CacheSize -= CacheSize % MaxLineSectors;	// Sectors that don't make up a whole line are not used.
+
+	Error = FF_FlushCache(pIoman);	// Most of the writing is done before the cache is locked.
+	if(FF_isERR(Error)) {
+		return Error;
+	}
+
+	// The read-ahead staging memory is reserved, so that no read-ahead can use it while it is replaced.
+	// (This also keeps other resizes out).
+	do {
+		FF_PendSemaphore(pIoman->ReadAhead.pSemaphore);
+		bReserved = (FF_T_BOOL) !pIoman->ReadAhead.Busy;
+		pIoman->ReadAhead.Busy = FF_TRUE;
+		FF_ReleaseSemaphore(pIoman->ReadAhead.pSemaphore);
+		if(!bReserved) {
+			FF_Yield();
+		}
+	} while(!bReserved);
+
+	// Other threads only hold buffers for a moment, so the cache is tried a few times for a point where none are held.
+	for(Attempt = 0; ; Attempt++) {
+		for(s = 0; s < pIoman->ShardCount; s++) {
+			FF_IOMAN_PendShard(pIoman->pShards + s);
+		}
+		for(pBuffer = pIoman->pBuffers; pBuffer < pIoman->pBuffers + pIoman->CacheSize && !pBuffer->NumHandles; pBuffer++);
+		if(pBuffer == pIoman->pBuffers + pIoman->CacheSize) {
+			break;
+		}
+		if(Attempt == FF_RESIZE_ATTEMPTS) {
+			Error = FF_ERR_IOMAN_ACTIVE_HANDLES | FF_RESIZECACHE;
+			break;
+		}
+		for(s = pIoman->ShardCount; s > 0; s--) {
+			FF_ReleaseSemaphore(pIoman->pShards[s - 1].pSemaphore);
+		}
+		FF_Yield();
+	}
+	{
+
+		// Sectors modified since the flush are written back too.
+		for(pBuffer = pIoman->pBuffers; !FF_isERR(Error) && pBuffer < pIoman->pBuffers + pIoman->CacheSize; pBuffer += pIoman->LineSectors) {
+			if(pBuffer->LineValid) {
+				Error = FF_IOMAN_WriteLine(pIoman, FF_IOMAN_GetShard(pIoman, pBuffer->Sector), pBuffer);
+			}
+		}
+
+		if(!FF_isERR(Error)) {
+			pOldBuffers			= pIoman->pBuffers;
+			pOldCacheMem		= pIoman->pCacheMem;
+			pOldStaging			= pIoman->ReadAhead.pStaging;
+			OldCacheSize		= pIoman->CacheSize;
+			OldMaxLineSectors	= pIoman->MaxLineSectors;
+
+			pIoman->CacheSize		= (FF_T_UINT16) CacheSize;
+			pIoman->MaxLineSectors	= (FF_T_UINT16) MaxLineSectors;
+			ReadAheadSectors		= FF_IOMAN_ReadAheadSectors(pIoman);
+
+			pIoman->pBuffers = FF_IOMAN_AllocDescriptors(pIoman);
+			if((pIoman->MemAllocation & FF_IOMAN_ALLOC_BUFFERS) || CacheSize > OldCacheSize) {
+				pCacheMem = (FF_T_UINT8 *) FF_MALLOC(CacheSize * pIoman->BlkSize);
+			} else {
+				pCacheMem = pOldCacheMem;	// The caller's memory is big enough.
+			}
+			if(ReadAheadSectors && ReadAheadSectors != pIoman->ReadAhead.MaxSectors) {
+				pStaging = (FF_T_UINT8 *) FF_MALLOC(ReadAheadSectors * pIoman->BlkSize);
+			} else if(ReadAheadSectors) {
+				pStaging = pOldStaging;
+			}
+
+			if(!pIoman->pBuffers || !pCacheMem || (ReadAheadSectors && !pStaging)) {
+				if(pIoman->pBuffers) {
+					FF_FREE(pIoman->pBuffers);
+				}
+				if(pCacheMem && pCacheMem != pOldCacheMem) {
+					FF_FREE(pCacheMem);
+				}
+				if(pStaging && pStaging != pOldStaging) {
+					FF_FREE(pStaging);
+				}
+				pIoman->pBuffers		= pOldBuffers;
+				pIoman->CacheSize		= OldCacheSize;
+				pIoman->MaxLineSectors	= OldMaxLineSectors;
+				Error = FF_ERR_NOT_ENOUGH_MEMORY | FF_RESIZECACHE;
+			}
+		}
+
+		if(!FF_isERR(Error)) {
+			for(s = 0; s < pIoman->ShardCount; s++) {
+				pOldLines[s] = pIoman->pShards[s].pBuffers;
+				OldCounts[s] = pIoman->pShards[s].BufferCount;
+			}
+
+			pIoman->pCacheMem = pCacheMem;
+			FF_IOMAN_LayoutShards(pIoman);
+			FF_IOMAN_InitBufferDescriptors(pIoman);
+
+			if(pCacheMem != pOldCacheMem) {
+				for(s = 0; s < pIoman->ShardCount; s++) {
+					FF_IOMAN_MoveLines(pIoman, pIoman->pShards + s, pOldLines[s], OldCounts[s]);
+				}
+				if((pIoman->MemAllocation & FF_IOMAN_ALLOC_BUFFERS)) {
+					FF_FREE(pOldCacheMem);
+				}
+				pIoman->MemAllocation |= FF_IOMAN_ALLOC_BUFFERS;
+			}
+			FF_FREE(pOldBuffers);
+
+			if(pStaging != pOldStaging) {
+				if((pIoman->MemAllocation & FF_IOMAN_ALLOC_READAHEAD)) {
+					FF_FREE(pOldStaging);
+				}
+				pIoman->MemAllocation |= FF_IOMAN_ALLOC_READAHEAD;
+			}
+			pIoman->ReadAhead.pStaging		= pStaging;
+			pIoman->ReadAhead.MaxSectors	= ReadAheadSectors;
+			if(!pStaging) {
+				pIoman->MemAllocation &= ~FF_IOMAN_ALLOC_READAHEAD;
+			}
+
+			pIoman->LastReplaced = 0;
+		}
+
+		// Threads waiting for a buffer try again, there may be more now.
+		for(s = 0; s < pIoman->ShardCount; s++) {
+			if(pIoman->pShards[s].Waiters) {
+				FF_SignalCondition(pIoman->pShards[s].pCondition);
+			}
+		}
+	}
+	for(s = pIoman->ShardCount; s > 0; s--) {
+		FF_ReleaseSemaphore(pIoman->pShards[s - 1].pSemaphore);
+	}
+
+	FF_PendSemaphore(pIoman->ReadAhead.pSemaphore);
+	pIoman->ReadAhead.Busy = FF_FALSE;
+	FF_ReleaseSemaphore(pIoman->ReadAhead.pSemaphore);
+
+	return Error;
+}
+
+/**
+ *	@public
+ *	@brief	Creates a cache that several FF_IOMAN objects can share, see FF_CreatePooledIOMAN().
+ *
+ *	The parameters are those of FF_CreateIOMAN(). Lines have the longest size that the pool
+ *	allows, whatever the cluster size of the volumes mounted through it.
+ *
+ *	@return	The pool, or NULL on error, check the contents of pError.
+ **/
+FF_CACHE_POOL *FF_CreateCachePool(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, const FF_CACHE_LAYOUT *pLayout, FF_ERROR *pError) {
+	FF_CACHE_POOL *pPool = (FF_CACHE_POOL *) FF_MALLOC(sizeof(FF_CACHE_POOL));
+
+	if(!pPool) {
+		if(pError) {
+			*pError = FF_ERR_NOT_ENOUGH_MEMORY | FF_CREATEIOMAN;
+		}
+		return NULL;
+	}
+	memset (pPool, '\0', sizeof(FF_CACHE_POOL));
+
+	pPool->pCache = FF_IOMAN_Create(NULL, pCacheMem, Size, BlkSize, pLayout, pError);
+	if(!pPool->pCache) {
+		FF_FREE(pPool);
+		return NULL;
+	}
+	pPool->pSemaphore = FF_CreateSemaphore();
+
+	return pPool;
+}
+
+/**
+ *	@public
+ *	@brief	Destroys a cache pool, and frees its memory.
+ *
+ *	@param	pPool	The pool returned by FF_CreateCachePool().
+ *
+ *	@return	FF_ERR_NONE on success, or FF_ERR_IOMAN_POOL_IN_USE while IOMANs are attached to the pool.
+ **/
+FF_ERROR FF_DestroyCachePool(FF_CACHE_POOL *pPool) {
+	FF_T_UINT16 Members;
+
+	if(!pPool) {
+		return FF_ERR_NULL_POINTER | FF_DESTROYCACHEPOOL;
+	}
+
+	FF_PendSemaphore(pPool->pSemaphore);
+	{
+		Members = pPool->Members;
+	}
+	FF_ReleaseSemaphore(pPool->pSemaphore);
+	if(Members) {
+		return FF_ERR_IOMAN_POOL_IN_USE | FF_DESTROYCACHEPOOL;
+	}
+
+	FF_DestroyIOMAN(pPool->pCache);
+	FF_DestroySemaphore(pPool->pSemaphore);
+	FF_FREE(pPool);
+
+	return FF_ERR_NONE;
+}
+
+/**
+ *	@public
+ *	@brief	Creates an FF_IOMAN object that caches its sectors in a pool, instead of a cache of its own.
+ *
+ *	The IOMAN is used like any other. Its sectors are tagged with it in the pool, and compete
+ *	for the lines with the sectors of the other IOMANs, so cache memory follows the busy volumes.
+ *	FF_DestroyIOMAN() removes its sectors from the pool, which must outlive it.
+ *
+ *	@param	pPool	The pool returned by FF_CreateCachePool().
+ *	@param	pError	To be checked when a NULL pointer is returned.
+ *
+ *	@return	Returns a pointer to an FF_IOMAN type object. NULL on Error, check the contents of pError.
+ **/
+FF_IOMAN *FF_CreatePooledIOMAN(FF_CACHE_POOL *pPool, FF_ERROR *pError) {
+	if(!pPool) {
+		if(pError) {
+			*pError = FF_ERR_NULL_POINTER | FF_CREATEPOOLEDIOMAN;
+		}
+		return NULL;
+	}
+
+	return FF_IOMAN_Create(pPool, NULL, pPool->pCache->CacheSize * pPool->pCache->BlkSize, pPool->pCache->BlkSize, &pPool->pCache->Layout, pError);
+}
@@ -64,7 +64,7 @@
 #define FF_MODE_APPEND			0x04		///< FILE Mode Append Access.
 #define	FF_MODE_CREATE			0x08		///< FILE Mode Create file if not existing.
 #define FF_MODE_TRUNCATE		0x10		///< FILE Mode Truncate an Existing file.
-#define FF_MODE_DIR				0x80		///< Special Mode to open a Dir. (Internal use ONLY!)
+#define FF_MODE_DIR				0x80		///< Special Mode to open a Dir. Also marks directory sectors for FF_GetBuffer(). (Internal use ONLY!)
 
 #define FF_MODE_RD_WR			(FF_MODE_READ|FF_MODE_WRITE) ///< Just for bit filtering
 
@@ -102,12 +102,69 @@ typedef struct {
 	void			*pParam;		///< Pointer to some parameters e.g. for a Low-Level Driver Handle
 } FF_BLK_DEVICE;
 
+#define FF_CACHE_CLASS_FAT		0	///< The reserved area, and the FAT tables.
+#define FF_CACHE_CLASS_DIR		1	///< Directory sectors.
+#define FF_CACHE_CLASS_DATA		2	///< File data, and sectors outside of the mounted partition.
+#define FF_CACHE_CLASS_PINNED	3	///< Leading FAT sectors, that are never replaced once cached.
+#define FF_CACHE_CLASSES		4
+#define FF_CACHE_CLASS_ANY		0xFF	///< Used when choosing a victim, to ignore the quotas.
+
+/**
+ *	@public
+ *	@brief	Describes how the cache is shared between the classes of sector, passed to FF_CreateIOMANEx().
+ *
+ *	Each class is guaranteed a quota of the cache lines. Lines of a class that is within its
+ *	quota are only replaced by lines of the same class, the rest of the cache is shared by all.
+ *	The quotas are percentages of the cache, and may add up to 100 at most.
+ **/
+typedef struct {
+	FF_T_UINT8		FatQuota;			///< Percentage of the cache reserved for the FAT tables, (and the reserved area).
+	FF_T_UINT8		DirQuota;			///< Percentage of the cache reserved for directory sectors.
+	FF_T_UINT8		DataQuota;			///< Percentage of the cache reserved for file data.
+	FF_T_UINT32		PinnedFatSectors;	///< Sectors from the start of the first FAT, that stay cached once read. (Upto half the cache).
+} FF_CACHE_LAYOUT;
+
+/**
+ *	@public
+ *	@brief	I/O statistics of an IOMAN, as returned by FF_GetStats().
+ *
+ *	All counters start at 0 when the IOMAN is created, and wrap around on overflow.
+ *	Times are in microseconds, and are only measured if FF_STATS_TIMING is defined.
+ **/
+typedef struct {
+	FF_T_UINT32		CacheHits[FF_CACHE_CLASSES];	///< Requests for sectors that were cached, by FF_CACHE_CLASS_ of the sector.
+	FF_T_UINT32		CacheMisses[FF_CACHE_CLASSES];	///< Requests for sectors that had to be read, by FF_CACHE_CLASS_ of the sector.
+	FF_T_UINT32		Evictions;			///< Cache lines replaced to make room for other sectors.
+	FF_T_UINT32		WriteBacks;			///< Driver writes of modified cache buffers.
+	FF_T_UINT32		FlusherPasses;		///< Passes of the background flusher over the cache. (FF_CACHE_FLUSHER only).
+	FF_T_UINT32		WriterThrottles;	///< Times a writer found its shard at FF_FLUSH_DIRTY_LIMIT, and had to wait for the flusher.
+	FF_T_UINT32		ReadAheads;			///< Read-ahead driver calls.
+	FF_T_UINT32		ReadAheadHits;		///< Lines read ahead, that were requested afterwards.
+	FF_T_UINT32		ReadAheadWasted;	///< Lines read ahead, that were replaced without being requested.
+	FF_T_UINT32		DriverReads;		///< Calls to the driver's read function.
+	FF_T_UINT32		DriverReadSectors;	///< Sectors read by the driver.
+	FF_T_UINT32		DriverWrites;		///< Calls to the driver's write function.
+	FF_T_UINT32		DriverWriteSectors;	///< Sectors written by the driver.
+	FF_T_UINT32		FatBufferGets[2];	///< FAT entry accesses through an empty FF_FatBuffers, [0] for reads and [1] for writes.
+	FF_T_UINT32		FatBufferReuses[2];	///< FAT entry accesses that reused the sector already held by the FF_FatBuffers.
+	FF_T_UINT32		FatBufferMisses[2];	///< FAT entry accesses that released the held sector, to get another one.
+	FF_T_UINT32		BufferWaits;		///< Times FF_GetBuffer() waited for a buffer to be released.
+	FF_T_UINT32		BufferWaitTime;		///< Time spent waiting in FF_GetBuffer() for buffers to be released.
+	FF_T_UINT32		LockWaitTime;		///< Time spent waiting for cache shard semaphores.
+} FF_IOSTATS;
+
 /**
  *	@private
  *	@brief	FullFAT handles memory with buffers, described as below.
+ *
+ *	Each buffer describes a single sector. The buffers are grouped into cache lines of
+ *	LineSectors consecutive sectors, that are fetched and replaced together. The first
+ *	buffer of a line (its head) holds the line's state, and is the one indexed and kept on
+ *	the replacement lists.
+ *
  *	@note	This may change throughout development.
  **/
-typedef struct {
+typedef struct _FF_BUFFER {
 	FF_T_UINT32		Sector;			///< The LBA of the Cached sector.
 	FF_T_UINT32		LRU;			///< For the Least Recently Used algorithm.
 	FF_T_UINT16		NumHandles;		///< Number of objects using this buffer.
@@ -116,8 +173,114 @@ typedef struct {
 	FF_T_BOOL		Modified;		///< If the sector was modified since read.
 	FF_T_BOOL		Valid;			///< Initially FALSE.
 	FF_T_UINT8		*pBuffer;		///< Pointer to the cache block.
+	FF_T_UINT16		LineHandles;	///< Handles held on all sectors of the cache line. (Line heads only).
+	FF_T_BOOL		LineValid;		///< The cache line is allocated, starting at Sector. (Line heads only).
+	FF_T_BOOL		ReadAhead;		///< The cache line was read ahead, and hasn't been requested yet. (Line heads only).
+	FF_T_UINT8		Class;			///< Kind of sectors held by the cache line, an FF_CACHE_CLASS_ value. (Line heads only).
+	struct _FF_IOMAN	*pOwner;	///< IOMAN whose device the line's sectors belong to. (Line heads and ghosts only).
+#ifdef FF_CACHE_FLUSHER
+	FF_T_UINT32		DirtyTick;		///< Flusher tick when the sector was modified, after it was last written back.
+#endif
+#ifndef FF_CACHE_REPLACE_SCAN
+	struct _FF_BUFFER	*pPrev;		///< Previous (older) buffer on the replacement list holding this buffer.
+	struct _FF_BUFFER	*pNext;		///< Next (newer) buffer on the replacement list holding this buffer.
+#endif
+#ifdef FF_CACHE_REPLACE_2Q
+	FF_T_UINT8		Queue;			///< Which 2Q queue the buffer belongs to.
+#endif
 } FF_BUFFER;
 
+#ifndef FF_CACHE_REPLACE_SCAN
+/**
+ *	@private
+ *	@brief	A list of buffers, used by the cache replacement policies.
+ **/
+typedef struct {
+	FF_BUFFER		*pHead;			///< Oldest buffer on the list.
+	FF_BUFFER		*pTail;			///< Newest buffer on the list.
+} FF_BUFFER_LIST;
+#endif
+
+/**
+ *	@private
+ *	@brief	A lock shard of the buffer cache.
+ *
+ *	Every sector belongs to one shard, chosen from its hash. Each shard owns a share of
+ *	the buffers, with their index and replacement state, all protected by its own semaphore.
+ *	Threads working on sectors of different shards never wait for each other.
+ **/
+typedef struct {
+	void			*pSemaphore;		///< Protects the shard's buffer descriptors, index and replacement state.
+	void			*pCondition;		///< Signalled when a buffer is released, to wake threads waiting in FF_GetBuffer().
+	FF_T_UINT32		Waiters;			///< Number of threads waiting on pCondition.
+	FF_BUFFER		*pBuffers;			///< First buffer descriptor of the shard.
+	FF_T_UINT16		BufferCount;		///< Number of buffers in the shard. (Always a whole number of cache lines).
+	FF_T_UINT16		LineSectors;		///< Sectors per cache line, copied from the IOMAN.
+	FF_T_UINT16		*pIndex;			///< Open-addressed index of allocated lines by their first Sector. (Offset from pBuffers + 1, 0 is empty).
+	FF_T_UINT32		IndexMask;			///< Size of the index - 1. (Size is always a power of 2).
+	FF_IOSTATS		Stats;				///< Cache statistics of the shard, updated while its semaphore is claimed.
+	FF_T_UINT16		ClassLines[FF_CACHE_CLASSES];	///< Number of allocated lines of each class.
+	FF_T_UINT16		ClassQuota[FF_CACHE_CLASSES];	///< Lines of each class that only lines of the same class can replace.
+#ifdef FF_CACHE_FLUSHER
+	FF_T_UINT16		DirtyCount;			///< Number of modified buffers in the shard.
+#endif
+#ifdef FF_CACHE_REPLACE_LRU
+	FF_BUFFER_LIST	LRU;				///< Lines without handles, least recently used first.
+#endif
+#ifdef FF_CACHE_REPLACE_2Q
+	FF_BUFFER_LIST	FreeBuffers;		///< Lines that are not allocated, these are re-used first.
+	FF_BUFFER_LIST	A1in;				///< Probation, FIFO of sectors referenced only once.
+	FF_BUFFER_LIST	Am;					///< Sectors re-referenced after probation, without handles, in LRU order.
+	FF_BUFFER_LIST	A1out;				///< Ghosts of sectors recently evicted from probation, oldest first.
+	FF_BUFFER_LIST	FreeGhosts;			///< Unused ghost descriptors.
+	FF_BUFFER		*pGhosts;			///< First ghost descriptor of the shard.
+	FF_T_UINT16		GhostCount;			///< Number of ghost descriptors in the shard.
+	FF_T_UINT16		A1inCount;			///< Number of buffers on probation.
+	FF_T_UINT16		A1inTarget;			///< Probation is evicted from first, while it holds more buffers than this.
+#endif
+} FF_CACHE_SHARD;
+
+#define FF_READAHEAD_STREAMS	4	///< Number of sequential miss streams that are followed at once.
+
+/**
+ *	@private
+ *	@brief	State of the read-ahead engine.
+ *
+ *	A cache miss on the line following a recent miss continues a stream. The next Window
+ *	sectors of a stream are then read with a single driver call. The window grows while
+ *	streams keep consuming it, and shrinks when lines that were read ahead are replaced
+ *	without being requested.
+ **/
+typedef struct {
+	void			*pSemaphore;		///< Protects the read-ahead state. No other semaphore is claimed while it is held.
+	FF_T_UINT8		*pStaging;			///< Memory that sectors are read ahead into, before being copied to their lines.
+	FF_T_UINT32		MaxSectors;			///< Size of pStaging in sectors. (0 if read-ahead is disabled).
+	FF_T_UINT32		Window;				///< Sectors read ahead when a stream continues.
+	FF_T_UINT32		NextLBA[FF_READAHEAD_STREAMS];	///< The line that would continue each stream. (0 for none).
+	FF_T_UINT16		NextStream;			///< Stream replaced by the next miss that doesn't continue one.
+	FF_T_BOOL		Busy;				///< pStaging is in use.
+} FF_READAHEAD;
+
+#ifdef FF_CACHE_FLUSHER
+/**
+ *	@private
+ *	@brief	State of the background flusher thread.
+ *
+ *	The thread writes back sectors that have been dirty for FF_FLUSH_DIRTY_AGE, once every
+ *	FF_FLUSH_INTERVAL. Writers wake it early, when a shard has more than FF_FLUSH_DIRTY_RATIO
+ *	dirty buffers, and wait for it at FF_FLUSH_DIRTY_LIMIT.
+ **/
+typedef struct {
+	void			*pThread;			///< The flusher thread, NULL while none is running.
+	void			*pSemaphore;		///< Protects the flusher state. No other semaphore is claimed while it is held.
+	void			*pCondition;		///< Wakes the flusher before its interval is up.
+	void			*pFlushed;			///< Signalled at the end of each pass, for writers waiting at the dirty limit.
+	FF_T_UINT32		Tick;				///< Intervals since the partition was mounted, sectors are aged by it.
+	FF_T_BOOL		bKicked;			///< The flusher must write back every dirty sector, not just the old ones.
+	FF_T_BOOL		bStop;				///< The flusher thread must return.
+} FF_FLUSHER;
+#endif
+
 typedef struct {
 #ifdef FF_UNICODE_SUPPORT
 	FF_T_WCHAR	Path[FF_MAX_PATH];
@@ -148,6 +311,7 @@ typedef struct {
 	 FF_T_UINT8      	BlkFactor;				///< Scale Factor for blocksizes above 512!
 	 //FF_T_INT8		Name[FF_MAX_PARTITION_NAME];	///< Partition Identifier e.g. c: sd0: etc.
 	 FF_T_INT8			VolLabel[12];			///< Volume Label of the partition.
+	 FF_T_UINT32		VolSerial;				///< Volume serial number of the partition.
 	 FF_T_UINT32		BeginLBA;				///< LBA start address of the partition.
 	 FF_T_UINT32		PartSize;				///< Size of Partition in number of sectors.
 	 FF_T_UINT32		FatBeginLBA;			///< LBA of the FAT tables.
@@ -158,6 +322,8 @@ typedef struct {
 	 FF_T_UINT32		DataSectors;
 #ifdef FF_WRITE_FREE_COUNT
 	 FF_T_UINT32    	FSInfoLBA;				///< LBA of the FSINFO sector.
+	 FF_T_BOOL			bFSInfoDirty;			///< FF_TRUE while the FSINFO sector is behind FreeClusterCount and LastFreeCluster.
+	 FF_T_UINT32		FSInfoUpdates;			///< Changes to the free count since the FSINFO sector was last written.
 #endif
 	 FF_T_UINT32		RootDirSectors;
 	 FF_T_UINT32		FirstDataSector;
@@ -166,6 +332,28 @@ typedef struct {
 	 FF_T_UINT32		NumClusters;		///< Number of clusters.
 	 FF_T_UINT32		RootDirCluster;		///< Cluster number of the root directory entry.
 	 FF_T_UINT32		LastFreeCluster;
+#ifdef FF_FREE_BITMAP
+	 FF_T_UINT32		*pFreeBitmap;		///< One bit for each cluster, set while the cluster is free. (NULL until it is built).
+#endif
+#ifdef FF_FAT12_DECODE
+	 FF_T_UINT16		*pFat12Table;		///< The FAT12 entries, decoded to one per word. (NULL if the volume is not FAT12, or there was no memory).
+	 FF_T_UINT8			*pFat12Raw;			///< The FAT12 sectors that pFat12Table was decoded from, encoded again as they are written back.
+	 FF_T_UINT32		*pFat12Dirty;		///< One bit for each sector of pFat12Raw, set while its entries are modified and not yet written.
+#endif
+#ifdef FF_FAT_MIRROR
+	 FF_T_UINT8			*pFatMirror;		///< The whole FAT, when it is held in RAM. (NULL if it is too large, or there was no memory).
+	 FF_T_UINT32		*pFatMirrorDirty;	///< One bit for each sector of pFatMirror, set while it is modified and not yet written.
+#endif
+#ifdef FF_MIRROR_FATS_UMOUNT
+	 FF_T_UINT32		*pFatCopyDirty;		///< One bit for each sector of the first FAT, set while the other FATs are behind it. (NULL if there is 1 FAT).
+	 FF_T_BOOL			bDeferFatCopies;	///< FF_TRUE while the other FATs are only written by FF_SyncFatCopies(), see FF_DeferFatCopies().
+#endif
+#if FF_ALLOC_GROUPS > 1
+	 FF_T_UINT16		nAllocGroups;		///< Number of allocation groups, 1 when the volume is too small to split, (or is FAT12).
+	 FF_T_UINT16		NextAllocGroup;		///< Group that the next file opened for writing is bound to.
+	 FF_T_UINT32		AllocGroupSize;		///< Clusters in each group, (the last group also takes the rest).
+	 FF_T_UINT32		AllocGroupHint[FF_ALLOC_GROUPS];	///< Where the search for free clusters starts in each group.
+#endif
 	 FF_T_UINT32		FreeClusterCount;	///< Records free space on mount.
 	 FF_T_BOOL			PartitionMounted;	///< FF_TRUE if the partition is mounted, otherwise FF_FALSE.
 #ifdef FF_PATH_CACHE
@@ -182,8 +370,6 @@ typedef struct {
  *
  *	FullFAT functions around an object like this.
  **/
-#define FF_FAT_LOCK			0x01	///< Lock bit mask for FAT table locking.
-#define FF_DIR_LOCK			0x02	///< Lock bit mask for DIR modification locking.
 //#define FF_PATHCACHE_LOCK	0x04
 
 /**
@@ -199,45 +385,97 @@ typedef struct {
  *	something!
  *
  **/
-typedef struct {
+typedef struct _FF_IOMAN {
 	FF_BLK_DEVICE	*pBlkDevice;		///< Pointer to a Block device description.
 	FF_PARTITION	*pPartition;		///< Pointer to a partition description.
 	FF_BUFFER		*pBuffers;			///< Pointer to the first buffer description.
-	void			*pSemaphore;		///< Pointer to a Semaphore object. (For buffer description modifications only!).
+	void			*pSemaphore;		///< Pointer to a Semaphore object. (For the file list and FAT/DIR locks, buffers are protected by their shard).
 #ifdef FF_BLKDEV_USES_SEM
 	void			*pBlkDevSemaphore;	///< Semaphore to guarantee Atomic access to the underlying block device, if required.
 #endif
 	void			*FirstFile;			///< Pointer to the first File object.
 	FF_T_UINT8		*pCacheMem;			///< Pointer to a block of memory for the cache.
+	FF_T_UINT16		LineSectors;		///< Sectors per cache line. (Always a power of 2, set for each mounted partition).
+	FF_T_UINT16		MaxLineSectors;		///< Longest cache line that the cache was laid out for.
+	FF_CACHE_SHARD	*pShards;			///< The lock shards that the buffers are divided between.
+	FF_T_UINT16		ShardCount;			///< Number of shards. (Always a power of 2).
+#ifdef FF_CACHE_REPLACE_2Q
+	FF_T_UINT16		GhostCount;			///< Number of ghost descriptors, following the buffer descriptors.
+#endif
+	FF_BUFFER		**pFlushList;		///< Scratch list of dirty buffers, sorted by FF_FlushCache().
+	FF_T_UINT8		*pFlushStaging;		///< Staging memory for merging dirty buffers into a single write. (May be NULL).
+	FF_READAHEAD	ReadAhead;			///< Sequential miss detection and read-ahead.
+#ifdef FF_CACHE_FLUSHER
+	FF_FLUSHER		Flusher;			///< Background write-back of dirty sectors.
+#endif
+	FF_CACHE_LAYOUT	Layout;				///< Cache quotas, all 0 when the cache is not partitioned.
+	FF_T_UINT8		*pSnapshot;			///< Caller's storage for the hot sectors saved at unmount, see FF_SetCacheSnapshot(). (May be NULL).
+	FF_T_UINT32		SnapshotSize;		///< Size of pSnapshot in bytes.
+	FF_IOSTATS		Stats;				///< Driver and FAT statistics, updated with FF_AtomicAdd(). (Cache statistics are kept by the shards).
 	FF_T_UINT32		LastReplaced;		///< Marks which sector was last replaced in the cache.
 	FF_T_UINT16		BlkSize;			///< The Block size that IOMAN is configured to.
 	FF_T_UINT16		CacheSize;			///< Size of the cache in number of Sectors.
 	FF_T_UINT8		PreventFlush;		///< Flushing to disk only allowed when 0
 	FF_T_UINT8		MemAllocation;		///< Bit-Mask identifying allocated pointers.
-	FF_T_UINT8		Locks;				///< Lock Flag for FAT & DIR Locking etc (This must be accessed via a semaphore).
+	void			*pFatLock;			///< Reader-writer lock of the FAT, see FF_lockFAT() and FF_lockFATRead().
+	void			*pDirLock;			///< Reader-writer lock of the directories, see FF_lockDIR().
+#if FF_ALLOC_GROUPS > 1
+	FF_T_UINT32		GroupLocks;			///< One bit for each allocation group locked by FF_lockAllocGroup(), (accessed via the semaphore).
+	void			*pGroupCondition;	///< Signalled when allocation groups are unlocked.
+#endif
+	struct _FF_CACHE_POOL	*pPool;		///< Pool that the cache is shared through, (the cache fields are copied from it). NULL for a cache of its own.
+	FF_T_UINT32		PoolTag;			///< Mixed into the sector hash, so the same sectors of other IOMANs in the pool hash elsewhere. (0 without a pool).
 #ifdef FF_HASH_CACHE
 	FF_HASHCACHE	HashCache[FF_HASH_CACHE_DEPTH];
 #endif
 } FF_IOMAN;
 
+/**
+ *	@public
+ *	@brief	A cache shared by several FF_IOMAN objects, created by FF_CreateCachePool().
+ *
+ *	Every IOMAN of the pool caches its sectors in the same lines, tagged with the IOMAN they
+ *	belong to, and a single replacement policy chooses the victims for all of them. The
+ *	cache memory therefore goes to whichever volumes are busy.
+ **/
+typedef struct _FF_CACHE_POOL {
+	FF_IOMAN		*pCache;			///< IOMAN that the cache memory, shards and descriptors were created for. (It never has a device).
+	void			*pSemaphore;		///< Protects Members and NextTag.
+	FF_T_UINT16		Members;			///< Number of IOMANs attached to the pool.
+	FF_T_UINT32		NextTag;			///< Sequence number of the next IOMAN to attach, its PoolTag is derived from it.
+} FF_CACHE_POOL;
+
 // Bit-Masks for Memory Allocation testing.
 #define FF_IOMAN_ALLOC_BLKDEV	0x01	///< Flags the pBlkDevice pointer is allocated.
 #define FF_IOMAN_ALLOC_PART		0x02	///< Flags the pPartition pointer is allocated.
 #define	FF_IOMAN_ALLOC_BUFDESCR	0x04	///< Flags the pBuffers pointer is allocated.
 #define	FF_IOMAN_ALLOC_BUFFERS	0x08	///< Flags the pCacheMem pointer is allocated.
-#define FF_IOMAN_ALLOC_RESERVED	0xF0	///< Reserved Section.
+#define	FF_IOMAN_ALLOC_STAGING	0x10	///< Flags the pFlushStaging pointer is allocated.
+#define	FF_IOMAN_ALLOC_READAHEAD	0x20	///< Flags the ReadAhead.pStaging pointer is allocated.
+#define	FF_IOMAN_ALLOC_SHARDS	0x40	///< Flags the pShards pointer is allocated.
+#define FF_IOMAN_ALLOC_RESERVED	0x80	///< Reserved Section.
 
 
 //---------- PROTOTYPES (in order of appearance)
 
 // PUBLIC (Interfaces):
 FF_IOMAN	*FF_CreateIOMAN			(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, FF_ERROR *pError);
+FF_IOMAN	*FF_CreateIOMANEx		(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, const FF_CACHE_LAYOUT *pLayout, FF_ERROR *pError);
 FF_ERROR	FF_DestroyIOMAN			(FF_IOMAN *pIoman);
 FF_ERROR	FF_RegisterBlkDevice	(FF_IOMAN *pIoman, FF_T_UINT16 BlkSize, FF_WRITE_BLOCKS fnWriteBlocks, FF_READ_BLOCKS fnReadBlocks, void *pParam);
 FF_ERROR	FF_UnregisterBlkDevice	(FF_IOMAN *pIoman);
 FF_ERROR	FF_MountPartition		(FF_IOMAN *pIoman, FF_T_UINT8 PartitionNumber);
 FF_ERROR	FF_UnmountPartition		(FF_IOMAN *pIoman);
 FF_ERROR	FF_FlushCache			(FF_IOMAN *pIoman);
+FF_ERROR	FF_GetStats				(FF_IOMAN *pIoman, FF_IOSTATS *pStats);
+FF_ERROR	FF_ResizeCache			(FF_IOMAN *pIoman, FF_T_UINT32 Size);
+FF_CACHE_POOL	*FF_CreateCachePool	(FF_T_UINT8 *pCacheMem, FF_T_UINT32 Size, FF_T_UINT16 BlkSize, const FF_CACHE_LAYOUT *pLayout, FF_ERROR *pError);
+FF_ERROR	FF_DestroyCachePool		(FF_CACHE_POOL *pPool);
+FF_IOMAN	*FF_CreatePooledIOMAN	(FF_CACHE_POOL *pPool, FF_ERROR *pError);
+FF_ERROR	FF_SetCacheSnapshot		(FF_IOMAN *pIoman, FF_T_UINT8 *pSnapshot, FF_T_UINT32 Size);
+#ifdef FF_MIRROR_FATS_UMOUNT
+FF_ERROR	FF_DeferFatCopies		(FF_IOMAN *pIoman, FF_T_BOOL bDefer);
+#endif
 FF_INLINE FF_T_BOOL	FF_Mounted		(FF_IOMAN *pIoman)
 {
 	return pIoman && pIoman->pPartition && pIoman->pPartition->PartitionMounted;
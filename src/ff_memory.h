@@ -121,6 +121,7 @@ FF_INLINE FF_T_UINT16 FF_getShort(FF_T_UINT8 *pBuffer, FF_T_UINT32 aOffset)
 
 FF_INLINE FF_T_UINT32 FF_getLong(FF_T_UINT8 *pBuffer, FF_T_UINT32 aOffset) {
 	FF_T_UN32 u32;
+	u32.u32 = 0;	// FF_T_UINT32 may be wider than the 4 bytes filled in.
 	pBuffer += aOffset;
 	u32.bytes.u8_3 = pBuffer[3];
 	u32.bytes.u8_2 = pBuffer[2];
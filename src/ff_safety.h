@@ -50,6 +50,8 @@
 #include "ff_types.h"
 
 
+typedef void (*FF_THREAD_FUNCTION)(void *pParam);	///< Body of a thread started by FF_CreateThread().
+
 //---------- PROTOTYPES (in order of appearance)
 
 // PUBLIC:
@@ -61,8 +63,22 @@ void		FF_PendSemaphore		(void *pSemaphore);
 FF_T_BOOL	FF_TrySemaphore         (void *pSemaphore, FF_T_UINT32 TimeMs);
 void		FF_ReleaseSemaphore		(void *pSemaphore);
 void		FF_DestroySemaphore		(void *pSemaphore);
+void		*FF_CreateCondition		(void);
+FF_T_BOOL	FF_WaitCondition		(void *pCondition, void *pSemaphore, FF_T_UINT32 TimeMs);
+void		FF_SignalCondition		(void *pCondition);
+void		FF_DestroyCondition		(void *pCondition);
+void		*FF_CreateRWLock		(void);
+void		FF_PendRead				(void *pRWLock);
+void		FF_ReleaseRead			(void *pRWLock);
+void		FF_PendWrite			(void *pRWLock);
+void		FF_ReleaseWrite			(void *pRWLock);
+void		FF_DestroyRWLock		(void *pRWLock);
 void		FF_Yield				(void);
 void		FF_Sleep				(FF_T_UINT32 TimeMs);
+void		FF_AtomicAdd			(FF_T_UINT32 *pValue, FF_T_UINT32 Add);
+FF_T_UINT32	FF_GetMicroseconds		(void);
+void		*FF_CreateThread		(FF_THREAD_FUNCTION fnThread, void *pParam);
+void		FF_JoinThread			(void *pThread);
 
 #endif
 
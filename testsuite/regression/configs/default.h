@@ -0,0 +1,3 @@
+/*
+	The options as ff_config.h sets them.
+*/
@@ -0,0 +1,5 @@
+/*
+	A per-file extent map of only 4 runs, so lookups past them follow the chain.
+*/
+#undef	FF_FILE_EXTENT_MAP_RUNS
+#define	FF_FILE_EXTENT_MAP_RUNS	4
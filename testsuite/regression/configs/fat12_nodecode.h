@@ -0,0 +1,4 @@
+/*
+	FAT12 entries are read and written in the FAT sectors, (no decoded table).
+*/
+#undef FF_FAT12_DECODE
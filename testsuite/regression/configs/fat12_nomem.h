@@ -0,0 +1,11 @@
+/*
+	FF_MALLOC() goes to RD_Malloc(), so that a test can mount a volume with no memory for
+	the FAT12 table, (or the free cluster bitmap and FAT mirror).
+*/
+#include <stddef.h>
+
+void *RD_Malloc(size_t Size);
+
+#define RD_MALLOC_HOOK
+#undef	FF_MALLOC
+#define	FF_MALLOC(aSize)	RD_Malloc(aSize)
@@ -0,0 +1,4 @@
+/*
+	FAT copies are written by FF_FlushCache(), (see FF_DeferFatCopies()).
+*/
+#define	FF_MIRROR_FATS_UMOUNT
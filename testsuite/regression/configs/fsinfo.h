@@ -0,0 +1,5 @@
+/*
+	The FSINFO free count is also written after every 16 changes, between flushes.
+*/
+#undef	FF_FSINFO_UPDATE_INTERVAL
+#define	FF_FSINFO_UPDATE_INTERVAL	16
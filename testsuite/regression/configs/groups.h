@@ -0,0 +1,5 @@
+/*
+	4 allocation groups, so that concurrent writers allocate from their own group.
+*/
+#undef	FF_ALLOC_GROUPS
+#define	FF_ALLOC_GROUPS			4
@@ -0,0 +1,5 @@
+/*
+	Plain LRU replacement, instead of 2Q.
+*/
+#undef	FF_CACHE_REPLACE_2Q
+#define	FF_CACHE_REPLACE_LRU
@@ -0,0 +1,4 @@
+/*
+	FAT entries are read and written in a copy of the FAT in RAM, (FAT12 and FAT16 fit).
+*/
+#define	FF_FAT_MIRROR
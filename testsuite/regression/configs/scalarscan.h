@@ -0,0 +1,6 @@
+/*
+	The FAT is scanned an entry at a time, through the cache, (no SIMD kernels, no staging buffer).
+*/
+#undef	FF_FAT_SCAN_SIMD
+#undef	FF_FAT_SCAN_SECTORS
+#define	FF_FAT_SCAN_SECTORS	0
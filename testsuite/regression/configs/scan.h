@@ -0,0 +1,6 @@
+/*
+	The original replacement policy, that ages every buffer on each cache miss.
+*/
+#undef	FF_CACHE_REPLACE_2Q
+#undef	FF_CACHE_REPLACE_LRU
+#define	FF_CACHE_REPLACE_SCAN
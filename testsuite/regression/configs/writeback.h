@@ -0,0 +1,9 @@
+/*
+	Write-back caching, where modified sectors stay in the cache until they are flushed,
+	(or written back by the flusher thread), with the cache split into lock shards.
+*/
+#undef	FF_CACHE_WRITE_THROUGH
+#define	FF_CACHE_WRITE_BACK
+#define	FF_CACHE_FLUSHER
+#undef	FF_CACHE_SHARDS
+#define	FF_CACHE_SHARDS		4
@@ -0,0 +1,370 @@
+/**
+ *	RAM disk driver, and FAT volume builder for the regression tests.
+ **/
+
+#include <stdlib.h>
+#include "regress.h"
+
+#define RD_BLKSIZE	512
+
+static int RD_bFailMalloc = 0;
+
+static FF_T_SINT32 RD_Read(FF_T_UINT8 *pBuffer, FF_T_UINT32 SectorAddress, FF_T_UINT32 Count, void *pParam) {
+	RAMDISK *pDisk = (RAMDISK *) pParam;
+
+	if(SectorAddress + Count > pDisk->Sectors) {
+		return FF_ERR_DEVICE_DRIVER_FAILED;
+	}
+	pthread_mutex_lock(&pDisk->Lock);
+	memcpy(pBuffer, pDisk->pData + (SectorAddress * RD_BLKSIZE), Count * RD_BLKSIZE);
+	pDisk->Reads++;
+	pDisk->ReadSectors += Count;
+	pthread_mutex_unlock(&pDisk->Lock);
+
+	return Count;
+}
+
+static FF_T_SINT32 RD_Write(FF_T_UINT8 *pBuffer, FF_T_UINT32 SectorAddress, FF_T_UINT32 Count, void *pParam) {
+	RAMDISK *pDisk = (RAMDISK *) pParam;
+
+	if(SectorAddress + Count > pDisk->Sectors) {
+		return FF_ERR_DEVICE_DRIVER_FAILED;
+	}
+	pthread_mutex_lock(&pDisk->Lock);
+	memcpy(pDisk->pData + (SectorAddress * RD_BLKSIZE), pBuffer, Count * RD_BLKSIZE);
+	pDisk->Writes++;
+	pDisk->WriteSectors += Count;
+	pthread_mutex_unlock(&pDisk->Lock);
+
+	return Count;
+}
+
+/**
+ *	Formats a new RAM disk. FAT12 is 2MB with 2KB clusters, (so there are entries that span the
+ *	FAT sectors), FAT16 is 32MB with 2KB clusters and FAT32 is 68MB with 512 byte clusters.
+ **/
+RAMDISK *RD_Create(FF_T_UINT8 FatType) {
+	RAMDISK		*pDisk = (RAMDISK *) calloc(1, sizeof(RAMDISK));
+	FF_T_UINT8	*pBoot;
+	FF_T_UINT32	SectorsPerCluster, RootEntries, RootSectors, Need, Fat;
+
+	switch(FatType) {
+		case 12:	pDisk->Sectors = 4096;		SectorsPerCluster = 4;	pDisk->ReservedSectors = 1;		RootEntries = 224;	break;
+		case 16:	pDisk->Sectors = 65536;		SectorsPerCluster = 4;	pDisk->ReservedSectors = 4;		RootEntries = 512;	break;
+		default:	pDisk->Sectors = 140000;	SectorsPerCluster = 1;	pDisk->ReservedSectors = 32;	RootEntries = 0;	break;
+	}
+	pDisk->FatType	= FatType;
+	pDisk->NumFATs	= 2;
+	pDisk->pData	= (FF_T_UINT8 *) calloc(pDisk->Sectors, RD_BLKSIZE);
+	pthread_mutex_init(&pDisk->Lock, NULL);
+
+	RootSectors = ((RootEntries * 32) + RD_BLKSIZE - 1) / RD_BLKSIZE;
+	for(pDisk->SectorsPerFAT = 1; ; pDisk->SectorsPerFAT = Need) {
+		pDisk->Clusters = (pDisk->Sectors - pDisk->ReservedSectors - (pDisk->NumFATs * pDisk->SectorsPerFAT) - RootSectors) / SectorsPerCluster;
+		Need = (FatType == 12) ? (((pDisk->Clusters + 2) * 3) / 2) + 1 : (pDisk->Clusters + 2) * (FatType / 8);
+		Need = (Need + RD_BLKSIZE - 1) / RD_BLKSIZE;
+		if(Need <= pDisk->SectorsPerFAT) {
+			break;
+		}
+	}
+
+	pBoot = pDisk->pData;
+	memcpy(pBoot, "\xEB\x3C\x90" "FULLFATR", 11);
+	FF_putShort(pBoot, 11, RD_BLKSIZE);
+	FF_putChar(pBoot, 13, (FF_T_UINT8) SectorsPerCluster);
+	FF_putShort(pBoot, 14, (FF_T_UINT16) pDisk->ReservedSectors);
+	FF_putChar(pBoot, 16, (FF_T_UINT8) pDisk->NumFATs);
+	FF_putShort(pBoot, 17, (FF_T_UINT16) RootEntries);
+	FF_putChar(pBoot, 21, 0xF8);
+	if(pDisk->Sectors < 65536) {
+		FF_putShort(pBoot, 19, (FF_T_UINT16) pDisk->Sectors);
+	} else {
+		FF_putLong(pBoot, 32, pDisk->Sectors);
+	}
+	if(FatType == 32) {
+		FF_putLong(pBoot, 36, pDisk->SectorsPerFAT);
+		FF_putLong(pBoot, 44, 2);				// Root directory cluster.
+		FF_putShort(pBoot, 48, 1);				// FSINFO sector.
+		memcpy(pBoot + 82, "FAT32   ", 8);
+		FF_putLong(pDisk->pData + RD_BLKSIZE, 0, 0x41615252);
+		FF_putLong(pDisk->pData + RD_BLKSIZE, 484, 0x61417272);
+		FF_putLong(pDisk->pData + RD_BLKSIZE, 488, pDisk->Clusters - 1);
+		FF_putLong(pDisk->pData + RD_BLKSIZE, 492, 3);
+		FF_putShort(pDisk->pData + RD_BLKSIZE, 510, 0xAA55);
+	} else {
+		FF_putShort(pBoot, 22, (FF_T_UINT16) pDisk->SectorsPerFAT);
+		memcpy(pBoot + 54, (FatType == 12) ? "FAT12   " : "FAT16   ", 8);
+	}
+	FF_putShort(pBoot, 510, 0xAA55);
+
+	for(Fat = 0; Fat < pDisk->NumFATs; Fat++) {
+		FF_T_UINT8 *pFat = pDisk->pData + ((pDisk->ReservedSectors + (Fat * pDisk->SectorsPerFAT)) * RD_BLKSIZE);
+		switch(FatType) {
+			case 12:	memcpy(pFat, "\xF8\xFF\xFF", 3);	break;
+			case 16:	FF_putLong(pFat, 0, 0xFFFFFFF8);	break;
+			default:
+				FF_putLong(pFat, 0, 0x0FFFFFF8);
+				FF_putLong(pFat, 4, 0x0FFFFFFF);
+				FF_putLong(pFat, 8, 0x0FFFFFFF);	// The root directory.
+				break;
+		}
+	}
+
+	return pDisk;
+}
+
+void RD_Destroy(RAMDISK *pDisk) {
+	pthread_mutex_destroy(&pDisk->Lock);
+	free(pDisk->pData);
+	free(pDisk);
+}
+
+/**
+ *	Creates an IOMAN with a cache of CacheSize bytes, (or in pDisk->pPool), and mounts the RAM disk.
+ **/
+FF_IOMAN *RD_Mount(RAMDISK *pDisk, FF_T_UINT32 CacheSize, FF_ERROR *pError) {
+	FF_IOMAN *pIoman;
+
+	if(pDisk->pPool) {
+		pIoman = FF_CreatePooledIOMAN(pDisk->pPool, pError);
+	} else if(pDisk->pLayout) {
+		pIoman = FF_CreateIOMANEx(NULL, CacheSize, RD_BLKSIZE, pDisk->pLayout, pError);
+	} else {
+		pIoman = FF_CreateIOMAN(NULL, CacheSize, RD_BLKSIZE, pError);
+	}
+	if(!pIoman) {
+		return NULL;
+	}
+	*pError = FF_ERR_NONE;
+	if(pDisk->pSnapshot) {
+		*pError = FF_SetCacheSnapshot(pIoman, pDisk->pSnapshot, pDisk->SnapshotSize);
+	}
+	if(!FF_isERR(*pError)) {
+		*pError = FF_RegisterBlkDevice(pIoman, RD_BLKSIZE, RD_Write, RD_Read, pDisk);
+	}
+	if(!FF_isERR(*pError)) {
+		RD_bFailMalloc = pDisk->bNoMemAtMount;
+		*pError = FF_MountPartition(pIoman, 0);
+		RD_bFailMalloc = 0;
+	}
+	if(FF_isERR(*pError)) {
+		FF_DestroyIOMAN(pIoman);
+		return NULL;
+	}
+
+	return pIoman;
+}
+
+FF_ERROR RD_Unmount(FF_IOMAN *pIoman) {
+	FF_ERROR Error = FF_UnmountPartition(pIoman);
+
+	if(!FF_isERR(Error)) {
+		FF_UnregisterBlkDevice(pIoman);
+		Error = FF_DestroyIOMAN(pIoman);
+	}
+
+	return Error;
+}
+
+/**
+ *	@return	1 when every FAT copy is the same as the first FAT.
+ **/
+int RD_FatCopiesMatch(RAMDISK *pDisk) {
+	FF_T_UINT8	*pFirst = pDisk->pData + (pDisk->ReservedSectors * RD_BLKSIZE);
+	FF_T_UINT32	Fat;
+
+	for(Fat = 1; Fat < pDisk->NumFATs; Fat++) {
+		if(memcmp(pFirst, pFirst + (Fat * pDisk->SectorsPerFAT * RD_BLKSIZE), pDisk->SectorsPerFAT * RD_BLKSIZE)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ *	Reads an entry of the first FAT, as it is on the disk.
+ **/
+FF_T_UINT32 RD_FatEntry(RAMDISK *pDisk, FF_T_UINT32 nCluster) {
+	FF_T_UINT8	*pFat = pDisk->pData + (pDisk->ReservedSectors * RD_BLKSIZE);
+	FF_T_UINT32	Entry;
+
+	switch(pDisk->FatType) {
+		case 12:
+			Entry = FF_getShort(pFat, nCluster + (nCluster / 2));
+			return ((nCluster & 1) ? (Entry >> 4) : Entry) & 0x0FFF;
+		case 16:
+			return FF_getShort(pFat, nCluster * 2);
+		default:
+			return FF_getLong(pFat, nCluster * 4) & 0x0FFFFFFF;
+	}
+}
+
+FF_T_UINT32 RD_FreeClusters(RAMDISK *pDisk) {
+	FF_T_UINT32 nCluster, Free = 0;
+
+	for(nCluster = 2; nCluster < pDisk->Clusters + 2; nCluster++) {
+		if(!RD_FatEntry(pDisk, nCluster)) {
+			Free++;
+		}
+	}
+
+	return Free;
+}
+
+/**
+ *	@return	The free cluster count in the FSINFO sector, (FAT32 only).
+ **/
+FF_T_UINT32 RD_FSInfoFree(RAMDISK *pDisk) {
+	return FF_getLong(pDisk->pData + RD_BLKSIZE, 488);
+}
+
+/**
+ *	FF_MALLOC(), in configurations that define RD_MALLOC_HOOK.
+ **/
+void *RD_Malloc(size_t Size) {
+	return RD_bFailMalloc ? NULL : malloc(Size);
+}
+
+void RD_Fill(FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Seed) {
+	FF_T_UINT32 i;
+
+	for(i = 0; i < Size; i++) {
+		Seed = (Seed * 1103515245) + 12345;
+		pData[i] = (FF_T_UINT8) (Seed >> 16);
+	}
+}
+
+/**
+ *	Fills Count sectors from First directly on the disk, each with a pattern seeded by its LBA.
+ *	(Sectors of free clusters are not looked at by FullFAT, so the cache tests read these).
+ **/
+void RD_FillSectors(RAMDISK *pDisk, FF_T_UINT32 First, FF_T_UINT32 Count) {
+	FF_T_UINT32 Sector;
+
+	for(Sector = First; Sector < First + Count; Sector++) {
+		RD_Fill(pDisk->pData + (Sector * RD_BLKSIZE), RD_BLKSIZE, Sector);
+	}
+}
+
+/**
+ *	Gets a sector through the cache, and compares it with the disk.
+ *
+ *	@return	1 when the cached sector has the same contents as the disk.
+ **/
+int RD_CheckSector(FF_IOMAN *pIoman, RAMDISK *pDisk, FF_T_UINT32 Sector) {
+	FF_BUFFER	*pBuffer = FF_GetBuffer(pIoman, Sector, FF_MODE_READ);
+	int			Match;
+
+	if(!pBuffer) {
+		return 0;
+	}
+	Match = (pBuffer->Sector == Sector) && !memcmp(pBuffer->pBuffer, pDisk->pData + (Sector * RD_BLKSIZE), RD_BLKSIZE);
+	FF_ReleaseBuffer(pIoman, pBuffer);
+
+	return Match;
+}
+
+/**
+ *	Creates a file with Size bytes of pData, written Chunk bytes at a time.
+ **/
+int RD_WriteFile(FF_IOMAN *pIoman, const char *szPath, const FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Chunk) {
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT32	Pos, Count;
+
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) szPath, FF_MODE_WRITE | FF_MODE_CREATE | FF_MODE_TRUNCATE, &Error);
+	if(!pFile) {
+		DO_FF_FAIL(Error);
+	}
+	for(Pos = 0; Pos < Size; Pos += Count) {
+		Count = (Size - Pos < Chunk) ? Size - Pos : Chunk;
+		if(FF_Write(pFile, 1, Count, (FF_T_UINT8 *) pData + Pos) != (FF_T_SINT32) Count) {
+			FF_Close(pFile);
+			printf("Short write to %s at %lu\n", szPath, (unsigned long) Pos);
+			DO_FAIL;
+		}
+	}
+	CHECK_ERR(FF_Close(pFile));
+
+	return PASS;
+}
+
+/**
+ *	Reads a file back, Chunk bytes at a time, and compares it with pData.
+ **/
+int RD_CheckFile(FF_IOMAN *pIoman, const char *szPath, const FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Chunk) {
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pRead;
+	FF_T_UINT32	Pos, Count;
+	int			Match;
+
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) szPath, FF_MODE_READ, &Error);
+	if(!pFile) {
+		DO_FF_FAIL(Error);
+	}
+	pRead = (FF_T_UINT8 *) malloc(Size + 1);
+	Match = (pFile->Filesize == Size);
+	for(Pos = 0; Match && Pos < Size; Pos += Count) {
+		Count = (Size - Pos < Chunk) ? Size - Pos : Chunk;
+		Match = (FF_Read(pFile, 1, Count, pRead + Pos) == (FF_T_SINT32) Count);
+	}
+	Match = Match && !memcmp(pRead, pData, Size);
+	free(pRead);
+	CHECK_ERR(FF_Close(pFile));
+	if(!Match) {
+		printf("%s does not match what was written\n", szPath);
+		DO_FAIL;
+	}
+
+	return PASS;
+}
+
+/**
+ *	@return	Number of runs of consecutive clusters that a file is stored in, 0 on an error.
+ **/
+FF_T_UINT32 RD_FileRuns(FF_IOMAN *pIoman, RAMDISK *pDisk, const char *szPath) {
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT32	nCluster, Next, Runs = 1;
+
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) szPath, FF_MODE_READ, &Error);
+	if(!pFile) {
+		return 0;
+	}
+	nCluster = pFile->ObjectCluster;
+	FF_Close(pFile);
+
+	while(nCluster >= 2 && nCluster < pDisk->Clusters + 2) {
+		Next = RD_FatEntry(pDisk, nCluster);
+		if(Next >= 2 && Next < pDisk->Clusters + 2 && Next != nCluster + 1) {
+			Runs++;
+		}
+		nCluster = Next;
+	}
+
+	return Runs;
+}
+
+FF_T_UINT32 RD_AllocateChain(FF_IOMAN *pIoman, FF_T_UINT32 nClusters, FF_EXTENT *pExtent, FF_ERROR *pError) {
+	FF_lockFAT(pIoman);
+	*pError = FF_AllocateExtent(pIoman, nClusters, 0, pExtent);
+	FF_unlockFAT(pIoman);
+	if(FF_isERR(*pError)) {
+		return 0;
+	}
+	*pError = FF_DecreaseFreeClusters(pIoman, pExtent->Clusters);
+
+	return pExtent->Runs[0].Start;
+}
+
+FF_ERROR RD_FreeChain(FF_IOMAN *pIoman, FF_T_UINT32 Start) {
+	FF_ERROR Error;
+
+	FF_lockFAT(pIoman);
+	Error = FF_UnlinkClusterChain(pIoman, Start, 0);
+	FF_unlockFAT(pIoman);
+
+	return Error;
+}
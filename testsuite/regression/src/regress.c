@@ -0,0 +1,113 @@
+/**
+ *	FullFAT regression tests.
+ *
+ *	Every test is run on new FAT12, FAT16 and FAT32 RAM disks, (those it applies to).
+ *	The Makefile builds this once for each configuration in configs/.
+ **/
+
+#include <stdlib.h>
+#include "regress.h"
+
+char errBuf[1024];
+
+int test_files				(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_append				(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_seek_fragmented		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fat12_straddle		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fat12_straddle_nomem	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fat12_decode		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_lookup		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_recent		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_scan_resistance	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_write_back	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_lines		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_read_ahead	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_layout		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_get_stats			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_resize_cache		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_pool			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_flusher		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_cache_snapshot		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_free_reuse			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_allocate_extent		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fill_volume			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_scan_free_count		(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fsinfo_free_count	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fat_mirror			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_concurrent_writers	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_fat_copies			(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_threads_wait_release	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_threads_readers	(FF_T_UINT8 FatType, const char **pszpMessage);
+int test_threads_fat_lock	(FF_T_UINT8 FatType, const char **pszpMessage);
+
+static const REGRESS_TEST tests[] = {
+	{ "Files and directories are intact after a remount",		FAT_ALL,	test_files },
+	{ "Appended writes continue the chain from its end",		FAT_ALL,	test_append },
+	{ "Seeks in a file in many runs read the right data",		FAT_ALL,	test_seek_fragmented },
+	{ "Extend a file across FAT12 entries that span sectors",	FAT_12,		test_fat12_straddle },
+#ifdef RD_MALLOC_HOOK
+	{ "Extend a file across FAT12 entries, no memory at mount",	FAT_12,		test_fat12_straddle_nomem },
+#endif
+#ifdef FF_FAT12_DECODE
+	{ "The decoded FAT12 table is written back in runs",		FAT_12,		test_fat12_decode },
+#endif
+	{ "Cached sectors are found again, and match the disk",		FAT_ALL,	test_cache_lookup },
+	{ "A sector used between misses stays cached",				FAT_ALL,	test_cache_recent },
+	{ "Sectors used again stay cached through a scan",			FAT_ALL,	test_cache_scan_resistance },
+	{ "Modified sectors reach the disk, in runs when flushed",	FAT_ALL,	test_cache_write_back },
+	{ "A miss reads the whole line, a write keeps the rest of it",	FAT_ALL,	test_cache_lines },
+	{ "Sectors read in order are read ahead",					FAT_ALL,	test_cache_read_ahead },
+	{ "Cache quotas are checked, and pinned FAT sectors stay",	FAT_ALL,	test_cache_layout },
+	{ "FF_GetStats() agrees with the driver calls made",		FAT_ALL,	test_get_stats },
+	{ "FF_ResizeCache() resizes under an open file",			FAT_ALL,	test_resize_cache },
+	{ "Two volumes in a cache pool",							FAT_ALL,	test_cache_pool },
+#ifdef FF_CACHE_FLUSHER
+	{ "The flusher writes dirty sectors back on its own",		FAT_ALL,	test_cache_flusher },
+#endif
+	{ "A cache snapshot warms up the next mount",				FAT_ALL,	test_cache_snapshot },
+	{ "Clusters freed behind the last allocation are reused",	FAT_ALL,	test_free_reuse },
+	{ "FF_AllocateExtent() claims, links and extends runs",		FAT_ALL,	test_allocate_extent },
+	{ "Every cluster is used when the volume is filled",		FAT_ALL,	test_fill_volume },
+	{ "A new mount counts and finds the free clusters",		FAT_ALL,	test_scan_free_count },
+	{ "FSINFO free count after flushes and updates",			FAT_32,		test_fsinfo_free_count },
+#ifdef FF_FAT_MIRROR
+	{ "The FAT mirror is written back in runs when flushed",		FAT_ALL,	test_fat_mirror },
+#endif
+	{ "Files written by concurrent threads",					FAT_ALL,	test_concurrent_writers },
+	{ "FAT copies match after FF_FlushCache() and unmounting",	FAT_ALL,	test_fat_copies },
+	{ "A thread waits for a sector another thread is writing",	FAT_ALL,	test_threads_wait_release },
+	{ "Threads reading sectors at once get the disk contents",	FAT_ALL,	test_threads_readers },
+	{ "Readers share the FAT lock, a writer waits for them",	FAT_ALL,	test_threads_fat_lock },
+};
+
+static int exec_test(const REGRESS_TEST *pTest, FF_T_UINT8 FatType) {
+	const char	*pMessage = "";
+	char		*pf = "FAIL";
+	int			bFail = 1;
+
+	if(pTest->pfnTest(FatType, &pMessage)) {
+		pf = "PASS";
+		bFail = 0;
+	}
+
+	printf("%s : FAT%-2d : %-60s : %s\n", pf, FatType, pTest->szpTestDescription, pMessage);
+	fflush(stdout);
+	return bFail;
+}
+
+int main(int argc, char **argv) {
+	const FF_T_UINT8 FatTypes[] = { 12, 16, 32 };
+	int i, t, nFailed = 0, nRun = 0;
+
+	for(i = 0; i < (int) (sizeof(tests) / sizeof(REGRESS_TEST)); i++) {
+		for(t = 0; t < 3; t++) {
+			if(tests[i].FatTypes & (1 << t)) {
+				nFailed += exec_test(&tests[i], FatTypes[t]);
+				nRun++;
+			}
+		}
+	}
+
+	printf("%d of %d tests passed\n", nRun - nFailed, nRun);
+	return nFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
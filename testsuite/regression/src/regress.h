@@ -0,0 +1,77 @@
+#ifndef _REGRESS_H_
+#define _REGRESS_H_
+
+#include <fullfat.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define FAIL 0
+#define PASS 1
+
+#define DO_FF_FAIL(x)	printf("FAILED Line:%d : %s\n", __LINE__, __FILE__);  FF_GetErrDescription(x, errBuf, sizeof(errBuf)); \
+						printf("%s\n", errBuf); return FAIL
+
+#define DO_FAIL			printf("FAILED Line:%d : %s\n", __LINE__, __FILE__);  return FAIL
+
+#define CHECK_ERR(x)	{FF_ERROR _Error = (x); if(FF_isERR(_Error)) {DO_FF_FAIL(_Error);}}
+#define CHECK(x)		{if(!(x)) {printf("CHECK (%s) ", #x); DO_FAIL;}}
+
+extern char errBuf[1024];
+
+/**
+ *	A FAT volume held in RAM, with a count of the driver calls made to it.
+ **/
+typedef struct {
+	FF_T_UINT8		*pData;
+	FF_T_UINT32		Sectors;
+	FF_T_UINT32		Reads, ReadSectors;
+	FF_T_UINT32		Writes, WriteSectors;
+	pthread_mutex_t	Lock;
+	// Geometry, as formatted by RD_Create().
+	FF_T_UINT8		FatType;			///< 12, 16 or 32.
+	FF_T_UINT32		ReservedSectors;
+	FF_T_UINT32		NumFATs;
+	FF_T_UINT32		SectorsPerFAT;
+	FF_T_UINT32		Clusters;
+	// How RD_Mount() creates the IOMAN, (all 0 for FF_CreateIOMAN()).
+	const FF_CACHE_LAYOUT	*pLayout;		///< Passed to FF_CreateIOMANEx().
+	FF_CACHE_POOL	*pPool;					///< FF_CreatePooledIOMAN() in this pool, instead of a cache of its own.
+	FF_T_UINT8		*pSnapshot;				///< Given to FF_SetCacheSnapshot() before mounting.
+	FF_T_UINT32		SnapshotSize;
+	int				bNoMemAtMount;			///< FF_MALLOC() fails in FF_MountPartition(), (where a config sets RD_MALLOC_HOOK).
+} RAMDISK;
+
+RAMDISK		*RD_Create			(FF_T_UINT8 FatType);
+void		 RD_Destroy			(RAMDISK *pDisk);
+FF_IOMAN	*RD_Mount			(RAMDISK *pDisk, FF_T_UINT32 CacheSize, FF_ERROR *pError);
+FF_ERROR	 RD_Unmount			(FF_IOMAN *pIoman);
+int			 RD_FatCopiesMatch	(RAMDISK *pDisk);
+FF_T_UINT32	 RD_FatEntry		(RAMDISK *pDisk, FF_T_UINT32 nCluster);
+FF_T_UINT32	 RD_FreeClusters	(RAMDISK *pDisk);
+FF_T_UINT32	 RD_FSInfoFree		(RAMDISK *pDisk);
+void		*RD_Malloc			(size_t Size);
+
+void		 RD_Fill			(FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Seed);
+void		 RD_FillSectors		(RAMDISK *pDisk, FF_T_UINT32 First, FF_T_UINT32 Count);
+int			 RD_CheckSector		(FF_IOMAN *pIoman, RAMDISK *pDisk, FF_T_UINT32 Sector);
+int			 RD_WriteFile		(FF_IOMAN *pIoman, const char *szPath, const FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Chunk);
+int			 RD_CheckFile		(FF_IOMAN *pIoman, const char *szPath, const FF_T_UINT8 *pData, FF_T_UINT32 Size, FF_T_UINT32 Chunk);
+FF_T_UINT32	 RD_FileRuns		(FF_IOMAN *pIoman, RAMDISK *pDisk, const char *szPath);
+FF_T_UINT32	 RD_AllocateChain	(FF_IOMAN *pIoman, FF_T_UINT32 nClusters, FF_EXTENT *pExtent, FF_ERROR *pError);
+FF_ERROR	 RD_FreeChain		(FF_IOMAN *pIoman, FF_T_UINT32 Start);
+
+typedef int (*TEST_FUNCTION) (FF_T_UINT8 FatType, const char **pszpMessage);
+
+typedef struct {
+	const char		*szpTestDescription;	///< Description of the test.
+	FF_T_UINT8		 FatTypes;				///< FAT_12, FAT_16 and FAT_32 bits, for the volumes the test is run on.
+	TEST_FUNCTION	 pfnTest;				///< Test entry point.
+} REGRESS_TEST;
+
+#define FAT_12	0x01
+#define FAT_16	0x02
+#define FAT_32	0x04
+#define FAT_ALL	(FAT_12 | FAT_16 | FAT_32)
+
+#endif
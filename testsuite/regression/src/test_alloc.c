@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include "regress.h"
+
+static FF_T_BOOL is_end_of_chain(RAMDISK *pDisk, FF_T_UINT32 Entry) {
+	switch(pDisk->FatType) {
+		case 12:	return Entry >= 0xFF8;
+		case 16:	return Entry >= 0xFFF8;
+		default:	return Entry >= 0x0FFFFFF8;
+	}
+}
+
+/**
+ *	Checks, on the disk, that the runs of an extent are linked in order and end the chain.
+ **/
+static int check_extent(RAMDISK *pDisk, FF_EXTENT *pExtent) {
+	FF_T_UINT32 Run, nCluster, Total = 0;
+
+	for(Run = 0; Run < pExtent->Count; Run++) {
+		for(nCluster = pExtent->Runs[Run].Start; nCluster < pExtent->Runs[Run].Start + pExtent->Runs[Run].Length - 1; nCluster++) {
+			CHECK(RD_FatEntry(pDisk, nCluster) == nCluster + 1);
+		}
+		if(Run + 1 < pExtent->Count) {
+			CHECK(RD_FatEntry(pDisk, nCluster) == pExtent->Runs[Run + 1].Start);
+		} else {
+			CHECK(is_end_of_chain(pDisk, RD_FatEntry(pDisk, nCluster)));
+		}
+		Total += pExtent->Runs[Run].Length;
+	}
+	CHECK(Total == pExtent->Clusters);
+
+	return PASS;
+}
+
+/**
+ *	Clusters freed behind the allocation hint are found again once the end of the volume is
+ *	reached, and the free count of the cache agrees with the FAT on the disk.
+ **/
+int test_free_reuse(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	ClusterSize, Size;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	ClusterSize	= pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+	Size		= (pDisk->Clusters / 10) * ClusterSize;
+	pData = (FF_T_UINT8 *) malloc(Size * 6);
+	RD_Fill(pData, Size * 6, FatType);
+
+	CHECK(RD_WriteFile(pIoman, "\\first.bin", pData, Size * 6, 65536));
+	CHECK(RD_WriteFile(pIoman, "\\second.bin", pData + Size, Size * 3, 65536));
+	CHECK_ERR(FF_RmFile(pIoman, (const FF_T_INT8 *) "\\first.bin"));
+	CHECK(RD_WriteFile(pIoman, "\\third.bin", pData, Size * 5, 65536));	// Only a tenth of the volume is left past second.bin.
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(FF_GetFreeSize(pIoman, &Error) == (FF_T_UINT64) RD_FreeClusters(pDisk) * ClusterSize);
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\second.bin", pData + Size, Size * 3, Size));
+	CHECK(RD_CheckFile(pIoman, "\\third.bin", pData, Size * 5, Size));
+	CHECK(FF_GetFreeSize(pIoman, &Error) == (FF_T_UINT64) RD_FreeClusters(pDisk) * ClusterSize);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	FF_AllocateExtent() claims runs of consecutive clusters, (FF_ClaimRun()), links them, and
+ *	continues a chain just after its Tail. Asked for more than is free, it returns what is left.
+ **/
+int test_allocate_extent(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_EXTENT	First, Second, Rest;
+	FF_ERROR	Error;
+	FF_T_UINT32	Start, Tail, FreeClusters;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	FreeClusters = FF_CountFreeClusters(pIoman, &Error);
+	CHECK_ERR(Error);
+
+	Start = RD_AllocateChain(pIoman, 40, &First, &Error);
+	CHECK_ERR(Error);
+	CHECK(First.Count == 1 && First.Clusters == 40);	// An empty volume has room for a single run.
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(check_extent(pDisk, &First) == PASS);
+
+	Tail = First.Runs[0].Start + First.Runs[0].Length - 1;
+	FF_lockFAT(pIoman);
+	Error = FF_AllocateExtent(pIoman, 20, Tail, &Second);
+	FF_unlockFAT(pIoman);
+	CHECK_ERR(Error);
+	CHECK_ERR(FF_DecreaseFreeClusters(pIoman, Second.Clusters));
+	CHECK(Second.Runs[0].Start == Tail + 1);			// The chain stays contiguous.
+
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(RD_FatEntry(pDisk, Tail) == Tail + 1);
+	CHECK(check_extent(pDisk, &Second) == PASS);
+
+	RD_AllocateChain(pIoman, pDisk->Clusters, &Rest, &Error);
+	CHECK_ERR(Error);
+	CHECK(Rest.Clusters > 0 && Rest.Clusters <= FreeClusters - 60);
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(check_extent(pDisk, &Rest) == PASS);
+	CHECK(FF_GetFreeSize(pIoman, &Error) == (FF_T_UINT64) RD_FreeClusters(pDisk) * pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize);
+
+	CHECK_ERR(RD_FreeChain(pIoman, Rest.Runs[0].Start));
+	CHECK_ERR(RD_FreeChain(pIoman, Start));			// (Second is part of this chain).
+	CHECK(FF_CountFreeClusters(pIoman, &Error) == FreeClusters);
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	Files are written until the volume is full, (in smaller writes at the end). Every cluster
+ *	must then be in use, (up to cluster NumClusters + 1), and the free size reported is 0.
+ **/
+int test_fill_volume(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	FreeClusters, Files, Written = 0, Chunk = 65536;
+	FF_T_SINT32	Count;
+	char		szPath[16];
+	const FF_T_UINT32 Size = 1024 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size);
+	RD_Fill(pData, Size, FatType);
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	FreeClusters = FF_CountFreeClusters(pIoman, &Error);
+	CHECK_ERR(Error);
+	CHECK(FreeClusters == RD_FreeClusters(pDisk));
+
+	for(Files = 0; Chunk && FF_GetFreeSize(pIoman, &Error); Files++) {
+		CHECK_ERR(Error);
+		sprintf(szPath, "\\fill%02lu.bin", (unsigned long) Files);
+		pFile = FF_Open(pIoman, (const FF_T_INT8 *) szPath, FF_MODE_WRITE | FF_MODE_CREATE, &Error);
+		if(!pFile) {
+			DO_FF_FAIL(Error);
+		}
+		for(Written = 0; Written < Size; ) {
+			Count = FF_Write(pFile, 1, Chunk, pData + Written);
+			if(!FF_isERR(Count)) {
+				Written += Count;
+			}
+			if(Count != (FF_T_SINT32) Chunk) {	// Out of space.
+				// Each write asks for a byte more than it writes, so the last cluster is filled a byte at a time.
+				Chunk = (Chunk > pIoman->pPartition->BlkSize) ? pIoman->pPartition->BlkSize : ((Chunk > 1) ? 1 : 0);
+				if(!Chunk) {
+					break;
+				}
+			}
+		}
+		CHECK_ERR(FF_Close(pFile));
+	}
+	CHECK(FF_GetFreeSize(pIoman, &Error) == 0);
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == 0);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(FF_GetFreeSize(pIoman, &Error) == 0);
+	CHECK(RD_CheckFile(pIoman, "\\fill00.bin", pData, Size, Size));
+	CHECK(RD_CheckFile(pIoman, szPath, pData, Written, Size));		// The file that filled the volume.
+	for(Files = 0; Files < 2; Files++) {
+		sprintf(szPath, "\\fill%02lu.bin", (unsigned long) Files);
+		CHECK_ERR(FF_RmFile(pIoman, (const FF_T_INT8 *) szPath));
+	}
+	CHECK(RD_WriteFile(pIoman, "\\again.bin", pData, Size, Size));	// The freed clusters are found again.
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#define SCAN_FILES		24
+
+/**
+ *	After files of many sizes are written and every other one is deleted, the FAT scan of a new
+ *	mount counts the free clusters that are on the disk, and finds the first of them.
+ **/
+int test_scan_free_count(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	ClusterSize, nCluster, First;
+	char		szPath[16];
+	int			i;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	ClusterSize = pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+	pData = (FF_T_UINT8 *) malloc(ClusterSize * SCAN_FILES);
+	RD_Fill(pData, ClusterSize * SCAN_FILES, FatType);
+	for(i = 0; i < SCAN_FILES; i++) {
+		sprintf(szPath, "\\scan%02d.bin", i);
+		CHECK(RD_WriteFile(pIoman, szPath, pData, ClusterSize * (i + 1) - 7, ClusterSize));
+	}
+	for(i = 0; i < SCAN_FILES; i += 2) {
+		sprintf(szPath, "\\scan%02d.bin", i);
+		CHECK_ERR(FF_RmFile(pIoman, (const FF_T_INT8 *) szPath));
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	CHECK(FF_CountFreeClusters(pIoman, &Error) == RD_FreeClusters(pDisk));
+	CHECK_ERR(Error);
+
+	for(First = 2; RD_FatEntry(pDisk, First); First++);
+	FF_lockFAT(pIoman);
+	pIoman->pPartition->LastFreeCluster = 0;
+	nCluster = FF_FindFreeCluster(pIoman, &Error);
+	FF_unlockFAT(pIoman);
+	CHECK_ERR(Error);
+	CHECK(nCluster == First);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	The FSINFO free count is written by FF_FlushCache(), and every FF_FSINFO_UPDATE_INTERVAL
+ *	changes in between.
+ **/
+int test_fsinfo_free_count(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_EXTENT	Extent;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	Chains[40];
+#if defined(FF_WRITE_FREE_COUNT) && defined(FF_CACHE_WRITE_THROUGH)
+	FF_T_UINT32	Flushed;
+#endif
+	int			i;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(64 * 1024);
+	RD_Fill(pData, 64 * 1024, FatType);
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_WriteFile(pIoman, "\\fsinfo.bin", pData, 64 * 1024, 1000));
+#ifdef FF_WRITE_FREE_COUNT
+	CHECK(RD_FSInfoFree(pDisk) == RD_FreeClusters(pDisk));
+#endif
+
+#if defined(FF_WRITE_FREE_COUNT) && defined(FF_CACHE_WRITE_THROUGH)
+	Flushed = RD_FSInfoFree(pDisk);
+#endif
+	for(i = 0; i < 40; i++) {
+		Chains[i] = RD_AllocateChain(pIoman, 1, &Extent, &Error);
+		CHECK_ERR(Error);
+#if defined(FF_WRITE_FREE_COUNT) && defined(FF_CACHE_WRITE_THROUGH)
+#if FF_FSINFO_UPDATE_INTERVAL > 0
+		CHECK(RD_FSInfoFree(pDisk) == Flushed - (((i + 1) / FF_FSINFO_UPDATE_INTERVAL) * FF_FSINFO_UPDATE_INTERVAL));
+#else
+		CHECK(RD_FSInfoFree(pDisk) == Flushed);
+#endif
+#endif
+	}
+	CHECK_ERR(FF_FlushCache(pIoman));
+#ifdef FF_WRITE_FREE_COUNT
+	CHECK(RD_FSInfoFree(pDisk) == RD_FreeClusters(pDisk));
+#endif
+
+	for(i = 0; i < 40; i++) {
+		CHECK_ERR(RD_FreeChain(pIoman, Chains[i]));
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+#ifdef FF_WRITE_FREE_COUNT
+	CHECK(RD_FSInfoFree(pDisk) == RD_FreeClusters(pDisk));
+#endif
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#ifdef FF_FAT_MIRROR
+/**
+ *	A FAT that fits FF_FAT_MIRROR_MAX_SIZE is mirrored in RAM. Entries written there reach the disk
+ *	when the cache is flushed, each run of modified FAT sectors in a single write per FAT.
+ **/
+int test_fat_mirror(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_EXTENT	Extent;
+	FF_ERROR	Error;
+	FF_T_UINT32	Start, Writes, WriteSectors, FreeClusters;
+	FF_T_BOOL	bMirrored = (pDisk->SectorsPerFAT * 512 <= FF_FAT_MIRROR_MAX_SIZE) ? FF_TRUE : FF_FALSE;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+#ifdef FF_FAT12_DECODE
+	if(pIoman->pPartition->Type == FF_T_FAT12) {	// Held in the decoded FAT12 table instead, which is written back the same way.
+		CHECK(!pIoman->pPartition->pFatMirror && pIoman->pPartition->pFat12Table);
+	} else
+#endif
+	CHECK((pIoman->pPartition->pFatMirror != NULL) == bMirrored);
+	FreeClusters = FF_CountFreeClusters(pIoman, &Error);
+	CHECK_ERR(Error);
+
+	Start = RD_AllocateChain(pIoman, pDisk->Clusters / 2, &Extent, &Error);	// Over several FAT sectors.
+	CHECK_ERR(Error);
+	Writes			= pDisk->Writes;
+	WriteSectors	= pDisk->WriteSectors;
+	if(bMirrored) {
+		CHECK(!RD_FatEntry(pDisk, Start));		// Only in the mirror so far.
+	}
+	CHECK_ERR(FF_FlushCache(pIoman));
+	if(bMirrored) {
+		CHECK(pDisk->Writes - Writes <= pDisk->NumFATs);
+		CHECK(pDisk->WriteSectors - WriteSectors >= pDisk->NumFATs * 2);
+	}
+	CHECK(RD_FatEntry(pDisk, Start) == Start + 1);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	CHECK_ERR(RD_FreeChain(pIoman, Start));
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+#endif
+
+#define WRITERS			4
+#define WRITER_SIZE		(96 * 1024)
+
+typedef struct {
+	FF_IOMAN	*pIoman;
+	char		szPath[16];
+	FF_T_UINT8	*pData;
+	int			Result;
+} WRITER;
+
+static void *writer_thread(void *pParam) {
+	WRITER *pWriter = (WRITER *) pParam;
+
+	pWriter->Result = RD_WriteFile(pWriter->pIoman, pWriter->szPath, pWriter->pData, WRITER_SIZE, 4096);
+	return NULL;
+}
+
+/**
+ *	Files written at the same time must all be intact. With FF_ALLOC_GROUPS each writer is bound
+ *	to a group of its own, so each file also stays contiguous.
+ **/
+int test_concurrent_writers(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	FreeClusters;
+	WRITER		Writers[WRITERS];
+	pthread_t	Threads[WRITERS];
+	int			i;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(WRITERS * WRITER_SIZE);
+	RD_Fill(pData, WRITERS * WRITER_SIZE, FatType);
+
+	pIoman = RD_Mount(pDisk, 131072, &Error);
+	CHECK_ERR(Error);
+	for(i = 0; i < WRITERS; i++) {
+		Writers[i].pIoman	= pIoman;
+		Writers[i].pData	= pData + (i * WRITER_SIZE);
+		sprintf(Writers[i].szPath, "\\writer%d.bin", i);
+		pthread_create(&Threads[i], NULL, writer_thread, &Writers[i]);
+	}
+	for(i = 0; i < WRITERS; i++) {
+		pthread_join(Threads[i], NULL);
+		CHECK(Writers[i].Result == PASS);
+	}
+	for(i = 0; i < WRITERS; i++) {
+		CHECK(RD_CheckFile(pIoman, Writers[i].szPath, Writers[i].pData, WRITER_SIZE, WRITER_SIZE));
+#if FF_ALLOC_GROUPS >= WRITERS
+		CHECK(RD_FileRuns(pIoman, pDisk, Writers[i].szPath) == 1);
+#endif
+	}
+	FreeClusters = FF_CountFreeClusters(pIoman, &Error);
+	CHECK_ERR(Error);
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	for(i = 0; i < WRITERS; i++) {
+		CHECK(RD_CheckFile(pIoman, Writers[i].szPath, Writers[i].pData, WRITER_SIZE, WRITER_SIZE));
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
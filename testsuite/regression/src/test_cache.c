@@ -0,0 +1,597 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "regress.h"
+
+#define FIRST_SECTOR	1024		///< Sectors from here are in free clusters of every test volume.
+#define LAST_SECTOR		4096		///< (The FAT12 volume ends here).
+
+/**
+ *	Sectors still in the cache are found again without the driver, and every sector got
+ *	through the cache has the contents of the disk, while sectors are replaced all the time.
+ **/
+int test_cache_lookup(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Reads, Seed = FatType;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, LAST_SECTOR - FIRST_SECTOR);
+	pIoman = RD_Mount(pDisk, 262144, &Error);
+	CHECK_ERR(Error);
+
+	for(i = 0; i < 32; i++) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + (i * 16)));
+	}
+	Reads = pDisk->Reads;
+	for(i = 32; i > 0; i--) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + ((i - 1) * 16)));
+	}
+	CHECK(pDisk->Reads == Reads);
+
+	for(i = 0; i < 4000; i++) {
+		Seed = (Seed * 1103515245) + 12345;
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + ((Seed >> 8) % (LAST_SECTOR - FIRST_SECTOR))));
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	A sector used between each cache miss is the most recently used one whenever a buffer
+ *	is replaced, so it stays cached while other sectors pass through the cache. (The original
+ *	policy, FF_CACHE_REPLACE_SCAN, ages buffers from when they were filled, so only the
+ *	contents are checked with it).
+ **/
+int test_cache_recent(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Reads, HotReads = 0;
+	const FF_T_UINT32 Hot = FIRST_SECTOR - 16;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, Hot, LAST_SECTOR - Hot);
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+
+	for(i = 0; i < 150; i++) {
+		Reads = pDisk->Reads;
+		CHECK(RD_CheckSector(pIoman, pDisk, Hot));
+		HotReads += pDisk->Reads - Reads;
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + (i * 16)));
+	}
+#if defined(FF_CACHE_REPLACE_2Q)
+	CHECK(HotReads <= 2);		// Read once more, from its ghost, when it leaves probation.
+#elif !defined(FF_CACHE_REPLACE_SCAN)
+	CHECK(HotReads == 1);
+#endif
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#define HOT_SECTORS		2
+
+/**
+ *	Sectors that are used again after they left the cache are kept by 2Q, while a long scan
+ *	of sectors used only once goes through. (LRU and the original policy let the scan replace
+ *	them, so only the contents are checked with those).
+ **/
+int test_cache_scan_resistance(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Round, Reads, Next = FIRST_SECTOR + (HOT_SECTORS * 16);
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, LAST_SECTOR - FIRST_SECTOR);
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+
+	// The hot sectors are used after every few misses. They pass through the cache,
+	// and come back while it still remembers them.
+	for(Round = 0; Round < 32; Round++) {
+		for(i = 0; i < HOT_SECTORS; i++) {
+			CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + (i * 16)));
+		}
+		for(i = 0; i < 2; i++, Next += 16) {
+			CHECK(RD_CheckSector(pIoman, pDisk, Next));
+		}
+	}
+
+	// A scan of three times as many sectors as the cache holds.
+	for(i = 0; i < 96; i++, Next += 16) {
+		CHECK(RD_CheckSector(pIoman, pDisk, Next));
+	}
+	Reads = pDisk->Reads;
+	for(i = 0; i < HOT_SECTORS; i++) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + (i * 16)));
+	}
+#ifdef FF_CACHE_REPLACE_2Q
+	CHECK(pDisk->Reads == Reads);
+#else
+	(void) Reads;
+#endif
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	Writes one sector through the cache, with a pattern seeded by its LBA and Seed.
+ **/
+static int write_sector(FF_IOMAN *pIoman, FF_T_UINT32 Sector, FF_T_UINT32 Seed) {
+	FF_BUFFER *pBuffer = FF_GetBuffer(pIoman, Sector, FF_MODE_WRITE);
+
+	if(!pBuffer) {
+		return 0;
+	}
+	RD_Fill(pBuffer->pBuffer, 512, Sector + Seed);
+	FF_ReleaseBuffer(pIoman, pBuffer);
+
+	return 1;
+}
+
+/**
+ *	@return	1 when the sector on the disk has the pattern written by write_sector().
+ **/
+static int sector_written(RAMDISK *pDisk, FF_T_UINT32 Sector, FF_T_UINT32 Seed) {
+	FF_T_UINT8 Expect[512];
+
+	RD_Fill(Expect, 512, Sector + Seed);
+	return !memcmp(Expect, pDisk->pData + (Sector * 512), 512);
+}
+
+/**
+ *	A modified sector reaches the disk when its buffer is released, (write-through), or at
+ *	FF_FlushCache(), (write-back), which writes each run of consecutive sectors at once.
+ **/
+int test_cache_write_back(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Writes;
+	const FF_T_UINT32 Seed = 0x10000;
+	const FF_T_UINT32 Sectors[] = {		// Two runs, modified out of order.
+		FIRST_SECTOR + 19, FIRST_SECTOR + 3, FIRST_SECTOR, FIRST_SECTOR + 16, FIRST_SECTOR + 2,
+		FIRST_SECTOR + 17, FIRST_SECTOR + 1, FIRST_SECTOR + 18,
+	};
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, 32);
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+
+	Writes = pDisk->Writes;
+	for(i = 0; i < sizeof(Sectors) / sizeof(Sectors[0]); i++) {
+		CHECK(write_sector(pIoman, Sectors[i], Seed));
+#ifdef FF_CACHE_WRITE_BACK
+		CHECK(!sector_written(pDisk, Sectors[i], Seed));
+#else
+		CHECK(sector_written(pDisk, Sectors[i], Seed));
+#endif
+	}
+#ifdef FF_CACHE_WRITE_BACK
+	CHECK(pDisk->Writes == Writes);
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(pDisk->Writes == Writes + 2);
+#else
+	CHECK(pDisk->Writes == Writes + (sizeof(Sectors) / sizeof(Sectors[0])));
+#endif
+	for(i = 0; i < sizeof(Sectors) / sizeof(Sectors[0]); i++) {
+		CHECK(sector_written(pDisk, Sectors[i], Seed));
+		CHECK(RD_CheckSector(pIoman, pDisk, Sectors[i]));
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	A miss reads the whole cache line with one driver call, so the other sectors of the
+ *	line are then found in the cache. Writing one sector of a line leaves the others intact.
+ **/
+int test_cache_lines(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Reads, ReadSectors, Line;
+	FF_T_UINT8	Expect[512];
+	const FF_T_UINT32 Seed = 0x20000;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, 64);
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	Line = pIoman->LineSectors;
+	CHECK(Line >= 1 && Line <= 16);
+
+	Reads		= pDisk->Reads;
+	ReadSectors	= pDisk->ReadSectors;
+	for(i = 0; i < Line; i++) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + i));
+	}
+	CHECK(pDisk->Reads == Reads + 1);
+	CHECK(pDisk->ReadSectors == ReadSectors + Line);
+
+	CHECK(write_sector(pIoman, FIRST_SECTOR + 16 + (Line / 2), Seed));
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(sector_written(pDisk, FIRST_SECTOR + 16 + (Line / 2), Seed));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	for(i = 0; i < Line; i++) {
+		if(i != Line / 2) {
+			RD_Fill(Expect, 512, FIRST_SECTOR + 16 + i);
+			CHECK(!memcmp(Expect, pDisk->pData + ((FIRST_SECTOR + 16 + i) * 512), 512));
+		}
+	}
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	Sectors read in order are read ahead, in a few long driver reads, and have the contents
+ *	of the disk. The read-ahead doesn't go far past the end of the stream.
+ **/
+int test_cache_read_ahead(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Reads, ReadSectors, Lines;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, 512);
+	pIoman = RD_Mount(pDisk, 262144, &Error);
+	CHECK_ERR(Error);
+
+	Reads		= pDisk->Reads;
+	ReadSectors	= pDisk->ReadSectors;
+	Lines		= 256 / pIoman->LineSectors;
+	for(i = 0; i < 256; i++) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + i));
+	}
+#if FF_READAHEAD_SECTORS > 0
+	CHECK(pDisk->Reads - Reads <= Lines / 2);
+	CHECK(pDisk->ReadSectors - ReadSectors <= 256 + FF_READAHEAD_SECTORS + pIoman->LineSectors);
+#else
+	CHECK(pDisk->Reads - Reads == Lines);
+#endif
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	FF_CreateIOMANEx() refuses quotas over 100%, and a volume works in a partitioned cache
+ *	with pinned FAT sectors, which stay cached while file data passes through.
+ **/
+int test_cache_layout(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK			*pDisk = RD_Create(FatType);
+	FF_IOMAN		*pIoman;
+	FF_ERROR		Error;
+	FF_T_UINT8		*pData;
+	FF_T_UINT32		i, Reads;
+	FF_CACHE_LAYOUT	Layout = { 60, 30, 20, 0 };
+	const FF_T_UINT32 Size = 200 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pIoman = FF_CreateIOMANEx(NULL, 65536, 512, &Layout, &Error);
+	CHECK(!pIoman && FF_isERR(Error));
+
+	pData = (FF_T_UINT8 *) malloc(Size);
+	RD_Fill(pData, Size, FatType);
+
+	Layout.FatQuota			= 20;
+	Layout.DirQuota			= 20;
+	Layout.DataQuota		= 30;
+	Layout.PinnedFatSectors	= 8;
+	pDisk->pLayout = &Layout;
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+	CHECK(pIoman->Layout.FatQuota == 20 && pIoman->Layout.PinnedFatSectors == 8);
+	CHECK(RD_CheckSector(pIoman, pDisk, pDisk->ReservedSectors));
+	CHECK(RD_WriteFile(pIoman, "\\layout1.bin", pData, Size, 3000));
+	CHECK(RD_WriteFile(pIoman, "\\layout2.bin", pData, Size / 2, Size / 2));
+	CHECK(RD_CheckFile(pIoman, "\\layout1.bin", pData, Size, Size));
+	CHECK(RD_CheckFile(pIoman, "\\layout2.bin", pData, Size / 2, Size / 2));
+	CHECK_ERR(FF_FlushCache(pIoman));
+	for(i = 0; i < 300; i++) {
+		CHECK(RD_CheckSector(pIoman, pDisk, FIRST_SECTOR + (i * 8)));
+	}
+	Reads = pDisk->Reads;
+	CHECK(RD_CheckSector(pIoman, pDisk, pDisk->ReservedSectors));
+	CHECK(pDisk->Reads == Reads);
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	pDisk->pLayout = NULL;
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\layout1.bin", pData, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#define DIR_FILES	40
+
+/**
+ *	Creates DIR_FILES small files in \\dir, (so that opening them reads directory sectors).
+ **/
+static int create_dir_files(FF_IOMAN *pIoman, const FF_T_UINT8 *pData) {
+	char	szPath[32];
+	int		i;
+
+	CHECK_ERR(FF_MkDir(pIoman, (const FF_T_INT8 *) "\\dir"));
+	for(i = 0; i < DIR_FILES; i++) {
+		sprintf(szPath, "\\dir\\file%02d.txt", i);
+		CHECK(RD_WriteFile(pIoman, szPath, pData + i, 100, 100));
+	}
+
+	return PASS;
+}
+
+static int open_dir_files(FF_IOMAN *pIoman) {
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	char		szPath[32];
+	int			i;
+
+	for(i = 0; i < DIR_FILES; i++) {
+		sprintf(szPath, "\\dir\\file%02d.txt", i);
+		pFile = FF_Open(pIoman, (const FF_T_INT8 *) szPath, FF_MODE_READ, &Error);
+		if(!pFile) {
+			DO_FF_FAIL(Error);
+		}
+		CHECK_ERR(FF_Close(pFile));
+	}
+
+	return PASS;
+}
+
+/**
+ *	The driver counters of FF_GetStats() must agree with the calls the RAM disk saw, and
+ *	directory sectors that are still cached are found again without the driver.
+ **/
+int test_get_stats(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_IOSTATS	Before, After;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	i, Hits[2] = { 0, 0 };
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(16 * 1024);
+	RD_Fill(pData, 16 * 1024, FatType);
+
+	pIoman = RD_Mount(pDisk, 131072, &Error);
+	CHECK_ERR(Error);
+	CHECK(FF_GetStats(NULL, &Before) == (FF_ERR_NULL_POINTER | FF_GETSTATS));
+	CHECK(RD_WriteFile(pIoman, "\\stats.bin", pData, 16 * 1024, 1000));
+	CHECK(RD_CheckFile(pIoman, "\\stats.bin", pData, 16 * 1024, 1000));
+	CHECK(create_dir_files(pIoman, pData));
+	CHECK_ERR(FF_FlushCache(pIoman));
+
+	CHECK_ERR(FF_GetStats(pIoman, &Before));
+	CHECK(Before.DriverReads == pDisk->Reads && Before.DriverReadSectors == pDisk->ReadSectors);
+	CHECK(Before.DriverWrites == pDisk->Writes && Before.DriverWriteSectors == pDisk->WriteSectors);
+
+	CHECK(open_dir_files(pIoman));
+	CHECK_ERR(FF_GetStats(pIoman, &After));
+	CHECK(After.DriverReads == Before.DriverReads);		// The directory was still cached.
+	for(i = 0; i < FF_CACHE_CLASSES; i++) {
+		Hits[0] += Before.CacheHits[i];
+		Hits[1] += After.CacheHits[i];
+	}
+	CHECK(Hits[1] > Hits[0]);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	FF_ResizeCache() grows and shrinks the cache under an open file, and keeps the cache as it
+ *	was when the size is not valid.
+ **/
+int test_resize_cache(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	const FF_T_UINT32 Size = 256 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size);
+	RD_Fill(pData, Size, FatType);
+
+	pIoman = RD_Mount(pDisk, 131072, &Error);
+	CHECK_ERR(Error);
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) "\\resize.bin", FF_MODE_WRITE | FF_MODE_CREATE | FF_MODE_TRUNCATE, &Error);
+	CHECK(pFile);
+	CHECK(FF_Write(pFile, 1, Size / 2, pData) == (FF_T_SINT32) (Size / 2));
+	CHECK(FF_ResizeCache(pIoman, 1000) == (FF_ERR_IOMAN_BAD_MEMSIZE | FF_RESIZECACHE));
+	CHECK_ERR(FF_ResizeCache(pIoman, 524288));
+	CHECK(pIoman->CacheSize == 1024);
+	CHECK(FF_Write(pFile, 1, Size / 2, pData + (Size / 2)) == (FF_T_SINT32) (Size / 2));
+	CHECK_ERR(FF_ResizeCache(pIoman, 65536));
+	CHECK(pIoman->CacheSize == 128);
+	CHECK_ERR(FF_Close(pFile));
+	CHECK(RD_CheckFile(pIoman, "\\resize.bin", pData, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\resize.bin", pData, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	Two volumes share a cache pool. The pool can't be destroyed, nor resized through one of
+ *	its IOMANs, while they are attached.
+ **/
+int test_cache_pool(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK			*pDisks[2];
+	FF_IOMAN		*pIomans[2];
+	FF_CACHE_POOL	*pPool;
+	FF_ERROR		Error;
+	FF_T_UINT8		*pData;
+	const FF_T_UINT32 Size = 160 * 1024;
+	int				i;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size * 2);
+	RD_Fill(pData, Size * 2, FatType);
+
+	pPool = FF_CreateCachePool(NULL, 131072, 512, NULL, &Error);
+	CHECK(pPool);
+	for(i = 0; i < 2; i++) {
+		pDisks[i] = RD_Create(FatType);
+		pDisks[i]->pPool = pPool;
+		pIomans[i] = RD_Mount(pDisks[i], 0, &Error);
+		CHECK_ERR(Error);
+	}
+	CHECK(pPool->Members == 2);
+	CHECK(FF_ResizeCache(pIomans[0], 262144) == (FF_ERR_IOMAN_CACHE_POOLED | FF_RESIZECACHE));
+
+	CHECK(RD_WriteFile(pIomans[0], "\\pool.bin", pData, Size, 5000));
+	CHECK(RD_WriteFile(pIomans[1], "\\pool.bin", pData + Size, Size, 7000));
+	CHECK(RD_CheckFile(pIomans[0], "\\pool.bin", pData, Size, Size));
+	CHECK(RD_CheckFile(pIomans[1], "\\pool.bin", pData + Size, Size, 3000));
+
+	CHECK(FF_GETERROR(FF_DestroyCachePool(pPool)) == FF_ERR_IOMAN_POOL_IN_USE);
+	for(i = 0; i < 2; i++) {
+		CHECK_ERR(RD_Unmount(pIomans[i]));
+		CHECK(RD_FatCopiesMatch(pDisks[i]));
+	}
+	CHECK(pPool->Members == 0);
+	CHECK_ERR(FF_DestroyCachePool(pPool));
+
+	for(i = 0; i < 2; i++) {
+		pDisks[i]->pPool = NULL;
+		pIomans[i] = RD_Mount(pDisks[i], 16384, &Error);
+		CHECK_ERR(Error);
+		CHECK(RD_CheckFile(pIomans[i], "\\pool.bin", pData + (i * Size), Size, Size));
+		CHECK_ERR(RD_Unmount(pIomans[i]));
+		RD_Destroy(pDisks[i]);
+	}
+
+	free(pData);
+	return PASS;
+}
+
+#ifdef FF_CACHE_FLUSHER
+/**
+ *	The flusher thread writes modified sectors back on its own, once they have been dirty
+ *	for FF_FLUSH_DIRTY_AGE.
+ **/
+int test_cache_flusher(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_IOSTATS	Stats;
+	FF_ERROR	Error;
+	FF_T_UINT32	i, Waited, Written = 0;
+	const FF_T_UINT32 Seed = 0x30000;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, FIRST_SECTOR, 32);
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+
+	for(i = 0; i < 32; i += 4) {
+		CHECK(write_sector(pIoman, FIRST_SECTOR + i, Seed));
+	}
+	for(Waited = 0; Written < 8 && Waited < (FF_FLUSH_DIRTY_AGE * 3); Waited += 50) {
+		usleep(50000);
+		for(i = 0, Written = 0; i < 32; i += 4) {
+			Written += sector_written(pDisk, FIRST_SECTOR + i, Seed);
+		}
+	}
+	CHECK(Written == 8);
+	CHECK_ERR(FF_GetStats(pIoman, &Stats));
+	CHECK(Stats.FlusherPasses > 0);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+#endif
+
+/**
+ *	A cache snapshot taken at unmount warms the cache of the next mount, so a directory that
+ *	was cached is then searched with fewer driver calls.
+ **/
+int test_cache_snapshot(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData, Snapshot[4096];
+	FF_T_UINT32	Reads, Cold, Warm;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(1024);
+	RD_Fill(pData, 1024, FatType);
+
+	pIoman = FF_CreateIOMAN(NULL, 262144, 512, &Error);
+	CHECK(pIoman);
+	CHECK(FF_SetCacheSnapshot(pIoman, Snapshot, 8) == (FF_ERR_IOMAN_BAD_MEMSIZE | FF_SETCACHESNAPSHOT));
+	CHECK_ERR(FF_DestroyIOMAN(pIoman));
+
+	pIoman = RD_Mount(pDisk, 262144, &Error);
+	CHECK_ERR(Error);
+	CHECK(create_dir_files(pIoman, pData));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	// Cold.
+	pIoman = RD_Mount(pDisk, 262144, &Error);
+	CHECK_ERR(Error);
+	Reads = pDisk->Reads;
+	CHECK(open_dir_files(pIoman));
+	Cold = pDisk->Reads - Reads;
+	CHECK_ERR(FF_SetCacheSnapshot(pIoman, Snapshot, sizeof(Snapshot)));
+	CHECK_ERR(RD_Unmount(pIoman));		// Takes the snapshot.
+
+	// Warmed by the snapshot.
+	pDisk->pSnapshot	= Snapshot;
+	pDisk->SnapshotSize	= sizeof(Snapshot);
+	pIoman = RD_Mount(pDisk, 262144, &Error);
+	CHECK_ERR(Error);
+	Reads = pDisk->Reads;
+	CHECK(open_dir_files(pIoman));
+	Warm = pDisk->Reads - Reads;
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(Cold > 0 && Warm < Cold);
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
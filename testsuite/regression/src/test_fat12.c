@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include "regress.h"
+
+/**
+ *	FAT12 entries 341 and 682 span two FAT sectors. FF_ExtendFile() keeps the FAT sectors
+ *	claimed while it links a run of clusters, and FF_putFatEntry() used to wait for them
+ *	forever on these entries when the FAT12 table is not decoded.
+ **/
+static int fat12_straddle(FF_T_UINT8 FatType, int bNoMem, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	ClusterSize, FreeClusters;
+	const FF_T_UINT32 SizeA = 800 * 1024, SizeB = 700 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(SizeA + SizeB);
+	RD_Fill(pData, SizeA + SizeB, FatType);
+
+	pDisk->bNoMemAtMount = bNoMem;
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+#ifdef FF_FAT12_DECODE
+	CHECK((pIoman->pPartition->pFat12Table == NULL) == (bNoMem != 0));
+#endif
+	ClusterSize = pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+
+	CHECK(RD_WriteFile(pIoman, "\\single.bin", pData, SizeA, SizeA));			// One run, over entry 341.
+	CHECK(RD_WriteFile(pIoman, "\\chunks.bin", pData + SizeA, SizeB, 3000));	// Cluster by cluster, over entry 682.
+	FreeClusters = (FF_T_UINT32) (FF_GetFreeSize(pIoman, &Error) / ClusterSize);
+	CHECK_ERR(Error);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	CHECK(RD_FatEntry(pDisk, 341) && RD_FatEntry(pDisk, 682));
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\single.bin", pData, SizeA, SizeA));
+	CHECK(RD_CheckFile(pIoman, "\\chunks.bin", pData + SizeA, SizeB, SizeB));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+int test_fat12_straddle(FF_T_UINT8 FatType, const char **pszpMessage) {
+	return fat12_straddle(FatType, 0, pszpMessage);
+}
+
+#ifdef RD_MALLOC_HOOK
+int test_fat12_straddle_nomem(FF_T_UINT8 FatType, const char **pszpMessage) {
+	return fat12_straddle(FatType, 1, pszpMessage);
+}
+#endif
+
+#ifdef FF_FAT12_DECODE
+/**
+ *	Entries written to the decoded FAT12 table reach the disk when the cache is flushed, each run
+ *	of modified FAT sectors in a single write per FAT, and are read back from the disk on a remount.
+ **/
+int test_fat12_decode(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_EXTENT	Extent;
+	FF_ERROR	Error;
+	FF_T_UINT32	Start, nCluster, Writes, WriteSectors, FreeClusters;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(pIoman->pPartition->pFat12Table);
+	FreeClusters = FF_CountFreeClusters(pIoman, &Error);
+	CHECK_ERR(Error);
+	CHECK(FreeClusters == RD_FreeClusters(pDisk));
+
+	Start = RD_AllocateChain(pIoman, pDisk->Clusters / 2, &Extent, &Error);	// Over several FAT sectors, and entry 341.
+	CHECK_ERR(Error);
+	CHECK(Extent.Count == 1 && Start <= 341 && Start + Extent.Clusters > 342);
+	Writes			= pDisk->Writes;
+	WriteSectors	= pDisk->WriteSectors;
+	CHECK(!RD_FatEntry(pDisk, Start));		// Only in the table so far.
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(pDisk->Writes - Writes <= pDisk->NumFATs);
+	CHECK(pDisk->WriteSectors - WriteSectors >= pDisk->NumFATs * 2);
+	for(nCluster = Start; nCluster + 1 < Start + Extent.Clusters; nCluster++) {
+		CHECK(RD_FatEntry(pDisk, nCluster) == nCluster + 1);
+	}
+	CHECK(RD_FatEntry(pDisk, nCluster) >= 0xFF8);
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(FF_CountFreeClusters(pIoman, &Error) == FreeClusters - Extent.Clusters);
+	CHECK_ERR(Error);
+	CHECK(FF_getFatEntry(pIoman, 341, &Error, NULL) == 342);
+	CHECK_ERR(Error);
+	CHECK_ERR(RD_FreeChain(pIoman, Start));
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+#endif
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include "regress.h"
+
+#ifdef FF_MIRROR_FATS_UMOUNT
+/**
+ *	@return	1 when FAT entries reach the disk as they are written, (not held in the cache, or a table).
+ **/
+static int fat_written_through(FF_IOMAN *pIoman) {
+#ifdef FF_CACHE_WRITE_BACK
+	return 0;
+#else
+#ifdef FF_FAT12_DECODE
+	if(pIoman->pPartition->pFat12Table) {
+		return 0;
+	}
+#endif
+#ifdef FF_FAT_MIRROR
+	if(pIoman->pPartition->pFatMirror) {
+		return 0;
+	}
+#endif
+	return 1;
+#endif
+}
+#endif
+
+/**
+ *	Every FAT copy must match the first FAT after FF_FlushCache() and after unmounting. With
+ *	FF_MIRROR_FATS_UMOUNT, the copies are behind the first FAT between flushes while they are
+ *	deferred, and written with it after FF_DeferFatCopies(pIoman, FF_FALSE).
+ **/
+int test_fat_copies(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	const FF_T_UINT32 Size = 300 * 1024;
+#ifdef FF_MIRROR_FATS_UMOUNT
+	FF_EXTENT	Extent;
+	FF_T_UINT32	Chain;
+#endif
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size * 2);
+	RD_Fill(pData, Size * 2, FatType);
+
+	pIoman = RD_Mount(pDisk, 32768, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_WriteFile(pIoman, "\\first.bin", pData, Size, 5000));	// FF_Close() flushes the cache.
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+#ifdef FF_MIRROR_FATS_UMOUNT
+	Chain = RD_AllocateChain(pIoman, 100, &Extent, &Error);
+	CHECK_ERR(Error);
+	if(fat_written_through(pIoman)) {
+		CHECK(!RD_FatCopiesMatch(pDisk));	// Deferred, (the default), so only the first FAT was written.
+	}
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK_ERR(RD_FreeChain(pIoman, Chain));
+
+	CHECK_ERR(FF_DeferFatCopies(pIoman, FF_FALSE));	// Copies the freed chain.
+	if(fat_written_through(pIoman)) {
+		CHECK(RD_FatCopiesMatch(pDisk));
+	}
+	Chain = RD_AllocateChain(pIoman, 100, &Extent, &Error);
+	CHECK_ERR(Error);
+#ifdef FF_WRITE_BOTH_FATS
+	if(fat_written_through(pIoman)) {
+		CHECK(RD_FatCopiesMatch(pDisk));	// Every FAT is written at once again.
+	}
+#endif
+	CHECK_ERR(RD_FreeChain(pIoman, Chain));
+	CHECK_ERR(FF_FlushCache(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK_ERR(FF_DeferFatCopies(pIoman, FF_TRUE));
+#endif
+
+	CHECK(RD_WriteFile(pIoman, "\\second.bin", pData + Size, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	pIoman = RD_Mount(pDisk, 32768, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\first.bin", pData, Size, Size));
+	CHECK(RD_CheckFile(pIoman, "\\second.bin", pData + Size, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
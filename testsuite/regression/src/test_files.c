@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include "regress.h"
+
+/**
+ *	Files of a few sizes, in the root and in a sub-directory, read back the same after a
+ *	remount, and the FAT copies and free cluster count on the disk agree with FullFAT.
+ **/
+int test_files(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	ClusterSize, FreeClusters;
+	const FF_T_UINT32 Size = 256 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size);
+	RD_Fill(pData, Size, FatType);
+
+	pIoman = RD_Mount(pDisk, 32768, &Error);
+	CHECK_ERR(Error);
+	ClusterSize = pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+	CHECK_ERR(FF_MkDir(pIoman, (const FF_T_INT8 *) "\\sub"));
+	CHECK(RD_WriteFile(pIoman, "\\small.txt", pData, 100, 100));
+	CHECK(RD_WriteFile(pIoman, "\\large.bin", pData, Size, Size));
+	CHECK(RD_WriteFile(pIoman, "\\sub\\chunks.bin", pData, Size / 2, 777));
+	CHECK(RD_CheckFile(pIoman, "\\sub\\chunks.bin", pData, Size / 2, 1000));
+	FreeClusters = (FF_T_UINT32) (FF_GetFreeSize(pIoman, &Error) / ClusterSize);
+	CHECK_ERR(Error);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\small.txt", pData, 100, 100));
+	CHECK(RD_CheckFile(pIoman, "\\large.bin", pData, Size, 4096));
+	CHECK(RD_CheckFile(pIoman, "\\sub\\chunks.bin", pData, Size / 2, Size / 2));
+	CHECK_ERR(FF_RmFile(pIoman, (const FF_T_INT8 *) "\\large.bin"));
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters + ((Size + ClusterSize - 1) / ClusterSize));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+/**
+ *	Writes appended to a file that has data, and whose next clusters are taken by another file,
+ *	continue the chain from its real end, (as found when the file is opened).
+ **/
+int test_append(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	FF_T_UINT32	ClusterSize, FreeClusters, Pos, Count;
+	const FF_T_UINT32 Size = 64 * 1024;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(Size * 4);
+	RD_Fill(pData, Size * 4, FatType);
+
+	pIoman = RD_Mount(pDisk, 32768, &Error);
+	CHECK_ERR(Error);
+	ClusterSize = pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+	CHECK(RD_WriteFile(pIoman, "\\append.bin", pData, Size, Size));
+	CHECK(RD_WriteFile(pIoman, "\\other.bin", pData + Size, Size, Size));
+
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) "\\append.bin", FF_MODE_WRITE | FF_MODE_APPEND, &Error);
+	if(!pFile) {
+		DO_FF_FAIL(Error);
+	}
+	for(Pos = Size; Pos < Size * 4; Pos += Count) {
+		Count = (Size * 4 - Pos < 1000) ? Size * 4 - Pos : 1000;	// Not a multiple of the cluster size.
+		CHECK(FF_Write(pFile, 1, Count, pData + Pos) == (FF_T_SINT32) Count);
+	}
+	CHECK_ERR(FF_Close(pFile));
+	FreeClusters = (FF_T_UINT32) (FF_GetFreeSize(pIoman, &Error) / ClusterSize);
+	CHECK_ERR(Error);
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	CHECK(RD_FatCopiesMatch(pDisk));
+	CHECK(RD_FreeClusters(pDisk) == FreeClusters);
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\append.bin", pData, Size * 4, 4096));
+	CHECK(RD_CheckFile(pIoman, "\\other.bin", pData + Size, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#define SEEK_CHUNKS		64
+
+/**
+ *	Two files written a little at a time each, so their chains are in many runs, read back the same
+ *	at positions sought at random, (forwards and backwards through the chain).
+ **/
+int test_seek_fragmented(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_FILE		*pFiles[2];
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData, Read[100];
+	FF_T_UINT32	Chunk, Size, Pos, Seed = FatType;
+	int			i, f;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 32768, &Error);
+	CHECK_ERR(Error);
+	Chunk	= 2 * pIoman->pPartition->SectorsPerCluster * pIoman->pPartition->BlkSize;
+	Size	= SEEK_CHUNKS * Chunk;
+	pData	= (FF_T_UINT8 *) malloc(Size * 2);
+	RD_Fill(pData, Size * 2, FatType);
+
+	for(f = 0; f < 2; f++) {
+		pFiles[f] = FF_Open(pIoman, (const FF_T_INT8 *) (f ? "\\b.bin" : "\\a.bin"), FF_MODE_WRITE | FF_MODE_CREATE, &Error);
+		if(!pFiles[f]) {
+			DO_FF_FAIL(Error);
+		}
+	}
+	for(i = 0; i < SEEK_CHUNKS; i++) {
+		for(f = 0; f < 2; f++) {	// Each file takes the clusters after the other's last chunk.
+			CHECK(FF_Write(pFiles[f], 1, Chunk, pData + (f * Size) + (i * Chunk)) == (FF_T_SINT32) Chunk);
+		}
+	}
+	for(f = 0; f < 2; f++) {
+		CHECK_ERR(FF_Close(pFiles[f]));
+	}
+
+	pFiles[0] = FF_Open(pIoman, (const FF_T_INT8 *) "\\a.bin", FF_MODE_READ, &Error);
+	if(!pFiles[0]) {
+		DO_FF_FAIL(Error);
+	}
+	for(i = 0; i < 400; i++) {
+		Seed	= (Seed * 1103515245) + 12345;
+		Pos		= (Seed >> 8) % (Size - sizeof(Read));
+		CHECK_ERR(FF_Seek(pFiles[0], (FF_T_SINT32) Pos, FF_SEEK_SET));
+		CHECK(FF_Read(pFiles[0], 1, sizeof(Read), Read) == sizeof(Read));
+		CHECK(!memcmp(Read, pData + Pos, sizeof(Read)));
+	}
+	CHECK_ERR(FF_Close(pFiles[0]));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+	CHECK(RD_CheckFile(pIoman, "\\a.bin", pData, Size, 3000));
+	CHECK(RD_CheckFile(pIoman, "\\b.bin", pData + Size, Size, Size));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
@@ -0,0 +1,246 @@
+/**
+ *	Tests of the cache and the FAT with several threads.
+ **/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "regress.h"
+
+#define SECTOR	1024		///< In a free cluster of every test volume.
+
+typedef struct {
+	FF_IOMAN		*pIoman;
+	FF_T_UINT32		 Sector;
+	volatile int	 bReleased;		///< Set by the main thread just before it releases the sector.
+	int				 Result;
+} WAITER;
+
+static void *waiter_thread(void *pParam) {
+	WAITER		*pWaiter = (WAITER *) pParam;
+	FF_BUFFER	*pBuffer = FF_GetBuffer(pWaiter->pIoman, pWaiter->Sector, FF_MODE_READ);
+	FF_T_UINT8	Expect[512];
+
+	if(pBuffer) {
+		RD_Fill(Expect, 512, pWaiter->Sector);
+		pWaiter->Result = pWaiter->bReleased && !memcmp(pBuffer->pBuffer, Expect, 512);
+		FF_ReleaseBuffer(pWaiter->pIoman, pBuffer);
+	}
+	return NULL;
+}
+
+/**
+ *	A thread asking for a sector that another thread is modifying waits until it is released,
+ *	and then gets the new contents.
+ **/
+int test_threads_wait_release(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_BUFFER	*pBuffer;
+	FF_ERROR	Error;
+	WAITER		Waiter;
+	pthread_t	Thread;
+
+	*pszpMessage = "No Error";
+
+	pIoman = RD_Mount(pDisk, 16384, &Error);
+	CHECK_ERR(Error);
+
+	pBuffer = FF_GetBuffer(pIoman, SECTOR, FF_MODE_WRITE);
+	CHECK(pBuffer);
+	Waiter.pIoman		= pIoman;
+	Waiter.Sector		= SECTOR;
+	Waiter.bReleased	= 0;
+	Waiter.Result		= 0;
+	CHECK(!pthread_create(&Thread, NULL, waiter_thread, &Waiter));
+
+	usleep(50000);
+	RD_Fill(pBuffer->pBuffer, 512, SECTOR);
+	Waiter.bReleased = 1;
+	FF_ReleaseBuffer(pIoman, pBuffer);
+	pthread_join(Thread, NULL);
+	CHECK(Waiter.Result);
+#ifdef FF_CACHE_WRITE_BACK
+	CHECK_ERR(FF_FlushCache(pIoman));
+#endif
+	CHECK(RD_CheckSector(pIoman, pDisk, SECTOR));
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+#define READERS		4
+
+typedef struct {
+	FF_IOMAN		*pIoman;
+	RAMDISK			*pDisk;
+	FF_T_UINT32		 Seed;
+	int				 Result;
+} READER;
+
+static void *reader_thread(void *pParam) {
+	READER		*pReader = (READER *) pParam;
+	FF_T_UINT32	i;
+
+	pReader->Result = 1;
+	for(i = 0; i < 4000 && pReader->Result; i++) {
+		pReader->Seed = (pReader->Seed * 1103515245) + 12345;
+		pReader->Result = RD_CheckSector(pReader->pIoman, pReader->pDisk, SECTOR + ((pReader->Seed >> 8) % 2048));
+	}
+	return NULL;
+}
+
+/**
+ *	Threads reading sectors at the same time, from a cache too small to hold them all, each
+ *	get the contents of the disk.
+ **/
+int test_threads_readers(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_ERROR	Error;
+	READER		Readers[READERS];
+	pthread_t	Threads[READERS];
+	int			i;
+
+	*pszpMessage = "No Error";
+
+	RD_FillSectors(pDisk, SECTOR, 2048);
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+
+	for(i = 0; i < READERS; i++) {
+		Readers[i].pIoman	= pIoman;
+		Readers[i].pDisk	= pDisk;
+		Readers[i].Seed		= (FatType * READERS) + i;
+		Readers[i].Result	= 0;
+		CHECK(!pthread_create(&Threads[i], NULL, reader_thread, &Readers[i]));
+	}
+	for(i = 0; i < READERS; i++) {
+		pthread_join(Threads[i], NULL);
+	}
+	for(i = 0; i < READERS; i++) {
+		CHECK(Readers[i].Result);
+	}
+	CHECK_ERR(RD_Unmount(pIoman));
+
+	RD_Destroy(pDisk);
+	return PASS;
+}
+
+typedef struct {
+	FF_IOMAN		*pIoman;
+	FF_T_BOOL		 bWrite;		///< Takes the FAT lock for writing, rather than for reading.
+	volatile int	 bLocked;		///< Set once the lock is held.
+} LOCKER;
+
+static void *locker_thread(void *pParam) {
+	LOCKER *pLocker = (LOCKER *) pParam;
+
+	if(pLocker->bWrite) {
+		FF_lockFAT(pLocker->pIoman);
+		pLocker->bLocked = 1;
+		FF_unlockFAT(pLocker->pIoman);
+	} else {
+		FF_lockFATRead(pLocker->pIoman);
+		pLocker->bLocked = 1;
+		FF_unlockFATRead(pLocker->pIoman);
+	}
+	return NULL;
+}
+
+#define WALKERS		4
+#define WALK_SIZE	(64 * 1024)
+
+typedef struct {
+	FF_IOMAN		*pIoman;
+	FF_T_UINT32		 Start;
+	FF_T_UINT32		 Length;		///< Of the chain at Start, as counted before the threads run.
+	int				 Result;
+} WALKER;
+
+static void *walker_thread(void *pParam) {
+	WALKER		*pWalker = (WALKER *) pParam;
+	FF_ERROR	Error;
+	FF_T_UINT32	i;
+
+	pWalker->Result = 1;
+	for(i = 0; i < 500 && pWalker->Result; i++) {
+		pWalker->Result = (FF_GetChainLength(pWalker->pIoman, pWalker->Start, NULL, &Error) == pWalker->Length)
+						&& !FF_isERR(Error);
+	}
+	return NULL;
+}
+
+/**
+ *	The FAT lock is shared by readers, and a writer waits until they have all let it go.
+ *	Threads walking a chain, (which only read the FAT), get its length while another file grows.
+ **/
+int test_threads_fat_lock(FF_T_UINT8 FatType, const char **pszpMessage) {
+	RAMDISK		*pDisk = RD_Create(FatType);
+	FF_IOMAN	*pIoman;
+	FF_FILE		*pFile;
+	FF_ERROR	Error;
+	FF_T_UINT8	*pData;
+	LOCKER		Reader, Writer;
+	WALKER		Walkers[WALKERS];
+	pthread_t	Thread, Threads[WALKERS];
+	int			i;
+
+	*pszpMessage = "No Error";
+
+	pData = (FF_T_UINT8 *) malloc(2 * WALK_SIZE);
+	RD_Fill(pData, 2 * WALK_SIZE, FatType);
+	pIoman = RD_Mount(pDisk, 65536, &Error);
+	CHECK_ERR(Error);
+
+	FF_lockFATRead(pIoman);
+	Reader.pIoman	= pIoman;
+	Reader.bWrite	= FF_FALSE;
+	Reader.bLocked	= 0;
+	CHECK(!pthread_create(&Thread, NULL, locker_thread, &Reader));
+	for(i = 0; i < 100 && !Reader.bLocked; i++) {
+		usleep(10000);
+	}
+	pthread_join(Thread, NULL);
+	CHECK(Reader.bLocked);
+
+	Writer.pIoman	= pIoman;
+	Writer.bWrite	= FF_TRUE;
+	Writer.bLocked	= 0;
+	CHECK(!pthread_create(&Thread, NULL, locker_thread, &Writer));
+	usleep(50000);
+	CHECK(!Writer.bLocked);
+	FF_unlockFATRead(pIoman);
+	pthread_join(Thread, NULL);
+	CHECK(Writer.bLocked);
+
+	CHECK(RD_WriteFile(pIoman, "\\walked.bin", pData, WALK_SIZE, 4096));
+	pFile = FF_Open(pIoman, (const FF_T_INT8 *) "\\walked.bin", FF_MODE_READ, &Error);
+	CHECK_ERR(Error);
+	for(i = 0; i < WALKERS; i++) {
+		Walkers[i].pIoman	= pIoman;
+		Walkers[i].Start	= pFile->ObjectCluster;
+		Walkers[i].Length	= FF_GetChainLength(pIoman, pFile->ObjectCluster, NULL, &Error);
+		CHECK_ERR(Error);
+		Walkers[i].Result	= 0;
+	}
+	CHECK_ERR(FF_Close(pFile));
+	for(i = 0; i < WALKERS; i++) {
+		CHECK(!pthread_create(&Threads[i], NULL, walker_thread, &Walkers[i]));
+	}
+	CHECK(RD_WriteFile(pIoman, "\\grown.bin", pData + WALK_SIZE, WALK_SIZE, 512));
+	for(i = 0; i < WALKERS; i++) {
+		pthread_join(Threads[i], NULL);
+	}
+	for(i = 0; i < WALKERS; i++) {
+		CHECK(Walkers[i].Result);
+	}
+	CHECK(RD_CheckFile(pIoman, "\\walked.bin", pData, WALK_SIZE, WALK_SIZE));
+	CHECK(RD_CheckFile(pIoman, "\\grown.bin", pData + WALK_SIZE, WALK_SIZE, WALK_SIZE));
+	CHECK_ERR(RD_Unmount(pIoman));
+	CHECK(RD_FatCopiesMatch(pDisk));
+
+	free(pData);
+	RD_Destroy(pDisk);
+	return PASS;
+}
@@ -15,6 +15,7 @@ OBJECTS += $(BASE)Demo/cmd/mkdir_cmd.o
 OBJECTS += $(BASE)Demo/cmd/mv_cmd.o
 OBJECTS += $(BASE)Demo/cmd/pwd_cmd.o
 OBJECTS += $(BASE)Demo/cmd/fsinfo_cmd.o
+OBJECTS += $(BASE)Demo/cmd/iostat_cmd.o
 OBJECTS += $(BASE)Demo/cmd/more_cmd.o
 OBJECTS += $(BASE)Demo/cmd/hexview_cmd.o
 OBJECTS += $(BASE)Demo/cmd/mkfile_cmd.o